@@ -346,8 +346,9 @@ void IArray<T>::removeAt(roSize idx, roSize count)
 	if(TypeOf<T>::isPOD())
 		roMemmov(&_data[idx], &_data[idx+count], sizeof(T) * (_size - idx - count));
 	else {
-		for(roSize i=idx; i<idx+count; ++i) {
+		for(roSize i=idx; i<idx+count; ++i)
 			_data[i].~T();
+		for(roSize i=idx; i+count<_size; ++i) {	// Move the whole tail forward
 			new ((void *)&_data[i]) T;
 			roSwap(_data[i], _data[i+count]);
 			_data[i+count].~T();
@@ -606,6 +607,23 @@ Status SizeLimitedArray<InnerArray>::reserve(roSize newCapacity, bool force)
 namespace ro {
 namespace Reflection {
 
+template<class S, class T>
+roStatus _serializeArrayElements(S& se, Field& f, T* begin, roSize count)
+{
+	for(roSize i=0; i<count; ++i) {
+		roStatus st = f.type->serializeFunc(se, f, begin + i);
+		if(!st) return st;
+	}
+	return roStatus::ok;
+}
+
+// Contiguous floats go to the array specialization of the Serializer
+template<class S>
+roStatus _serializeArrayElements(S& se, Field& f, float* begin, roSize count)
+{
+	return se.serialize(begin, count);
+}
+
 template<class T>
 roStatus serialize_Array(Serializer& se, Field& field, void* fieldParent)
 {
@@ -633,17 +651,22 @@ roStatus serialize_Array(Serializer& se, Field& field, void* fieldParent)
 		IArray<T>* a2 = field.getPtr<IArray<T> >(fieldParent);
 		a2->clear();
 
-		while(!se.isArrayEnded()) {
-			a2->incSize(1);	// TODO: Make some hints for reserve
+		const roSize count = se.arrayCount();
+		if(count != roSize(-1)) {
+			st = a2->resize(count);
+			if(!st) return st;
+			st = _serializeArrayElements(se, f, a2->typedPtr(), count);
+			if(!st) return st;
+		}
+		else while(!se.isArrayEnded()) {
+			a2->incSize(1);
 			st = innerType->serializeFunc(se, f, &a2->back());
 			if(!st) return st;
 		}
 	}
 	else {
-		for(const auto& i : *a) {
-			st = innerType->serializeFunc(se, f, (void*)&i);
-			if(!st) return st;
-		}
+		st = _serializeArrayElements(se, f, const_cast<T*>(a->typedPtr()), a->size());
+		if(!st) return st;
 	}
 
 	return se.endArray();
@@ -7,6 +7,12 @@ long roAtomicInc(volatile long* v);
 long roAtomicDec(volatile long* v);
 long roAtomicAddThenFetch(volatile long* v, long toAdd);
 long roAtomicCompareAndSwap(volatile long* v, long oldValue, long newValue);
+roInt64 roAtomicCompareAndSwap64(volatile roInt64* v, roInt64 oldValue, roInt64 newValue);
+long roAtomicExchange(volatile long* v, long newValue);
+void* roAtomicCompareAndSwapPtr(void* volatile* v, void* oldValue, void* newValue);
+
+/// Full memory fence, both compiler and cpu
+void roMemoryBarrier();
 
 // ----------------------------------------------------------------------
 
@@ -56,11 +62,19 @@ long __cdecl _InterlockedDecrement(long volatile *);
 long __cdecl _InterlockedExchangeAdd(long volatile *, long);
 long __cdecl _InterlockedExchange(long volatile *, long);
 long __cdecl _InterlockedCompareExchange(long volatile *, long, long);
+__int64 __cdecl _InterlockedCompareExchange64(__int64 volatile *, __int64, __int64);
+void __cdecl _mm_mfence(void);
 #pragma intrinsic(_InterlockedIncrement)
 #pragma intrinsic(_InterlockedDecrement)
 #pragma intrinsic(_InterlockedExchangeAdd)
 #pragma intrinsic(_InterlockedExchange)
 #pragma intrinsic(_InterlockedCompareExchange)
+#pragma intrinsic(_InterlockedCompareExchange64)
+#pragma intrinsic(_mm_mfence)
+#if defined(_M_X64)
+void* _InterlockedCompareExchangePointer(void* volatile *, void*, void*);
+#pragma intrinsic(_InterlockedCompareExchangePointer)
+#endif
 #if defined(__cplusplus)
 }
 #endif
@@ -77,6 +91,24 @@ inline long roAtomicAddThenFetch(volatile long* v, long toAdd)
 inline long roAtomicCompareAndSwap(volatile long* v, long testValue, long newValue)
 {	return _InterlockedCompareExchange(v, newValue, testValue);	}
 
+inline roInt64 roAtomicCompareAndSwap64(volatile roInt64* v, roInt64 testValue, roInt64 newValue)
+{	return _InterlockedCompareExchange64(v, newValue, testValue);	}
+
+inline long roAtomicExchange(volatile long* v, long newValue)
+{	return _InterlockedExchange(v, newValue);	}
+
+inline void* roAtomicCompareAndSwapPtr(void* volatile* v, void* testValue, void* newValue)
+{
+#if defined(_M_X64)
+	return _InterlockedCompareExchangePointer(v, newValue, testValue);
+#else
+	return (void*)_InterlockedCompareExchange((long volatile*)v, (long)newValue, (long)testValue);
+#endif
+}
+
+inline void roMemoryBarrier()
+{	_mm_mfence();	}
+
 #elif roOS_APPLE
 
 #include <libkern/OSAtomic.h>
@@ -93,6 +125,19 @@ inline long roAtomicAddThenFetch(volatile long* v, long toAdd)
 inline long roAtomicCompareAndSwap(volatile long* v, long testValue, long newValue)
 {	return OSAtomicCompareAndSwapLong(testValue, newValue, v);	}
 
+inline roInt64 roAtomicCompareAndSwap64(volatile roInt64* v, roInt64 testValue, roInt64 newValue)
+{	return OSAtomicCompareAndSwap64Barrier(testValue, newValue, v) ? testValue : *v;	}
+
+inline long roAtomicExchange(volatile long* v, long newValue)
+{	long old; do { old = *v; } while(!OSAtomicCompareAndSwapLongBarrier(old, newValue, v)); return old;	}
+
+// NOTE: OSAtomic only tell us success or not, return the test value on success to mimic the other platforms
+inline void* roAtomicCompareAndSwapPtr(void* volatile* v, void* testValue, void* newValue)
+{	return OSAtomicCompareAndSwapPtrBarrier(testValue, newValue, v) ? testValue : *v;	}
+
+inline void roMemoryBarrier()
+{	OSMemoryBarrier();	}
+
 #elif roCOMPILER_GCC
 
 inline long roAtomicInc(volatile long* v)
@@ -107,6 +152,18 @@ inline long roAtomicAddThenFetch(volatile long* v, long toAdd)
 inline long roAtomicCompareAndSwap(volatile long* v, long testValue, long newValue)
 {	return __sync_val_compare_and_swap(v, testValue, newValue);	}
 
+inline roInt64 roAtomicCompareAndSwap64(volatile roInt64* v, roInt64 testValue, roInt64 newValue)
+{	return __sync_val_compare_and_swap(v, testValue, newValue);	}
+
+inline long roAtomicExchange(volatile long* v, long newValue)
+{	return __atomic_exchange_n(v, newValue, __ATOMIC_SEQ_CST);	}
+
+inline void* roAtomicCompareAndSwapPtr(void* volatile* v, void* testValue, void* newValue)
+{	return __sync_val_compare_and_swap(v, testValue, newValue);	}
+
+inline void roMemoryBarrier()
+{	__sync_synchronize();	}
+
 #endif
 
 #endif	// __roAtomic_h__
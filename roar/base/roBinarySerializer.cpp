@@ -0,0 +1,475 @@
+#include "pch.h"
+#include "roBinarySerializer.h"
+#include "roStringHash.h"
+
+namespace ro {
+namespace Reflection {
+
+static const roByte _binaryMagic[4] = { 'r', 'o', 'B', '1' };
+
+BinarySchema::BinarySchema()
+	: _lastType(NULL)
+	, _lastPlan(NULL)
+{}
+
+BinarySchema::~BinarySchema()
+{
+	clear();
+}
+
+void BinarySchema::clear()
+{
+	for(auto& e : _plans)
+		delete e.value;
+	_plans.clear();
+	_hashes.clear();
+	_lastType = NULL;
+	_lastPlan = NULL;
+}
+
+// Size of the types which can be copied as is, 0 for the others
+static roSize _rawSize(const Type* type)
+{
+#if roSERIALIZE_BYTE_ORDER == roBYTE_ORDER
+	SerializeFunc f = type->serializeFunc;
+	if(f == serialize_int8 || f == serialize_uint8)
+		return 1;
+	if(f == serialize_int16 || f == serialize_uint16)
+		return 2;
+	if(f == serialize_int32 || f == serialize_uint32 || f == serialize_float)
+		return 4;
+	if(f == serialize_int64 || f == serialize_uint64 || f == serialize_double)
+		return 8;
+#endif
+	return 0;
+}
+
+roStatus BinarySchema::_buildPlan(Type* type, roSize offset, Plan& plan)
+{
+	for(Field& f : type->fields) {
+		if(!f.type) return roStatus::pointer_is_null;
+		if(f.isConst) continue;	// We simply ignore any const member, as the other serializers
+
+		const roSize fieldOffset = offset + f.offset;
+
+		// Nested object, inline it's fields
+		if(!f.isPointer && f.type->serializeFunc == serialize_generic) {
+			roStatus st = _buildPlan(f.type, fieldOffset, plan);
+			if(!st) return st;
+			continue;
+		}
+
+		const roSize size = f.isPointer ? 0 : _rawSize(f.type);
+		if(size && !plan.steps.isEmpty()) {
+			Step& last = plan.steps.back();
+			if(last.size && last.offset + last.size == fieldOffset) {
+				last.size += size;
+				continue;
+			}
+		}
+
+		Step step = { fieldOffset, size, f };
+		step.field.offset = unsigned(fieldOffset);
+		roStatus st = plan.steps.pushBack(step);
+		if(!st) return st;
+	}
+
+	return roStatus::ok;
+}
+
+BinarySchema::Plan* BinarySchema::plan(Type* type)
+{
+	if(type == _lastType)
+		return _lastPlan;
+
+	Plan** p = _plans.find(type);
+	if(!p) {
+		Plan* plan = new Plan;
+		if(!_buildPlan(type, 0, *plan) || !(p = _plans.insert(type, plan))) {
+			delete plan;
+			return NULL;
+		}
+	}
+
+	_lastType = type;
+	_lastPlan = *p;
+	return *p;
+}
+
+static roUint32 _hashCombine(roUint32 h, roUint32 v)
+{
+	return h ^ (v + 0x9E3779B9u + (h << 6) + (h >> 2));
+}
+
+roUint32 BinarySchema::_hash(Type* type, Array<Type*>& visiting)
+{
+	roUint32 h = stringHash(type->name.c_str(), type->name.size());
+
+	// Recursive type, the name is enough to stop there
+	if(roArrayFind(visiting.typedPtr(), visiting.size(), type))
+		return h;
+
+	visiting.pushBack(type);
+
+	for(Type* arg : type->templateArgTypes)
+		h = _hashCombine(h, arg ? _hash(arg, visiting) : 0);
+
+	// Types with a custom serializeFunc have their own format, the fields matter for objects only
+	if(type->serializeFunc == serialize_generic) for(Field& f : type->fields) {
+		if(f.isConst) continue;
+		h = _hashCombine(h, stringHash(f.name.c_str(), f.name.size()));
+		h = _hashCombine(h, f.type ? _hash(f.type, visiting) : 0);
+	}
+
+	visiting.popBack();
+	return h;
+}
+
+roUint32 BinarySchema::hash(Type* type)
+{
+	if(!type) return 0;
+
+	const roUint32* h = _hashes.find(type);
+	if(h) return *h;
+
+	Array<Type*> visiting;
+	const roUint32 ret = _hash(type, visiting);
+	_hashes.insert(type, ret);
+	return ret;
+}
+
+
+// ----------------------------------------------------------------------
+
+roStatus BinaryOutputSerializer::beginArchive()
+{
+	if(!serializer._buf) return roStatus::pointer_is_null;
+	_depth = 0;
+	return serializer.ioRaw(_binaryMagic, sizeof(_binaryMagic));
+}
+
+roStatus BinaryOutputSerializer::endArchive()
+{
+	return _depth == 0 ? roStatus::ok : roStatus::assertion;
+}
+
+// The schema hash before each root value
+roStatus BinaryOutputSerializer::_beginValue(Field& field)
+{
+	if(_depth) return roStatus::ok;
+	roUint32 h = schema.hash(field.type);
+	return serializer.io(h);
+}
+
+template<class T>
+roStatus _serialize(BinaryOutputSerializer& se, Field& field, void* fieldParent)
+{
+	if(!fieldParent) return roStatus::pointer_is_null;
+	roStatus st = se._beginValue(field); if(!st) return st;
+	T val = *reinterpret_cast<const T*>(field.getConstPtr(fieldParent));
+	return se.serializer.io(val);
+}
+
+roStatus BinaryOutputSerializer::serialize_bool(Field& field, void* fieldParent)	{ return _serialize<bool>(*this, field, fieldParent); }
+roStatus BinaryOutputSerializer::serialize_int8(Field& field, void* fieldParent)	{ return _serialize<roInt8>(*this, field, fieldParent); }
+roStatus BinaryOutputSerializer::serialize_int16(Field& field, void* fieldParent)	{ return _serialize<roInt16>(*this, field, fieldParent); }
+roStatus BinaryOutputSerializer::serialize_int32(Field& field, void* fieldParent)	{ return _serialize<roInt32>(*this, field, fieldParent); }
+roStatus BinaryOutputSerializer::serialize_int64(Field& field, void* fieldParent)	{ return _serialize<roInt64>(*this, field, fieldParent); }
+roStatus BinaryOutputSerializer::serialize_uint8(Field& field, void* fieldParent)	{ return _serialize<roUint8>(*this, field, fieldParent); }
+roStatus BinaryOutputSerializer::serialize_uint16(Field& field, void* fieldParent)	{ return _serialize<roUint16>(*this, field, fieldParent); }
+roStatus BinaryOutputSerializer::serialize_uint32(Field& field, void* fieldParent)	{ return _serialize<roUint32>(*this, field, fieldParent); }
+roStatus BinaryOutputSerializer::serialize_uint64(Field& field, void* fieldParent)	{ return _serialize<roUint64>(*this, field, fieldParent); }
+roStatus BinaryOutputSerializer::serialize_float(Field& field, void* fieldParent)	{ return _serialize<float>(*this, field, fieldParent); }
+roStatus BinaryOutputSerializer::serialize_double(Field& field, void* fieldParent)	{ return _serialize<double>(*this, field, fieldParent); }
+
+// Length plus one followed by the string and it's terminator, 0 for NULL
+roStatus BinaryOutputSerializer::_writeString(const roUtf8* str)
+{
+	roUint64 n = str ? roStrLen(str) + 1 : 0;
+	roStatus st = serializer.ioVary(n); if(!st) return st;
+	return n ? serializer.ioRaw(str, roSize(n)) : st;
+}
+
+roStatus BinaryOutputSerializer::serialize_string(Field& field, void* fieldParent)
+{
+	if(!fieldParent) return roStatus::pointer_is_null;
+	roStatus st = _beginValue(field); if(!st) return st;
+	return _writeString(*reinterpret_cast<const roUtf8* const*>(field.getConstPtr(fieldParent)));
+}
+
+roStatus BinaryOutputSerializer::serialize_object(Field& field, void* fieldParent)
+{
+	Type* type = field.type;
+	if(!type) return roStatus::pointer_is_null;
+	roStatus st = _beginValue(field); if(!st) return st;
+
+	BinarySchema::Plan* plan = schema.plan(type);
+	if(!plan) return roStatus::not_enough_memory;
+
+	// The members are relative to the object, not to its parent
+	roByte* self = (roByte*)field.getConstPtr(fieldParent);
+	++_depth;
+	for(BinarySchema::Step& step : plan->steps) {
+		st = step.size ?
+			serializer.ioRaw(self + step.offset, step.size) :
+			step.field.type->serializeFunc(*this, step.field, self);
+		if(!st) break;
+	}
+	--_depth;
+
+	return st;
+}
+
+roStatus BinaryOutputSerializer::beginArray(Field& field, roSize count)
+{
+	roStatus st = _beginValue(field); if(!st) return st;
+	roUint64 n = count;
+	st = serializer.ioVary(n); if(!st) return st;
+	++_depth;
+	return st;
+}
+
+roStatus BinaryOutputSerializer::endArray()
+{
+	if(_depth == 0) return roStatus::assertion;
+	--_depth;
+	return roStatus::ok;
+}
+
+roStatus BinaryOutputSerializer::serialize(float& val)
+{
+	return serializer.io(val);
+}
+
+roStatus BinaryOutputSerializer::serialize(double& val)
+{
+	return serializer.io(val);
+}
+
+roStatus BinaryOutputSerializer::serialize(const roUtf8*& val)
+{
+	return _writeString(val);
+}
+
+roStatus BinaryOutputSerializer::serialize(roByte*& val, roSize& size)
+{
+	roUint64 n = size;
+	roStatus st = serializer.ioVary(n); if(!st) return st;
+	return size ? serializer.ioRaw(val, size) : st;
+}
+
+roStatus BinaryOutputSerializer::serialize(float* valArray, roSize count)
+{
+	if(!count) return roStatus::ok;
+
+#if roSERIALIZE_BYTE_ORDER == roBYTE_ORDER
+	return serializer.ioRaw(valArray, count * sizeof(float));
+#else
+	for(roSize i=0; i<count; ++i) {
+		roStatus st = serializer.io(valArray[i]);
+		if(!st) return st;
+	}
+	return roStatus::ok;
+#endif
+}
+
+bool BinaryOutputSerializer::isArrayEnded()
+{
+	roAssert(false);
+	return true;
+}
+
+
+// ----------------------------------------------------------------------
+
+roStatus BinaryInputSerializer::beginArchive()
+{
+	if(!deserializer._buf) return roStatus::pointer_is_null;
+	_remaining.clear();
+
+	roByte magic[sizeof(_binaryMagic)];
+	roStatus st = deserializer.ioRaw(magic, sizeof(magic)); if(!st) return st;
+	return memcmp(magic, _binaryMagic, sizeof(magic)) == 0 ? roStatus::ok : roStatus::data_corrupted;
+}
+
+roStatus BinaryInputSerializer::endArchive()
+{
+	return _remaining.isEmpty() ? roStatus::ok : roStatus::data_corrupted;
+}
+
+// Check the schema hash before each root value, count the elements of arrays
+roStatus BinaryInputSerializer::_beginValue(Field& field)
+{
+	if(!_remaining.isEmpty())
+		return _consume(1);
+
+	roUint32 h = 0;
+	roStatus st = deserializer.io(h); if(!st) return st;
+	return h == schema.hash(field.type) ? roStatus::ok : roStatus::serialization_schema_mismatch;
+}
+
+roStatus BinaryInputSerializer::_consume(roSize count)
+{
+	if(_remaining.isEmpty()) return roStatus::ok;
+
+	roSize& remaining = _remaining.back();
+	if(remaining == roSize(-1)) return roStatus::ok;	// Fields of an object
+	if(remaining < count) return roStatus::data_corrupted;
+
+	remaining -= count;
+	return roStatus::ok;
+}
+
+template<class T>
+roStatus _serialize(BinaryInputSerializer& se, Field& field, void* fieldParent)
+{
+	if(!fieldParent) return roStatus::pointer_is_null;
+	T* val = reinterpret_cast<T*>(field.getPtr(fieldParent));
+	if(!val) return roStatus::pointer_is_null;
+
+	roStatus st = se._beginValue(field); if(!st) return st;
+	return se.deserializer.io(*val);
+}
+
+roStatus BinaryInputSerializer::serialize_bool(Field& field, void* fieldParent)		{ return _serialize<bool>(*this, field, fieldParent); }
+roStatus BinaryInputSerializer::serialize_int8(Field& field, void* fieldParent)		{ return _serialize<roInt8>(*this, field, fieldParent); }
+roStatus BinaryInputSerializer::serialize_int16(Field& field, void* fieldParent)	{ return _serialize<roInt16>(*this, field, fieldParent); }
+roStatus BinaryInputSerializer::serialize_int32(Field& field, void* fieldParent)	{ return _serialize<roInt32>(*this, field, fieldParent); }
+roStatus BinaryInputSerializer::serialize_int64(Field& field, void* fieldParent)	{ return _serialize<roInt64>(*this, field, fieldParent); }
+roStatus BinaryInputSerializer::serialize_uint8(Field& field, void* fieldParent)	{ return _serialize<roUint8>(*this, field, fieldParent); }
+roStatus BinaryInputSerializer::serialize_uint16(Field& field, void* fieldParent)	{ return _serialize<roUint16>(*this, field, fieldParent); }
+roStatus BinaryInputSerializer::serialize_uint32(Field& field, void* fieldParent)	{ return _serialize<roUint32>(*this, field, fieldParent); }
+roStatus BinaryInputSerializer::serialize_uint64(Field& field, void* fieldParent)	{ return _serialize<roUint64>(*this, field, fieldParent); }
+roStatus BinaryInputSerializer::serialize_float(Field& field, void* fieldParent)	{ return _serialize<float>(*this, field, fieldParent); }
+roStatus BinaryInputSerializer::serialize_double(Field& field, void* fieldParent)	{ return _serialize<double>(*this, field, fieldParent); }
+
+roStatus BinaryInputSerializer::_readString(const roUtf8*& str)
+{
+	roUint64 n = 0;
+	roStatus st = deserializer.ioVary(n); if(!st) return st;
+	if(n == 0) {
+		str = NULL;
+		return st;
+	}
+
+	st = deserializer._checkRemain(roSize(n)); if(!st) return st;
+	str = deserializer._r.cast<const roUtf8>();
+	if(str[n - 1] != '\0') return roStatus::data_corrupted;
+	deserializer._advance(roSize(n));
+	return st;
+}
+
+roStatus BinaryInputSerializer::serialize_string(Field& field, void* fieldParent)
+{
+	if(!fieldParent) return roStatus::pointer_is_null;
+	const roUtf8** val = reinterpret_cast<const roUtf8**>(field.getPtr(fieldParent));
+	if(!val) return roStatus::pointer_is_null;
+
+	roStatus st = _beginValue(field); if(!st) return st;
+	return _readString(*val);
+}
+
+roStatus BinaryInputSerializer::serialize_object(Field& field, void* fieldParent)
+{
+	Type* type = field.type;
+	if(!type) return roStatus::pointer_is_null;
+
+	// The members are relative to the object, not to its parent
+	roByte* self = (roByte*)field.getPtr(fieldParent);
+	if(!self) return roStatus::pointer_is_null;
+
+	roStatus st = _beginValue(field); if(!st) return st;
+
+	BinarySchema::Plan* plan = schema.plan(type);
+	if(!plan) return roStatus::not_enough_memory;
+
+	st = _remaining.pushBack(roSize(-1)); if(!st) return st;
+	for(BinarySchema::Step& step : plan->steps) {
+		st = step.size ?
+			deserializer.ioRaw(self + step.offset, step.size) :
+			step.field.type->serializeFunc(*this, step.field, self);
+		if(!st) return st;
+	}
+	_remaining.popBack();
+
+	return st;
+}
+
+roStatus BinaryInputSerializer::beginArray(Field& field, roSize count)
+{
+	roStatus st = _beginValue(field); if(!st) return st;
+	roUint64 n = 0;
+	st = deserializer.ioVary(n); if(!st) return st;
+	return _remaining.pushBack(roSize(n));
+}
+
+roStatus BinaryInputSerializer::endArray()
+{
+	if(_remaining.isEmpty() || _remaining.back() != 0)
+		return roStatus::data_corrupted;
+	_remaining.popBack();
+	return roStatus::ok;
+}
+
+roStatus BinaryInputSerializer::serialize(float& val)
+{
+	roStatus st = _consume(1); if(!st) return st;
+	return deserializer.io(val);
+}
+
+roStatus BinaryInputSerializer::serialize(double& val)
+{
+	roStatus st = _consume(1); if(!st) return st;
+	return deserializer.io(val);
+}
+
+roStatus BinaryInputSerializer::serialize(const roUtf8*& val)
+{
+	roStatus st = _consume(1); if(!st) return st;
+	return _readString(val);
+}
+
+roStatus BinaryInputSerializer::serialize(roByte*& val, roSize& size)
+{
+	roStatus st = _consume(1); if(!st) return st;
+
+	roUint64 n = 0;
+	st = deserializer.ioVary(n); if(!st) return st;
+	st = deserializer._checkRemain(roSize(n)); if(!st) return st;
+	val = deserializer._r;
+	size = roSize(n);
+	deserializer._advance(size);
+	return st;
+}
+
+roStatus BinaryInputSerializer::serialize(float* valArray, roSize count)
+{
+	roStatus st = _consume(count); if(!st) return st;
+	if(!count) return st;
+
+#if roSERIALIZE_BYTE_ORDER == roBYTE_ORDER
+	return deserializer.ioRaw(valArray, count * sizeof(float));
+#else
+	for(roSize i=0; i<count; ++i) {
+		st = deserializer.io(valArray[i]);
+		if(!st) return st;
+	}
+	return st;
+#endif
+}
+
+bool BinaryInputSerializer::isArrayEnded()
+{
+	return _remaining.isEmpty() || _remaining.back() == 0 || _remaining.back() == roSize(-1);
+}
+
+// A corrupted size could ask for a huge allocation, in that case the array is read element by element
+roSize BinaryInputSerializer::arrayCount()
+{
+	if(_remaining.isEmpty()) return roSize(-1);
+	const roSize count = _remaining.back();
+	return count <= deserializer._remain ? count : roSize(-1);
+}
+
+}	// namespace Reflection
+}   // namespace ro
@@ -0,0 +1,139 @@
+#ifndef __roBinarySerializer_h__
+#define __roBinarySerializer_h__
+
+#include "roHashMap.h"
+#include "roReflection.h"
+#include "roSerializer.h"
+
+namespace ro {
+namespace Reflection {
+
+/// Per Type plan and schema hash, used by the binary serializers.
+///
+/// The plan of an object inlines the fields of it's nested objects, and merges the fixed size
+/// primitives lying next to each other in memory into a single memcpy. Anything else (strings,
+/// arrays, types with a custom serializeFunc) is dispatched to it's serializeFunc as usual.
+///
+/// The schema hash covers the type name, the field names and field types recursively, such that
+/// data written with another version of a type fails to load instead of being misread.
+struct BinarySchema : private NonCopyable
+{
+	BinarySchema();
+	~BinarySchema();
+
+	struct Step
+	{
+		roSize offset;	///< From the beginning of the object
+		roSize size;	///< Number of bytes to copy, 0 to dispatch to field's serializeFunc
+		Field field;	///< With offset relative to the object
+	};
+
+	struct Plan
+	{
+		Array<Step> steps;
+	};
+
+	Plan*		plan		(Type* type);	///< NULL if out of memory
+	roUint32	hash		(Type* type);
+	void		clear		();
+
+// Private
+	roStatus	_buildPlan	(Type* type, roSize offset, Plan& plan);
+	roUint32	_hash		(Type* type, Array<Type*>& visiting);
+
+	HashMap<const Type*, Plan*> _plans;
+	HashMap<const Type*, roUint32> _hashes;
+	const Type* _lastType;	///< Arrays of objects ask for the same plan again and again
+	Plan* _lastPlan;
+};	// BinarySchema
+
+/// Compact binary archive, favor save and load speed over readability:
+/// - Each root value begins with the schema hash of it's type, field names are not stored
+/// - Fixed size primitives are raw in little endian, bool is a byte
+/// - Array sizes and string lengths are varint, see ro::Serializer::ioVary()
+/// - Strings keep their terminator, such that reading gives a pointer into the buffer without any copy
+struct BinaryOutputSerializer : public Serializer
+{
+	BinaryOutputSerializer() : _depth(0) { isReading = false; }
+	roStatus	beginArchive	()									override;
+	roStatus	endArchive		()									override;
+	roStatus	serialize_bool	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_int8	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_int16	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_int32	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_int64	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_uint8	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_uint16(Field& field, void* fieldParent)	override;
+	roStatus	serialize_uint32(Field& field, void* fieldParent)	override;
+	roStatus	serialize_uint64(Field& field, void* fieldParent)	override;
+	roStatus	serialize_float	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_double(Field& field, void* fieldParent)	override;
+	roStatus	serialize_string(Field& field, void* fieldParent)	override;
+	roStatus	serialize_object(Field& field, void* fieldParent)	override;
+	roStatus	beginArray		(Field& field, roSize count)		override;
+	roStatus	endArray		()									override;
+
+	roStatus	serialize		(float& val)						override;
+	roStatus	serialize		(double& val)						override;
+	roStatus	serialize		(const roUtf8*& val)				override;
+	roStatus	serialize		(roByte*& val, roSize& size)		override;
+
+	roStatus	serialize		(float* valArray, roSize count)		override;
+
+// Reader interface
+	bool		isArrayEnded	()									override;
+
+	roStatus	_beginValue		(Field& field);
+	roStatus	_writeString	(const roUtf8* str);
+
+	ro::Serializer serializer;
+	BinarySchema schema;
+	roSize _depth;
+};	// BinaryOutputSerializer
+
+/// Read what BinaryOutputSerializer wrote, the strings returned point into the buffer given to deserializer.
+struct BinaryInputSerializer : public Serializer
+{
+	BinaryInputSerializer() { isReading = true; }
+	roStatus	beginArchive	()									override;
+	roStatus	endArchive		()									override;
+	roStatus	serialize_bool	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_int8	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_int16	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_int32	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_int64	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_uint8	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_uint16(Field& field, void* fieldParent)	override;
+	roStatus	serialize_uint32(Field& field, void* fieldParent)	override;
+	roStatus	serialize_uint64(Field& field, void* fieldParent)	override;
+	roStatus	serialize_float	(Field& field, void* fieldParent)	override;
+	roStatus	serialize_double(Field& field, void* fieldParent)	override;
+	roStatus	serialize_string(Field& field, void* fieldParent)	override;
+	roStatus	serialize_object(Field& field, void* fieldParent)	override;
+	roStatus	beginArray		(Field& field, roSize count)		override;
+	roStatus	endArray		()									override;
+
+	roStatus	serialize		(float& val)						override;
+	roStatus	serialize		(double& val)						override;
+	roStatus	serialize		(const roUtf8*& val)				override;
+	roStatus	serialize		(roByte*& val, roSize& size)		override;
+
+	roStatus	serialize		(float* valArray, roSize count)		override;
+
+// Reader interface
+	bool		isArrayEnded	()									override;
+	roSize		arrayCount		()									override;
+
+	roStatus	_beginValue		(Field& field);
+	roStatus	_consume		(roSize count);
+	roStatus	_readString		(const roUtf8*& str);
+
+	ro::Deserializer deserializer;
+	BinarySchema schema;
+	Array<roSize> _remaining;	///< Elements left in each opened array, roSize(-1) for an object
+};	// BinaryInputSerializer
+
+}	// namespace Reflection
+}   // namespace ro
+
+#endif	// __roBinarySerializer_h__
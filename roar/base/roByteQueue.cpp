@@ -0,0 +1,341 @@
+#include "pch.h"
+#include "roByteQueue.h"
+#include "roMemory.h"
+#include "roUtility.h"
+
+namespace ro {
+
+ByteQueue::ByteQueue()
+	: _buf(NULL)
+	, _capacity(0)
+	, _mask(0)
+	, _closed(false)
+	, _producersWaiting(0)
+	, _consumerWaiting(0)
+{
+}
+
+ByteQueue::~ByteQueue()
+{
+	roFree(_buf);
+}
+
+Status ByteQueue::_init(roSize capacity)
+{
+	if(_buf)
+		return roStatus::already_initialized;
+
+	// The header store the size in 32 bits
+	if(capacity > (roSize(1) << 31))
+		return roStatus::size_limit_reached;
+
+	roSize size = _cacheLineSize;
+	while(size < capacity)
+		size *= 2;
+
+	_buf = roMalloc(size);
+	if(!_buf)
+		return roStatus::not_enough_memory;
+
+	// A zero header is an uncommitted one
+	roZeroMemory(_buf, size);
+	_capacity = size;
+	_mask = size - 1;
+	_closed.store(false);
+	return roStatus::ok;
+}
+
+void ByteQueue::close()
+{
+	_closed.store(true, std::memory_order_release);
+
+	roScopeLock(_condVar);
+	_condVar.broadcast();
+}
+
+// The waiting side first raise the flag then check the condition, while the other side first
+// change the condition then check the flag, with a full fence in between on both sides at least
+// one of them see the other, so no wake up is lost.
+// The waker clear the flag, such that only the first commit after a wait pay for the broadcast.
+template<class Pred>
+void ByteQueue::_wait(std::atomic<int>& waiting, Pred ready)
+{
+	roScopeLock(_condVar);
+	while(true) {
+		waiting.store(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(ready() || isClosed())
+			break;
+		_condVar.waitNoLock();
+	}
+}
+
+void ByteQueue::_wake(std::atomic<int>& waiting)
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(waiting.load(std::memory_order_relaxed) == 0 || waiting.exchange(0) == 0)
+		return;
+
+	roScopeLock(_condVar);
+	_condVar.broadcast();
+}
+
+// ----------------------------------------------------------------------
+
+SpscByteQueue::SpscByteQueue()
+	: _head(0)
+	, _reserved(0)
+	, _reservedSize(0)
+	, _tailCache(0)
+	, _tail(0)
+	, _readExtent(0)
+	, _headCache(0)
+{
+}
+
+Status SpscByteQueue::init(roSize capacity)
+{
+	return _init(capacity);
+}
+
+roByte* SpscByteQueue::reserveWrite(roSize size)
+{
+	if(!_buf || size > maxMessageSize() || isClosed())
+		return NULL;
+
+	const roSize head = _head.load(std::memory_order_relaxed);
+	const roSize record = _recordSize(size);
+	const roSize toEnd = _capacity - (head & _mask);
+	const roSize pad = toEnd < record ? toEnd : 0;
+
+	if(_capacity - (head - _tailCache) < pad + record) {
+		_tailCache = _tail.load(std::memory_order_acquire);
+		if(_capacity - (head - _tailCache) < pad + record)
+			return NULL;
+	}
+
+	// Published together with the message by commitWrite()
+	if(pad)
+		_state(head).store(_wrapMarker, std::memory_order_relaxed);
+
+	_reserved = head + pad;
+	_reservedSize = size;
+	return _buf + (_reserved & _mask) + _headerSize;
+}
+
+Status SpscByteQueue::reserveWriteWait(roSize size, roByte*& outPtr)
+{
+	if(!_buf) return roStatus::not_initialized;
+	if(size > maxMessageSize()) return roStatus::size_limit_reached;
+
+	while(!(outPtr = reserveWrite(size))) {
+		if(isClosed())
+			return roStatus::end_of_data;
+
+		// The tail reserveWrite() found too close
+		const roSize tail = _tailCache;
+		_wait(_producersWaiting, [&]() { return _tail.load(std::memory_order_acquire) != tail; });
+	}
+
+	return roStatus::ok;
+}
+
+void SpscByteQueue::commitWrite(roSize size)
+{
+	roAssert(size <= _reservedSize);
+
+	const roSize record = _recordSize(size);
+	_extent(_reserved) = roUint32(record);
+	_state(_reserved).store(roUint32(size + 1), std::memory_order_relaxed);
+	_head.store(_reserved + record, std::memory_order_release);
+	_reservedSize = 0;
+
+	_wake(_consumerWaiting);
+}
+
+Status SpscByteQueue::write(const void* data, roSize size)
+{
+	roByte* p = NULL;
+	Status st = reserveWriteWait(size, p);
+	if(!st) return st;
+
+	if(size)
+		roMemcpy(p, data, size);
+	commitWrite(size);
+	return roStatus::ok;
+}
+
+roByte* SpscByteQueue::read(roSize& outSize)
+{
+	roSize tail = _tail.load(std::memory_order_relaxed);
+	if(tail == _headCache) {
+		_headCache = _head.load(std::memory_order_acquire);
+		if(tail == _headCache)
+			return NULL;
+	}
+
+	// A wrap marker is always followed by a message
+	if(_state(tail).load(std::memory_order_relaxed) == _wrapMarker) {
+		tail += _capacity - (tail & _mask);
+		_tail.store(tail, std::memory_order_release);
+	}
+
+	outSize = _state(tail).load(std::memory_order_relaxed) - 1;
+	_readExtent = _extent(tail);
+	return _buf + (tail & _mask) + _headerSize;
+}
+
+Status SpscByteQueue::readWait(roByte*& outPtr, roSize& outSize)
+{
+	if(!_buf) return roStatus::not_initialized;
+
+	while(!(outPtr = read(outSize))) {
+		if(isClosed())
+			return (outPtr = read(outSize)) ? roStatus::ok : roStatus::end_of_data;
+
+		const roSize tail = _tail.load(std::memory_order_relaxed);
+		_wait(_consumerWaiting, [&]() { return _head.load(std::memory_order_acquire) != tail; });
+	}
+
+	return roStatus::ok;
+}
+
+void SpscByteQueue::commitRead()
+{
+	roAssert(_readExtent);
+
+	_tail.store(_tail.load(std::memory_order_relaxed) + _readExtent, std::memory_order_release);
+	_readExtent = 0;
+
+	_wake(_producersWaiting);
+}
+
+// ----------------------------------------------------------------------
+
+MpscByteQueue::MpscByteQueue()
+	: _head(0)
+	, _tail(0)
+	, _readExtent(0)
+{
+}
+
+Status MpscByteQueue::init(roSize capacity)
+{
+	return _init(capacity);
+}
+
+roByte* MpscByteQueue::reserveWrite(roSize size)
+{
+	if(!_buf || size > maxMessageSize() || isClosed())
+		return NULL;
+
+	const roSize record = _recordSize(size);
+	roSize head = _head.load(std::memory_order_relaxed);
+	roSize pad = 0;
+
+	// The acquire on the tail make the consumer's clearing visible before we write there
+	do {
+		const roSize toEnd = _capacity - (head & _mask);
+		pad = toEnd < record ? toEnd : 0;
+		if(_capacity - (head - _tail.load(std::memory_order_acquire)) < pad + record)
+			return NULL;
+	} while(!_head.compare_exchange_weak(head, head + pad + record, std::memory_order_relaxed));
+
+	if(pad)
+		_state(head).store(_wrapMarker, std::memory_order_release);
+
+	const roSize pos = head + pad;
+	_extent(pos) = roUint32(record);
+	return _buf + (pos & _mask) + _headerSize;
+}
+
+Status MpscByteQueue::reserveWriteWait(roSize size, roByte*& outPtr)
+{
+	if(!_buf) return roStatus::not_initialized;
+	if(size > maxMessageSize()) return roStatus::size_limit_reached;
+
+	while(true) {
+		// Taken before trying, such that a read in between is not missed
+		const roSize tail = _tail.load(std::memory_order_acquire);
+		if((outPtr = reserveWrite(size)) != NULL)
+			return roStatus::ok;
+		if(isClosed())
+			return roStatus::end_of_data;
+
+		_wait(_producersWaiting, [&]() { return _tail.load(std::memory_order_acquire) != tail; });
+	}
+}
+
+void MpscByteQueue::commitWrite(roByte* ptr, roSize size)
+{
+	const roSize pos = roSize(ptr - _buf) - _headerSize;
+	roAssert(pos < _capacity);
+	roAssert(_recordSize(size) <= _extent(pos));
+
+	_state(pos).store(roUint32(size + 1), std::memory_order_release);
+
+	_wake(_consumerWaiting);
+}
+
+Status MpscByteQueue::write(const void* data, roSize size)
+{
+	roByte* p = NULL;
+	Status st = reserveWriteWait(size, p);
+	if(!st) return st;
+
+	if(size)
+		roMemcpy(p, data, size);
+	commitWrite(p, size);
+	return roStatus::ok;
+}
+
+roByte* MpscByteQueue::read(roSize& outSize)
+{
+	roSize tail = _tail.load(std::memory_order_relaxed);
+	roUint32 state = _state(tail).load(std::memory_order_acquire);
+
+	// The padding after the marker was never written, only the marker need clearing
+	if(state == _wrapMarker) {
+		_state(tail).store(0, std::memory_order_relaxed);
+		tail += _capacity - (tail & _mask);
+		_tail.store(tail, std::memory_order_release);
+		state = _state(tail).load(std::memory_order_acquire);
+	}
+
+	if(state == 0)
+		return NULL;
+
+	outSize = state - 1;
+	_readExtent = _extent(tail);
+	return _buf + (tail & _mask) + _headerSize;
+}
+
+Status MpscByteQueue::readWait(roByte*& outPtr, roSize& outSize)
+{
+	if(!_buf) return roStatus::not_initialized;
+
+	while(!(outPtr = read(outSize))) {
+		if(isClosed())
+			return (outPtr = read(outSize)) ? roStatus::ok : roStatus::end_of_data;
+
+		const roSize tail = _tail.load(std::memory_order_relaxed);
+		_wait(_consumerWaiting, [&]() { return _state(tail).load(std::memory_order_acquire) != 0; });
+	}
+
+	return roStatus::ok;
+}
+
+void MpscByteQueue::commitRead()
+{
+	roAssert(_readExtent);
+
+	// Clear it for the next round, then give it back to the producers
+	const roSize tail = _tail.load(std::memory_order_relaxed);
+	roZeroMemory(_buf + (tail & _mask), _readExtent);
+	_tail.store(tail + _readExtent, std::memory_order_release);
+	_readExtent = 0;
+
+	_wake(_producersWaiting);
+}
+
+}	// namespace ro
@@ -0,0 +1,138 @@
+#ifndef __roByteQueue_h__
+#define __roByteQueue_h__
+
+#include "roCondVar.h"
+#include "roNonCopyable.h"
+#include "roStatus.h"
+#include <atomic>
+
+namespace ro {
+
+/// Thread safe FIFO of variable sized messages, for handing data between threads
+/// (for instance decoded audio or network data from TaskPool workers to the main thread)
+/// without a mutex-guarded copy: the producer reserve a contiguous region, fill it in place
+/// and commit it, the consumer then read it in place and commit the read.
+///
+/// The memory is a fixed power of 2 ring, each message is an 8 bytes header followed by it's
+/// contiguous payload, a message not fitting before the end of the ring wrap to the beginning.
+/// That's why a message can be at most half of the capacity.
+/// The producer and consumer indices are on their own cache lines so the two sides don't false share.
+///
+/// The Wait() functions block only when the queue is actually full (or empty), on a CondVar
+/// which is signaled only if some thread is known to be waiting, so the fast path never lock.
+/// close() wake up every waiting thread, the messages already committed can still be read.
+struct ByteQueue : private NonCopyable
+{
+	ByteQueue();
+	~ByteQueue();
+
+	roSize		capacity		() const { return _capacity; }
+	roSize		maxMessageSize	() const { return _capacity / 2 - _headerSize; }
+
+	void		close			();
+	bool		isClosed		() const { return _closed.load(std::memory_order_acquire); }
+
+// Private
+	static const roSize _headerSize = 8;
+	static const roSize _cacheLineSize = 64;
+	static const roUint32 _wrapMarker = 0xFFFFFFFF;
+
+	Status		_init			(roSize capacity);
+	roSize		_recordSize		(roSize size) const { return _headerSize + ((size + _headerSize - 1) & ~(_headerSize - 1)); }
+	std::atomic<roUint32>& _state(roSize pos) const { return *reinterpret_cast<std::atomic<roUint32>*>(_buf + (pos & _mask)); }
+	roUint32&	_extent			(roSize pos) const { return *reinterpret_cast<roUint32*>(_buf + (pos & _mask) + 4); }
+
+	template<class Pred>
+	void		_wait			(std::atomic<int>& waiting, Pred ready);
+	void		_wake			(std::atomic<int>& waiting);
+
+	roByte* _buf;
+	roSize _capacity;
+	roSize _mask;
+	std::atomic<bool> _closed;
+	std::atomic<int> _producersWaiting;	///< Flags raised by _wait(), cleared by _wake()
+	std::atomic<int> _consumerWaiting;
+	CondVar _condVar;
+};	// ByteQueue
+
+/// Single producer, single consumer, both sides wait-free.
+struct SpscByteQueue : public ByteQueue
+{
+	SpscByteQueue();
+
+	/// capacity is rounded up to a power of 2
+	Status		init			(roSize capacity);
+
+// Producer
+	/// Return NULL if there is not enough space for now (or the size is bigger than maxMessageSize())
+	roByte*		reserveWrite	(roSize size);
+	Status		reserveWriteWait(roSize size, roByte*& outPtr);
+
+	/// Publish the reserved message, size can be smaller than reserved
+	void		commitWrite		(roSize size);
+
+	/// Copy a message in, wait while the queue is full
+	Status		write			(const void* data, roSize size);
+
+// Consumer
+	/// The next message in place, NULL if empty
+	roByte*		read			(roSize& outSize);
+	Status		readWait		(roByte*& outPtr, roSize& outSize);
+	void		commitRead		();
+
+	bool		isEmpty			() const { return _tail.load(std::memory_order_acquire) == _head.load(std::memory_order_acquire); }
+
+// Private
+	char _pad0[_cacheLineSize];
+
+	// Producer side
+	std::atomic<roSize> _head;	///< Published end of the committed messages
+	roSize _reserved;			///< Position of the reserved message, after any wrap padding
+	roSize _reservedSize;
+	roSize _tailCache;			///< Last seen _tail, to touch the consumer's cache line only when looking full
+	char _pad1[_cacheLineSize];
+
+	// Consumer side
+	std::atomic<roSize> _tail;
+	roSize _readExtent;			///< Record size of the message returned by read()
+	roSize _headCache;
+	char _pad2[_cacheLineSize];
+};	// SpscByteQueue
+
+/// Multiple producers, single consumer.
+/// Producers claim their region with a compare-and-swap on the head, fill and commit it in any order,
+/// the consumer see a message once it's committed and, to keep the FIFO order, only after those before it.
+/// The consumer clear what it read, such that an unclaimed header always read as uncommitted.
+struct MpscByteQueue : public ByteQueue
+{
+	MpscByteQueue();
+
+	/// capacity is rounded up to a power of 2
+	Status		init			(roSize capacity);
+
+// Producers, from any thread
+	roByte*		reserveWrite	(roSize size);
+	Status		reserveWriteWait(roSize size, roByte*& outPtr);
+
+	/// Publish the message reserved at ptr, size can be smaller than reserved
+	void		commitWrite		(roByte* ptr, roSize size);
+
+	Status		write			(const void* data, roSize size);
+
+// Consumer
+	roByte*		read			(roSize& outSize);
+	Status		readWait		(roByte*& outPtr, roSize& outSize);
+	void		commitRead		();
+
+// Private
+	char _pad0[_cacheLineSize];
+	std::atomic<roSize> _head;	///< End of the claimed region, committed or not
+	char _pad1[_cacheLineSize];
+	std::atomic<roSize> _tail;
+	roSize _readExtent;
+	char _pad2[_cacheLineSize];
+};	// MpscByteQueue
+
+}	// namespace ro
+
+#endif	// __roByteQueue_h__
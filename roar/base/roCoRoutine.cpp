@@ -670,5 +670,10 @@ void roLongJmp(jmp_buf buf, int val)
 }
 #endif
 
-#include "roCoroutine.iocp.inc"
-//#include "roCoroutine.select.inc"
\ No newline at end of file
+#if roOS_WIN
+#	include "roCoroutine.iocp.inc"
+#elif roUSE_EPOLL
+#	include "roCoRoutine.epoll.inc"
+#else
+#	include "roCoRoutine.select.inc"
+#endif
\ No newline at end of file
@@ -133,8 +133,15 @@ void		coWakeup(Coroutine* coroutine);	// Wake up the coroutine suspended by coSl
 void		coYield();
 void		coYieldFrame();
 
+/// The io event backend is chosen at build time: IOCP on Windows, edge triggered epoll
+/// on Linux (define roUSE_EPOLL to 0 to fall back), select() otherwise.
+#ifndef roUSE_EPOLL
+#	define roUSE_EPOLL roOS_Linux
+#endif
+
 roStatus	ioEventInit();
 roStatus	ioEventRegister(void* fdCtx);
+roStatus	ioEventUnregister(void* fdCtx);	// Call before closing the fd
 roStatus	ioEventRead(const void* ioCtx);
 roStatus	ioEventWrite(const void* ioCtx);
 roStatus	ioEventCancel(const void* ioCtx);
@@ -84,8 +84,11 @@
 #ifndef CORO_H
 #define CORO_H
 
-//#define CORO_ASM 1
-#define CORO_FIBER 1
+#if roOS_WIN
+#	define CORO_FIBER 1
+#else
+#	define CORO_ASM 1
+#endif
 
 #if __cplusplus
 extern "C" {
@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "roCompressedStream.h"
 #include "roTypeCast.h"
+#include <limits.h>
 
 namespace ro {
 
@@ -11,6 +12,141 @@ namespace ro {
 #	pragma comment(lib, "zlib")
 #endif
 
+static const int _windowBits = 15;
+static const int _gzipOnly = 16;		// For deflate, write gzip header and trailer
+static const int _gzipOrZlib = 32;		// For inflate, detect the header automatically
+
+static const roSize _minChunkSize = 4 * 1024;
+static const roSize _maxChunkSize = 256 * 1024;
+
+// zlib counts in 32 bits
+static uInt _clampUInt(roUint64 size)
+{
+	return uInt(roMinOf2(size, roUint64(UINT_MAX)));
+}
+
+typedef int (*ZlibFunc)(z_streamp stream, int flush);
+
+// Run deflate() or inflate() over the whole buffers, which may exceed the 32 bits avail_in/avail_out
+static int _zlibRun(ZlibFunc func, z_stream& z, const roByte* in, roSize inSize, roByte* out, roSize outSize, int lastFlush)
+{
+	static roByte dummy;
+	z.next_in = (Bytef*)(in ? in : &dummy);
+	z.next_out = (Bytef*)(out ? out : &dummy);
+	z.avail_in = z.avail_out = 0;
+
+	while(true) {
+		if(z.avail_in == 0 && inSize) {
+			z.next_in = (Bytef*)in;
+			z.avail_in = _clampUInt(inSize);
+			in += z.avail_in;
+			inSize -= z.avail_in;
+		}
+		if(z.avail_out == 0 && outSize) {
+			z.next_out = (Bytef*)out;
+			z.avail_out = _clampUInt(outSize);
+			out += z.avail_out;
+			outSize -= z.avail_out;
+		}
+
+		int err = func(&z, inSize == 0 ? lastFlush : Z_NO_FLUSH);
+		if(err == Z_STREAM_END)
+			return err;
+		if(err != Z_OK && err != Z_BUF_ERROR)
+			return err;
+
+		// No more room, or no more input to make progress
+		if(z.avail_out == 0 && outSize == 0)
+			return Z_BUF_ERROR;
+		if(z.avail_in == 0 && inSize == 0 && err == Z_BUF_ERROR)
+			return Z_DATA_ERROR;
+	}
+}
+
+roSize gzipCompressBound(roSize srcSize)
+{
+	// Same as compressBound(), which is for the zlib wrapper of 6 bytes, while gzip has 18 bytes
+	return srcSize + (srcSize >> 12) + (srcSize >> 14) + (srcSize >> 25) + 13 + 12;
+}
+
+Status gzipCompress(const void* src, roSize srcSize, ByteArray& dst, int level)
+{
+	if(!src && srcSize) return Status::pointer_is_null;
+
+	z_stream z;
+	roMemZeroStruct(z);
+	if(deflateInit2(&z, level, Z_DEFLATED, _windowBits | _gzipOnly, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return Status::zlib_error;
+
+	Status st = dst.resizeNoInit(gzipCompressBound(srcSize));
+	if(st) {
+		int err = _zlibRun(deflate, z, static_cast<const roByte*>(src), srcSize, dst.typedPtr(), dst.size(), Z_FINISH);
+		st = err == Z_STREAM_END ? Status::ok : Status::zlib_error;
+	}
+
+	const roSize produced = roSize(z.next_out - dst.typedPtr());
+	deflateEnd(&z);
+
+	if(!st) {
+		dst.clear();
+		return st;
+	}
+
+	return dst.resizeNoInit(produced);
+}
+
+Status gzipDecompress(const void* src, roSize srcSize, void* dst, roSize& dstSize)
+{
+	if(!src && srcSize) return Status::pointer_is_null;
+	if(!dst && dstSize) return Status::pointer_is_null;
+
+	z_stream z;
+	roMemZeroStruct(z);
+	if(inflateInit2(&z, _windowBits | _gzipOrZlib) != Z_OK)
+		return Status::zlib_error;
+
+	roByte* out = static_cast<roByte*>(dst);
+	int err = _zlibRun(inflate, z, static_cast<const roByte*>(src), srcSize, out, dstSize, Z_NO_FLUSH);
+	const roSize produced = out ? roSize(z.next_out - out) : 0;
+	inflateEnd(&z);
+
+	if(err == Z_STREAM_END) {
+		dstSize = produced;
+		return Status::ok;
+	}
+
+	return err == Z_BUF_ERROR ? Status::not_enough_buffer : Status::zlib_error;
+}
+
+Status gzipDecompress(const void* src, roSize srcSize, ByteArray& dst)
+{
+	// The gzip trailer end with the uncompressed size modulo 2^32
+	roSize size = 0;
+	if(src && srcSize >= 18) {
+		const roByte* p = static_cast<const roByte*>(src) + srcSize - 4;
+		size = roSize(p[0]) | (roSize(p[1]) << 8) | (roSize(p[2]) << 16) | (roSize(p[3]) << 24);
+	}
+
+	while(true) {
+		Status st = dst.resizeNoInit(size); if(!st) return st;
+
+		roSize produced = size;
+		st = gzipDecompress(src, srcSize, dst.typedPtr(), produced);
+		if(st)
+			return dst.resizeNoInit(produced);
+
+		// Not a gzip stream, or larger than 4GB
+		if(st != Status::not_enough_buffer) {
+			dst.clear();
+			return st;
+		}
+		size = roMaxOf2(size * 2, roMaxOf2(srcSize * 4, roSize(1024)));
+	}
+}
+
+
+// ----------------------------------------------------------------------
+
 GZipIStream::~GZipIStream()
 {
 	if(_innerStream.ptr())
@@ -19,15 +155,17 @@ GZipIStream::~GZipIStream()
 
 Status GZipIStream::init(AutoPtr<IStream>&& stream, roSize chunkSize)
 {
-	if(_innerStream.ptr())
+	if(_innerStream.ptr()) {
 		inflateEnd(&_zStream);
+		_innerStream.deleteObject();
+	}
 
-	st = _inBuffer.resizeNoInit(chunkSize);
-	_inBuffer.condense();
-	if(!st) return st;
+	_chunkSize = chunkSize;
+	_peekedSize = 0;
+	_ended = false;
+	_inBuffer.clear();
 
 	roMemZeroStruct(_zStream);
-
 	_zStream.zalloc = Z_NULL;
 	_zStream.zfree = Z_NULL;
 	_zStream.opaque = Z_NULL;
@@ -35,15 +173,58 @@ Status GZipIStream::init(AutoPtr<IStream>&& stream, roSize chunkSize)
 	_zStream.avail_in = 0;
 	_zStream.next_out = NULL;
 
-	const unsigned windowBits = 15;
-	const unsigned enableGzip = 32;
-	int err = inflateInit2(&_zStream, windowBits | enableGzip);
-	if(err != Z_OK) return Status::zlib_error;
+	int err = inflateInit2(&_zStream, _windowBits | _gzipOrZlib);
+	if(err != Z_OK) return (st = Status::zlib_error);
 
 	_innerStream = std::move(stream);
 	return (st = Status::ok);
 }
 
+Status GZipIStream::_fillInput(roUint64 bytesToRead)
+{
+	// Feed zlib with the inner stream's own buffer, no copy needed
+	if(_innerStream->_next) {
+		roByte* p = NULL;
+		roSize size = 0;
+		Status st = _innerStream->peek(p, size);
+		if(!st) return st;
+
+		_zStream.next_in = p;
+		_zStream.avail_in = _peekedSize = _clampUInt(size);
+		return Status::ok;
+	}
+
+	roSize chunkSize = _chunkSize;
+	if(chunkSize == 0) {
+		// The compressed input is usually a fraction of the requested output
+		chunkSize = roMaxOf2(_minChunkSize, _inBuffer.size());
+		while(chunkSize < _maxChunkSize && chunkSize < bytesToRead / 4)
+			chunkSize *= 2;
+	}
+
+	if(_inBuffer.size() < chunkSize) {
+		Status st = _inBuffer.resizeNoInit(chunkSize);
+		if(!st) return st;
+	}
+
+	roUint64 len = 0;
+	Status st = _innerStream->read(_inBuffer.typedPtr(), _inBuffer.size(), len);
+	if(!st) return st;
+
+	_zStream.next_in = _inBuffer.typedPtr();
+	_zStream.avail_in = uInt(len);
+	return Status::ok;
+}
+
+void GZipIStream::_consumeInput()
+{
+	if(_peekedSize == 0)
+		return;
+
+	_innerStream->skip(_peekedSize - _zStream.avail_in);
+	_peekedSize = _zStream.avail_in;
+}
+
 Status GZipIStream::read(void* buffer, roUint64 bytesToRead, roUint64& bytesRead)
 {
 	bytesRead = 0;
@@ -56,54 +237,69 @@ Status GZipIStream::read(void* buffer, roUint64 bytesToRead, roUint64& bytesRead
 	if(!_innerStream.ptr())
 		return (st = Status::pointer_is_null);
 
-	_zStream.next_out = (Bytef*)buffer;
-	st = roSafeAssign(_zStream.avail_out, bytesToRead);
-	if(!st) return st;
-
-	while(true)	// Loop for read more input
-	{
-		if(_zStream.next_in == NULL || _zStream.avail_out != 0) {
-			roUint64 len = 0;
-			st = _innerStream->read(_inBuffer.bytePtr(), _inBuffer.sizeInByte(), len);
-			if(!st) return st;
-
-			_zStream.next_in = _inBuffer.bytePtr();
-			st = roSafeAssign(_zStream.avail_in, len);
+	if(_ended)
+		return (st = Status::end_of_data);
+
+	roByte* out = static_cast<roByte*>(buffer);
+	bool streamEnd = false;
+	while(bytesRead < bytesToRead) {
+		if(_zStream.avail_in == 0) {
+			// Return what we have, instead of waiting for more input
+			if(bytesRead > 0)
+				break;
+
+			st = _fillInput(bytesToRead);
+			if(st == Status::end_of_data || st == Status::file_ended || (st && _zStream.avail_in == 0)) {
+				// Ended without the gzip trailer, for instance after GZipOStream::flush()
+				_ended = streamEnd = true;
+				break;
+			}
 			if(!st) return st;
 		}
 
+		_zStream.next_out = out + bytesRead;
+		_zStream.avail_out = _clampUInt(bytesToRead - bytesRead);
+		const uInt availOut = _zStream.avail_out;
+
 		int err = inflate(&_zStream, Z_NO_FLUSH);
+		bytesRead += availOut - _zStream.avail_out;
+		_consumeInput();
 
-		switch(err) {
-		case Z_OK:
-		case Z_BUF_ERROR:	// Not enough input buffer, read more
-			continue;
-		case Z_STREAM_END:
-			return (st = Status::ok);
-		default:
-			return (st = Status::zlib_error);
+		if(err == Z_STREAM_END) {
+			_ended = streamEnd = true;
+			break;
 		}
+		if(err != Z_OK && err != Z_BUF_ERROR)
+			return (st = Status::zlib_error);
 	}
 
-	bytesRead = bytesToRead - _zStream.avail_out;
-	return st;
+	// The call reaching the end succeed even with nothing read, like an empty stream
+	return (st = (bytesRead > 0 || streamEnd) ? Status::ok : Status::end_of_data);
 }
 
+
+// ----------------------------------------------------------------------
+
 GZipOStream::~GZipOStream()
 {
-	flush();
-	if(_innerStream.ptr())
+	if(_innerStream.ptr()) {
+		if(!_finished)
+			_deflate(Z_FINISH);
 		deflateEnd(&_zStream);
+	}
 }
 
-Status GZipOStream::init(AutoPtr<OStream>&& stream, roSize chunkSize)
+Status GZipOStream::init(AutoPtr<OStream>&& stream, roSize chunkSize, int level)
 {
-	if(_innerStream.ptr())
+	if(_innerStream.ptr()) {
 		deflateEnd(&_zStream);
+		_innerStream.deleteObject();
+	}
 
-	roStatus st = _buffer.resizeNoInit(chunkSize);
-	_buffer.condense();
-	if(!st) return st;
+	_chunkSize = chunkSize;
+	_outSize = chunkSize ? chunkSize : _minChunkSize;
+	_reservedSize = 0;
+	_finished = false;
 
 	roMemZeroStruct(_zStream);
 
@@ -112,56 +308,91 @@ Status GZipOStream::init(AutoPtr<OStream>&& stream, roSize chunkSize)
 	_zStream.opaque = Z_NULL;
 	_zStream.next_in = NULL;
 	_zStream.avail_in = 0;
-	_zStream.next_out = _buffer.bytePtr();
-
-	st = roSafeAssign(_zStream.avail_out, _buffer.sizeInByte());
-	if(!st) return st;
+	_zStream.next_out = NULL;
+	_zStream.avail_out = 0;
 
-	const unsigned windowBits = 15;
-	const unsigned enableGzip = 16;
-	int compressionLevel = 6;	// Z_DEFAULT_COMPRESSION
-	int err = deflateInit2(&_zStream, compressionLevel, Z_DEFLATED, windowBits | enableGzip, 8, Z_DEFAULT_STRATEGY);
+	int err = deflateInit2(&_zStream, level, Z_DEFLATED, _windowBits | _gzipOnly, 8, Z_DEFAULT_STRATEGY);
 	if(err != Z_OK) return Status::zlib_error;
 
 	_innerStream = std::move(stream);
-	return (st = Status::ok);
+	return Status::ok;
 }
 
-Status GZipOStream::write(const void* buffer, roUint64 bytesToWrite)
+Status GZipOStream::_writeOut()
 {
-	roStatus st = roStatus::ok;
+	if(!_reservedSize)
+		return Status::ok;
 
-	if(!_innerStream.ptr())
-		return (st = Status::pointer_is_null);
+	const roSize size = _reservedSize - _zStream.avail_out;
+	const bool filledUp = _zStream.avail_out == 0;
+	_reservedSize = 0;
+	_zStream.next_out = NULL;
+	_zStream.avail_out = 0;
 
-	_zStream.next_in = (Bytef*)buffer;
-	st = roSafeAssign(_zStream.avail_in, bytesToWrite);
+	Status st = _innerStream->commitWrite(size);
 	if(!st) return st;
 
-	while(_zStream.avail_in)
-	{
-		int err = deflate(&_zStream, Z_NO_FLUSH);
+	// Filled up, fewer but bigger writes to the inner stream next time
+	if(_chunkSize == 0 && filledUp && _outSize < _maxChunkSize)
+		_outSize *= 2;
 
-		// Only writ to inner stream when zStream out buffer is full
-		if(_zStream.avail_out == 0) {
-			st = _innerStream->write(_buffer.bytePtr(), _buffer.sizeInByte() - _zStream.avail_out);
-			if(!st) return st;
-			_zStream.next_out = _buffer.bytePtr();
-			st = roSafeAssign(_zStream.avail_out, _buffer.sizeInByte());
+	return Status::ok;
+}
+
+Status GZipOStream::_deflate(int flush)
+{
+	while(true) {
+		if(!_reservedSize) {
+			roByte* p = NULL;
+			roSize size = 0;
+			Status st = _innerStream->reserveWrite(_outSize, p, size);
 			if(!st) return st;
+			_zStream.next_out = p;
+			_zStream.avail_out = _clampUInt(size);
+			_reservedSize = _zStream.avail_out;
 		}
 
-		switch(err) {
-		case Z_OK:
-		case Z_BUF_ERROR:
-		case Z_STREAM_END:
+		int err = deflate(&_zStream, flush);
+		if(err != Z_OK && err != Z_BUF_ERROR && err != Z_STREAM_END)
+			return Status::zlib_error;
+
+		// More output pending
+		if(_zStream.avail_out == 0) {
+			Status st = _writeOut();
+			if(!st) return st;
 			continue;
-		default:
-			return (st = Status::zlib_error);
 		}
+
+		// All input consumed, commit what has been filled such that the inner stream
+		// can be used (size(), bytePtr() of MemoryOStream for instance) in between write()
+		if(flush == Z_FINISH)
+			_finished = true;
+		return _writeOut();
+	}
+}
+
+Status GZipOStream::write(const void* buffer, roUint64 bytesToWrite)
+{
+	if(!_innerStream.ptr())
+		return Status::pointer_is_null;
+
+	if(_finished)
+		return Status::file_write_error;
+
+	const roByte* p = static_cast<const roByte*>(buffer);
+	while(bytesToWrite) {
+		const uInt size = _clampUInt(bytesToWrite);
+		_zStream.next_in = (Bytef*)p;
+		_zStream.avail_in = size;
+
+		Status st = _deflate(Z_NO_FLUSH);
+		if(!st) return st;
+
+		p += size;
+		bytesToWrite -= size;
 	}
 
-	return st;
+	return Status::ok;
 }
 
 roUint64 GZipOStream::posWrite() const
@@ -171,35 +402,26 @@ roUint64 GZipOStream::posWrite() const
 
 Status GZipOStream::flush()
 {
-	roStatus st = roStatus::ok;
-
 	if(!_innerStream.ptr())
 		return roStatus::pointer_is_null;
 
-	while(true) {
-		int err = deflate(&_zStream, Z_FINISH);
-		switch (err) {
-		case Z_OK:
-		case Z_STREAM_END:
-			st = _innerStream->write(_buffer.bytePtr(), _buffer.sizeInByte() - _zStream.avail_out);
-			if(!st) return st;
-			_zStream.next_out = _buffer.bytePtr();
-			st = roSafeAssign(_zStream.avail_out, _buffer.sizeInByte());
-			if(!st) return st;
-			if(err == Z_STREAM_END)
-				return _innerStream->flush();
-		default:
-			break;
-		}
+	if(!_finished) {
+		Status st = _deflate(Z_SYNC_FLUSH);
+		if(!st) return st;
 	}
 
-	return roStatus::zlib_error;
+	return _innerStream->flush();
 }
 
 Status GZipOStream::closeWrite()
 {
-	Status st = flush();
-	if(!st) return st;
+	if(!_innerStream.ptr())
+		return roStatus::pointer_is_null;
+
+	if(!_finished) {
+		Status st = _deflate(Z_FINISH);
+		if(!st) return st;
+	}
 
 	return _innerStream->closeWrite();
 }
@@ -10,25 +10,58 @@
 
 namespace ro {
 
+/// One-shot gzip of a whole buffer, with a single deflate() call and no intermediate chunk.
+/// level is zlib's, 1 (fastest) to 9 (smallest), 0 for storing only.
+Status	gzipCompress		(const void* src, roSize srcSize, ByteArray& dst, int level=Z_DEFAULT_COMPRESSION);
+
+/// The maximum size of gzipCompress() output for srcSize of input, including the gzip header and trailer.
+roSize	gzipCompressBound	(roSize srcSize);
+
+/// One-shot gunzip of a whole buffer, dst is sized by the uncompressed size recorded in the gzip trailer.
+Status	gzipDecompress		(const void* src, roSize srcSize, ByteArray& dst);
+
+/// When the uncompressed size is known, decompress straight into the caller's buffer.
+/// dstSize is the capacity on input, and the size produced on output.
+Status	gzipDecompress		(const void* src, roSize srcSize, void* dst, roSize& dstSize);
+
+/// Streaming gunzip.
+/// With chunkSize 0 (adaptive), the input buffer start at 4KB and grow with the read size, up to 256KB.
+/// If the inner stream has it's own buffer (using the peek() interface like MemoryIStream),
+/// it's fed to zlib directly without copying to our input buffer.
+/// A stream truncated after a flush (see GZipOStream::flush()) ends with the data available.
 struct GZipIStream : public IStream
 {
 	~GZipIStream();
 
-	Status init(AutoPtr<IStream>&& stream, roSize chunkSize=1024 * 4);
+	Status init(AutoPtr<IStream>&& stream, roSize chunkSize=0);
 
 	virtual	Status read(void* buffer, roUint64 bytesToRead, roUint64& bytesRead) override;
 
 // Private
+	Status _fillInput(roUint64 bytesToRead);
+	void _consumeInput();
+
 	z_stream _zStream;
 	ByteArray _inBuffer;
+	roSize _chunkSize;		///< 0 for adaptive
+	uInt _peekedSize;		///< Size given to zlib from the inner stream's own buffer, 0 if using _inBuffer
+	bool _ended;
 	AutoPtr<IStream> _innerStream;
 };	// GZipIStream
 
+/// Streaming gzip.
+/// The output is deflated straight into the region lent by the inner stream's reserveWrite(),
+/// so an inner stream having it's own buffer (MemoryOStream, chunked HTTP) get it without copying.
+/// The filled part of the region is committed before write() return, the inner stream never see uninitialized bytes.
+/// With chunkSize 0 (adaptive), the reserved size start at 4KB and double whenever it get full
+/// within a single write, up to 256KB, so that big writes go to the inner stream in big pieces.
+/// flush() send all the data written so far (Z_SYNC_FLUSH) but the stream can still be written,
+/// closeWrite() finish the gzip stream and close the inner stream.
 struct GZipOStream : public OStream
 {
 	~GZipOStream();
 
-	Status init(AutoPtr<OStream>&& stream, roSize chunkSize = 1024 * 4);
+	Status init(AutoPtr<OStream>&& stream, roSize chunkSize=0, int level=Z_DEFAULT_COMPRESSION);
 
 	virtual	Status		write		(const void* buffer, roUint64 bytesToWrite) override;
 	virtual roUint64	posWrite	() const override;
@@ -36,8 +69,14 @@ struct GZipOStream : public OStream
 	virtual Status		closeWrite	() override;
 
 // Private
+	Status _deflate(int flush);
+	Status _writeOut();
+
 	z_stream _zStream;
-	ByteArray _buffer;
+	roSize _outSize;		///< Size to reserve from the inner stream
+	roSize _reservedSize;	///< Of the region currently reserved, 0 for none
+	roSize _chunkSize;		///< 0 for adaptive
+	bool _finished;
 	AutoPtr<OStream> _innerStream;
 };	// GZipOStream
 
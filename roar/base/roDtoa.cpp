@@ -306,6 +306,33 @@ void grisu2(double value, char* buffer, int* length, int* K)
 	digitGen(W, Wp, Wp.f - Wm.f, buffer, length, K);
 }
 
+// Same as grisu2() but with the boundaries of a float, such that the digits generated are the
+// shortest reading back to the same float, 1.23f give "1.23" instead of "1.2300000190734863"
+void grisu2Float(float value, char* buffer, int* length, int* K)
+{
+	union {
+		float f;
+		roUint32 u32;
+	} u = { value };
+	const int biased_e = static_cast<int>((u.u32 >> 23) & 0xFF);
+	const roUint64 significand = u.u32 & 0x7FFFFF;
+	const roUint64 hiddenBit = 0x800000;
+	const DiyFp v = biased_e ? DiyFp(significand + hiddenBit, biased_e - 150) : DiyFp(significand, -149);
+
+	DiyFp pl = DiyFp((v.f << 1) + 1, v.e - 1).normalize();
+	DiyFp mi = (v.f == hiddenBit) ? DiyFp((v.f << 2) - 1, v.e - 2) : DiyFp((v.f << 1) - 1, v.e - 1);
+	mi.f <<= mi.e - pl.e;
+	mi.e = pl.e;
+
+	const DiyFp c_mk = getCachedPower(pl.e, K);
+	const DiyFp W = v.normalize() * c_mk;
+	DiyFp Wp = pl * c_mk;
+	DiyFp Wm = mi * c_mk;
+	++Wm.f;
+	--Wp.f;
+	digitGen(W, Wp, Wp.f - Wm.f, buffer, length, K);
+}
+
 const char* getDigitsLut()
 {
 	static const char cDigitsLut[200] = {
@@ -408,6 +435,62 @@ char* roDtoa(double value, char* buffer)
 	}
 }
 
+char* roFtoa(float value, char* buffer)
+{
+	if(value == 0) {
+		buffer[0] = '0';
+		buffer[1] = '.';
+		buffer[2] = '0';
+		return &buffer[3];
+	}
+	else {
+		if(value < 0) {
+			*buffer++ = '-';
+			value = -value;
+		}
+		int length, K;
+		grisu2Float(value, buffer, &length, &K);
+		return prettify(buffer, length, K);
+	}
+}
+
+// Two digits at a time from the back, using the same table as writeExponent()
+char* roU64toa(roUint64 value, char* buffer)
+{
+	const char* lut = getDigitsLut();
+	char tmp[20];
+	char* p = tmp + sizeof(tmp);
+
+	while(value >= 100) {
+		const unsigned i = static_cast<unsigned>(value % 100) * 2;
+		value /= 100;
+		*--p = lut[i + 1];
+		*--p = lut[i];
+	}
+
+	if(value < 10)
+		*--p = static_cast<char>('0' + value);
+	else {
+		const unsigned i = static_cast<unsigned>(value) * 2;
+		*--p = lut[i + 1];
+		*--p = lut[i];
+	}
+
+	const roSize len = tmp + sizeof(tmp) - p;
+	roMemcpy(buffer, p, len);
+	return buffer + len;
+}
+
+char* roI64toa(roInt64 value, char* buffer)
+{
+	roUint64 u = static_cast<roUint64>(value);
+	if(value < 0) {
+		*buffer++ = '-';
+		u = 0 - u;
+	}
+	return roU64toa(u, buffer);
+}
+
 roSize roToString(char* str, roSize strBufSize, double val, const char* option)
 {
 	char tmpBuf[64];
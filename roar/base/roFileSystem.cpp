@@ -1,6 +1,10 @@
 #include "pch.h"
 #include "roFileSystem.h"
+#include "roAtomic.h"
+#include "roHttpCacheFileSystem.h"
 #include "roHttpFileSystem.h"
+#include "roMmapFileSystem.h"
+#include "roPackFileSystem.h"
 #include "roRawFileSystem.h"
 #include "roMemory.h"
 #include "roStringUtility.h"
@@ -13,20 +17,32 @@ struct _CompoundFSContext
 {
 	void* impl;
 	FileSystem* fsImpl;
+	volatile long refCount;	///< One for the opened file, plus one per taken buffer
 };
 
+/// Taken buffers outlive closeFile(), so is the context which untakeBuffer() need
+static void _compoundFSRelease(_CompoundFSContext* c)
+{
+	if(roAtomicDec(&c->refCount) == 0)
+		_allocator.deleteObj(c);
+}
+
 Status _compoundFSOpenFile(const char* uri, void*& outFile)
 {
 	if(!uri || uri[0] == '\0') return Status::invalid_parameter;
 
-	_CompoundFSContext ctx = { NULL, NULL };
+	_CompoundFSContext ctx = { NULL, NULL, 1 };
 
 	if(roStrStr(uri, "http://") == uri)
-		ctx.fsImpl = &httpFileSystem;
+		ctx.fsImpl = httpCacheIsOpen() ? &httpCacheFileSystem : &httpFileSystem;
+	else if(packFileSystemHasMount() && packFileSystemOpenFile(uri, ctx.impl))
+		ctx.fsImpl = &packFileSystem;
 	else
-		ctx.fsImpl = &rawFileSystem;
+		ctx.fsImpl = mmapFileSystemForLocalFiles ? &mmapFileSystem : &rawFileSystem;
 
-	Status st = ctx.fsImpl->openFile(uri, ctx.impl); if(!st) return st;
+	if(!ctx.impl) {
+		Status st = ctx.fsImpl->openFile(uri, ctx.impl); if(!st) return st;
+	}
 
 	outFile = _allocator.newObj<_CompoundFSContext>(ctx).unref();
 	return Status::ok;
@@ -72,7 +88,7 @@ void _compoundFSCloseFile(void* file)
 	if(!file) return;
 	_CompoundFSContext* c = (_CompoundFSContext*)file;
 	c->fsImpl->closeFile(c->impl);
-	_allocator.deleteObj(c);
+	_compoundFSRelease(c);
 }
 
 roBytePtr _compoundFSGetBuffer(void* file, roUint64 requestSize, roUint64& readableSize)
@@ -84,13 +100,16 @@ roBytePtr _compoundFSGetBuffer(void* file, roUint64 requestSize, roUint64& reada
 void _compoundFSTakeBuffer(void* file)
 {
 	_CompoundFSContext* c = (_CompoundFSContext*)file;
-	return c->fsImpl->takeBuffer(c->impl);
+	roAtomicInc(&c->refCount);
+	c->fsImpl->takeBuffer(c->impl);
 }
 
 void _compoundFSUntakeBuffer(void* file, roBytePtr buf)
 {
 	_CompoundFSContext* c = (_CompoundFSContext*)file;
-	return c->fsImpl->untakeBuffer(c->impl, buf);
+	if(!c) return;
+	c->fsImpl->untakeBuffer(c->impl, buf);
+	_compoundFSRelease(c);
 }
 
 
@@ -101,14 +120,17 @@ void* _compoundFSOpenDir(const char* uri)
 	if(!uri || uri[0] == '\0')
 		return NULL;
 
-	_CompoundFSContext ctx = { NULL, NULL };
+	_CompoundFSContext ctx = { NULL, NULL, 1 };
 
 	if(roStrStr(uri, "http://") == uri)
 		ctx.fsImpl = &httpFileSystem;
+	else if(packFileSystemHasMount() && (ctx.impl = packFileSystemOpenDir(uri)) != NULL)
+		ctx.fsImpl = &packFileSystem;
 	else
 		ctx.fsImpl = &rawFileSystem;
 
-	ctx.impl = ctx.fsImpl->openDir(uri);
+	if(!ctx.impl)
+		ctx.impl = ctx.fsImpl->openDir(uri);
 
 	return ctx.impl ? _allocator.newObj<_CompoundFSContext>(ctx).unref() : NULL;
 }
@@ -0,0 +1,209 @@
+#include "pch.h"
+#include "roFrameArena.h"
+#include "roMemory.h"
+
+namespace ro {
+
+static DefaultAllocator _allocator;
+static const roSize _alignment = 16;
+
+static roFORCEINLINE roSize _alignUp(roSize size)
+{
+	return (size + _alignment - 1) & ~(_alignment - 1);
+}
+
+FrameArena::FrameArena(roSize blockSize)
+	: _head(NULL)
+	, _current(NULL)
+	, _lastAlloc(NULL)
+	, _blockSize(blockSize)
+{
+}
+
+FrameArena::~FrameArena()
+{
+	shrink();
+}
+
+FrameArena::Block* FrameArena::_allocBlock(roSize minSize)
+{
+	roSize size = _alignUp(roMaxOf2(minSize, _blockSize));
+	Block* b = _allocator.malloc(sizeof(Block) + size + _alignment).cast<Block>();
+	if(!b) return NULL;
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+	return b;
+}
+
+roBytePtr FrameArena::malloc(roSize size)
+{
+	size = _alignUp(size);
+
+	// NOTE: The user pointer is aligned up from data(), as the heap may only give 8 bytes alignment
+	if(_current) {
+		roByte* base = (roByte*)_alignUp(roSize(_current->data()));
+		if(_current->used + size <= _current->size) {
+			void* p = base + _current->used;
+			_current->used += size;
+			return _lastAlloc = p;
+		}
+	}
+
+	// Move to the next block which is reused from previous frames,
+	// or insert a new one if it is too small.
+	Block* next = _current ? _current->next : _head;
+	if(!next || next->size < size) {
+		Block* b = _allocBlock(size);
+		if(!b) return NULL;
+		b->next = next;
+		if(_current)
+			_current->next = b;
+		else
+			_head = b;
+		next = b;
+	}
+
+	_current = next;
+	_current->used = size;
+	return _lastAlloc = (roByte*)_alignUp(roSize(_current->data()));
+}
+
+roBytePtr FrameArena::realloc(void* originalPtr, roSize originalSize, roSize newSize)
+{
+	if(!originalPtr)
+		return malloc(newSize);
+
+	if(originalPtr == _lastAlloc) {
+		roByte* base = (roByte*)_alignUp(roSize(_current->data()));
+		roSize offset = roSize((roByte*)originalPtr - base);
+		if(offset + _alignUp(newSize) <= _current->size) {
+			_current->used = offset + _alignUp(newSize);
+			return originalPtr;
+		}
+	}
+
+	roBytePtr p = malloc(newSize);
+	if(p)
+		roMemcpy(p, originalPtr, roMinOf2(originalSize, newSize));
+	return p;
+}
+
+void FrameArena::free(void* ptr)
+{
+	if(!ptr || ptr != _lastAlloc)
+		return;
+
+	roByte* base = (roByte*)_alignUp(roSize(_current->data()));
+	_current->used = roSize((roByte*)ptr - base);
+	_lastAlloc = NULL;
+}
+
+FrameArena::Mark FrameArena::mark() const
+{
+	Mark m = { _current, _current ? _current->used : 0 };
+	return m;
+}
+
+void FrameArena::rollback(const Mark& m)
+{
+	// NOTE: Blocks after the current one are considered empty,
+	// their used count get reset when malloc() moves into them.
+	_current = m.block;
+	if(_current)
+		_current->used = m.used;
+	_lastAlloc = NULL;
+}
+
+void FrameArena::tick()
+{
+	Mark m = { NULL, 0 };
+	rollback(m);
+}
+
+void FrameArena::shrink()
+{
+	while(_head) {
+		Block* next = _head->next;
+		_allocator.free(_head);
+		_head = next;
+	}
+	_current = NULL;
+	_lastAlloc = NULL;
+}
+
+roSize FrameArena::bytesInUse() const
+{
+	roSize ret = 0;
+	for(Block* b = _head; b && _current; b = b->next) {
+		ret += b->used;
+		if(b == _current)
+			break;
+	}
+	return ret;
+}
+
+roSize FrameArena::capacity() const
+{
+	roSize ret = 0;
+	for(Block* b = _head; b; b = b->next)
+		ret += b->size;
+	return ret;
+}
+
+FrameArena& FrameArena::current()
+{
+	static thread_local FrameArena arena;
+	return arena;
+}
+
+
+// ----------------------------------------------------------------------
+
+ArenaString::ArenaString(FrameArena& arena)
+{
+	// Layout: [FrameArena*][size][capacity | _arenaFlag][characters...]['\0']
+	const roSize bytes = sizeof(FrameArena*) + sizeof(roSize) * 2 + 1;
+	roByte* p = arena.malloc(bytes).cast<roByte>();
+	if(!p) return;	// Remain as an empty heap string
+
+	*(FrameArena**)p = &arena;
+	_cstr = (char*)(p + sizeof(FrameArena*));
+	_size() = 0;
+	_capacity() = _arenaFlag;
+	_str()[0] = '\0';
+}
+
+ArenaString::ArenaString(FrameArena& arena, const char* str)
+	: ArenaString(arena)
+{
+	roVerify(assign(str));
+}
+
+ArenaString::ArenaString(const ArenaString& str)
+	: ArenaString(str._arena() ? *str._arena() : FrameArena::current())
+{
+	roVerify(assign(str.c_str(), str.size()));
+}
+
+ArenaString& ArenaString::operator=(const char* str)
+{
+	roVerify(assign(str));
+	return *this;
+}
+
+ArenaString& ArenaString::operator=(const String& str)
+{
+	if(&str != this)
+		roVerify(assign(str.c_str(), str.size()));
+	return *this;
+}
+
+ArenaString& ArenaString::operator=(const ArenaString& str)
+{
+	if(&str != this)
+		roVerify(assign(str.c_str(), str.size()));
+	return *this;
+}
+
+}	// namespace ro
@@ -0,0 +1,152 @@
+#ifndef __roFrameArena_h__
+#define __roFrameArena_h__
+
+#include "roArray.h"
+#include "roString.h"
+
+namespace ro {
+
+/// A bump allocator for scratch data which lives no longer than a frame.
+/// Unlike BlockAllocator, the memory blocks are kept after tick() and reused,
+/// therefore a steady state frame makes zero heap calls, and releasing all
+/// allocations is a single pointer reset.
+/// Use mark() and rollback() (or FrameArena::Scope) to release nested scratch
+/// data early. Every allocation is 16 bytes aligned.
+/// @note Not thread safe, use FrameArena::current() to get the instance of the calling thread.
+struct FrameArena : private NonCopyable
+{
+	explicit FrameArena(roSize blockSize = 64 * 1024);
+	~FrameArena();
+
+	struct Block;
+	struct Mark
+	{
+		Block* block;
+		roSize used;
+	};	// Mark
+
+// Operations
+	roBytePtr	malloc		(roSize size);
+
+	/// Grow or shrink in place if originalPtr is the most recent allocation, otherwise allocate and copy
+	roBytePtr	realloc		(void* originalPtr, roSize originalSize, roSize newSize);
+
+	/// Only the most recent allocation is reclaimed immediately, others wait for rollback() or tick()
+	void		free		(void* ptr);
+
+	Mark		mark		() const;
+
+	/// Release everything allocated after the mark
+	void		rollback	(const Mark& m);
+
+	/// Release everything, call it once per frame
+	void		tick		();
+
+	/// Return all blocks to the heap
+	void		shrink		();
+
+	/// The instance owned by the calling thread, it is tick() by SubSystems::tick()
+	/// for the main thread, other threads should call tick() themselves.
+	static FrameArena& current();
+
+	/// Rollback to the mark taken on construction
+	struct Scope : private NonCopyable
+	{
+		explicit Scope(FrameArena& arena = FrameArena::current()) : _arena(arena), _mark(arena.mark()) {}
+		~Scope() { _arena.rollback(_mark); }
+		FrameArena& _arena;
+		Mark _mark;
+	};	// Scope
+
+// Attributes
+	/// Number of bytes allocated since the last tick(), including alignment padding
+	roSize		bytesInUse	() const;
+
+	/// Total size of the blocks owned, which are reused across frames
+	roSize		capacity	() const;
+
+// Private
+	struct Block
+	{
+		Block* next;
+		roSize size;	///< Usable bytes after the header
+		roSize used;
+		roSize _padding;
+		roByte* data() { return (roByte*)(this + 1); }
+	};	// Block
+
+	Block* _allocBlock(roSize minSize);
+
+	Block* _head;
+	Block* _current;
+	void* _lastAlloc;	///< The most recent allocation, for in place realloc() and free()
+	roSize _blockSize;
+};	// FrameArena
+
+
+// ----------------------------------------------------------------------
+
+/// Dynamic array drawing it's memory from a FrameArena.
+/// Make sure the array is destroyed before the arena rollback or tick.
+template<class T>
+struct ArenaArray : public IArray<T>
+{
+	explicit ArenaArray(FrameArena& arena = FrameArena::current()) : _arena(&arena) {}
+	ArenaArray(const ArenaArray& src) : _arena(src._arena) { this->copy(src); }
+	~ArenaArray() { this->clear(); _arena->free(this->_data); }
+
+	ArenaArray& operator=(const ArenaArray& rhs) { this->copy(rhs); return *this; }
+
+// Operations
+	Status reserve(roSize newCapacity, bool force=false) override;
+
+	FrameArena* _arena;
+};	// ArenaArray
+
+/// String drawing it's buffer from a FrameArena.
+/// The buffer remembers it's arena, so all String operations keep using the arena.
+/// Make sure the string is destroyed before the arena rollback or tick.
+struct ArenaString : public String
+{
+	explicit ArenaString(FrameArena& arena = FrameArena::current());
+	ArenaString(FrameArena& arena, const char* str);
+	ArenaString(const ArenaString& str);
+
+	ArenaString& operator=(const char* str);
+	ArenaString& operator=(const String& str);
+	ArenaString& operator=(const ArenaString& str);
+};	// ArenaString
+
+template<class T>
+Status ArenaArray<T>::reserve(roSize newCapacity, bool force)
+{
+	newCapacity = roMaxOf2(newCapacity, this->size());
+	if(newCapacity == 0 && !force) return Status::ok;
+
+	if(!force && this->_capacity >= newCapacity)
+		return Status::ok;
+
+	T* newPtr = NULL;
+	if(TypeOf<T>::isPOD()) {
+		newPtr = _arena->realloc(this->_data, this->_capacity * sizeof(T), newCapacity * sizeof(T));
+		if(newCapacity && !newPtr) return Status::not_enough_memory;
+	}
+	else {
+		newPtr = _arena->malloc(newCapacity * sizeof(T));
+		if(newCapacity && !newPtr) return Status::not_enough_memory;
+		for(roSize i=0; i<this->_size; ++i) {
+			new ((void *)&newPtr[i]) T;
+			roSwap(this->_data[i], newPtr[i]);
+			this->_data[i].~T();
+		}
+		_arena->free(this->_data);
+	}
+
+	this->_data = newPtr;
+	this->_capacity = newCapacity;
+	return Status::ok;
+}
+
+}	// namespace ro
+
+#endif	// __roFrameArena_h__
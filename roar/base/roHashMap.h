@@ -0,0 +1,274 @@
+#ifndef __roHashMap_h__
+#define __roHashMap_h__
+
+#include "../platform/roCompiler.h"
+#include "roMemory.h"
+#include "roNonCopyable.h"
+#include "roString.h"
+#include "roUtility.h"
+#include <string.h>
+#include <utility>
+
+#if roCPU_SSE
+#	include <emmintrin.h>
+#endif
+
+#if roCOMPILER_VC
+#	include <intrin.h>
+#endif
+
+namespace ro {
+
+/// Hash and equality used by HashMap and HashSet, specialize it for your own key type.
+/// Overloads of hash() and equal() taking another type enable heterogeneous lookup,
+/// for example find() a String key with a RangedString, without constructing any String.
+/// The hash value need not be well distributed, it will be mixed by the table.
+template<class K>
+struct HashMapHasher
+{
+	static roSize	hash(const K& key)					{ return roSize(key); }
+	static bool		equal(const K& lhs, const K& rhs)	{ return lhs == rhs; }
+};	// HashMapHasher
+
+template<class T>
+struct HashMapHasher<T*>
+{
+	static roSize	hash(const T* key)					{ return roSize(roPtrInt(key)); }
+	static bool		equal(const T* lhs, const T* rhs)	{ return lhs == rhs; }
+};	// HashMapHasher
+
+/// Hash by string content, String, RangedString, ConstString and const char* can lookup each other.
+/// The hash value equals to stringHash(), therefore the one cached in ConstString is reused.
+struct StringHasher
+{
+	static roSize	hash(const char* key)			{ return _hash(key, roStrLen(key)); }
+	static roSize	hash(const String& key)			{ return _hash(key.c_str(), key.size()); }
+	static roSize	hash(const RangedString& key)	{ return _hash(key.begin, key.size()); }
+	static roSize	hash(const ConstString& key)	{ return key.hash(); }
+
+	/// Interned, compare by pointer is enough
+	static bool		equal(const ConstString& lhs, const ConstString& rhs) { return lhs.c_str() == rhs.c_str(); }
+
+	template<class A, class B>
+	static bool		equal(const A& lhs, const B& rhs) { return _equal(_range(lhs), _range(rhs)); }
+
+// Private
+	static RangedString _range(const char* s)			{ return RangedString(s); }
+	static RangedString _range(const String& s)			{ return RangedString(s); }
+	static RangedString _range(const RangedString& s)	{ return s; }
+	static RangedString _range(const ConstString& s)	{ const char* p = s.c_str(); return RangedString(p, p + s.size()); }
+
+	static bool _equal(const RangedString& lhs, const RangedString& rhs)
+	{
+		roSize size = lhs.size();
+		return size == rhs.size() && memcmp(lhs.begin, rhs.begin, size) == 0;
+	}
+
+	static StringHash _hash(const char* str, roSize len)
+	{
+		// Same as stringHash(), but the length is always respected
+		StringHash hash = 0;
+		for(roSize i=0; i<len; ++i)
+			hash = str[i] + (hash << 6) + (hash << 16) - hash;
+		return hash;
+	}
+};	// StringHasher
+
+template<> struct HashMapHasher<const char*> : public StringHasher {};
+template<> struct HashMapHasher<String> : public StringHasher {};
+template<> struct HashMapHasher<ConstString> : public StringHasher {};
+
+
+// ----------------------------------------------------------------------
+
+/// Control bytes of the hash table, a full slot stores the lower 7 bits of it's hash
+struct _HashCtrl
+{
+	static const roInt8 empty = -128;
+	static const roInt8 deleted = -2;
+	static const roSize groupWidth = 16;
+};	// _HashCtrl
+
+/// Open addressing hash table in the style of Swiss table:
+/// A probe reads a group of 16 control bytes at once (using SSE2 if available) and
+/// compares the 7 bits hash tag of all of them in parallel, so a lookup usually
+/// touches one cache line of control bytes before the key comparison.
+/// The slots are stored inline, no per entry allocation.
+/// Maximum load factor is 7/8, removed slots become tombstones until the next rehash.
+template<class K, class Slot, class KeyOf, class Hasher>
+struct _HashTable : private NonCopyable
+{
+	_HashTable() : _ctrl(NULL), _slots(NULL), _capacity(0), _size(0), _growthLeft(0) {}
+	_HashTable(_HashTable&& rhs);
+	~_HashTable()	{ clear(); roFree(_ctrl); }
+
+	_HashTable& operator=(_HashTable&& rhs);
+
+	template<class T>
+	struct Iterator
+	{
+		Iterator(roInt8* ctrl, T* slot, T* end) : _ctrl(ctrl), _slot(slot), _end(end) { _skipEmpty(); }
+		T&			operator*() const	{ return *_slot; }
+		T*			operator->() const	{ return _slot; }
+		Iterator&	operator++()		{ ++_ctrl; ++_slot; _skipEmpty(); return *this; }
+		bool		operator==(const Iterator& rhs) const { return _slot == rhs._slot; }
+		bool		operator!=(const Iterator& rhs) const { return _slot != rhs._slot; }
+		void		_skipEmpty()		{ while(_slot != _end && *_ctrl < 0) { ++_ctrl; ++_slot; } }
+		roInt8* _ctrl;
+		T* _slot;
+		T* _end;
+	};	// Iterator
+
+	typedef Iterator<Slot> iterator;
+	typedef Iterator<const Slot> const_iterator;
+
+// Operations
+	void		clear();				///< Destroy all entries but keep the memory
+	Status		reserve(roSize count);	///< Make room for count entries without rehash
+
+// Attributes
+	roSize		size() const			{ return _size; }
+	bool		isEmpty() const			{ return _size == 0; }
+	roSize		capacity() const		{ return _capacity; }
+
+// Private
+	static roSize	_mix(roSize hash);
+	static roSize	_capacityFor(roSize count);
+
+	template<class Q>
+	Slot*		_find(const Q& key) const;
+	template<class Q>
+	Slot*		_find(const Q& key, roSize mixedHash) const;
+
+	/// Return the slot index for the key, and whether it already exist.
+	/// If not exist, the slot is marked as full and the caller must construct it.
+	/// Return roSize(-1) if out of memory.
+	template<class Q>
+	roSize		_findOrPrepareInsert(const Q& key, bool& exist);
+
+	roSize		_findFirstNonFull(roSize hash) const;
+	void		_setCtrl(roSize i, roInt8 h);
+	void		_eraseAt(roSize i);
+	Status		_rehash(roSize newCapacity);
+
+	roInt8* _ctrl;		///< _capacity + groupWidth bytes, the first group is mirrored at the end
+	Slot* _slots;
+	roSize _capacity;	///< Power of 2, or 0
+	roSize _size;
+	roSize _growthLeft;	///< Number of empty slots can be filled before rehash
+};	// _HashTable
+
+struct _HashMapKeyOf
+{
+	template<class Slot> static const typename Slot::Key& key(const Slot& slot) { return slot.key; }
+};	// _HashMapKeyOf
+
+struct _HashSetKeyOf
+{
+	template<class Slot> static const Slot& key(const Slot& slot) { return slot; }
+};	// _HashSetKeyOf
+
+
+// ----------------------------------------------------------------------
+
+template<class K, class V>
+struct HashMapEntry
+{
+	typedef K Key;
+
+	template<class KK, class VV>
+	HashMapEntry(KK&& k, VV&& v) : key(std::forward<KK>(k)), value(std::forward<VV>(v)) {}
+
+	K key;
+	V value;
+};	// HashMapEntry
+
+/// Open addressing hash map, see _HashTable for the details.
+/// Value can be move only, and the key type can be different from K
+/// in all lookup functions, as long as Hasher supports it.
+/// @note Insertion may move the entries, pointers to value are invalidated.
+/// Example:
+/// @code
+/// HashMap<String, int> map;
+/// map.insert("one", 1);
+/// int* v = map.find(RangedString("one"));
+/// for(auto& e : map) { e.key; e.value; }
+/// @endcode
+template<class K, class V, class Hasher=HashMapHasher<K> >
+struct HashMap : public _HashTable<K, HashMapEntry<K, V>, _HashMapKeyOf, Hasher>
+{
+	typedef _HashTable<K, HashMapEntry<K, V>, _HashMapKeyOf, Hasher> Super;
+	typedef HashMapEntry<K, V> Entry;
+	typedef typename Super::iterator iterator;
+	typedef typename Super::const_iterator const_iterator;
+
+	HashMap() {}
+	HashMap(HashMap&& rhs) : Super(std::move(rhs)) {}
+	HashMap& operator=(HashMap&& rhs) { Super::operator=(std::move(rhs)); return *this; }
+
+// Operations
+	/// Insert or overwrite, return NULL if out of memory
+	template<class KK, class VV>
+	V*			insert(KK&& key, VV&& value);
+
+	/// Insert only if the key not exist yet, return NULL if already exist or out of memory
+	template<class KK, class VV>
+	V*			insertUnique(KK&& key, VV&& value);
+
+	/// Insert a default constructed value if the key not exist yet
+	template<class KK>
+	V&			operator[](KK&& key);
+
+	/// Return false if the key not found
+	template<class Q>
+	bool		remove(const Q& key);
+
+// Attributes
+	template<class Q>
+	V*			find(const Q& key)				{ Entry* e = this->_find(key); return e ? &e->value : NULL; }
+	template<class Q>
+	const V*	find(const Q& key) const		{ const Entry* e = this->_find(key); return e ? &e->value : NULL; }
+	template<class Q>
+	bool		contains(const Q& key) const	{ return this->_find(key) != NULL; }
+
+	iterator		begin()			{ return iterator(this->_ctrl, this->_slots, this->_slots + this->_capacity); }
+	iterator		end()			{ Entry* e = this->_slots + this->_capacity; return iterator(NULL, e, e); }
+	const_iterator	begin() const	{ return const_iterator(this->_ctrl, this->_slots, this->_slots + this->_capacity); }
+	const_iterator	end() const		{ const Entry* e = this->_slots + this->_capacity; return const_iterator(NULL, e, e); }
+};	// HashMap
+
+/// Open addressing hash set, see _HashTable for the details.
+template<class K, class Hasher=HashMapHasher<K> >
+struct HashSet : public _HashTable<K, K, _HashSetKeyOf, Hasher>
+{
+	typedef _HashTable<K, K, _HashSetKeyOf, Hasher> Super;
+	typedef typename Super::const_iterator const_iterator;
+
+	HashSet() {}
+	HashSet(HashSet&& rhs) : Super(std::move(rhs)) {}
+	HashSet& operator=(HashSet&& rhs) { Super::operator=(std::move(rhs)); return *this; }
+
+// Operations
+	/// Return the key stored in the set, or NULL if out of memory
+	template<class KK>
+	const K*	insert(KK&& key, bool* inserted=NULL);
+
+	/// Return false if the key not found
+	template<class Q>
+	bool		remove(const Q& key);
+
+// Attributes
+	template<class Q>
+	const K*	find(const Q& key) const		{ return this->_find(key); }
+	template<class Q>
+	bool		contains(const Q& key) const	{ return this->_find(key) != NULL; }
+
+	const_iterator	begin() const	{ return const_iterator(this->_ctrl, this->_slots, this->_slots + this->_capacity); }
+	const_iterator	end() const		{ const K* e = this->_slots + this->_capacity; return const_iterator(NULL, e, e); }
+};	// HashSet
+
+}	// namespace ro
+
+#include "roHashMap.inl"
+
+#endif	// __roHashMap_h__
@@ -0,0 +1,339 @@
+#ifndef __roHashMap_inl__
+#define __roHashMap_inl__
+
+#include <new>
+
+namespace ro {
+
+/// Index of the lowest set bit, mask must not be zero
+roFORCEINLINE roSize _hashCountTrailingZero(roUint32 mask)
+{
+#if roCOMPILER_VC
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#elif roCOMPILER_GCC
+	return __builtin_ctz(mask);
+#else
+	roSize index = 0;
+	while(!(mask & 1)) { mask >>= 1; ++index; }
+	return index;
+#endif
+}
+
+/// A group of 16 control bytes, each match function returns a bit mask of the matching bytes
+struct _HashGroup
+{
+#if roCPU_SSE
+	explicit _HashGroup(const roInt8* ctrl) : _ctrl(_mm_loadu_si128((const __m128i*)ctrl)) {}
+
+	roUint32 match(roInt8 h) const				{ return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h), _ctrl)); }
+	roUint32 matchEmpty() const					{ return match(_HashCtrl::empty); }
+
+	/// Both empty and deleted are smaller than -1
+	roUint32 matchEmptyOrDeleted() const		{ return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), _ctrl)); }
+
+	__m128i _ctrl;
+#else
+	explicit _HashGroup(const roInt8* ctrl) : _ctrl(ctrl) {}
+
+	roUint32 match(roInt8 h) const {
+		roUint32 ret = 0;
+		for(roSize i=0; i<_HashCtrl::groupWidth; ++i)
+			ret |= roUint32(_ctrl[i] == h) << i;
+		return ret;
+	}
+	roUint32 matchEmpty() const					{ return match(_HashCtrl::empty); }
+	roUint32 matchEmptyOrDeleted() const {
+		roUint32 ret = 0;
+		for(roSize i=0; i<_HashCtrl::groupWidth; ++i)
+			ret |= roUint32(_ctrl[i] < -1) << i;
+		return ret;
+	}
+
+	const roInt8* _ctrl;
+#endif
+};	// _HashGroup
+
+
+// ----------------------------------------------------------------------
+
+template<class K, class S, class KO, class H>
+_HashTable<K,S,KO,H>::_HashTable(_HashTable&& rhs)
+	: _ctrl(rhs._ctrl), _slots(rhs._slots), _capacity(rhs._capacity), _size(rhs._size), _growthLeft(rhs._growthLeft)
+{
+	rhs._ctrl = NULL;
+	rhs._slots = NULL;
+	rhs._capacity = rhs._size = rhs._growthLeft = 0;
+}
+
+template<class K, class S, class KO, class H>
+_HashTable<K,S,KO,H>& _HashTable<K,S,KO,H>::operator=(_HashTable&& rhs)
+{
+	if(&rhs == this) return *this;
+	clear();
+	roFree(_ctrl);
+	_ctrl = rhs._ctrl;
+	_slots = rhs._slots;
+	_capacity = rhs._capacity;
+	_size = rhs._size;
+	_growthLeft = rhs._growthLeft;
+	rhs._ctrl = NULL;
+	rhs._slots = NULL;
+	rhs._capacity = rhs._size = rhs._growthLeft = 0;
+	return *this;
+}
+
+template<class K, class S, class KO, class H>
+void _HashTable<K,S,KO,H>::clear()
+{
+	if(!_capacity) return;
+
+	if(_size) for(roSize i=0; i<_capacity; ++i) {
+		if(_ctrl[i] >= 0)
+			_slots[i].~S();
+	}
+
+	memset(_ctrl, _HashCtrl::empty, _capacity + _HashCtrl::groupWidth);
+	_size = 0;
+	_growthLeft = _capacity - _capacity / 8;
+}
+
+template<class K, class S, class KO, class H>
+Status _HashTable<K,S,KO,H>::reserve(roSize count)
+{
+	if(count <= _size + _growthLeft)
+		return Status::ok;
+	return _rehash(_capacityFor(count));
+}
+
+template<class K, class S, class KO, class H>
+roSize _HashTable<K,S,KO,H>::_mix(roSize hash)
+{
+	// Fibonacci hashing, so that both the group index and the 7 bits tag get well distributed
+	roUint64 h = roUint64(hash) * 0x9E3779B97F4A7C15ull;
+	return roSize(h ^ (h >> 32));
+}
+
+template<class K, class S, class KO, class H>
+roSize _HashTable<K,S,KO,H>::_capacityFor(roSize count)
+{
+	roSize capacity = _HashCtrl::groupWidth;
+	while(capacity - capacity / 8 < count)
+		capacity *= 2;
+	return capacity;
+}
+
+template<class K, class S, class KO, class H>
+template<class Q>
+S* _HashTable<K,S,KO,H>::_find(const Q& key) const
+{
+	if(!_size) return NULL;
+	return _find(key, _mix(H::hash(key)));
+}
+
+template<class K, class S, class KO, class H>
+template<class Q>
+S* _HashTable<K,S,KO,H>::_find(const Q& key, roSize hash) const
+{
+	const roInt8 h2 = roInt8(hash & 0x7F);
+	const roSize mask = _capacity - 1;
+
+	// Triangular probing visits every group exactly once when capacity is power of 2
+	for(roSize pos = (hash >> 7) & mask, step = 0; ; ) {
+		_HashGroup g(_ctrl + pos);
+		for(roUint32 m = g.match(h2); m; m &= m - 1) {
+			roSize i = (pos + _hashCountTrailingZero(m)) & mask;
+			if(H::equal(KO::key(_slots[i]), key))
+				return &_slots[i];
+		}
+		if(g.matchEmpty())
+			return NULL;
+		step += _HashCtrl::groupWidth;
+		pos = (pos + step) & mask;
+		roAssert(step <= _capacity);
+	}
+}
+
+template<class K, class S, class KO, class H>
+roSize _HashTable<K,S,KO,H>::_findFirstNonFull(roSize hash) const
+{
+	const roSize mask = _capacity - 1;
+	for(roSize pos = (hash >> 7) & mask, step = 0; ; ) {
+		_HashGroup g(_ctrl + pos);
+		if(roUint32 m = g.matchEmptyOrDeleted())
+			return (pos + _hashCountTrailingZero(m)) & mask;
+		step += _HashCtrl::groupWidth;
+		pos = (pos + step) & mask;
+		roAssert(step <= _capacity);
+	}
+}
+
+template<class K, class S, class KO, class H>
+void _HashTable<K,S,KO,H>::_setCtrl(roSize i, roInt8 h)
+{
+	_ctrl[i] = h;
+	if(i < _HashCtrl::groupWidth)
+		_ctrl[i + _capacity] = h;
+}
+
+template<class K, class S, class KO, class H>
+template<class Q>
+roSize _HashTable<K,S,KO,H>::_findOrPrepareInsert(const Q& key, bool& exist)
+{
+	const roSize hash = _mix(H::hash(key));
+	if(S* s = _size ? _find(key, hash) : NULL) {
+		exist = true;
+		return roSize(s - _slots);
+	}
+	exist = false;
+
+	roSize i = _capacity ? _findFirstNonFull(hash) : 0;
+
+	// Re-using a tombstone needs no growth
+	if(!_capacity || (_growthLeft == 0 && _ctrl[i] == _HashCtrl::empty)) {
+		// Rehash in place if it's the tombstones taking up the space, unless we are close to full
+		roSize newCapacity = _capacityFor(_size + 1);
+		if(newCapacity == _capacity && _size * 32 > _capacity * 25)
+			newCapacity *= 2;
+		if(!_rehash(newCapacity))
+			return roSize(-1);
+		i = _findFirstNonFull(hash);
+	}
+
+	if(_ctrl[i] == _HashCtrl::empty)
+		--_growthLeft;
+	_setCtrl(i, roInt8(hash & 0x7F));
+	++_size;
+	return i;
+}
+
+template<class K, class S, class KO, class H>
+void _HashTable<K,S,KO,H>::_eraseAt(roSize i)
+{
+	roAssert(_ctrl[i] >= 0);
+	_slots[i].~S();
+	_setCtrl(i, _HashCtrl::deleted);
+	--_size;
+}
+
+template<class K, class S, class KO, class H>
+Status _HashTable<K,S,KO,H>::_rehash(roSize newCapacity)
+{
+	roAssert(newCapacity >= _HashCtrl::groupWidth && (newCapacity & (newCapacity - 1)) == 0);
+	roAssert(newCapacity - newCapacity / 8 >= _size);
+
+	// Control bytes followed by the slots, in one allocation
+	const roSize ctrlBytes = (newCapacity + _HashCtrl::groupWidth + 15) & ~roSize(15);
+	roBytePtr mem = roMalloc(ctrlBytes + newCapacity * sizeof(S));
+	if(!mem) return Status::not_enough_memory;
+
+	roInt8* oldCtrl = _ctrl;
+	S* oldSlots = _slots;
+	roSize oldCapacity = _capacity;
+
+	_ctrl = mem.cast<roInt8>();
+	_slots = (S*)(mem.cast<roByte>() + ctrlBytes);
+	_capacity = newCapacity;
+	_growthLeft = newCapacity - newCapacity / 8 - _size;
+	memset(_ctrl, _HashCtrl::empty, newCapacity + _HashCtrl::groupWidth);
+
+	for(roSize i=0; i<oldCapacity; ++i) {
+		if(oldCtrl[i] < 0) continue;
+		const roSize hash = _mix(H::hash(KO::key(oldSlots[i])));
+		roSize j = _findFirstNonFull(hash);
+		_setCtrl(j, roInt8(hash & 0x7F));
+		new (&_slots[j]) S(std::move(oldSlots[i]));
+		oldSlots[i].~S();
+	}
+
+	roFree(oldCtrl);
+	return Status::ok;
+}
+
+
+// ----------------------------------------------------------------------
+
+template<class K, class V, class H>
+template<class KK, class VV>
+V* HashMap<K,V,H>::insert(KK&& key, VV&& value)
+{
+	bool exist;
+	roSize i = this->_findOrPrepareInsert(key, exist);
+	if(i == roSize(-1)) return NULL;
+
+	Entry* e = &this->_slots[i];
+	if(exist)
+		e->value = std::forward<VV>(value);
+	else
+		new (e) Entry(std::forward<KK>(key), std::forward<VV>(value));
+	return &e->value;
+}
+
+template<class K, class V, class H>
+template<class KK, class VV>
+V* HashMap<K,V,H>::insertUnique(KK&& key, VV&& value)
+{
+	bool exist;
+	roSize i = this->_findOrPrepareInsert(key, exist);
+	if(i == roSize(-1) || exist) return NULL;
+
+	Entry* e = &this->_slots[i];
+	new (e) Entry(std::forward<KK>(key), std::forward<VV>(value));
+	return &e->value;
+}
+
+template<class K, class V, class H>
+template<class KK>
+V& HashMap<K,V,H>::operator[](KK&& key)
+{
+	bool exist;
+	roSize i = this->_findOrPrepareInsert(key, exist);
+	roVerify(i != roSize(-1));
+
+	Entry* e = &this->_slots[i];
+	if(!exist)
+		new (e) Entry(std::forward<KK>(key), V());
+	return e->value;
+}
+
+template<class K, class V, class H>
+template<class Q>
+bool HashMap<K,V,H>::remove(const Q& key)
+{
+	Entry* e = this->_find(key);
+	if(!e) return false;
+	this->_eraseAt(roSize(e - this->_slots));
+	return true;
+}
+
+template<class K, class H>
+template<class KK>
+const K* HashSet<K,H>::insert(KK&& key, bool* inserted)
+{
+	bool exist;
+	roSize i = this->_findOrPrepareInsert(key, exist);
+	if(inserted) *inserted = false;
+	if(i == roSize(-1)) return NULL;
+
+	K* k = &this->_slots[i];
+	if(!exist) {
+		new (k) K(std::forward<KK>(key));
+		if(inserted) *inserted = true;
+	}
+	return k;
+}
+
+template<class K, class H>
+template<class Q>
+bool HashSet<K,H>::remove(const Q& key)
+{
+	const K* k = this->_find(key);
+	if(!k) return false;
+	this->_eraseAt(roSize(k - this->_slots));
+	return true;
+}
+
+}	// namespace ro
+
+#endif	// __roHashMap_inl__
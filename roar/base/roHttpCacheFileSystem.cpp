@@ -0,0 +1,887 @@
+#include "pch.h"
+#include "roHttpCacheFileSystem.h"
+#include "roAlgorithm.h"
+#include "roHashMap.h"
+#include "roHttpFileSystem.h"
+#include "roLinkList.h"
+#include "roLog.h"
+#include "roMutex.h"
+#include "roRawFileSystem.h"
+#include "roSha1.h"
+#include "roStopWatch.h"
+#include "roString.h"
+#include "roStringFormat.h"
+#include "roStringUtility.h"
+#include "roTaskPool.h"
+#include "roTypeCast.h"
+#include "../network/roHttp.h"
+#include <errno.h>
+#include <stdio.h>
+
+#if roOS_WIN
+#	include <direct.h>
+#else
+#	include <sys/stat.h>
+#endif
+
+namespace ro {
+
+static DefaultAllocator _allocator;
+
+struct HttpCacheEntry
+{
+	HttpCacheEntry() : size(0), lastUse(0) {}
+	String hash;		///< Sha1 of the body in hex, also the file name in the store
+	roUint64 size;
+	roUint64 lastUse;	///< Value of _HttpCache::clock when last stored or served
+	String etag;
+	String lastModified;
+};	// HttpCacheEntry
+
+struct _HttpCacheNode : public ListNode<_HttpCacheNode>
+{
+	String uri;
+	HttpCacheEntry entry;
+};	// _HttpCacheNode
+
+struct _HttpCache
+{
+	_HttpCache() : isOpen(false), maxSize(0), clock(0), tempCounter(0), storeSize(0), indexDirty(false), indexSaveTicks(0) { httpCacheResetStats(); }
+
+	Mutex mutex;
+	bool isOpen;
+	String directory;
+	roUint64 maxSize;
+	roUint64 clock;
+	roSize tempCounter;
+	HashMap<String, _HttpCacheNode*> entries;	///< Keyed by uri, the nodes are owned by lru
+	LinkList<_HttpCacheNode> lru;				///< The least recently used in front
+	HashMap<String, roSize> bodyRefs;			///< Number of uri referencing each body, keyed by hash
+	roUint64 storeSize;							///< Total size of the bodies, those shared by several uri count once
+	HttpCacheStats stats;
+
+	bool indexDirty;
+	roUint64 indexSaveTicks;	///< When the index was last written
+	Mutex saveMutex;			///< Serialize the index writes, done without locking mutex
+};	// _HttpCache
+
+static _HttpCache _cache;
+
+static const char _indexName[] = "index";
+static const char _indexSignature[] = "roHttpCache 1\n";
+static const double _indexSaveInterval = 5;	///< In seconds
+
+static bool _makeDir(const char* path)
+{
+#if roOS_WIN
+	return _mkdir(path) == 0 || errno == EEXIST;
+#else
+	return mkdir(path, 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+/// Rename and overwrite any existing one
+static bool _replaceFile(const char* from, const char* to)
+{
+#if roOS_WIN
+	::remove(to);
+#endif
+	return ::rename(from, to) == 0;
+}
+
+static bool _fileExist(const char* path)
+{
+	FILE* f = fopen(path, "rb");
+	if(f) fclose(f);
+	return f != NULL;
+}
+
+static void _toHex(String& str, const unsigned char* data, roSize size)
+{
+	static const char hex[] = "0123456789abcdef";
+	str.resize(size * 2);
+	for(roSize i=0; i<size; ++i) {
+		str[i * 2 + 0] = hex[data[i] >> 4];
+		str[i * 2 + 1] = hex[data[i] & 0x0F];
+	}
+}
+
+static bool _isHash(const char* name)
+{
+	roSize i = 0;
+	for(; name[i]; ++i) {
+		if(!roIsDigit(name[i]) && !(name[i] >= 'a' && name[i] <= 'f'))
+			return false;
+	}
+	return i == 40;
+}
+
+static Status _bodyPath(String& path, const String& hash)
+{
+	path.clear();
+	return strFormat(path, "{}/{}", _cache.directory.c_str(), hash.c_str());
+}
+
+
+// ----------------------------------------------------------------------
+// Entries, the mutex should be locked
+
+static bool _isReferenced(const String& hash)
+{
+	return _cache.bodyRefs.find(hash) != NULL;
+}
+
+static void _addBodyRef(const HttpCacheEntry& e)
+{
+	roSize& refCount = _cache.bodyRefs[e.hash];
+	if(refCount++ == 0)
+		_cache.storeSize += e.size;
+}
+
+/// Remove the body from the store when no more uri reference it
+static void _releaseBodyRef(const HttpCacheEntry& e)
+{
+	roSize* refCount = _cache.bodyRefs.find(e.hash);
+	if(!refCount || --(*refCount) > 0)
+		return;
+
+	_cache.bodyRefs.remove(e.hash);
+	_cache.storeSize -= e.size;
+
+	String path;
+	if(_bodyPath(path, e.hash))
+		::remove(path.c_str());
+}
+
+static _HttpCacheNode* _findEntry(const String& uri)
+{
+	_HttpCacheNode** n = _cache.entries.find(uri);
+	return n ? *n : NULL;
+}
+
+static void _touchEntry(_HttpCacheNode& n)
+{
+	n.entry.lastUse = ++_cache.clock;
+	_cache.lru.moveBack(n);
+	_cache.indexDirty = true;
+}
+
+static void _removeEntry(_HttpCacheNode* n)
+{
+	_releaseBodyRef(n->entry);
+	_cache.entries.remove(n->uri);
+	n->destroyThis();
+	_cache.indexDirty = true;
+}
+
+/// Forget all entries, without touching the store
+static void _clearEntries()
+{
+	_cache.lru.destroyAll();
+	_cache.entries.clear();
+	_cache.bodyRefs.clear();
+	_cache.storeSize = 0;
+}
+
+static void _evict()
+{
+	while(_cache.storeSize > _cache.maxSize && !_cache.lru.isEmpty()) {
+		_removeEntry(&_cache.lru.front());
+		++_cache.stats.evictCount;
+	}
+
+	_cache.stats.size = _cache.storeSize;
+}
+
+
+// ----------------------------------------------------------------------
+// Index
+
+/// Serialize the index in the lru order, the mutex should be locked
+static Status _snapshotIndex(String& path, String& str)
+{
+	Status st = str.assign(_indexSignature); if(!st) return st;
+	for(const _HttpCacheNode* n = _cache.lru.begin(); n != _cache.lru.end(); n = n->next()) {
+		const HttpCacheEntry& v = n->entry;
+		st = strFormat(str, "{}\t{}\t{}\t{}\t{}\t{}\n",
+			v.hash.c_str(), v.size, v.lastUse, v.etag.c_str(), v.lastModified.c_str(), n->uri.c_str()
+		);
+		if(!st) return st;
+	}
+
+	st = strFormat(path, "{}/{}", _cache.directory.c_str(), _indexName); if(!st) return st;
+
+	_cache.indexDirty = false;
+	_cache.indexSaveTicks = ticksSinceProgramStatup();
+	return Status::ok;
+}
+
+static Status _writeIndex(const String& path, const String& str)
+{
+	String tempPath;
+	Status st = strFormat(tempPath, "{}.part", path.c_str()); if(!st) return st;
+
+	FILE* f = fopen(tempPath.c_str(), "wb");
+	if(!f) return Status::file_open_error;
+	bool ok = fwrite(str.c_str(), 1, str.size(), f) == str.size();
+	ok &= fclose(f) == 0;
+
+	// Replace the old index only when the new one is complete
+	if(!ok || !_replaceFile(tempPath.c_str(), path.c_str())) {
+		::remove(tempPath.c_str());
+		return Status::file_write_error;
+	}
+
+	return Status::ok;
+}
+
+/// The mutex should NOT be locked, the file is written outside of it such that
+/// opening and reading other files are not blocked by the disk.
+/// With close, the entries are cleared in the same critical section as the snapshot.
+static Status _saveIndex(bool close=false)
+{
+	ScopeLock<Mutex> saveLock(_cache.saveMutex);
+
+	String path, str;
+	Status st;
+	{	ScopeLock<Mutex> lock(_cache.mutex);
+		if(!_cache.isOpen) return Status::not_initialized;
+
+		st = _snapshotIndex(path, str);
+		if(close) {
+			_clearEntries();
+			_cache.isOpen = false;
+		}
+		if(!st) return st;
+	}
+
+	st = _writeIndex(path, str);
+	if(!st && !close) {
+		ScopeLock<Mutex> lock(_cache.mutex);
+		_cache.indexDirty = true;	// Retry next time
+	}
+	return st;
+}
+
+/// Stores only mark the index dirty, it's written at most every _indexSaveInterval, the mutex should be locked
+static bool _isIndexSaveDue()
+{
+	return _cache.indexDirty &&
+		ticksToSeconds(ticksSinceProgramStatup() - _cache.indexSaveTicks) >= _indexSaveInterval;
+}
+
+/// Split the line by tab, return false if there are not exactly count fields
+static bool _splitFields(char* line, char** fields, roSize count)
+{
+	for(roSize i=0; i<count; ++i) {
+		fields[i] = line;
+		char* tab = roStrChr(line, '\t');
+		if(i == count - 1)
+			return tab == NULL;
+		if(!tab)
+			return false;
+		*tab = '\0';
+		line = tab + 1;
+	}
+	return true;
+}
+
+/// The mutex should be locked
+static Status _loadIndex()
+{
+	_clearEntries();
+	_cache.clock = 0;
+	_cache.indexDirty = false;
+	_cache.indexSaveTicks = ticksSinceProgramStatup();
+
+	String path;
+	Status st = strFormat(path, "{}/{}", _cache.directory.c_str(), _indexName); if(!st) return st;
+
+	void* file = NULL;
+	if(!rawFileSystemOpenFile(path.c_str(), file))
+		return Status::ok;	// A new cache
+
+	roUint64 size = 0;
+	String str;
+	st = rawFileSystemSize(file, size);
+	if(st) st = str.resize(num_cast<roSize>(size));
+	if(st) st = rawFileSystemAtomicRead(file, str.c_str(), size);
+	rawFileSystemCloseFile(file);
+	if(!st) return st;
+
+	if(roStrStr(str.c_str(), _indexSignature) != str.c_str()) {
+		roLog("warn", "Http cache index '%s' is not recognized, start over\n", path.c_str());
+		return Status::ok;
+	}
+
+	Array<_HttpCacheNode*> nodes;
+	char* line = str.c_str() + sizeof(_indexSignature) - 1;
+	while(char* end = roStrChr(line, '\n')) {
+		*end = '\0';
+
+		char* f[6];
+		HttpCacheEntry e;
+		if(_splitFields(line, f, roCountof(f)) && _isHash(f[0]) &&
+			roStrTo(f[1], e.size) && roStrTo(f[2], e.lastUse) &&
+			!_cache.entries.find(String(f[5])))
+		{
+			_HttpCacheNode* n = new _HttpCacheNode;
+			n->uri = f[5];
+			n->entry = std::move(e);
+			n->entry.hash = f[0];
+			n->entry.etag = f[3];
+			n->entry.lastModified = f[4];
+			_cache.clock = roMaxOf2(_cache.clock, n->entry.lastUse);
+			_cache.entries.insert(String(n->uri), n);
+			_addBodyRef(n->entry);
+			nodes.pushBack(n);
+		}
+
+		line = end + 1;
+	}
+
+	// The index is saved in lru order, but sort anyway for those written by an older version
+	struct Less { bool operator()(const _HttpCacheNode* a, const _HttpCacheNode* b) const {
+		return a->entry.lastUse < b->entry.lastUse;
+	}};
+	roQuickSort(nodes.begin(), nodes.end(), Less());
+	for(roSize i=0; i<nodes.size(); ++i)
+		_cache.lru.pushBack(*nodes[i]);
+
+	return Status::ok;
+}
+
+/// Remove the temporary files and the bodies not in the index, left by a crash for instance.
+/// The mutex should be locked
+static void _removeOrphans()
+{
+	void* dir = rawFileSystemOpenDir(_cache.directory.c_str());
+	Array<String> toRemove;
+
+	while(dir) {
+		const char* name = rawFileSystemDirName(dir);
+		const roSize len = roStrLen(name);
+		const bool isTemp = len > 5 && roStrCmp(name + len - 5, ".part") == 0;
+
+		if(isTemp || (_isHash(name) && !_isReferenced(String(name))))
+			toRemove.pushBack(String(name));
+
+		if(!rawFileSystemNextDir(dir))
+			break;
+	}
+	rawFileSystemCloseDir(dir);
+
+	for(roSize i=0; i<toRemove.size(); ++i) {
+		String path;
+		if(strFormat(path, "{}/{}", _cache.directory.c_str(), toRemove[i].c_str()))
+			::remove(path.c_str());
+	}
+}
+
+
+// ----------------------------------------------------------------------
+
+Status httpCacheInit(const char* directory, roUint64 maxSize)
+{
+	if(!directory || directory[0] == '\0') return Status::invalid_parameter;
+
+	ScopeLock<Mutex> lock(_cache.mutex);
+	if(_cache.isOpen) return Status::already_initialized;
+
+	Status st = _cache.directory.assign(directory); if(!st) return st;
+	if(!_makeDir(directory)) {
+		roLog("error", "Unable to create http cache directory '%s'\n", directory);
+		return Status::file_access_denied;
+	}
+
+	st = _loadIndex();
+	if(!st) return st;
+
+	_cache.maxSize = maxSize;
+	_cache.tempCounter = 0;
+	_cache.isOpen = true;
+
+	_removeOrphans();
+	_evict();
+	return Status::ok;
+}
+
+Status httpCacheFlush()
+{
+	return _saveIndex();
+}
+
+void httpCacheClose()
+{
+	_saveIndex(true);
+}
+
+void httpCacheClear()
+{
+	{	ScopeLock<Mutex> lock(_cache.mutex);
+		if(!_cache.isOpen) return;
+
+		_clearEntries();
+		_removeOrphans();
+		_cache.stats.size = 0;
+	}
+	_saveIndex();
+}
+
+bool httpCacheIsOpen()
+{
+	return _cache.isOpen;
+}
+
+HttpCacheStats httpCacheStats()
+{
+	ScopeLock<Mutex> lock(_cache.mutex);
+	HttpCacheStats ret = _cache.stats;
+	ret.entryCount = _cache.entries.size();
+	return ret;
+}
+
+void httpCacheResetStats()
+{
+	ScopeLock<Mutex> lock(_cache.mutex);
+	roUint64 size = _cache.stats.size;
+	roMemZeroStruct(_cache.stats);
+	_cache.stats.size = size;
+}
+
+
+// ----------------------------------------------------------------------
+
+enum HttpCacheFileState {
+	HttpCacheFile_Revalidating,
+	HttpCacheFile_FromCache,
+	HttpCacheFile_FromNetwork,
+	HttpCacheFile_Error,
+};
+
+struct HttpCacheFile
+{
+	HttpCacheFile() : state(HttpCacheFile_Revalidating), httpFile(NULL), rawFile(NULL), storeFile(NULL), stored(0), ended(false), takenCount(0), closed(false) {}
+
+	HttpCacheFileState state;
+	Status status;
+	void* httpFile;
+	void* rawFile;
+	String uri;
+	HttpCacheEntry cached;	///< A copy of the index entry, hash is empty if not cached
+
+	// Storing the body from the network while it's being read
+	FILE* storeFile;
+	String storePath;
+	Sha1 sha1;
+	roUint64 stored;
+	bool ended;
+	String etag;
+	String lastModified;
+
+	roSize takenCount;	///< Number of buffers taken but not yet given back
+	bool closed;		///< Closed while some buffers are still taken
+};	// HttpCacheFile
+
+static Status _serveFromCache(HttpCacheFile& f, bool stale)
+{
+	if(f.httpFile) {
+		httpFileSystemCloseFile(f.httpFile);
+		f.httpFile = NULL;
+	}
+
+	ScopeLock<Mutex> lock(_cache.mutex);
+
+	String path;
+	Status st = _bodyPath(path, f.cached.hash);
+	if(st) st = rawFileSystemOpenFile(path.c_str(), f.rawFile);
+
+	_HttpCacheNode* n = _findEntry(f.uri);
+	if(!st) {
+		// Removed behind our back, forget about it
+		if(n && n->entry.hash == f.cached.hash)
+			_removeEntry(n);
+		f.state = HttpCacheFile_Error;
+		return f.status = st;
+	}
+
+	if(n)
+		_touchEntry(*n);
+	++(stale ? _cache.stats.staleHitCount : _cache.stats.hitCount);
+
+	f.state = HttpCacheFile_FromCache;
+	return f.status = Status::ok;
+}
+
+static void _beginStore(HttpCacheFile& f, const char* header)
+{
+	HttpResponseHeader response;
+	response.string = header;
+
+	String cacheControl;
+	if(response.getField(HttpResponseHeader::HeaderField::CacheControl, cacheControl) && roStrStr(cacheControl.c_str(), "no-store"))
+		return;
+
+	// Without a validator it can never be revalidated
+	response.getField(HttpResponseHeader::HeaderField::ETag, f.etag);
+	response.getField(HttpResponseHeader::HeaderField::LastModified, f.lastModified);
+	if(f.etag.isEmpty() && f.lastModified.isEmpty())
+		return;
+
+	ScopeLock<Mutex> lock(_cache.mutex);
+	if(!_cache.isOpen || !strFormat(f.storePath, "{}/{}.part", _cache.directory.c_str(), ++_cache.tempCounter))
+		return;
+
+	f.storeFile = fopen(f.storePath.c_str(), "wb");
+}
+
+static void _abortStore(HttpCacheFile& f)
+{
+	if(!f.storeFile) return;
+	fclose(f.storeFile);
+	f.storeFile = NULL;
+	::remove(f.storePath.c_str());
+}
+
+static void _storeData(HttpCacheFile& f, const void* data, roUint64 size)
+{
+	if(!f.storeFile || size == 0) return;
+
+	if(fwrite(data, 1, num_cast<size_t>(size), f.storeFile) != size) {
+		_abortStore(f);
+		return;
+	}
+	f.sha1.update(data, num_cast<size_t>(size));
+	f.stored += size;
+}
+
+/// Return true if the index should be saved, which is done after releasing the mutex
+static bool _commitStore(HttpCacheFile& f)
+{
+	if(fclose(f.storeFile) != 0) {
+		f.storeFile = NULL;
+		::remove(f.storePath.c_str());
+		return false;
+	}
+	f.storeFile = NULL;
+
+	unsigned char digest[20];
+	f.sha1.final(digest);
+	String hash;
+	_toHex(hash, digest, sizeof(digest));
+
+	ScopeLock<Mutex> lock(_cache.mutex);
+
+	// The same body may be stored already, under another uri
+	String path;
+	bool ok = _cache.isOpen && _bodyPath(path, hash);
+	if(ok && _fileExist(path.c_str()))
+		::remove(f.storePath.c_str());
+	else if(!ok || !_replaceFile(f.storePath.c_str(), path.c_str())) {
+		::remove(f.storePath.c_str());
+		return false;
+	}
+
+	_HttpCacheNode* n = _findEntry(f.uri);
+	if(!n) {
+		n = new _HttpCacheNode;
+		n->uri = f.uri;
+		_cache.entries.insert(String(f.uri), n);
+	}
+
+	// Add the new reference first, the old body is kept if it's the same
+	HttpCacheEntry e;
+	e.hash = hash;
+	e.size = f.stored;
+	e.etag = f.etag;
+	e.lastModified = f.lastModified;
+	_addBodyRef(e);
+	if(!n->entry.hash.isEmpty())
+		_releaseBodyRef(n->entry);
+
+	n->entry = std::move(e);
+	_touchEntry(*n);
+	++_cache.stats.storeCount;
+
+	_evict();
+	return _isIndexSaveDue();
+}
+
+/// Decide where to read from once the response arrived, return false if not yet
+static bool _resolve(HttpCacheFile& f)
+{
+	if(f.state != HttpCacheFile_Revalidating)
+		return true;
+
+	int code = 0;
+	const char* header = NULL;
+	Status st = httpFileSystemResponse(f.httpFile, code, header);
+	if(st == Status::in_progress)
+		return false;
+
+	if(!st) {
+		if(f.cached.hash.isEmpty()) {
+			f.state = HttpCacheFile_Error;
+			f.status = st;
+		}
+		else
+			_serveFromCache(f, true);
+		return true;
+	}
+
+	if(code == 304 && !f.cached.hash.isEmpty()) {
+		_serveFromCache(f, false);
+		return true;
+	}
+
+	f.state = HttpCacheFile_FromNetwork;
+	{	ScopeLock<Mutex> lock(_cache.mutex);
+		++_cache.stats.missCount;
+	}
+
+	if(code == 200 || code == 206)
+		_beginStore(f, header);
+	return true;
+}
+
+static Status _blockTillResolved(HttpCacheFile& f)
+{
+	while(!_resolve(f))
+		TaskPool::yield();
+	return f.state == HttpCacheFile_Error ? f.status : Status::ok;
+}
+
+static void _countBytes(HttpCacheFile& f, roUint64 size)
+{
+	ScopeLock<Mutex> lock(_cache.mutex);
+	if(f.state == HttpCacheFile_FromCache)
+		_cache.stats.bytesFromCache += size;
+	else
+		_cache.stats.bytesFromNetwork += size;
+}
+
+Status httpCacheFileSystemOpenFile(const char* uri, void*& outFile)
+{
+	if(!uri) return Status::invalid_parameter;
+
+	AutoPtr<HttpCacheFile> f = _allocator.newObj<HttpCacheFile>();
+	Status st = f->uri.assign(uri); if(!st) return st;
+
+	{	ScopeLock<Mutex> lock(_cache.mutex);
+		if(_cache.isOpen) {
+			if(const _HttpCacheNode* n = _findEntry(f->uri))
+				f->cached = n->entry;
+		}
+	}
+
+	String condition;
+	if(!f->cached.etag.isEmpty())
+		strFormat(condition, "If-None-Match: {}\r\n", f->cached.etag.c_str());
+	if(!f->cached.lastModified.isEmpty())
+		strFormat(condition, "If-Modified-Since: {}\r\n", f->cached.lastModified.c_str());
+
+	st = httpFileSystemOpenFileWithHeader(uri, condition.c_str(), f->httpFile);
+	if(!st) {
+		f->httpFile = NULL;
+		if(f->cached.hash.isEmpty())
+			return st;
+
+		// Host cannot be resolved for instance
+		st = _serveFromCache(*f, true);
+		if(!st) return st;
+	}
+
+	outFile = f.unref();
+	return Status::ok;
+}
+
+bool httpCacheFileSystemReadWillBlock(void* file, roUint64 size)
+{
+	HttpCacheFile* f = static_cast<HttpCacheFile*>(file);
+	if(!f) return false;
+
+	if(f->state == HttpCacheFile_Revalidating) {
+		httpFileSystemReadWillBlock(f->httpFile, size);
+		if(!_resolve(*f))
+			return true;
+	}
+
+	switch(f->state) {
+	case HttpCacheFile_FromCache:	return rawFileSystemReadWillBlock(f->rawFile, size);
+	case HttpCacheFile_FromNetwork:	return httpFileSystemReadWillBlock(f->httpFile, size);
+	default:						return false;
+	}
+}
+
+Status httpCacheFileSystemRead(void* file, void* buffer, roUint64 size, roUint64& bytesRead)
+{
+	bytesRead = 0;
+	HttpCacheFile* f = static_cast<HttpCacheFile*>(file);
+	if(!f) return Status::invalid_parameter;
+
+	Status st = _blockTillResolved(*f); if(!st) return st;
+
+	if(f->state == HttpCacheFile_FromCache)
+		st = rawFileSystemRead(f->rawFile, buffer, size, bytesRead);
+	else {
+		st = httpFileSystemRead(f->httpFile, buffer, size, bytesRead);
+		_storeData(*f, buffer, bytesRead);
+		f->ended |= (st == Status::file_ended);
+	}
+
+	_countBytes(*f, bytesRead);
+	return st;
+}
+
+Status httpCacheFileSystemAtomicRead(void* file, void* buffer, roUint64 size)
+{
+	roUint64 bytesRead = 0;
+	Status st = httpCacheFileSystemRead(file, buffer, size, bytesRead);
+	if(!st) return st;
+	if(bytesRead < size) return Status::file_ended;
+	return st;
+}
+
+Status httpCacheFileSystemSize(void* file, roUint64& bytes)
+{
+	HttpCacheFile* f = static_cast<HttpCacheFile*>(file);
+	if(!f) return Status::invalid_parameter;
+
+	if(!_resolve(*f)) return Status::in_progress;
+
+	switch(f->state) {
+	case HttpCacheFile_FromCache:	return rawFileSystemSize(f->rawFile, bytes);
+	case HttpCacheFile_FromNetwork:	return httpFileSystemSize(f->httpFile, bytes);
+	default:						return f->status;
+	}
+}
+
+Status httpCacheFileSystemSeek(void* file, roInt64 offset, FileSystem::SeekOrigin origin)
+{
+	HttpCacheFile* f = static_cast<HttpCacheFile*>(file);
+	if(!f) return Status::invalid_parameter;
+
+	Status st = _blockTillResolved(*f); if(!st) return st;
+
+	if(f->state == HttpCacheFile_FromCache)
+		return rawFileSystemSeek(f->rawFile, offset, origin);
+
+	// Not reading from begin to end anymore
+	_abortStore(*f);
+	return httpFileSystemSeek(f->httpFile, offset, origin);
+}
+
+void httpCacheFileSystemCloseFile(void* file)
+{
+	HttpCacheFile* f = static_cast<HttpCacheFile*>(file);
+	if(!f) return;
+
+	if(f->storeFile) {
+		roUint64 size = 0;
+		if(f->ended || (httpFileSystemSize(f->httpFile, size) && size == f->stored)) {
+			if(_commitStore(*f))
+				_saveIndex();
+		}
+		else
+			_abortStore(*f);
+	}
+
+	if(f->httpFile) httpFileSystemCloseFile(f->httpFile);
+	if(f->rawFile) rawFileSystemCloseFile(f->rawFile);
+	f->httpFile = f->rawFile = NULL;
+
+	// The taken buffers still need f->state to know where to give them back
+	f->closed = true;
+	if(f->takenCount == 0)
+		_allocator.deleteObj(f);
+}
+
+roBytePtr httpCacheFileSystemGetBuffer(void* file, roUint64 requestSize, roUint64& readableSize)
+{
+	readableSize = 0;
+	HttpCacheFile* f = static_cast<HttpCacheFile*>(file);
+	if(!f || !_blockTillResolved(*f)) return NULL;
+
+	roBytePtr ret;
+	if(f->state == HttpCacheFile_FromCache)
+		ret = rawFileSystemGetBuffer(f->rawFile, requestSize, readableSize);
+	else {
+		ret = httpFileSystemGetBuffer(f->httpFile, requestSize, readableSize);
+		_storeData(*f, ret, readableSize);
+	}
+
+	_countBytes(*f, readableSize);
+	return ret;
+}
+
+void httpCacheFileSystemTakeBuffer(void* file)
+{
+	HttpCacheFile* f = static_cast<HttpCacheFile*>(file);
+	if(!f) return;
+
+	if(f->state == HttpCacheFile_FromCache)
+		rawFileSystemTakeBuffer(f->rawFile);
+	else if(f->state == HttpCacheFile_FromNetwork)
+		httpFileSystemTakeBuffer(f->httpFile);
+	else
+		return;
+
+	++f->takenCount;
+}
+
+void httpCacheFileSystemUntakeBuffer(void* file, roBytePtr buf)
+{
+	HttpCacheFile* f = static_cast<HttpCacheFile*>(file);
+	if(!f) return;
+
+	if(f->state == HttpCacheFile_FromCache)
+		rawFileSystemUntakeBuffer(f->rawFile, buf);
+	else
+		httpFileSystemUntakeBuffer(f->httpFile, buf);
+
+	if(f->takenCount == 0) return;
+	if(--f->takenCount == 0 && f->closed)
+		_allocator.deleteObj(f);
+}
+
+void* httpCacheFileSystemOpenDir(const char* uri)
+{
+	return httpFileSystemOpenDir(uri);
+}
+
+bool httpCacheFileSystemNextDir(void* dir)
+{
+	return httpFileSystemNextDir(dir);
+}
+
+const char* httpCacheFileSystemDirName(void* dir)
+{
+	return httpFileSystemDirName(dir);
+}
+
+void httpCacheFileSystemCloseDir(void* dir)
+{
+	httpFileSystemCloseDir(dir);
+}
+
+
+// ----------------------------------------------------------------------
+
+FileSystem httpCacheFileSystem = {
+	httpCacheFileSystemOpenFile,
+	httpCacheFileSystemReadWillBlock,
+	httpCacheFileSystemRead,
+	httpCacheFileSystemAtomicRead,
+	httpCacheFileSystemSize,
+	httpCacheFileSystemSeek,
+	httpCacheFileSystemCloseFile,
+	httpCacheFileSystemGetBuffer,
+	httpCacheFileSystemTakeBuffer,
+	httpCacheFileSystemUntakeBuffer,
+	httpCacheFileSystemOpenDir,
+	httpCacheFileSystemNextDir,
+	httpCacheFileSystemDirName,
+	httpCacheFileSystemCloseDir
+};
+
+}	// namespace ro
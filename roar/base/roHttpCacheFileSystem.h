@@ -0,0 +1,60 @@
+#ifndef __roHttpCacheFileSystem_h__
+#define __roHttpCacheFileSystem_h__
+
+#include "roFileSystem.h"
+
+namespace ro {
+
+/// A persistent cache in front of httpFileSystem.
+/// Bodies are kept in a content addressed store (files named by their sha1) in the cache directory,
+/// an index file maps each uri to it's body, together with the ETag and Last-Modified of the response.
+/// Every open revalidates with a conditional GET, a 304 Not Modified is then served from the store
+/// by rawFileSystem; if the server cannot be reached at all, the cached body is served as is.
+/// A response body is stored when it has been read from the beginning to the end without seek,
+/// and only if it has a validator and is not marked no-store.
+/// The least recently used bodies are removed when the store exceed maxSize.
+/// The index is written at most every few seconds after a store, and by httpCacheFlush() and httpCacheClose();
+/// bodies stored after the last write are treated as orphans and removed by the next httpCacheInit().
+Status		httpCacheInit				(const char* directory, roUint64 maxSize);
+Status		httpCacheFlush				();		///< Save the index now, it's also done by httpCacheClose()
+void		httpCacheClose				();
+void		httpCacheClear				();		///< Remove all cached bodies
+bool		httpCacheIsOpen				();
+
+struct HttpCacheStats
+{
+	roSize		entryCount;
+	roUint64	size;				///< Total size of the bodies in the store
+	roSize		hitCount;			///< Served from the store after a 304
+	roSize		staleHitCount;		///< Served from the store since the server cannot be reached
+	roSize		missCount;			///< Served from the network
+	roSize		storeCount;
+	roSize		evictCount;
+	roUint64	bytesFromCache;
+	roUint64	bytesFromNetwork;
+};
+
+HttpCacheStats httpCacheStats		();
+void		httpCacheResetStats		();
+
+Status		httpCacheFileSystemOpenFile		(const char* uri, void*& outFile);
+bool		httpCacheFileSystemReadWillBlock(void* file, roUint64 bytesToRead);
+Status		httpCacheFileSystemRead			(void* file, void* buffer, roUint64 bytesToRead, roUint64& bytesRead);
+Status		httpCacheFileSystemAtomicRead	(void* file, void* buffer, roUint64 bytesToRead);
+Status		httpCacheFileSystemSize			(void* file, roUint64& bytes);
+Status		httpCacheFileSystemSeek			(void* file, roInt64 offset, FileSystem::SeekOrigin origin);
+void		httpCacheFileSystemCloseFile	(void* file);
+roBytePtr	httpCacheFileSystemGetBuffer	(void* file, roUint64 requestSize, roUint64& readableSize);
+void		httpCacheFileSystemTakeBuffer	(void* file);
+void		httpCacheFileSystemUntakeBuffer	(void* file, roBytePtr buf);
+void*		httpCacheFileSystemOpenDir		(const char* uri);
+bool		httpCacheFileSystemNextDir		(void* dir);
+const char*	httpCacheFileSystemDirName		(void* dir);
+void		httpCacheFileSystemCloseDir		(void* dir);
+
+/// The default fileSystem use it for http uri after httpCacheInit()
+extern FileSystem httpCacheFileSystem;
+
+}	// namespace ro
+
+#endif	// __roHttpCacheFileSystem_h__
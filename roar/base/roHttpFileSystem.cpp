@@ -9,6 +9,7 @@
 #include "roTaskPool.h"
 #include "roTypeCast.h"
 #include "../math/roMath.h"
+#include "../network/roHttp.h"
 #include "../network/roSocket.h"
 #include "../platform/roPlatformHeaders.h"
 #include <stdio.h>
@@ -31,7 +32,7 @@ static String _encodeUrl(const char* uri)
 
 	do {
 		bool converted = false;
-		for(roSize i=0; i <= sizeof(_decode); ++i) {
+		for(roSize i=0; i < sizeof(_decode) - 1; ++i) {
 			if(*uri == _decode[i]) {
 				for(const char* s = _encode[i]; *s != '\0'; ++s)
 					*(buf++) = *s;
@@ -59,6 +60,37 @@ enum HttpState {
 	State_DataEnd,
 };
 
+HttpFileSystemOptions httpFileSystemOptions = {
+	4,				// maxConnections
+	256 * 1024,		// blockSize
+	8,				// readAheadBlocks
+};
+
+/// One connection of the parallel range download, it fetches one block at a time,
+/// and keeps the connection for the next block if the server allows.
+struct HttpRangeFetch
+{
+	HttpRangeFetch() : state(State_DataEnd), connected(false), keepAlive(false), reused(false), begin(0), end(0), received(0), requestSent(0) {}
+	BsdSocket socket;
+	HttpState state;		///< State_SendRequest, State_ReadingResponse, State_ReadReady, or State_DataEnd when idle
+	bool connected;
+	bool keepAlive;
+	bool reused;			///< The request is sent over a kept alive connection, which the server may have closed already
+	roUint64 begin, end;	///< The range being fetched
+	roUint64 received;		///< Bytes of the body received
+	roSize requestSent;
+	String request;
+	String header;			///< The response header received so far
+};
+
+struct HttpRangeBlock
+{
+	roUint64 begin, end;
+	roByte* data;
+	roUint64 received;		///< Bytes received from begin
+	HttpRangeFetch* fetch;	///< NULL if not requested yet, the fetch drops the data if the block is dropped
+};
+
 /// Notes on http 1.0 protocol:
 /// Http 1.0 protocol contains an optional "Content-Length" attribute, but
 /// if it's not present, the end of the data will indicated by a graceful disconnection.
@@ -69,8 +101,18 @@ enum HttpState {
 /// http://curl.haxx.se/libcurl/competitors.html
 struct HttpStream
 {
-	HttpStream() : buffer(nullptr) {}
-	~HttpStream() { defaultAllocator.free(buffer); }
+	HttpStream() : buffer(nullptr), responseCode(0), ranged(false), fileSize(0), readPos(0) {}
+	~HttpStream()
+	{
+		defaultAllocator.free(buffer);
+		for(roSize i=0; i<fetches.size(); ++i)
+			defaultAllocator.deleteObj(fetches[i]);
+		for(roSize i=0; i<blocks.size(); ++i)
+			defaultAllocator.free(blocks[i].data);
+		for(roSize i=0; i<spareBlocks.size(); ++i)
+			defaultAllocator.free(spareBlocks[i]);
+	}
+
 	BsdSocket socket;
 	char* buffer;
 	HttpState state;
@@ -87,6 +129,20 @@ struct HttpStream
 	roSize lastReadSize;		///< Size of readable returned by httpFileSystemGetBuffer()
 
 	String getCmd;
+	String extraHeader;		///< Additional fields of the first request
+	int responseCode;		///< Of the first response, 0 if not received yet
+	String responseHeader;
+
+	// Parallel range download, see HttpFileSystemOptions
+	bool ranged;					///< The server replied 206, read from the blocks instead of buffer
+	roUint64 fileSize;
+	roUint64 readPos;				///< Position in the file of the next read
+	Array<HttpRangeBlock> blocks;	///< Consecutive blocks, starting from the one containing readPos
+	Array<HttpRangeFetch*> fetches;
+	Array<roByte*> spareBlocks;
+	SockAddr addr;
+	String host;
+	String path;
 
 	StopWatch stopWatch;
 };
@@ -120,11 +176,26 @@ static Status prepareForRead(HttpStream& s, roUint64 readSize)
 	return s.status = Status::ok;
 }
 
-static bool _parseUri(const char* uri, SockAddr& addr, Array<char>& host, String& requestStr)
+static Status _formatGet(String& str, const String& path, const String& host, roUint64 begin, roUint64 end, const char* extraHeader="")
+{
+	const char getFmt[] =
+		"GET {} HTTP/1.1\r\n"
+		"Host: {}\r\n"	// Required for http 1.1
+		"User-Agent: The Roar Engine\r\n"
+		"Range: bytes={}-{}\r\n"
+		"{}"
+		"\r\n";
+
+	str.clear();
+	return strFormat(str, getFmt, path.c_str(), host.c_str(), begin, end - 1, extraHeader);
+}
+
+static bool _parseUri(const char* uri, SockAddr& addr, String& hostStr, String& pathStr)
 {
 	String _uri = _encodeUrl(uri);
 
 	// Parse http://host
+	Array<char> host;
 	Array<char> path;
 	host.resize(_uri.size(), 0);
 	path.resize(_uri.size(), 0);
@@ -151,16 +222,8 @@ static bool _parseUri(const char* uri, SockAddr& addr, Array<char>& host, String
 		return false;
 	}
 
-	const char getFmt[] =
-		"GET {} HTTP/1.1\r\n"
-		"Host: {}\r\n"	// Required for http 1.1
-		"User-Agent: The Roar Engine\r\n"
-//		"Range: bytes=0-64\r\n"
-		"\r\n";
-
-	requestStr.clear();
-	strFormat(requestStr, getFmt, path.begin(), host.begin());
-
+	hostStr = host.begin();
+	pathStr = path.begin();
 	return true;
 }
 
@@ -178,13 +241,16 @@ static Status _makeConnection(HttpStream& s, const char* uri)
 	s.userReadCount = 0;
 	s.lastReadSize = 0;
 
-	SockAddr addr;
-	Array<char> host;
-	if(!_parseUri(uri, addr, host, s.getCmd)) {
+	if(!_parseUri(uri, s.addr, s.host, s.path)) {
 		s.state = State_Error;
 		return s.status = Status::http_invalid_uri;
 	}
 
+	// Ask for the first block only, a server supporting range replies 206 and
+	// the rest will be downloaded in parallel, otherwise we get the whole file with 200
+	s.status = _formatGet(s.getCmd, s.path, s.host, 0, roMaxOf2(httpFileSystemOptions.blockSize, roSize(1)), s.extraHeader.c_str());
+	if(!s.status) return s.status;
+
 	// Create socket
 	s.status = s.socket.create(BsdSocket::TCP);
 	if(!s.status) return s.status;
@@ -193,9 +259,9 @@ static Status _makeConnection(HttpStream& s, const char* uri)
     if (!s.status) return s.status;
 
 	// Make connection
-	s.status = s.socket.connect(addr);
+	s.status = s.socket.connect(s.addr);
 	if(BsdSocket::isError(s.status)) {
-		roLog("error", "Connection to %s failed\n", host.begin());
+		roLog("error", "Connection to %s failed\n", s.host.c_str());
 		s.state = State_Error;
 		return s.status = Status::http_error;
 	}
@@ -224,11 +290,397 @@ static Status _readFromSocket(HttpStream& s, roSize size, roSize* bytesRead=NULL
 	return Status::ok;
 }
 
+// ----------------------------------------------------------------------
+// Parallel range download
+
+static bool _isKeepAlive(const HttpResponseHeader& response)
+{
+	if(response.cmpFieldNoCase(HttpResponseHeader::HeaderField::Connection, "close"))
+		return false;
+	if(response.cmpFieldNoCase(HttpResponseHeader::HeaderField::Connection, "keep-alive"))
+		return true;
+
+	RangedString version;
+	return response.getField(HttpResponseHeader::HeaderField::Version, version) && version == "1.1";
+}
+
+static HttpRangeBlock* _rangeBlockOf(HttpStream& s, const HttpRangeFetch& f)
+{
+	for(roSize i=0; i<s.blocks.size(); ++i) {
+		if(s.blocks[i].fetch == &f)
+			return &s.blocks[i];
+	}
+	return NULL;
+}
+
+static void _rangeFetchClose(HttpRangeFetch& f)
+{
+	f.socket.close();
+	f.connected = false;
+	f.state = State_DataEnd;
+}
+
+static Status _rangeFetchStart(HttpStream& s, HttpRangeFetch& f, HttpRangeBlock& b)
+{
+	f.reused = f.connected;
+
+	if(!f.connected) {
+		Status st = f.socket.create(BsdSocket::TCP);
+		if(!st) return st;
+
+		st = f.socket.setBlocking(false);
+		if(!st) return st;
+
+		st = f.socket.connect(s.addr);
+		if(BsdSocket::isError(st)) {
+			roLog("error", "Connection to %s failed\n", s.host.c_str());
+			return Status::http_error;
+		}
+		f.connected = true;
+	}
+
+	Status st = _formatGet(f.request, s.path, s.host, b.begin, b.end);
+	if(!st) return st;
+
+	f.state = State_SendRequest;
+	f.requestSent = 0;
+	f.header.clear();
+	f.begin = b.begin;
+	f.end = b.end;
+	f.received = 0;
+
+	b.fetch = &f;
+	b.received = 0;
+	return Status::ok;
+}
+
+/// Receive the body into the block, or discard it if the block was dropped by a seek
+static Status _rangeFetchReceive(HttpStream& s, HttpRangeFetch& f, const char* data, roSize size)
+{
+	if(f.received + size > f.end - f.begin)
+		return Status::http_error;
+
+	HttpRangeBlock* b = _rangeBlockOf(s, f);
+	if(b) {
+		roMemcpy(b->data + f.received, data, size);
+		b->received += size;
+	}
+	f.received += size;
+	return Status::ok;
+}
+
+/// Advance the fetch as far as it goes without blocking
+static Status _rangeFetchUpdate(HttpStream& s, HttpRangeFetch& f)
+{
+	Status st;
+
+	if(f.state == State_SendRequest) {
+		roSize len = f.request.size() - f.requestSent;
+		st = f.socket.send(f.request.c_str() + f.requestSent, len);
+		if(st == Status::net_notconn || BsdSocket::inProgress(st))
+			return Status::ok;	// Still connecting
+		if(!st) return st;
+
+		f.requestSent += len;
+		if(f.requestSent < f.request.size())
+			return Status::ok;
+
+		f.state = State_ReadingResponse;
+	}
+
+	if(f.state == State_ReadingResponse) {
+		static const roSize maxHeaderSize = 8 * 1024;
+		static const char headerTerminator[] = "\r\n\r\n";
+		const char* headerEnd = NULL;
+
+		while(!headerEnd) {
+			roSize oldSize = f.header.size();
+			if(oldSize >= maxHeaderSize)
+				return Status::http_error;
+
+			roSize len = 512;
+			st = f.header.resize(oldSize + len);
+			if(!st) return st;
+			st = f.socket.receive(f.header.c_str() + oldSize, len);
+			f.header.resize(oldSize + (st ? len : 0));
+
+			if(BsdSocket::inProgress(st)) return Status::ok;
+			if(!st) return st;
+			if(len == 0) return Status::net_connection_close;
+
+			headerEnd = roStrStr(f.header.c_str(), headerTerminator);
+		}
+		headerEnd += sizeof(headerTerminator) - 1;
+
+		HttpResponseHeader response;
+		response.string.assign(f.header.c_str(), headerEnd - f.header.c_str());
+
+		roUint64 code = 0, first = 0, last = 0, total = 0;
+		if(!response.getField(HttpResponseHeader::HeaderField::Status, code) || code != 206)
+			return Status::http_error;
+		if(!response.getField(HttpResponseHeader::HeaderField::ContentRange, first, last, total))
+			return Status::http_error;
+		if(first != f.begin || last + 1 != f.end || total != s.fileSize)
+			return Status::http_error;	// The file changed meanwhile
+
+		f.keepAlive = _isKeepAlive(response);
+		f.state = State_ReadReady;
+
+		st = _rangeFetchReceive(s, f, headerEnd, f.header.c_str() + f.header.size() - headerEnd);
+		if(!st) return st;
+	}
+
+	if(f.state == State_ReadReady) {
+		while(f.received < f.end - f.begin) {
+			HttpRangeBlock* b = _rangeBlockOf(s, f);
+			char discard[4 * 1024];
+			roSize len = clamp_cast<roSize>(f.end - f.begin - f.received);
+
+			if(b)
+				st = f.socket.receive(b->data + f.received, len);
+			else {
+				len = roMinOf2(len, sizeof(discard));
+				st = f.socket.receive(discard, len);
+			}
+
+			if(BsdSocket::inProgress(st)) return Status::ok;
+			if(!st) return st;
+			if(len == 0) return Status::net_connection_close;
+
+			if(b) b->received += len;
+			f.received += len;
+		}
+
+		if(HttpRangeBlock* b = _rangeBlockOf(s, f))
+			b->fetch = NULL;
+
+		f.state = State_DataEnd;
+		if(!f.keepAlive)
+			_rangeFetchClose(f);
+	}
+
+	return Status::ok;
+}
+
+static Status _rangeFetchPump(HttpStream& s, HttpRangeFetch& f)
+{
+	Status st = _rangeFetchUpdate(s, f);
+	if(st) return st;
+
+	const bool nothingReceived = f.header.isEmpty();
+	_rangeFetchClose(f);
+
+	HttpRangeBlock* b = _rangeBlockOf(s, f);
+	if(!b)	// Nobody wants the data anymore
+		return Status::ok;
+
+	// The server may close a kept alive connection at any time, retry once on a new connection
+	if(f.reused && nothingReceived) {
+		st = _rangeFetchStart(s, f, *b);
+		if(!st) return st;
+		return _rangeFetchUpdate(s, f);
+	}
+
+	b->fetch = NULL;
+	return st;
+}
+
+/// Drop the blocks outside the window starting from readPos, and add the missing ones.
+/// The window spans readAheadBlocks blocks, or more if requestSize needs.
+static Status _rangedWindow(HttpStream& s, roSize requestSize)
+{
+	const roUint64 blockSize = roMaxOf2(httpFileSystemOptions.blockSize, roSize(1));
+	const roUint64 readAhead = roMaxOf2(httpFileSystemOptions.readAheadBlocks, roSize(1));
+	const roUint64 begin = s.readPos / blockSize * blockSize;
+	const roUint64 requestEnd = s.readPos + roMinOf2(roUint64(requestSize), s.fileSize - s.readPos);
+	const roUint64 end = roMinOf2(s.fileSize, roMaxOf2(begin + blockSize * readAhead, requestEnd));
+
+	// Blocks behind readPos, or all of them if we seek backward
+	roSize dropCount = 0;
+	while(dropCount < s.blocks.size() && s.blocks[dropCount].end <= begin)
+		++dropCount;
+	if(dropCount < s.blocks.size() && s.blocks[dropCount].begin != begin)
+		dropCount = s.blocks.size();
+
+	for(roSize i=0; i<dropCount; ++i) {
+		Status st = s.spareBlocks.pushBack(s.blocks[i].data);
+		if(!st) defaultAllocator.free(s.blocks[i].data);
+	}
+	s.blocks.removeAt(0, dropCount);
+
+	for(roUint64 next = s.blocks.isEmpty() ? begin : s.blocks.back().end; next < end; ) {
+		HttpRangeBlock b = { next, roMinOf2(next + blockSize, s.fileSize), NULL, 0, NULL };
+
+		if(!s.spareBlocks.isEmpty()) {
+			b.data = s.spareBlocks.back();
+			s.spareBlocks.popBack();
+		}
+		else
+			b.data = defaultAllocator.malloc(clamp_cast<roSize>(blockSize)).cast<roByte>();
+
+		if(!b.data)
+			return Status::not_enough_memory;
+
+		Status st = s.blocks.pushBack(b);
+		if(!st) {
+			defaultAllocator.free(b.data);
+			return st;
+		}
+		next = b.end;
+	}
+
+	return Status::ok;
+}
+
+static Status _rangedUpdate(HttpStream& s, roSize requestSize)
+{
+	Status st = _rangedWindow(s, requestSize);
+	if(!st) return st;
+
+	for(roSize i=0; i<s.fetches.size(); ++i) {
+		if(s.fetches[i]->state == State_DataEnd)
+			continue;
+		st = _rangeFetchPump(s, *s.fetches[i]);
+		if(!st) return st;
+	}
+
+	// Hand out the blocks nearest to readPos first, prefer connections already established
+	const roSize maxConnections = roMaxOf2(httpFileSystemOptions.maxConnections, roSize(1));
+	for(roSize i=0; i<s.blocks.size(); ++i) {
+		HttpRangeBlock& b = s.blocks[i];
+		if(b.fetch || b.received == b.end - b.begin)
+			continue;
+
+		HttpRangeFetch* f = NULL;
+		for(roSize j=0; j<s.fetches.size(); ++j) {
+			HttpRangeFetch* candidate = s.fetches[j];
+			if(candidate->state == State_DataEnd && (!f || candidate->connected))
+				f = candidate;
+		}
+
+		if(!f && s.fetches.size() < maxConnections) {
+			AutoPtr<HttpRangeFetch> newFetch = defaultAllocator.newObj<HttpRangeFetch>();
+			if(!newFetch.ptr()) return Status::not_enough_memory;
+			st = s.fetches.pushBack(newFetch.ptr());
+			if(!st) return st;
+			f = newFetch.unref();
+		}
+
+		if(!f)
+			break;
+
+		st = _rangeFetchStart(s, *f, b);
+		if(!st) return st;
+		st = _rangeFetchPump(s, *f);
+		if(!st) return st;
+	}
+
+	return Status::ok;
+}
+
+/// Number of bytes can be read from readPos without blocking
+static roUint64 _rangedReadable(const HttpStream& s)
+{
+	roUint64 pos = s.readPos;
+	for(roSize i=0; i<s.blocks.size(); ++i) {
+		const HttpRangeBlock& b = s.blocks[i];
+		if(pos >= b.end)
+			continue;
+		if(b.begin + b.received <= pos)
+			break;
+		pos = b.begin + b.received;
+		if(pos < b.end)
+			break;
+	}
+	return pos - s.readPos;
+}
+
+/// Copy from the blocks and advance readPos, size must not exceed _rangedReadable()
+static void _rangedCopy(HttpStream& s, void* buffer, roSize size)
+{
+	roByte* dst = static_cast<roByte*>(buffer);
+	for(roSize i=0; i<s.blocks.size() && size > 0; ++i) {
+		const HttpRangeBlock& b = s.blocks[i];
+		if(s.readPos >= b.end)
+			continue;
+
+		roSize offset = clamp_cast<roSize>(s.readPos - b.begin);
+		roSize n = roMinOf2(size, clamp_cast<roSize>(b.received - offset));
+		roMemcpy(dst, b.data + offset, n);
+		dst += n;
+		size -= n;
+		s.readPos += n;
+	}
+	roAssert(size == 0);
+}
+
+static bool _rangedReadWillBlock(HttpStream& s, roSize requestSize)
+{
+	if(s.state == State_Error)
+		return false;
+
+	s.status = _rangedUpdate(s, requestSize);
+	if(!s.status) {
+		s.state = State_Error;
+		return false;
+	}
+
+	return _rangedReadable(s) < roMinOf2(roUint64(requestSize), s.fileSize - s.readPos);
+}
+
+/// The first response is 206, hand over the connection to the first fetch and switch to parallel download
+static Status _rangedBegin(HttpStream& s, const char* messageContent)
+{
+	HttpResponseHeader response;
+	response.string = s.buffer;	// The header is null terminated
+
+	roUint64 first = 0, last = 0, total = 0;
+	if(!response.getField(HttpResponseHeader::HeaderField::ContentRange, first, last, total) || first != 0 || last >= total)
+		return Status::http_error;
+
+	s.ranged = true;
+	s.fileSize = total;
+	s.readPos = 0;
+	s.getSizeStatus = roSafeAssign(s.expectedTotalSize, total);
+
+	Status st = _rangedWindow(s, 0);
+	if(!st) return st;
+
+	HttpRangeBlock& b = s.blocks.front();
+	if(b.end != last + 1)
+		return Status::http_error;
+
+	AutoPtr<HttpRangeFetch> f = defaultAllocator.newObj<HttpRangeFetch>();
+	if(!f.ptr()) return Status::not_enough_memory;
+	st = s.fetches.pushBack(f.ptr());
+	if(!st) return st;
+	HttpRangeFetch& fetch = *f.unref();
+
+	fetch.socket.swap(s.socket);
+	fetch.connected = true;
+	fetch.keepAlive = _isKeepAlive(response);
+	fetch.state = State_ReadReady;
+	fetch.begin = b.begin;
+	fetch.end = b.end;
+	b.fetch = &fetch;
+
+	// The received body, buffer is used as the staging of httpFileSystemGetBuffer() from now on
+	roSize bodySize = s.buffer + s.bufSize - messageContent;
+	s.bufSize = 0;
+	return _rangeFetchReceive(s, fetch, messageContent, bodySize);
+}
+
 Status httpFileSystemOpenFile(const char* uri, void*& outFile)
+{
+	return httpFileSystemOpenFileWithHeader(uri, "", outFile);
+}
+
+Status httpFileSystemOpenFileWithHeader(const char* uri, const char* extraHeader, void*& outFile)
 {
 	AutoPtr<HttpStream> s = defaultAllocator.newObj<HttpStream>();
 
-	Status st = _makeConnection(*s, uri); if(!st) return st;
+	Status st = s->extraHeader.assign(extraHeader); if(!st) return st;
+	st = _makeConnection(*s, uri); if(!st) return st;
 
 	s->buffer = NULL;
 	s->getSizeStatus = Status::http_unknow_size;
@@ -248,6 +700,9 @@ bool httpFileSystemReadWillBlock(void* file, roUint64 size)
 
 	static const roSize headerBufSize = 128;
 
+	if(s->ranged)
+		return _rangedReadWillBlock(*s, requestSize);
+
 // Http state handling
 
 ConnectionRestart:
@@ -259,7 +714,7 @@ ConnectionRestart:
 	{
 		roSize cmdSize = s->getCmd.size();
 		s->status = s->socket.send(s->getCmd.c_str(), cmdSize);
-		if(s->status == roStatus::net_notconn)
+		if(s->status == roStatus::net_notconn || BsdSocket::inProgress(s->status))	// Still connecting
 			return true;
 
 		if(BsdSocket::isError(s->status))
@@ -272,7 +727,7 @@ ConnectionRestart:
 	if(s->state == State_ReadingResponse)
 	{
 		s->status = _readFromSocket(*s, headerBufSize);
-		if(s->status == Status::in_progress) return true;
+		if(BsdSocket::inProgress(s->status)) return true;
 		if(!s->status) return false;
 
 		// Make sure the buffer are always null terminated
@@ -295,6 +750,10 @@ ConnectionRestart:
 		if(sscanf(s->buffer, "HTTP/%*c.%*c %d %*[^\n]", &serverRetCode) != 1)
 			return s->status = Status::http_error, false;
 
+		s->responseCode = serverRetCode;
+		s->status = s->responseHeader.assign(s->buffer);
+		if(!s->status) return false;
+
 		// Check for server return code
 		// http://www.w3.org/Protocols/rfc2616/rfc2616-sec10.html
 		if(serverRetCode == 200)	// Ok
@@ -332,7 +791,18 @@ ConnectionRestart:
 		}
 		else if(serverRetCode == 206)		// Partial Content
 		{
-			serverRetCode = 206;
+			s->status = _rangedBegin(*s, messageContent);
+			if(!s->status) {
+				s->state = State_Error;
+				return false;
+			}
+
+			return _rangedReadWillBlock(*s, requestSize);
+		}
+		else if(serverRetCode == 304)		// Not Modified, the extra header had a condition
+		{
+			s->state = State_DataEnd;
+			return false;
 		}
 		else if(
 			serverRetCode == 301 ||			// Moved Permanently
@@ -381,7 +851,7 @@ ConnectionRestart:
 				break;
 
 			s->status = _readFromSocket(*s, 1);
-			if(s->status == Status::in_progress) return true;
+			if(BsdSocket::inProgress(s->status)) return true;
 			if(!s->status) return false;
 		}
 
@@ -434,7 +904,7 @@ ConnectionRestart:
 
 	roSize bytesRead = 0;
 	s->status = _readFromSocket(*s, bytesToRead, &bytesRead);
-	if(s->status == Status::in_progress) return true;
+	if(BsdSocket::inProgress(s->status)) return true;
 	if(!s->status) return false;
 
 	if(s->chunked) {
@@ -451,6 +921,13 @@ ConnectionRestart:
 static Status _blockTillReadable(HttpStream& s, roUint64 size)
 {
 	if(size == 0) return Status::ok;
+
+	if(s.ranged) {
+		while(_rangedReadWillBlock(s, num_cast<roSize>(size)))
+			TaskPool::yield();
+		return s.status;
+	}
+
 	Status st = prepareForRead(s, size); if(!st) return st;
 
 	float timeout = 10;
@@ -486,9 +963,16 @@ Status httpFileSystemRead(void* file, void* buffer, roUint64 size, roUint64& byt
 	if(!s->status) return s->status;
 
 	_blockTillReadable(*s, _size);
-	roAssert(s->status != Status::in_progress);
+	roAssert(!BsdSocket::inProgress(s->status));
 	if(!s->status) return s->status;
 
+	if(s->ranged) {
+		roSize bytesToRead = clamp_cast<roSize>(roMinOf2(_rangedReadable(*s), size));
+		_rangedCopy(*s, buffer, bytesToRead);
+		bytesRead = bytesToRead;
+		return s->status;
+	}
+
 	roAssert(s->state == State_ReadReady || s->state == State_LastDataReceived);
 	roAssert(s->userReadCount < s->expectedTotalSize);
 
@@ -520,6 +1004,11 @@ Status httpFileSystemSize(void* file, roUint64& size)
 	HttpStream* s = static_cast<HttpStream*>(file);
 	if(!s) return Status::invalid_parameter;
 
+	if(s->ranged) {
+		size = s->fileSize;
+		return Status::ok;
+	}
+
 	if(httpFileSystemReadWillBlock(file, 1)) return Status::in_progress;
 	if(!s->getSizeStatus) return s->getSizeStatus;
 
@@ -527,9 +1016,50 @@ Status httpFileSystemSize(void* file, roUint64& size)
 	return Status::ok;
 }
 
+Status httpFileSystemResponse(void* file, int& statusCode, const char*& header)
+{
+	HttpStream* s = static_cast<HttpStream*>(file);
+	if(!s) return Status::invalid_parameter;
+
+	if(!s->responseCode && httpFileSystemReadWillBlock(file, 1)) return Status::in_progress;
+	if(!s->responseCode) return s->status ? Status::http_error : s->status;
+
+	statusCode = s->responseCode;
+	header = s->responseHeader.c_str();
+	return Status::ok;
+}
+
 Status httpFileSystemSeek(void* file, roInt64 offset, FileSystem::SeekOrigin origin)
 {
-	return Status::not_implemented;
+	HttpStream* s = static_cast<HttpStream*>(file);
+	if(!s) return Status::invalid_parameter;
+
+	// Wait for the first response to see if the server support range
+	while(!s->ranged && s->state <= State_ReadingResponse) {
+		if(!httpFileSystemReadWillBlock(file, 1))
+			break;
+		TaskPool::yield();
+	}
+
+	if(!s->ranged)
+		return s->state == State_Error ? s->status : Status::not_supported;
+
+	roInt64 base = 0;
+	if(origin == FileSystem::SeekOrigin_Current)
+		base = s->readPos;
+	else if(origin == FileSystem::SeekOrigin_End)
+		base = s->fileSize;
+	else if(origin != FileSystem::SeekOrigin_Begin)
+		return Status::invalid_parameter;
+
+	roInt64 pos = base + offset;
+	if(pos < 0 || roUint64(pos) > s->fileSize)
+		return Status::file_seek_error;
+
+	// The blocks outside the new window are dropped, and the new ranges are requested on the next read
+	s->readPos = pos;
+	s->userReadCount = clamp_cast<roSize>(s->readPos);
+	return Status::ok;
 }
 
 void httpFileSystemCloseFile(void* file)
@@ -544,11 +1074,21 @@ roBytePtr httpFileSystemGetBuffer(void* file, roUint64 requestSize, roUint64& re
 	if(!s || s->state == State_Error || requestSize == 0) { readableSize = 0; return NULL; }
 
 	roSize bytesToRead = 0;
-	if(!roSafeAssign(bytesToRead, requestSize)) return false;
+	if(!roSafeAssign(bytesToRead, requestSize)) { readableSize = 0; return NULL; }
 
 	if(!_blockTillReadable(*s, bytesToRead))
 		bytesToRead = 0;
 
+	// Copy to buffer, so it can be taken by httpFileSystemTakeBuffer() as usual
+	if(s->ranged) {
+		s->bufSize = s->lastReadSize = 0;
+		bytesToRead = clamp_cast<roSize>(roMinOf2(_rangedReadable(*s), roUint64(bytesToRead)));
+		if(!prepareForRead(*s, bytesToRead))
+			bytesToRead = 0;
+		_rangedCopy(*s, s->buffer, bytesToRead);
+		s->bufSize = bytesToRead;
+	}
+
 	readableSize = bytesToRead = roMinOf2(s->bufSize, bytesToRead);
 	s->userReadCount += bytesToRead;
 	s->lastReadSize = bytesToRead;
@@ -562,14 +1102,14 @@ void httpFileSystemTakeBuffer(void* file)
 	if(!s || s->state == State_Error || s->lastReadSize == 0) return;
 
 	roBytePtr newBuf = defaultAllocator.malloc(s->bufCapacity);
-	s->buffer = newBuf;
-
 	if(!newBuf) {
 		s->state = State_Error;
 		return;
 	}
 
+	// The old buffer now belongs to the caller, keep the unread part
 	roMemcpy(newBuf, s->buffer + s->lastReadSize, s->bufSize - s->lastReadSize);
+	s->buffer = newBuf;
 	s->bufSize -= s->lastReadSize;
 	s->lastReadSize = 0;
 }
@@ -6,6 +6,7 @@
 namespace ro {
 
 Status		httpFileSystemOpenFile		(const char* uri, void*& outFile);
+Status		httpFileSystemOpenFileWithHeader(const char* uri, const char* extraHeader, void*& outFile);	///< extraHeader are "Field: value\r\n" lines, for instance a If-None-Match
 bool		httpFileSystemReadWillBlock	(void* file, roUint64 bytesToRead);
 Status		httpFileSystemRead			(void* file, void* buffer, roUint64 bytesToRead, roUint64& bytesRead);
 Status		httpFileSystemAtomicRead	(void* file, void* buffer, roUint64 bytesToRead);
@@ -15,11 +16,26 @@ void		httpFileSystemCloseFile		(void* file);
 roBytePtr	httpFileSystemGetBuffer		(void* file, roUint64 requestSize, roUint64& readableSize);
 void		httpFileSystemTakeBuffer	(void* file);
 void		httpFileSystemUntakeBuffer	(void* file, roBytePtr buf);
+Status		httpFileSystemResponse		(void* file, int& statusCode, const char*& header);	///< The first response, in_progress if not received yet
 void*		httpFileSystemOpenDir		(const char* uri);
 bool		httpFileSystemNextDir		(void* dir);
 const char*	httpFileSystemDirName		(void* dir);
 void		httpFileSystemCloseDir		(void* dir);
 
+/// Parallel range download, used when the server answers the first request with 206 Partial Content.
+/// The file is split into blocks of blockSize, fetched by up to maxConnections keep-alive connections,
+/// and at most readAheadBlocks blocks from the read position are buffered.
+/// Seeking only discards the blocks outside the new window, and request the new ranges.
+/// Servers without range support (answering 200) fall back to a single front to back stream.
+struct HttpFileSystemOptions
+{
+	roSize maxConnections;
+	roSize blockSize;
+	roSize readAheadBlocks;
+};
+
+extern HttpFileSystemOptions httpFileSystemOptions;
+
 extern FileSystem httpFileSystem;
 
 }	// namespace ro
@@ -147,11 +147,193 @@ Status MemoryIStream::seekRead(roInt64 offset, SeekOrigin origin)
 	return roStatus::ok;
 }
 
+Status OStream::writev(const IoVec* bufs, roSize count)
+{
+	for(roSize i=0; i<count; ++i) {
+		Status st = write(bufs[i].data, bufs[i].size);
+		if(!st) return st;
+	}
+	return roStatus::ok;
+}
+
+Status OStream::reserveWrite(roSize minBytes, roByte*& outBuf, roSize& outBytes)
+{
+	if(_scratch.size() < minBytes) {
+		Status st = _scratch.resizeNoInit(minBytes);
+		if(!st) return st;
+	}
+
+	outBuf = _scratch.typedPtr();
+	outBytes = _scratch.size();
+	return roStatus::ok;
+}
+
+Status OStream::commitWrite(roSize bytesWritten)
+{
+	roAssert(bytesWritten <= _scratch.size());
+	if(bytesWritten == 0)
+		return roStatus::ok;
+	return write(_scratch.typedPtr(), bytesWritten);
+}
+
 Status MemoryOStream::write(const void* buffer, roUint64 bytesToWrite)
 {
+	roAssert(!_reserved);
 	return _buf.insert(_buf.size(), (roUint8*)buffer, (roUint8*)buffer + bytesToWrite);
 }
 
+Status MemoryOStream::writev(const IoVec* bufs, roSize count)
+{
+	roAssert(!_reserved);
+
+	// Grow once for all the buffers
+	roSize total = 0;
+	for(roSize i=0; i<count; ++i) {
+		Status st = roSafeAdd(total, bufs[i].size, total);
+		if(!st) return st;
+	}
+
+	roSize offset = _buf.size();
+	Status st = _buf.incSizeNoInit(total);
+	if(!st) return st;
+
+	for(roSize i=0; i<count; ++i) {
+		if(bufs[i].size)
+			roMemcpy(_buf.typedPtr() + offset, bufs[i].data, bufs[i].size);
+		offset += bufs[i].size;
+	}
+
+	return roStatus::ok;
+}
+
+Status MemoryOStream::reserveWrite(roSize minBytes, roByte*& outBuf, roSize& outBytes)
+{
+	roAssert(!_reserved);
+
+	// Lend all the spare capacity, which grow geometrically like write() does
+	_reservedAt = _buf.size();
+	Status st = _buf.incSizeNoInit(minBytes);
+	if(!st) return st;
+	st = _buf.resizeNoInit(_buf.capacity());
+	if(!st) return st;
+
+	_reserved = true;
+	outBuf = _buf.typedPtr() + _reservedAt;
+	outBytes = _buf.size() - _reservedAt;
+	return roStatus::ok;
+}
+
+Status MemoryOStream::commitWrite(roSize bytesWritten)
+{
+	roAssert(_reserved);
+	roAssert(bytesWritten <= _buf.size() - _reservedAt);
+
+	_reserved = false;
+	return _buf.resizeNoInit(_reservedAt + bytesWritten);
+}
+
+MemoryChainOStream::MemoryChainOStream(roSize blockSize)
+	: _blockSize(blockSize ? blockSize : 1)
+	, _size(0)
+{
+}
+
+MemoryChainOStream::~MemoryChainOStream()
+{
+	clear();
+}
+
+Status MemoryChainOStream::_newBlock(roSize minBytes)
+{
+	Block block;
+	block.capacity = roMaxOf2(_blockSize, minBytes);
+	block.size = 0;
+	block.data = roMalloc(block.capacity);
+	if(!block.data)
+		return roStatus::not_enough_memory;
+
+	Status st = _blocks.pushBack(block);
+	if(!st) roFree(block.data);
+	return st;
+}
+
+Status MemoryChainOStream::write(const void* buffer, roUint64 bytesToWrite)
+{
+	const roByte* p = static_cast<const roByte*>(buffer);
+	while(bytesToWrite) {
+		if(_blocks.isEmpty() || _blocks.back().size == _blocks.back().capacity) {
+			Status st = _newBlock(0);
+			if(!st) return st;
+		}
+
+		Block& block = _blocks.back();
+		const roSize n = clamp_cast<roSize>(roMinOf2(bytesToWrite, roUint64(block.capacity - block.size)));
+		roMemcpy(block.data + block.size, p, n);
+		block.size += n;
+		_size += n;
+		p += n;
+		bytesToWrite -= n;
+	}
+
+	return roStatus::ok;
+}
+
+Status MemoryChainOStream::reserveWrite(roSize minBytes, roByte*& outBuf, roSize& outBytes)
+{
+	// The tail of the last block if it's big enough, otherwise a new one and the tail is left unused
+	if(_blocks.isEmpty() || _blocks.back().capacity - _blocks.back().size < roMaxOf2(minBytes, roSize(1))) {
+		Status st = _newBlock(minBytes);
+		if(!st) return st;
+	}
+
+	Block& block = _blocks.back();
+	outBuf = block.data + block.size;
+	outBytes = block.capacity - block.size;
+	return roStatus::ok;
+}
+
+Status MemoryChainOStream::commitWrite(roSize bytesWritten)
+{
+	if(bytesWritten == 0)
+		return roStatus::ok;
+
+	roAssert(!_blocks.isEmpty());
+	Block& block = _blocks.back();
+	roAssert(bytesWritten <= block.capacity - block.size);
+	block.size += bytesWritten;
+	_size += bytesWritten;
+	return roStatus::ok;
+}
+
+Status MemoryChainOStream::getIoVecs(Array<IoVec>& bufs) const
+{
+	bufs.clear();
+	for(const Block& block : _blocks) {
+		if(!block.size)
+			continue;
+		IoVec v = { block.data, block.size };
+		Status st = bufs.pushBack(v);
+		if(!st) return st;
+	}
+	return roStatus::ok;
+}
+
+Status MemoryChainOStream::writeTo(OStream& os) const
+{
+	Array<IoVec> bufs;
+	Status st = getIoVecs(bufs);
+	if(!st) return st;
+	return os.writev(bufs.typedPtr(), bufs.size());
+}
+
+void MemoryChainOStream::clear()
+{
+	for(Block& block : _blocks)
+		roFree(block.data);
+	_blocks.clear();
+	_size = 0;
+}
+
 MemorySeekableOStream::MemorySeekableOStream()
 	: _pos(0)
 {
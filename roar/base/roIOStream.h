@@ -2,6 +2,7 @@
 #define __roIOStream_h__
 
 #include "roArray.h"
+#include "roIoVec.h"
 #include "roMemory.h"
 
 namespace ro {
@@ -80,8 +81,22 @@ struct OStream : private NonCopyable
 	virtual Status		flush			() { return roStatus::ok; }
 	virtual Status		closeWrite		() { return roStatus::ok; }
 
+	// Scatter/gather write, as if the buffers were concatenated but without doing so.
+	// The default write() them one by one, streams that can send them together should override.
+	virtual Status		writev			(const IoVec* bufs, roSize count);
+
+	// Lend a writable region of at least minBytes (outBytes may be bigger) for the caller to fill in place,
+	// then commitWrite() the amount actually filled, saving the copy of write() when the stream has it's own buffer.
+	// Only one region can be outstanding and no other write is allowed in between.
+	// The default fill a scratch buffer and write() it on commit.
+	virtual Status		reserveWrite	(roSize minBytes, roByte*& outBuf, roSize& outBytes);
+	virtual Status		commitWrite		(roSize bytesWritten);
+
 	template<roSize N>
 			Status		write			(const roUtf8 (&ary)[N]) { return write(ary, N); }
+
+// Private
+	ByteArray _scratch;
 };
 
 struct MemoryIStream : public IStream
@@ -98,15 +113,54 @@ struct MemoryOStream : public OStream
 {
 	virtual Status		seekWrite		(roInt64 offset, SeekOrigin origin) { return roStatus::not_supported; }
 	virtual Status		write			(const void* buffer, roUint64 bytesToWrite);
-	virtual roUint64	posWrite		() const { return size(); }
+	virtual roUint64	posWrite		() const { return _reserved ? _reservedAt : size(); }
+	virtual Status		writev			(const IoVec* bufs, roSize count);
+	virtual Status		reserveWrite	(roSize minBytes, roByte*& outBuf, roSize& outBytes);
+	virtual Status		commitWrite		(roSize bytesWritten);
 
 	roByte*				bytePtr			() { return _buf.castedPtr<roByte>(); }
 	roSize				size			() const { return _buf.sizeInByte(); }
 
-	void				clear			() { _buf.clear(); }
+	void				clear			() { _buf.clear(); _reserved = false; }
 
 // Private:
 	ByteArray _buf;
+	roSize _reservedAt = 0;
+	bool _reserved = false;
+};
+
+/// Keep the written data in a chain of blocks instead of one contiguous buffer, growing never copy
+/// what was written before, and the blocks go to another stream with a single writev().
+struct MemoryChainOStream : public OStream
+{
+	explicit MemoryChainOStream(roSize blockSize=64 * 1024);
+	~MemoryChainOStream();
+
+	virtual Status		write			(const void* buffer, roUint64 bytesToWrite);
+	virtual roUint64	posWrite		() const { return _size; }
+	virtual Status		reserveWrite	(roSize minBytes, roByte*& outBuf, roSize& outBytes);
+	virtual Status		commitWrite		(roSize bytesWritten);
+
+	roUint64			size			() const { return _size; }
+	roSize				blockCount		() const { return _blocks.size(); }
+
+	// The filled part of each block, valid until the next write
+	Status				getIoVecs		(Array<IoVec>& bufs) const;
+	Status				writeTo			(OStream& os) const;
+
+	void				clear			();
+
+// Private:
+	struct Block {
+		roByte* data;
+		roSize size;
+		roSize capacity;
+	};
+	Status _newBlock(roSize minBytes);
+
+	Array<Block> _blocks;
+	roSize _blockSize;
+	roUint64 _size;
 };
 
 struct MemorySeekableOStream : public OStream
@@ -0,0 +1,17 @@
+#ifndef __roIoVec_h__
+#define __roIoVec_h__
+
+#include "../platform/roCompiler.h"
+
+namespace ro {
+
+///	One buffer of a scatter/gather read or write
+struct IoVec
+{
+	const void* data;
+	roSize size;
+};	// IoVec
+
+}	// namespace ro
+
+#endif	// __roIoVec_h__
@@ -1,206 +1,485 @@
 #include "pch.h"
 #include "roJson.h"
 #include "roIOStream.h"
-#include "roStringFormat.h"
 #include "roBlockAllocator.h"
+#include "roStringHash.h"
+#include "roStringUtility.h"
 #include "../Math/roMath.h"
 
+#if roCPU_SSE
+#	include <emmintrin.h>
+#	if defined(__AVX2__)
+#		include <immintrin.h>
+#	endif
+#endif
+
 namespace ro {
 
-JsonParser::JsonParser()
-	: _str(""), _it(""), _event(Event::Undefined), _nextFunc(&JsonParser::_unInitializedCallback)
-{}
+// ----------------------------------------------------------------------
+// Stage 1, see "Parsing Gigabytes of JSON per Second", Langdale and Lemire
 
-void JsonParser::parse(const roUtf8* source)
+/// Index of the lowest set bit, mask must not be zero
+static roFORCEINLINE roSize _jsonCountTrailingZero(roUint64 mask)
 {
-	_tmpStr = source;
-	parseInplace(_tmpStr.c_str());
+#if roCOMPILER_VC && roCPU_x86_64
+	unsigned long index;
+	_BitScanForward64(&index, mask);
+	return index;
+#elif roCOMPILER_VC
+	unsigned long index;
+	if(_BitScanForward(&index, roUint32(mask)))
+		return index;
+	_BitScanForward(&index, roUint32(mask >> 32));
+	return index + 32;
+#elif roCOMPILER_GCC
+	return __builtin_ctzll(mask);
+#else
+	roSize index = 0;
+	while(!(mask & 1)) { mask >>= 1; ++index; }
+	return index;
+#endif
 }
 
-void JsonParser::parseInplace(roUtf8* source)
+/// Bit i of each mask is for the i-th byte of a 64 bytes block
+struct _JsonBlockMasks
 {
-	if(!source)
-		source = "";
+	roUint64 backslash, quote, whiteSpace, op;
+};
 
-	if(source != _tmpStr.c_str()) {
-		_tmpStr.clear();
-		_tmpStr.condense();
-	}
+#if roCPU_SSE && defined(__AVX2__)
 
-	_str = source;
-	_it = source;
-	_event = Event::Undefined;
-	_stack.clear();
-	_nextFunc = &JsonParser::_parseRoot;
+static roFORCEINLINE roUint64 _jsonMask(__m256i lo, __m256i hi)
+{
+	return roUint64(roUint32(_mm256_movemask_epi8(lo))) | (roUint64(roUint32(_mm256_movemask_epi8(hi))) << 32);
 }
 
-void JsonParser::_skipWhiteSpace()
+static roFORCEINLINE void _jsonClassify(const roUtf8* p, _JsonBlockMasks& m)
 {
-	while(*_it == '\x20' || *_it == '\x9' || *_it == '\xD' || *_it == '\xA')
-		++_it;
+	const __m256i c0 = _mm256_loadu_si256((const __m256i*)p);
+	const __m256i c1 = _mm256_loadu_si256((const __m256i*)(p + 32));
+
+	#define roJSON_EQ(c, ch) _mm256_cmpeq_epi8(c, _mm256_set1_epi8(ch))
+	#define roJSON_OP(c, l) _mm256_or_si256( \
+		_mm256_or_si256(roJSON_EQ(l, '{'), roJSON_EQ(l, '}')), \
+		_mm256_or_si256(roJSON_EQ(c, ':'), roJSON_EQ(c, ',')))
+	#define roJSON_WS(c) _mm256_or_si256( \
+		_mm256_or_si256(roJSON_EQ(c, ' '), roJSON_EQ(c, '\t')), \
+		_mm256_or_si256(roJSON_EQ(c, '\n'), roJSON_EQ(c, '\r')))
+
+	// '[' and ']' differ from '{' and '}' only by the 0x20 bit
+	const __m256i l0 = _mm256_or_si256(c0, _mm256_set1_epi8(0x20));
+	const __m256i l1 = _mm256_or_si256(c1, _mm256_set1_epi8(0x20));
+
+	m.backslash = _jsonMask(roJSON_EQ(c0, '\\'), roJSON_EQ(c1, '\\'));
+	m.quote = _jsonMask(roJSON_EQ(c0, '"'), roJSON_EQ(c1, '"'));
+	m.whiteSpace = _jsonMask(roJSON_WS(c0), roJSON_WS(c1));
+	m.op = _jsonMask(roJSON_OP(c0, l0), roJSON_OP(c1, l1));
+
+	#undef roJSON_EQ
+	#undef roJSON_OP
+	#undef roJSON_WS
 }
 
-bool JsonParser::_unInitializedCallback()
+#elif roCPU_SSE
+
+static roFORCEINLINE roUint64 _jsonMask(__m128i a, __m128i b, __m128i c, __m128i d)
 {
-	return _onError(roStatus::not_initialized, "Please call parse()");
+	return
+		roUint64(roUint32(_mm_movemask_epi8(a))) |
+		(roUint64(roUint32(_mm_movemask_epi8(b))) << 16) |
+		(roUint64(roUint32(_mm_movemask_epi8(c))) << 32) |
+		(roUint64(roUint32(_mm_movemask_epi8(d))) << 48);
 }
 
-bool JsonParser::_onError(roStatus st, const roUtf8* errMsg)
+static roFORCEINLINE void _jsonClassify(const roUtf8* p, _JsonBlockMasks& m)
 {
-	_status = st;
-	_errStr = errMsg;
-	return false;
+	__m128i c[4], l[4];
+	for(roSize i=0; i<4; ++i) {
+		c[i] = _mm_loadu_si128((const __m128i*)(p + i * 16));
+		// '[' and ']' differ from '{' and '}' only by the 0x20 bit
+		l[i] = _mm_or_si128(c[i], _mm_set1_epi8(0x20));
+	}
+
+	#define roJSON_EQ(c, ch) _mm_cmpeq_epi8(c, _mm_set1_epi8(ch))
+	#define roJSON_OP(i) _mm_or_si128( \
+		_mm_or_si128(roJSON_EQ(l[i], '{'), roJSON_EQ(l[i], '}')), \
+		_mm_or_si128(roJSON_EQ(c[i], ':'), roJSON_EQ(c[i], ',')))
+	#define roJSON_WS(i) _mm_or_si128( \
+		_mm_or_si128(roJSON_EQ(c[i], ' '), roJSON_EQ(c[i], '\t')), \
+		_mm_or_si128(roJSON_EQ(c[i], '\n'), roJSON_EQ(c[i], '\r')))
+
+	m.backslash = _jsonMask(roJSON_EQ(c[0], '\\'), roJSON_EQ(c[1], '\\'), roJSON_EQ(c[2], '\\'), roJSON_EQ(c[3], '\\'));
+	m.quote = _jsonMask(roJSON_EQ(c[0], '"'), roJSON_EQ(c[1], '"'), roJSON_EQ(c[2], '"'), roJSON_EQ(c[3], '"'));
+	m.whiteSpace = _jsonMask(roJSON_WS(0), roJSON_WS(1), roJSON_WS(2), roJSON_WS(3));
+	m.op = _jsonMask(roJSON_OP(0), roJSON_OP(1), roJSON_OP(2), roJSON_OP(3));
+
+	#undef roJSON_EQ
+	#undef roJSON_OP
+	#undef roJSON_WS
 }
 
-bool JsonParser::_parseRoot()
+#else
+
+static void _jsonClassify(const roUtf8* p, _JsonBlockMasks& m)
 {
-	_skipWhiteSpace();
-	switch(*_it) {
-		case '{': return _parseBeginObject();
-		case '[': return _parseBeginArray();
-		default: return _onError(roStatus::json_parse_error, "Expecting object or array as root");
+	roZeroMemory(&m, sizeof(m));
+	for(roSize i=0; i<64; ++i) {
+		const roUint64 bit = roUint64(1) << i;
+		switch(p[i]) {
+		case '\\':	m.backslash |= bit;	break;
+		case '"':	m.quote |= bit;		break;
+		case ' ': case '\t': case '\n': case '\r':
+			m.whiteSpace |= bit;		break;
+		case '{': case '}': case '[': case ']': case ':': case ',':
+			m.op |= bit;				break;
+		}
 	}
 }
 
-bool JsonParser::_parseBeginObject()
+#endif
+
+/// Index the 64 bytes blocks from state.pos until the end or blockCount blocks,
+/// out must have room for 64 indices per block, return the end of the written indices
+static roUint32* _jsonIndexBlocks(const roUtf8* json, roSize size, _JsonIndexState& state, roSize blockCount, roUint32* out)
 {
-	roAssert(*_it == '{');
-	_event = Event::BeginObject;
-	_StackElement s = { _event, 0 };
-	_stack.pushBack(s);
-	++_it;
+	roUtf8 tail[64];
 
-	_skipWhiteSpace();
-	if(*_it == '}')
-		_nextFunc = &JsonParser::_parseEndObject;
-	else
-		_nextFunc = &JsonParser::_parseName;
+	for(; state.pos < size && blockCount; state.pos += 64, --blockCount) {
+		const roSize base = state.pos;
+		const roUtf8* p = json + base;
 
-	return true;
+		// Pad the last partial block with white space
+		if(size - base < 64) {
+			memset(tail, ' ', sizeof(tail));
+			roMemcpy(tail, p, size - base);
+			p = tail;
+		}
+
+		_JsonBlockMasks m;
+		_jsonClassify(p, m);
+
+		// Bytes following an odd sequence of backslashes, backslashes are rare enough for a loop
+		roUint64 escaped = state.escaped;
+		state.escaped = 0;
+		for(roUint64 b = m.backslash; b; b &= b - 1) {
+			const roUint64 bit = b & (0 - b);
+			if(escaped & bit)
+				continue;
+			if(bit >> 63)
+				state.escaped = 1;
+			else
+				escaped |= bit << 1;
+		}
+
+		// Prefix xor of the real quotes: set from an opening quote up to, but excluding, the closing one
+		const roUint64 quote = m.quote & ~escaped;
+		roUint64 inString = quote;
+		inString ^= inString << 1;
+		inString ^= inString << 2;
+		inString ^= inString << 4;
+		inString ^= inString << 8;
+		inString ^= inString << 16;
+		inString ^= inString << 32;
+		inString ^= state.inString;
+		state.inString = roUint64(roInt64(inString) >> 63);
+
+		// A scalar start where a run of non white space, non operator bytes begin, an opening quote
+		// always start a new one. The string content and the closing quote are then masked out.
+		const roUint64 scalar = ~(m.op | m.whiteSpace);
+		const roUint64 nonQuoteScalar = scalar & ~quote;
+		const roUint64 followScalar = (nonQuoteScalar << 1) | state.scalar;
+		state.scalar = nonQuoteScalar >> 63;
+
+		roUint64 structurals = (m.op | (scalar & ~followScalar)) & ~(inString ^ quote);
+
+		// Flatten the bits into offsets
+		for(; structurals; structurals &= structurals - 1)
+			*(out++) = roUint32(base + _jsonCountTrailingZero(structurals));
+	}
+
+	return out;
 }
 
-bool JsonParser::_parseEndObject()
+roStatus jsonStructuralIndex(const roUtf8* json, roSize size, Array<roUint32>& indices)
 {
-	roAssert(*_it == '}');
-	if(_stack.isEmpty() || _stack.back().event != Event::BeginObject)
-		return _onError(roStatus::json_parse_error, "unexpected '}'");
+	indices.clear();
+	if(size > roUint32(-1))
+		return roStatus::size_limit_reached;
+
+	_JsonIndexState state = { 0, 0, 0, 0 };
+	while(state.pos < size) {
+		// Room for a whole chunk then trim
+		const roSize blockCount = 64;
+		const roSize oldSize = indices.size();
+		if(!indices.resizeNoInit(oldSize + blockCount * 64))
+			return roStatus::not_enough_memory;
+
+		roUint32* begin = indices.typedPtr() + oldSize;
+		roUint32* end = _jsonIndexBlocks(json, size, state, blockCount, begin);
+		indices.resizeNoInit(oldSize + (end - begin));
+	}
 
-	++_it;
-	_MemberCount = _stack.back().elementCount;
-	_stack.popBack();
-	_event = Event::EndObject;
+	if(state.inString)
+		return roStatus::json_parse_error;
 
-	if(_stack.isEmpty())
-		_nextFunc = &JsonParser::_parseEnd;
-	else
-		return _valueEnd();
+	return roStatus::ok;
+}
 
-	return true;
+// ----------------------------------------------------------------------
+// Stage 2, validate the grammar while walking through the structural characters
+
+JsonParser::JsonParser()
+	: _str(""), _strEnd(_str), _event(Event::Undefined), _state(_State_Error), _raw(false), _idx(NULL), _idxEnd(NULL)
+{
+	_onError(roStatus::not_initialized, "Please call parse()");
 }
 
-bool JsonParser::_parseEnd()
+void JsonParser::parse(const roUtf8* source)
 {
-	_event = Event::End;
-	return true;
+	_tmpStr = source;
+	parseInplace(_tmpStr.c_str());
 }
 
-bool JsonParser::_parseBeginArray()
+void JsonParser::parseInplace(roUtf8* source)
 {
-	roAssert(*_it == '[');
+	if(!source)
+		source = "";
 
-	++_it;
-	_event = Event::BeginArray;
-	_StackElement s = { _event, 0 };
-	_stack.pushBack(s);
+	if(source != _tmpStr.c_str()) {
+		_tmpStr.clear();
+		_tmpStr.condense();
+	}
 
-	_skipWhiteSpace();
-	_nextFunc = &JsonParser::_parseValue;
+	_str = source;
+	_strEnd = source + roStrLen(source);
+	_event = Event::Undefined;
+	_state = _State_Root;
+	_raw = false;
+	_stack.clear();
+	_status = roStatus::ok;
+	_errStr.clear();
 
-	return true;
+	_JsonIndexState indexState = { 0, 0, 0, 0 };
+	_indexState = indexState;
+	_idx = _idxEnd = _indices.typedPtr();
+
+	if(roSize(_strEnd - _str) > roUint32(-1)) {
+		_state = _State_Error;
+		_onError(roStatus::size_limit_reached, "Document too big");
+	}
 }
 
-bool JsonParser::_parseEndArray()
+// Stage 1 run only a few kilo bytes ahead of stage 2, such that the document is read from
+// the memory only once and the indices stay in cache
+bool JsonParser::_indexNextChunk()
 {
-	roAssert(*_it == ']');
-	if(_stack.isEmpty() || _stack.back().event != Event::BeginArray)
-		return _onError(roStatus::json_parse_error, "unexpected ']'");
-
-	++_it;
-	_ElementCount = _stack.back().elementCount;
-	_stack.popBack();
-	_event = Event::EndArray;
-
-	if(_stack.isEmpty())
-		_nextFunc = &JsonParser::_parseEnd;
-	else
-		return _valueEnd();
+	const roSize blockCount = 64;
+	if(!_indices.resizeNoInit(blockCount * 64))
+		return _onError(roStatus::not_enough_memory, "Out of memory");
+
+	const roSize size = _strEnd - _str;
+	do {
+		_idx = _indices.typedPtr();
+		_idxEnd = _jsonIndexBlocks(_str, size, _indexState, blockCount, _indices.typedPtr());
+	} while(_idx == _idxEnd && _indexState.pos < size);
+
+	if(_idx != _idxEnd)
+		return true;
+
+	if(_indexState.inString)
+		return _onError(roStatus::json_parse_error, "Unterminated string");
+	if(_state == _State_Root)
+		return _onError(roStatus::json_parse_error, "Expecting object or array as root");
+	return _onError(roStatus::json_parse_error, "Unexpected end of document");
+}
 
-	return true;
+bool JsonParser::_onError(roStatus st, const roUtf8* errMsg)
+{
+	_status = st;
+	_errStr = errMsg;
+	return false;
 }
 
-bool JsonParser::_parseValue()
+// Scalars must be followed by white space, an operator or the end of the document
+static bool _jsonIsScalarEnd(roUtf8 c)
 {
-	switch(*_it) {
-	case '{':	return _parseBeginObject();
-	case '}':	return _parseEndObject();
-	case '[':	return _parseBeginArray();
-	case ']':	return _parseEndArray();
-	case '"':	return _parseString();
-	case 'n':
-	case 't':
-	case 'f':	return _parseNullTrueFalse();
-	default:	return _parseNumber();
+	switch(c) {
+	case '\0': case ' ': case '\t': case '\n': case '\r':
+	case '{': case '}': case '[': case ']': case ':': case ',':
+		return true;
+	default:
+		return false;
 	}
 }
 
-bool JsonParser::_valueEnd()
+// The syntax accepted by _jsonParseNumber() without the conversion, the range is checked when it's read
+static bool _jsonSkipNumber(roUtf8*& it)
 {
-	_skipWhiteSpace();
+	if(*it == '-' || *it == '+')
+		++it;
 
-	if(*_it == ',') {
-		if(_stack.back().event == Event::BeginObject)
-			_nextFunc = &JsonParser::_parseName;
-		else
-			_nextFunc = &JsonParser::_parseValue;
-		++_it;
+	const roUtf8* digits = it;
+	while(*it >= '0' && *it <= '9')
+		++it;
+
+	if(*it == '.') {
+		++it;
+		if(*it < '0' || *it > '9')
+			return false;
+		while(*it >= '0' && *it <= '9')
+			++it;
+	}
+
+	if(it == digits)
+		return false;
+
+	if(*it == 'e' || *it == 'E') {
+		++it;
+		if(*it == '+' || *it == '-')
+			++it;
+		if(*it < '0' || *it > '9')
+			return false;
+		while(*it >= '0' && *it <= '9')
+			++it;
 	}
-	else if(*_it == '}')
-		_nextFunc = &JsonParser::_parseEndObject;
-	else if(*_it == ']')
-		_nextFunc = &JsonParser::_parseEndArray;
-	else
-		return _onError(roStatus::json_parse_error, "Expecting ',}]'");
 
-	_stack.back().elementCount++;
 	return true;
 }
 
-bool JsonParser::_parseName()
+bool JsonParser::_parseNext()
 {
-	if(!_parseStringImpl())
-		return false;
+	while(true) {
+		if(_state == _State_Error)
+			return false;
+		if(_state == _State_End) {
+			_event = Event::End;
+			return true;
+		}
+		if(_idx == _idxEnd && !_indexNextChunk())
+			return false;
 
-	_skipWhiteSpace();
-	if(*_it != ':')
-		return _onError(roStatus::json_parse_error, "Expecting ':'");
+		roUtf8* p = _str + *(_idx++);
+		const roUtf8 c = *p;
 
-	++_it;
-	_event = Event::Name;
-	_nextFunc = &JsonParser::_parseValue;
+		switch(_state) {
+		case _State_ObjectBegin:
+			if(c == '}')
+				break;
+			// Fall through
+		case _State_Name:
+			if(c != '"')
+				return _onError(roStatus::json_parse_error, "Expecting '\"'");
+			if(!_parseStringImpl(p, false))
+				return false;
+			if(_idx == _idxEnd && !_indexNextChunk())
+				return false;
+			if(_str[*_idx] != ':')
+				return _onError(roStatus::json_parse_error, "Expecting ':'");
+
+			++_idx;
+			_event = Event::Name;
+			_state = _State_Value;
+			return true;
+
+		case _State_Root:
+			if(c != '{' && c != '[')
+				return _onError(roStatus::json_parse_error, "Expecting object or array as root");
+			// Fall through
+		case _State_Value:
+			if(c == '{' || c == '[') {
+				_event = (c == '{') ? Event::BeginObject : Event::BeginArray;
+				_StackElement s = { _event, 0 };
+				if(!_stack.pushBack(s))
+					return _onError(roStatus::not_enough_memory, "Out of memory");
+				_state = (c == '{') ? _State_ObjectBegin : _State_ArrayBegin;
+				return true;
+			}
 
-	return true;
-}
+			// Accept a trailing ',' in array
+			if(c == ']' && _stack.back().event == Event::BeginArray)
+				break;
 
-bool JsonParser::_parseString()
-{
-	if(!_parseStringImpl())
-		return false;
+			switch(c) {
+			case '"':
+				if(!_parseStringImpl(p, _raw))
+					return false;
+				_event = Event::String;
+				break;
+			case 'n':
+			case 't':
+			case 'f':
+				if(!_parseNullTrueFalse(p) || !_jsonIsScalarEnd(*p))
+					return _onError(roStatus::json_parse_error, "Invalid value");
+				break;
+			case '{': case '}': case '[': case ']': case ':': case ',':
+				return _onError(roStatus::json_parse_error, "Expecting value");
+			default:
+				if(_raw) {
+					_stringVal = p;
+					if(!_jsonSkipNumber(p) || !_jsonIsScalarEnd(*p))
+						return _onError(roStatus::json_parse_error, "Invalid number");
+					_stringValLen = p - _stringVal;
+					_event = Event::Undefined;
+				}
+				else if(!_parseNumber(p) || !_jsonIsScalarEnd(*p))
+					return _onError(roStatus::json_parse_error, "Invalid number");
+				break;
+			}
+
+			++_stack.back().elementCount;
+			_state = _State_ValueEnd;
+			return true;
+
+		case _State_ArrayBegin:
+			if(c == ']')
+				break;
+			_state = _State_Value;
+			--_idx;
+			continue;
+
+		case _State_ValueEnd:
+			if(c == ',') {
+				_state = (_stack.back().event == Event::BeginObject) ? _State_Name : _State_Value;
+				continue;
+			}
+			if(c != '}' && c != ']')
+				return _onError(roStatus::json_parse_error, "Expecting ',}]'");
+			break;
+
+		default:
+			roAssert(false);
+			return false;
+		}
+
+		// Only a closing '}' or ']' reach here
+		if(c == '}') {
+			if(_stack.back().event != Event::BeginObject)
+				return _onError(roStatus::json_parse_error, "unexpected '}'");
+			_event = Event::EndObject;
+			_MemberCount = _stack.back().elementCount;
+		}
+		else {
+			if(_stack.back().event != Event::BeginArray)
+				return _onError(roStatus::json_parse_error, "unexpected ']'");
+			_event = Event::EndArray;
+			_ElementCount = _stack.back().elementCount;
+		}
+
+		_stack.popBack();
+
+		// Anything after the root is ignored
+		if(_stack.isEmpty())
+			_state = _State_End;
+		else {
+			++_stack.back().elementCount;
+			_state = _State_ValueEnd;
+		}
 
-	_event = Event::String;
-	return _valueEnd();
+		return true;
+	}
 }
 
-static bool parseHex4(roUtf8* it, unsigned& codepoint)
+static bool parseHex4(const roUtf8* it, unsigned& codepoint)
 {
 	codepoint = 0;
 	for(roSize i = 0; i<4; ++i) {
@@ -221,20 +500,18 @@ static bool parseHex4(roUtf8* it, unsigned& codepoint)
 	return true;
 }
 
-bool JsonParser::_parseStringImpl()
+// Unescape [it, end) in place, last end up one pass the decoded string
+static bool _jsonUnescape(roUtf8* it, const roUtf8* end, roUtf8*& last, const roUtf8*& errMsg)
 {
-	if(*_it != '"')
-		return _onError(roStatus::json_parse_error, "Expecting '\"'");
-
-	++_it;
-	roUtf8* first = _it;
-	roUtf8* last = _it;
+	last = it;
 
-	while(*_it) {
-		if((roUint8)*_it < '\x20')	// Control characters not allowed
+	while(it < end) {
+		if((roUint8)*it < '\x20') {
+			errMsg = "Invalid character in string";
 			return false;
-		else if(*_it == '\\') {
-			switch(_it[1]) {
+		}
+		else if(*it == '\\') {
+			switch(it[1]) {
 			case '"':	*last = '"';	break;
 			case '\\':	*last = '\\';	break;
 			case '/':	*last = '/';	break;
@@ -245,20 +522,28 @@ bool JsonParser::_parseStringImpl()
 			case 't':	*last = '\t';	break;
 			case 'u':
 				unsigned codepoint;
-				if(!parseHex4(_it + 2, codepoint))
+				if(!parseHex4(it + 2, codepoint)) {
+					errMsg = "Invalid unicode escape";
 					return false;
+				}
 
 				// Reference:
 				// http://www.russellcottrell.com/greek/utilities/SurrogatePairCalculator.htm
 				if(codepoint >= 0xD800 && codepoint <= 0xDBFF) {	// Detect hight-surrogate code point
-					_it += 6;
-					if(_it[0] != '\\' || _it[1] != 'u')				// Expecting low-surrogate code point
+					it += 6;
+					if(it[0] != '\\' || it[1] != 'u') {				// Expecting low-surrogate code point
+						errMsg = "Invalid unicode escape";
 						return false;
+					}
 					unsigned codepoint2;
-					if(!parseHex4(_it + 2, codepoint2))
+					if(!parseHex4(it + 2, codepoint2)) {
+						errMsg = "Invalid unicode escape";
 						return false;
-					if(codepoint2 < 0xDC00 || codepoint2 > 0xDFFF)
+					}
+					if(codepoint2 < 0xDC00 || codepoint2 > 0xDFFF) {
+						errMsg = "Invalid unicode escape";
 						return false;
+					}
 
 					codepoint = (((codepoint - 0xD800) << 10) | (codepoint2 - 0xDC00)) + 0x10000;
 				}
@@ -281,69 +566,179 @@ bool JsonParser::_parseStringImpl()
 					*last++ = (roUtf8)(0x80 | ((codepoint >> 6) & 0x3F));
 					*last   = (roUtf8)(0x80 | (codepoint & 0x3F));
 				}
-				_it += 4;
+				it += 4;
 				break;
 			default:
+				errMsg = "Invalid escape";
 				return false;
 			}
 			++last;
-			_it += 2;
+			it += 2;
+		}
+		else
+			*last++ = *it++;
+	}
+
+	return true;
+}
+
+// The checks of _jsonUnescape() without writing anything, for the raw strings of JsonDocument
+static bool _jsonValidateEscape(const roUtf8* it, const roUtf8* end, const roUtf8*& errMsg)
+{
+	unsigned codepoint;
+	while(it < end) {
+		if((roUint8)*it < '\x20') {
+			errMsg = "Invalid character in string";
+			return false;
+		}
+		if(*it != '\\') {
+			++it;
+			continue;
+		}
+
+		switch(it[1]) {
+		case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+			it += 2;
+			break;
+		case 'u':
+			if(!parseHex4(it + 2, codepoint)) {
+				errMsg = "Invalid unicode escape";
+				return false;
+			}
+			it += 6;
+
+			// A hight-surrogate must be followed by a low-surrogate
+			if(codepoint >= 0xD800 && codepoint <= 0xDBFF) {
+				if(it[0] != '\\' || it[1] != 'u' || !parseHex4(it + 2, codepoint) || codepoint < 0xDC00 || codepoint > 0xDFFF) {
+					errMsg = "Invalid unicode escape";
+					return false;
+				}
+				it += 6;
+			}
+			break;
+		default:
+			errMsg = "Invalid escape";
+			return false;
 		}
-		else if(*_it == '"') {
-			*last = '\0';
-			++_it;
+	}
+
+	return true;
+}
+
+bool JsonParser::_parseStringImpl(roUtf8*& it, bool raw)
+{
+	roAssert(*it == '"');
+	++it;
+	roUtf8* first = it;
+
+	// Fast path up to the first escape, nothing need to move
+#if roCPU_SSE
+	while(it + 16 <= _strEnd) {
+		const __m128i c = _mm_loadu_si128((const __m128i*)it);
+		const __m128i stop = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('"')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\\'))),
+			_mm_cmpeq_epi8(_mm_max_epu8(c, _mm_set1_epi8(0x1F)), _mm_set1_epi8(0x1F)));	// Control characters
+		const roUint32 mask = _mm_movemask_epi8(stop);
+		if(mask) {
+			it += _jsonCountTrailingZero(mask);
 			break;
 		}
-		else
-			*last++ = *_it++;
+		it += 16;
 	}
+#endif
 
+	while(*it != '"' && *it != '\\') {
+		if((roUint8)*it < '\x20')	// Control characters not allowed
+			return _onError(roStatus::json_parse_error, "Invalid character in string");
+		++it;
+	}
+
+	// The string is modified in place below, the stage 1 must be done with it before
+	roUtf8* end = it;
+	while(*end && *end != '"') {
+		if(*end == '\\' && end[1])
+			++end;
+		++end;
+	}
+	if(*end != '"')
+		return _onError(roStatus::json_parse_error, "Unterminated string");
+	if(!raw && roSize(end - _str) >= _indexState.pos) {
+		roAssert(_idx == _idxEnd);	// A string contains no structural character
+		if(!_indexNextChunk())
+			return false;
+	}
+
+	if(raw) {
+		const roUtf8* errMsg = NULL;
+		if(it != end && !_jsonValidateEscape(it, end, errMsg))
+			return _onError(roStatus::json_parse_error, errMsg);
+		_stringVal = first;
+		_stringValLen = end - first;
+		_rawEscaped = (it != end);
+		it = end + 1;
+		return true;
+	}
+
+	roUtf8* last = NULL;
+	const roUtf8* errMsg = NULL;
+	if(!_jsonUnescape(it, end, last, errMsg))
+		return _onError(roStatus::json_parse_error, errMsg);
+	it = end + 1;
+
+	// The closing quote is never a structural character, safe to overwrite
+	*last = '\0';
 	_stringVal = first;
 	_stringValLen = last - first;
 	return true;
 }
 
-bool JsonParser::_parseNumber()
+struct _JsonNumber
+{
+	JsonParser::Event::Enum type;
+	union { roInt64 int64Val; roUint64 uint64Val; double doubleVal; };
+};
+
+static bool _jsonParseNumber(const roUtf8*& it, _JsonNumber& n)
 {
 	bool minus = false;
-	if(*_it == '-') {
+	if(*it == '-') {
 		minus = true;
-		++_it;
+		++it;
 	}
-	else if(*_it == '+')
-		++_it;
+	else if(*it == '+')
+		++it;
 
 	// Take away any leading zero
-	while(*_it == '0')
-		++_it;
+	while(*it == '0')
+		++it;
 
 	// Try parse as int64
 	roUint64 i = 0;
 	bool useDouble = false;
-	if(*_it >= '1' && *_it <= '9') {
-		i = *_it - '0';
-		++_it;
+	if(*it >= '1' && *it <= '9') {
+		i = *it - '0';
+		++it;
 
 		if(minus) {
-			while(*_it >= '0' && *_it <= '9') {
+			while(*it >= '0' && *it <= '9') {
 				if(i >= 922337203685477580uLL)	// 2^63 = 9223372036854775808
-					if (i != 922337203685477580uLL || *_it > '8') {
+					if (i != 922337203685477580uLL || *it > '8') {
 						useDouble = true;
 						break;
 					}
-				i = i * 10 + (*_it - '0');
-				++_it;
+				i = i * 10 + (*it - '0');
+				++it;
 			}
 		}
 		else {
-			while(*_it >= '0' && *_it <= '9') {
+			while(*it >= '0' && *it <= '9') {
 				if(i >= 1844674407370955161uLL)	// 2^64 - 1 = 18446744073709551615
-					if (i != 1844674407370955161uLL || *_it > '5') {
+					if (i != 1844674407370955161uLL || *it > '5') {
 						useDouble = true;
 						break;
 					}
-				i = i * 10 + (*_it - '0');
-				++_it;
+				i = i * 10 + (*it - '0');
+				++it;
 			}
 		}
 	}
@@ -352,62 +747,62 @@ bool JsonParser::_parseNumber()
 	double d = 0.0;
 	if (useDouble) {
 		d = (double)i;
-		while(*_it >= '0' && *_it <= '9') {
+		while(*it >= '0' && *it <= '9') {
 			if(d >= 1E307)	// Even double cannot store the number 
 				return false;
-			d = d * 10 + (*_it - '0');
-			++_it;
+			d = d * 10 + (*it - '0');
+			++it;
 		}
 	}
 
 	int expFrac = 0;
-	if(*_it == '.') {
+	if(*it == '.') {
 		if(!useDouble) {
 			d = (double)i;
 			useDouble = true;
 		}
-		++_it;
+		++it;
 
-		if(*_it >= '0' && *_it <= '9') {
-			d = d * 10 + (*_it - '0');
-			++_it;
+		if(*it >= '0' && *it <= '9') {
+			d = d * 10 + (*it - '0');
+			++it;
 			--expFrac;
 		}
 		else
 			return false;
 
-		while(*_it >= '0' && *_it <= '9') {
+		while(*it >= '0' && *it <= '9') {
 			if(expFrac > -16) {
-				d = d * 10 + (*_it - '0');
+				d = d * 10 + (*it - '0');
 				--expFrac;
 			}
-			++_it;
+			++it;
 		}
 	}
 
 	// Parse exp = e [ minus / plus ] 1*DIGIT
 	int exp = 0;
-	if(*_it == 'e' || *_it == 'E') {
+	if(*it == 'e' || *it == 'E') {
 		if(!useDouble) {
 			d = (double)i;
 			useDouble = true;
 		}
-		++_it;
+		++it;
 
 		bool expMinus = false;
-		if(*_it == '+')
-			++_it;
-		else if(*_it == '-') {
-			++_it;
+		if(*it == '+')
+			++it;
+		else if(*it == '-') {
+			++it;
 			expMinus = true;
 		}
 
-		if(*_it >= '0' && *_it <= '9') {
-			exp = *_it - '0';
-			++_it;
-			while(*_it >= '0' && *_it <= '9') {
-				exp = exp * 10 + (*_it - '0');
-				++_it;
+		if(*it >= '0' && *it <= '9') {
+			exp = *it - '0';
+			++it;
+			while(*it >= '0' && *it <= '9') {
+				exp = exp * 10 + (*it - '0');
+				++it;
 				if(exp > 308)
 					return false;
 			}
@@ -422,43 +817,62 @@ bool JsonParser::_parseNumber()
 	// Finish parsing, call event according to the type of number.
 	if(useDouble) {
 		d *= roPow10d(exp + expFrac);
-		_event = Event::Double;
-		_doubleVal = (minus ? -d : d);
+		n.type = JsonParser::Event::Double;
+		n.doubleVal = (minus ? -d : d);
 	}
 	else {
 		if(minus) {
-			_int64Val = -((roInt64)i);
-			_event = Event::Integer64;
+			n.int64Val = -((roInt64)i);
+			n.type = JsonParser::Event::Integer64;
 		}
 		else {
-			_uint64Val = i;
-			_event = Event::UInteger64;
+			n.uint64Val = i;
+			n.type = JsonParser::Event::UInteger64;
 		}
 	}
 
-	return _valueEnd();
+	return true;
+}
+
+bool JsonParser::_parseNumber(roUtf8*& it)
+{
+	const roUtf8* p = it;
+	_JsonNumber n;
+	if(!_jsonParseNumber(p, n))
+		return false;
+
+	it += p - it;
+	_event = n.type;
+	if(n.type == Event::Double)
+		_doubleVal = n.doubleVal;
+	else if(n.type == Event::Integer64)
+		_int64Val = n.int64Val;
+	else
+		_uint64Val = n.uint64Val;
+
+	return true;
 }
 
-bool JsonParser::_parseNullTrueFalse()
+bool JsonParser::_parseNullTrueFalse(roUtf8*& it)
 {
-	if(_it[0] == 'n' && _it[1] == 'u' && _it[2] == 'l' && _it[3] == 'l') {
+	if(it[0] == 'n' && it[1] == 'u' && it[2] == 'l' && it[3] == 'l') {
 		_event = Event::Null;
-		_it += 4;
+		it += 4;
 	}
-	else if(_it[0] == 't' && _it[1] == 'r' && _it[2] == 'u' && _it[3] == 'e') {
+	else if(it[0] == 't' && it[1] == 'r' && it[2] == 'u' && it[3] == 'e') {
 		_event = Event::Bool;
 		_boolVal = true;
-		_it += 4;
+		it += 4;
 	}
-	else if(_it[0] == 'f' && _it[1] == 'a' && _it[2] == 'l' && _it[3] == 's' && _it[4] == 'e') {
+	else if(it[0] == 'f' && it[1] == 'a' && it[2] == 'l' && it[3] == 's' && it[4] == 'e') {
 		_event = Event::Bool;
 		_boolVal = false;
-		_it += 5;
+		it += 5;
 	}
 	else
 		return false;
 
-	return _valueEnd();
+	return true;
 }
 
 JsonParser::Event::Enum JsonParser::nextEvent()
@@ -466,9 +880,10 @@ JsonParser::Event::Enum JsonParser::nextEvent()
 	if(_event == Event::End || _event == Event::Error)
 		return Event::Error;
 
-	_skipWhiteSpace();
-	if(!(this->*_nextFunc)())
+	if(!_parseNext()) {
+		_state = _State_Error;
 		_event = Event::Error;
+	}
 
 	return _event;
 }
@@ -580,292 +995,634 @@ JsonValue* jsonParseInplace(roUtf8* source, BlockAllocator& allocator, String* e
 	return ret;
 }
 
-//
+// ----------------------------------------------------------------------
+// JsonDocument
+
+JsonDocument::JsonDocument()
+	: _source(NULL)
+{
+	_onError(roStatus::not_initialized, "Please call parse()");
+}
+
+roStatus JsonDocument::parse(const roUtf8* source)
+{
+	_tmpStr = source;
+	return parseInplace(_tmpStr.c_str());
+}
+
+static roSize _jsonHashSlotCount(roSize memberCount)
+{
+	roSize slotCount = 1;
+	while(slotCount < memberCount * 2)
+		slotCount *= 2;
+	return slotCount;
+}
+
+// Fibonacci hashing on top of stringHash(), whose low bits alone cluster a lot for names like "item1", "item2"...
+static roSize _jsonHashSlot(const roUtf8* name, roSize slotCount)
+{
+	roSize bits = 0;
+	while((roSize(1) << bits) < slotCount)
+		++bits;
+	return roUint32(stringHash(name, roStrLen(name)) * 2654435769u) >> (32 - bits);
+}
+
+roStatus JsonDocument::parseInplace(roUtf8* source)
+{
+	typedef JsonParser::Event Event;
+
+	if(!source)
+		source = "";
+
+	if(source != _tmpStr.c_str()) {
+		_tmpStr.clear();
+		_tmpStr.condense();
+	}
+
+	_source = source;
+	_nodes.clear();
+	_children.clear();
+	_errStr.clear();
+
+	JsonParser parser;
+	parser.parseInplace(source);
+	parser._raw = true;
+
+	// The children of the opened containers, moved to _children once they are complete
+	struct Opened { roUint32 node; roSize firstPending; };
+	Array<Opened> opened;
+	Array<roUint32> pending;
+	roUint32 name = 0;
+
+	while(true) {
+		const Event::Enum e = parser.nextEvent();
+
+		if(e == Event::Error)
+			return _onError(parser._status, parser.getErrorMessage());
+
+		if(e == Event::End)
+			break;
+
+		// Names are decoded right away by the parser, they are needed for the hash table
+		if(e == Event::Name) {
+			name = num_cast<roUint32>(parser.getName() - source);
+			continue;
+		}
+
+		if(e == Event::EndObject || e == Event::EndArray) {
+			const Opened o = opened.back();
+			opened.popBack();
+
+			const roSize count = pending.size() - o.firstPending;
+			_Node& n = _nodes[o.node];
+			n.range.offset = num_cast<roUint32>(_children.size());
+			n.range.size = num_cast<roUint32>(count);
+			if(!_children.pushBack(pending.typedPtr() + o.firstPending, count))
+				return _onError(roStatus::not_enough_memory, "Out of memory");
+			pending.resizeNoInit(o.firstPending);
+
+			if(e == Event::EndObject && count >= _hashThreshold) {
+				const roSize slotCount = _jsonHashSlotCount(count);
+				const roSize first = _children.size();
+				if(!_children.resize(first + slotCount, 0))
+					return _onError(roStatus::not_enough_memory, "Out of memory");
+
+				roUint32* children = _children.typedPtr() + n.range.offset;
+				roUint32* slots = _children.typedPtr() + first;
+				for(roSize i=0; i<count; ++i) {
+					const roUtf8* memberName = _source + _nodes[children[i]].name;
+					roSize s = _jsonHashSlot(memberName, slotCount);
+					while(slots[s] != 0)
+						s = (s + 1) & (slotCount - 1);
+					slots[s] = roUint32(i + 1);
+				}
+			}
+			continue;
+		}
+
+		_Node n;
+		roMemZeroStruct(n);
+		n.type = roUint8(e);
+		n.name = name;
+		name = 0;
+
+		switch(e) {
+		case Event::Null:
+			break;
+		case Event::Bool:
+			n.boolVal = parser.getBool();
+			break;
+		case Event::String:
+		case Event::Undefined:	// A number
+			n.range.offset = num_cast<roUint32>(parser._stringVal - source);
+			n.range.size = num_cast<roUint32>(parser._stringValLen);
+			n.flags = (e == Event::String && parser._rawEscaped) ? _Flag_Escaped : 0;
+			break;
+		case Event::BeginObject:
+		case Event::BeginArray:
+			break;
+		default:
+			roAssert(false);
+			return _onError(roStatus::json_parse_error, "Unexpected event");
+		}
+
+		const roUint32 index = num_cast<roUint32>(_nodes.size());
+		if(!_nodes.pushBack(n))
+			return _onError(roStatus::not_enough_memory, "Out of memory");
+
+		// The root has no parent
+		if(!opened.isEmpty() && !pending.pushBack(index))
+			return _onError(roStatus::not_enough_memory, "Out of memory");
+
+		if(e == Event::BeginObject || e == Event::BeginArray) {
+			Opened o = { index, pending.size() };
+			if(!opened.pushBack(o))
+				return _onError(roStatus::not_enough_memory, "Out of memory");
+		}
+	}
+
+	return roStatus::ok;
+}
+
+roStatus JsonDocument::_onError(roStatus st, const roUtf8* errMsg)
+{
+	_nodes.clear();
+	_children.clear();
+	_errStr = errMsg;
+	return st;
+}
+
+JsonCursor JsonDocument::root()
+{
+	JsonCursor c;
+	if(_nodes.isEmpty())
+		return c;
+
+	c._doc = this;
+	c._parent = roUint32(-1);
+	return c;
+}
+
+roSize JsonDocument::sizeInByte() const
+{
+	return _nodes.sizeInByte() + _children.sizeInByte();
+}
+
+JsonDocument::_Node* JsonDocument::_decode(roUint32 node)
+{
+	typedef JsonParser::Event Event;
+	_Node& n = _nodes[node];
+
+	if(n.type == Event::Undefined) {
+		const roUtf8* it = _source + n.range.offset;
+		const roUtf8* end = it + n.range.size;
+		_JsonNumber number;
+		if(!_jsonParseNumber(it, number) || it != end) {
+			n.type = roUint8(Event::Error);
+			return NULL;
+		}
+
+		n.type = roUint8(number.type);
+		n.uint64Val = number.uint64Val;	// Copy the whole union
+	}
+	else if(n.type == Event::String && !(n.flags & _Flag_Decoded)) {
+		roUtf8* first = _source + n.range.offset;
+		roUtf8* last = first + n.range.size;
+		const roUtf8* errMsg = NULL;
+		if((n.flags & _Flag_Escaped) && !_jsonUnescape(first, first + n.range.size, last, errMsg)) {
+			n.type = roUint8(Event::Error);
+			return NULL;
+		}
+
+		// Replacing the closing quote
+		*last = '\0';
+		n.range.size = num_cast<roUint32>(last - first);
+		n.flags |= _Flag_Decoded;
+	}
+	else if(n.type == Event::Error)
+		return NULL;
+
+	return &n;
+}
+
+// ----------------------------------------------------------------------
+// JsonCursor
+
+JsonParser::Event::Enum JsonCursor::type() const
+{
+	if(!_doc) return JsonParser::Event::Undefined;
+	const JsonDocument::_Node* n = _doc->_decode(_node);
+	return n ? JsonParser::Event::Enum(n->type) : JsonParser::Event::Error;
+}
+
+const roUtf8* JsonCursor::name() const
+{
+	if(!_doc) return NULL;
+	const roUint32 name = _doc->_nodes[_node].name;
+	return name ? _doc->_source + name : NULL;
+}
+
+bool JsonCursor::getBool() const
+{
+	if(!_doc) return false;
+	const JsonDocument::_Node& n = _doc->_nodes[_node];
+	return n.type == JsonParser::Event::Bool && n.boolVal;
+}
+
+const roUtf8* JsonCursor::getString() const
+{
+	if(!_doc) return NULL;
+	const JsonDocument::_Node* n = _doc->_decode(_node);
+	if(!n || n->type != JsonParser::Event::String) return NULL;
+	return _doc->_source + n->range.offset;
+}
+
+roSize JsonCursor::getStringLen() const
+{
+	if(!_doc) return 0;
+	const JsonDocument::_Node* n = _doc->_decode(_node);
+	if(!n || n->type != JsonParser::Event::String) return 0;
+	return n->range.size;
+}
+
+bool JsonCursor::isNumber() const
+{
+	const JsonParser::Event::Enum e = type();
+	return e == JsonParser::Event::Integer64 || e == JsonParser::Event::UInteger64 || e == JsonParser::Event::Double;
+}
+
+roSize JsonCursor::size() const
+{
+	if(!_doc) return 0;
+	const JsonDocument::_Node& n = _doc->_nodes[_node];
+	if(n.type != JsonParser::Event::BeginObject && n.type != JsonParser::Event::BeginArray)
+		return 0;
+	return n.range.size;
+}
+
+JsonCursor JsonCursor::child(roSize i) const
+{
+	JsonCursor c;
+	if(i >= size())
+		return c;
+
+	const JsonDocument::_Node& n = _doc->_nodes[_node];
+	c._doc = _doc;
+	c._node = _doc->_children[n.range.offset + i];
+	c._parent = _node;
+	c._index = roUint32(i);
+	return c;
+}
+
+JsonCursor JsonCursor::member(const roUtf8* name) const
+{
+	if(!_doc || !name || _doc->_nodes[_node].type != JsonParser::Event::BeginObject)
+		return JsonCursor();
+
+	const JsonDocument::_Node& n = _doc->_nodes[_node];
+	const roUint32* children = _doc->_children.typedPtr() + n.range.offset;
+	const roSize count = n.range.size;
+
+	if(count < JsonDocument::_hashThreshold) {
+		for(roSize i=0; i<count; ++i)
+			if(roStrCmp(_doc->_source + _doc->_nodes[children[i]].name, name) == 0)
+				return child(i);
+		return JsonCursor();
+	}
+
+	const roSize slotCount = _jsonHashSlotCount(count);
+	const roSize mask = slotCount - 1;
+	const roUint32* slots = children + count;
+	for(roSize s = _jsonHashSlot(name, slotCount); slots[s] != 0; s = (s + 1) & mask) {
+		const roSize i = slots[s] - 1;
+		if(roStrCmp(_doc->_source + _doc->_nodes[children[i]].name, name) == 0)
+			return child(i);
+	}
+
+	return JsonCursor();
+}
+
+JsonCursor JsonCursor::nextSibling() const
+{
+	if(!_doc || _parent == roUint32(-1))
+		return JsonCursor();
+
+	JsonCursor parent;
+	parent._doc = _doc;
+	parent._node = _parent;
+	return parent.child(_index + 1);
+}
+
+// ----------------------------------------------------------------------
+// JsonWriter
+
 JsonWriter::JsonWriter(OStream* stream)
 	: _stream(stream)
 	, _beginDocument(false)
+	, _pretty(false)
+	, _begin(NULL)
+	, _cur(NULL)
+	, _end(NULL)
 {}
 
 JsonWriter::~JsonWriter()
 {
 	roAssert(!_beginDocument);
+	_commit();
 }
 
 void JsonWriter::setStream(OStream* stream)
 {
+	_commit();
 	_stream = stream;
 }
 
+void JsonWriter::setPretty(bool pretty)
+{
+	_pretty = pretty;
+}
+
 void JsonWriter::beginDocument()
 {
 	roAssert(_stream);
 	_beginDocument = true;
-	_strBuf.clear();
+	_stateStack.clear();
 }
 
-void JsonWriter::endDocument()
+roStatus JsonWriter::endDocument()
 {
 	_beginDocument = false;
 	roAssert(_stateStack.size() == 0);
-	roAssert(_strBuf.isEmpty());
+	return _commit();
 }
 
-roStatus JsonWriter::flushStrBuf()
+roStatus JsonWriter::flush()
 {
-	if(!_stream) return roStatus::pointer_is_null;
-	roStatus st = _stream->write(_strBuf.c_str(), _strBuf.size());
-	if(!st) return st;
-	_strBuf.clear();
-	return st;
+	return _commit();
 }
 
-struct JsonString
+roStatus JsonWriter::_reserve(roSize bytes)
 {
-	JsonString(const roUtf8* str) : buf((roByte*)str), bufLen(roStrLen(str)) {}
-	JsonString(const roByte* b, roSize l) : buf(b), bufLen(l) {}
-	JsonString(const RangedString& str) : buf((const roByte*)str.begin), bufLen(str.size()) {}
-	const roByte* buf;
-	roSize bufLen;
-};
-
-static void _strFormat_JsonString(String& str, JsonString* val, const roUtf8* options)
-{
-	if(!val) return;
-
-	// Perform escape
-	static const StaticArray<char, 16> hexDigits = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
-	static const StaticArray<char, 256> escape = {
-	#define Z16 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
-		//0    1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
-		'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',	// 00
-		'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',	// 10
-		  0,   0, '"',   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	// 20
-		Z16, Z16,																		// 30~4F
-		  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,'\\',   0,   0,   0,	// 50
-		Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16								// 60~FF
-	#undef Z16
-	};
-
-	str.reserve(str.size() + val->bufLen);
-
-	for(roSize i=0; i < val->bufLen; ++i) {
-		roUtf8 c = val->buf[i];
-		roUint8 esc = escape[(roUint8)c];
-		if((sizeof(*val) == 1 || (unsigned)c < 256) && esc) {
-			str.append('\\');
-			str.append(esc);
-			if(esc == 'u') {
-				str.append('0', 2);
-				str.append(hexDigits[(roUint8)c >> 4]);
-				str.append(hexDigits[(roUint8)c & 0xF]);
-			}
-		}
-		else
-			str.append(c);
-	}
-}
+	if(roSize(_end - _cur) >= bytes)
+		return roStatus::ok;
 
-static roPtrInt _strFormatFunc(const JsonString& val) {
-	return (roPtrInt)_strFormat_JsonString;
-}
-
-roStatus JsonWriter::beginObject(const roUtf8* name)
-{
-	roStatus st = flushStrBuf();
+	if(!_stream) return roStatus::pointer_is_null;
+	roStatus st = _commit();
 	if(!st) return st;
 
-	if(name) {
-		roAssert(_stateStack.back() == JsonWriter::_inObject);
-		st = strFormat(_strBuf, "\"{}\":{}", JsonString(name), "{");
+	roSize size = 0;
+	st = _stream->reserveWrite(bytes > _chunkSize ? bytes : _chunkSize, _begin, size);
+	if(!st) {
+		_begin = NULL;
+		return st;
 	}
-	else
-		st = _strBuf.assign("{");
 
-	if(!st) return st;
-	_stateStack.pushBack(_inObject);
+	_cur = _begin;
+	_end = _begin + size;
 	return st;
 }
 
-roStatus JsonWriter::endObject()
+roStatus JsonWriter::_commit()
 {
-	roAssert(_stateStack.back() == _inObject);
-	if(!_stream) return roStatus::pointer_is_null;
-
-	if(!_strBuf.isEmpty() && _strBuf.back() == ',')
-		_strBuf.decSize(1);
-
-	roStatus st = flushStrBuf();
-	if(!st) return st;
-
-	if(_stateStack.size() == 1)
-		st = _stream->write("}\0");
-	else
-		st = _strBuf.assign("},");
+	if(!_begin)
+		return roStatus::ok;
 
-	if(!st) return st;
-	_stateStack.popBack();
+	roStatus st = _stream->commitWrite(_cur - _begin);
+	_begin = _cur = _end = NULL;
 	return st;
 }
 
-roStatus JsonWriter::writeNull(const roUtf8* name)
+// Have room for depth + 1 bytes
+void JsonWriter::_newLine(roSize depth)
 {
-	roAssert(_stateStack.back() == _inObject);
-	roStatus st = flushStrBuf();
-	if(!st) return st;
-	return strFormat(_strBuf, "\"{}\":null,", JsonString(name));
+	*_cur++ = '\n';
+	for(roSize i=0; i<depth; ++i)
+		*_cur++ = '\t';
 }
 
-template<typename T>
-static roStatus writeNumbers(JsonWriter& writer, const roUtf8* name, T val)
+roStatus JsonWriter::_beginValue(const roUtf8* name)
 {
-	roAssert(writer._stateStack.back() == JsonWriter::_inObject);
-	roStatus st = writer.flushStrBuf();
+	const roSize depth = _stateStack.size();
+	roStatus st = _reserve(depth + 2);
 	if(!st) return st;
-	return strFormat(writer._strBuf, "\"{}\":{},", JsonString(name), val);
-}
 
-roStatus JsonWriter::write(const roUtf8* name, roInt8 val)		{ return writeNumbers(*this, name, val); }
-roStatus JsonWriter::write(const roUtf8* name, roInt16 val)		{ return writeNumbers(*this, name, val); }
-roStatus JsonWriter::write(const roUtf8* name, roInt32 val)		{ return writeNumbers(*this, name, val); }
-roStatus JsonWriter::write(const roUtf8* name, roInt64 val)		{ return writeNumbers(*this, name, val); }
-roStatus JsonWriter::write(const roUtf8* name, roUint8 val)		{ return writeNumbers(*this, name, val); }
-roStatus JsonWriter::write(const roUtf8* name, roUint16 val)	{ return writeNumbers(*this, name, val); }
-roStatus JsonWriter::write(const roUtf8* name, roUint32 val)	{ return writeNumbers(*this, name, val); }
-roStatus JsonWriter::write(const roUtf8* name, roUint64 val)	{ return writeNumbers(*this, name, val); }
-roStatus JsonWriter::write(const roUtf8* name, float val)		{ return writeNumbers(*this, name, val); }
-roStatus JsonWriter::write(const roUtf8* name, double val)		{ return writeNumbers(*this, name, val); }
+	if(depth) {
+		Level& level = _stateStack.back();
+		if(level.hasValue)
+			*_cur++ = ',';
+		level.hasValue = true;
+		if(_pretty)
+			_newLine(depth);
+	}
 
-roStatus JsonWriter::write(const roUtf8* name, bool val)
-{
-	roAssert(_stateStack.back() == _inObject);
-	roStatus st = flushStrBuf();
+	if(!name)
+		return roStatus::ok;
+
+	st = _writeString((const roByte*)name, roStrLen(name));
+	if(!st) return st;
+	st = _reserve(2);
 	if(!st) return st;
-	return strFormat(_strBuf, "\"{}\":{},", name, val ? "true" : "false");
+
+	*_cur++ = ':';
+	if(_pretty)
+		*_cur++ = ' ';
+	return st;
 }
 
-roStatus JsonWriter::write(const roUtf8* name, const roUtf8* val)
+roStatus JsonWriter::_beginScalar(const roUtf8* name, roSize maxBytes)
 {
-	roAssert(_stateStack.back() == _inObject);
-	roStatus st = flushStrBuf();
+	roAssert(!_stateStack.isEmpty() && _stateStack.back().state == (name ? _inObject : _inArray));
+	roStatus st = _beginValue(name);
 	if(!st) return st;
-
-	return strFormat(_strBuf, "\"{}\":\"{}\",", JsonString(name), JsonString(val));
+	return _reserve(maxBytes);
 }
 
-roStatus JsonWriter::write(const roUtf8* name, const RangedString& val)
+roStatus JsonWriter::_beginContainer(const roUtf8* name, State state, roUtf8 c)
 {
-	roAssert(_stateStack.back() == _inObject);
-	roStatus st = flushStrBuf();
+	roAssert(!name || _stateStack.back().state == _inObject);
+	roStatus st = _beginValue(name);
+	if(!st) return st;
+	st = _reserve(1);
 	if(!st) return st;
 
-	return strFormat(_strBuf, "\"{}\":\"{}\",", JsonString(name), JsonString(val));
+	*_cur++ = c;
+	Level level = { state, false };
+	return _stateStack.pushBack(level);
 }
 
-roStatus JsonWriter::write(const roUtf8* name, const roByte* buf, roSize bufLen)
+roStatus JsonWriter::_endContainer(State state, roUtf8 c)
 {
-	roAssert(_stateStack.back() == _inObject);
-	roStatus st = flushStrBuf();
+	roAssert(!_stateStack.isEmpty() && _stateStack.back().state == state);
+	const roSize depth = _stateStack.size();
+	roStatus st = _reserve(depth + 2);
 	if(!st) return st;
 
-	return strFormat(_strBuf, "\"{}\":\"{}\",", JsonString(name), JsonString(buf, bufLen));
+	if(_pretty && _stateStack.back().hasValue)
+		_newLine(depth - 1);
+	*_cur++ = c;
+	_stateStack.popBack();
+
+	if(!_stateStack.isEmpty())
+		return st;
+
+	// End of the root value
+	*_cur++ = '\0';
+	return _commit();
 }
 
-roStatus JsonWriter::beginArray(const roUtf8* name)
+static const StaticArray<char, 16> _jsonHexDigits = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+static const StaticArray<roUtf8, 256> _jsonEscape = {
+#define Z16 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+	//0    1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',	// 00
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',	// 10
+	  0,   0, '"',   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	// 20
+	Z16, Z16,																		// 30~4F
+	  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,'\\',   0,   0,   0,	// 50
+	Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16, Z16								// 60~FF
+#undef Z16
+};
+
+// Quoted and escaped, the runs needing no escape are copied as a whole.
+// The room reserved is always enough for the rest of the string without escape plus the closing quote.
+roStatus JsonWriter::_writeString(const roByte* str, roSize len)
 {
-	roStatus st = flushStrBuf();
+	roStatus st = _reserve(len + 2);
 	if(!st) return st;
 
-	if(name) {
-		roAssert(_stateStack.back() == _inObject);
-		st = strFormat(_strBuf, "\"{}\":[", JsonString(name));
+	*_cur++ = '"';
+	const roByte* end = str + len;
+	while(str < end) {
+		const roByte* run = str;
+		while(str < end && !_jsonEscape[*str])
+			++str;
+		roMemcpy(_cur, run, str - run);
+		_cur += str - run;
+
+		if(str == end)
+			break;
+
+		st = _reserve(6 + (end - str) + 1);
+		if(!st) return st;
+
+		const roByte c = *(str++);
+		const roUtf8 esc = _jsonEscape[c];
+		*_cur++ = '\\';
+		*_cur++ = esc;
+		if(esc == 'u') {
+			*_cur++ = '0';
+			*_cur++ = '0';
+			*_cur++ = _jsonHexDigits[c >> 4];
+			*_cur++ = _jsonHexDigits[c & 0xF];
+		}
 	}
-	else
-		st = _strBuf.assign("[");
 
-	if(!st) return st;
-	_stateStack.pushBack(_inArray);
+	*_cur++ = '"';
 	return st;
 }
 
-roStatus JsonWriter::endArray()
+roStatus JsonWriter::_writeLiteral(const roUtf8* name, const roUtf8* literal, roSize len)
 {
-	roAssert(_stateStack.back() == _inArray);
-	if(!_stream) return roStatus::pointer_is_null;
-
-	if(!_strBuf.isEmpty() && _strBuf.back() == ',')
-		_strBuf.decSize(1);
-
-	roStatus st = flushStrBuf();
-	if(!st) return st;
-
-	st = _strBuf.assign("],");
+	roStatus st = _beginScalar(name, len);
 	if(!st) return st;
-
-	_stateStack.popBack();
+	roMemcpy(_cur, literal, len);
+	_cur += len;
 	return st;
 }
 
-roStatus JsonWriter::writeNull()
+roStatus JsonWriter::_writeInt(const roUtf8* name, roInt64 val)
 {
-	roAssert(_stateStack.back() == _inArray);
-	roStatus st = flushStrBuf();
+	roStatus st = _beginScalar(name, 20);
 	if(!st) return st;
-	return _strBuf.append("null,");
+	_cur = (roByte*)roI64toa(val, (char*)_cur);
+	return st;
 }
 
-template<typename T>
-static roStatus writeNumbers(JsonWriter& writer, T val)
+roStatus JsonWriter::_writeUint(const roUtf8* name, roUint64 val)
 {
-	roAssert(writer._stateStack.back() == JsonWriter::_inArray);
-	roStatus st = writer.flushStrBuf();
+	roStatus st = _beginScalar(name, 20);
 	if(!st) return st;
-	return strFormat(writer._strBuf, "{},", val);
+	_cur = (roByte*)roU64toa(val, (char*)_cur);
+	return st;
 }
 
-roStatus JsonWriter::write(roInt8 val)		{ return writeNumbers(*this, val); }
-roStatus JsonWriter::write(roInt16 val)		{ return writeNumbers(*this, val); }
-roStatus JsonWriter::write(roInt32 val)		{ return writeNumbers(*this, val); }
-roStatus JsonWriter::write(roInt64 val)		{ return writeNumbers(*this, val); }
-roStatus JsonWriter::write(roUint8 val)		{ return writeNumbers(*this, val); }
-roStatus JsonWriter::write(roUint16 val)	{ return writeNumbers(*this, val); }
-roStatus JsonWriter::write(roUint32 val)	{ return writeNumbers(*this, val); }
-roStatus JsonWriter::write(roUint64 val)	{ return writeNumbers(*this, val); }
-roStatus JsonWriter::write(float val)		{ return writeNumbers(*this, val); }
-roStatus JsonWriter::write(double val)		{ return writeNumbers(*this, val); }
+// False for infinity and NaN, which JSON cannot represent
+static bool _jsonIsFinite(double val)
+{
+	return val - val == 0;
+}
 
-roStatus JsonWriter::write(bool val)
+roStatus JsonWriter::_writeFloat(const roUtf8* name, float val)
 {
-	roAssert(_stateStack.back() == _inArray);
-	roStatus st = flushStrBuf();
+	if(!_jsonIsFinite(val))
+		return _writeLiteral(name, "null", 4);
+
+	roStatus st = _beginScalar(name, 25);
 	if(!st) return st;
-	return strFormat(_strBuf, "{},", val ? "true" : "false");
+	_cur = (roByte*)roFtoa(val, (char*)_cur);
+	return st;
 }
 
-roStatus JsonWriter::write(const roUtf8* val)
+roStatus JsonWriter::_writeDouble(const roUtf8* name, double val)
 {
-	roAssert(_stateStack.back() == _inArray);
-	roStatus st = flushStrBuf();
-	if(!st) return st;
+	if(!_jsonIsFinite(val))
+		return _writeLiteral(name, "null", 4);
 
-	return strFormat(_strBuf, "\"{}\",", JsonString(val));
+	roStatus st = _beginScalar(name, 25);
+	if(!st) return st;
+	_cur = (roByte*)roDtoa(val, (char*)_cur);
+	return st;
 }
 
-roStatus JsonWriter::write(const RangedString& val)
+roStatus JsonWriter::beginObject(const roUtf8* name)	{ return _beginContainer(name, _inObject, '{'); }
+roStatus JsonWriter::endObject()						{ return _endContainer(_inObject, '}'); }
+roStatus JsonWriter::beginArray(const roUtf8* name)		{ return _beginContainer(name, _inArray, '['); }
+roStatus JsonWriter::endArray()							{ return _endContainer(_inArray, ']'); }
+
+roStatus JsonWriter::writeNull(const roUtf8* name)					{ return _writeLiteral(name, "null", 4); }
+roStatus JsonWriter::write(const roUtf8* name, bool val)			{ return val ? _writeLiteral(name, "true", 4) : _writeLiteral(name, "false", 5); }
+roStatus JsonWriter::write(const roUtf8* name, roInt8 val)			{ return _writeInt(name, val); }
+roStatus JsonWriter::write(const roUtf8* name, roInt16 val)			{ return _writeInt(name, val); }
+roStatus JsonWriter::write(const roUtf8* name, roInt32 val)			{ return _writeInt(name, val); }
+roStatus JsonWriter::write(const roUtf8* name, roInt64 val)			{ return _writeInt(name, val); }
+roStatus JsonWriter::write(const roUtf8* name, roUint8 val)			{ return _writeUint(name, val); }
+roStatus JsonWriter::write(const roUtf8* name, roUint16 val)		{ return _writeUint(name, val); }
+roStatus JsonWriter::write(const roUtf8* name, roUint32 val)		{ return _writeUint(name, val); }
+roStatus JsonWriter::write(const roUtf8* name, roUint64 val)		{ return _writeUint(name, val); }
+roStatus JsonWriter::write(const roUtf8* name, float val)			{ return _writeFloat(name, val); }
+roStatus JsonWriter::write(const roUtf8* name, double val)			{ return _writeDouble(name, val); }
+
+roStatus JsonWriter::write(const roUtf8* name, const roUtf8* val)
 {
-	roAssert(_stateStack.back() == _inArray);
-	roStatus st = flushStrBuf();
-	if(!st) return st;
+	return write(name, (const roByte*)val, roStrLen(val));
+}
 
-	return strFormat(_strBuf, "\"{}\",", JsonString(val));
+roStatus JsonWriter::write(const roUtf8* name, const RangedString& val)
+{
+	return write(name, (const roByte*)val.begin, val.size());
 }
 
-roStatus JsonWriter::write(const roByte* buf, roSize bufLen)
+roStatus JsonWriter::write(const roUtf8* name, const roByte* buf, roSize bufLen)
 {
-	roAssert(_stateStack.back() == _inArray);
-	roStatus st = flushStrBuf();
+	roStatus st = _beginScalar(name, 0);
 	if(!st) return st;
-
-	return strFormat(_strBuf, "\"{}\",", JsonString(buf, bufLen));
+	return _writeString(buf, bufLen);
 }
 
+roStatus JsonWriter::writeNull()					{ return writeNull(NULL); }
+roStatus JsonWriter::write(bool val)				{ return write(NULL, val); }
+roStatus JsonWriter::write(roInt8 val)				{ return _writeInt(NULL, val); }
+roStatus JsonWriter::write(roInt16 val)				{ return _writeInt(NULL, val); }
+roStatus JsonWriter::write(roInt32 val)				{ return _writeInt(NULL, val); }
+roStatus JsonWriter::write(roInt64 val)				{ return _writeInt(NULL, val); }
+roStatus JsonWriter::write(roUint8 val)				{ return _writeUint(NULL, val); }
+roStatus JsonWriter::write(roUint16 val)			{ return _writeUint(NULL, val); }
+roStatus JsonWriter::write(roUint32 val)			{ return _writeUint(NULL, val); }
+roStatus JsonWriter::write(roUint64 val)			{ return _writeUint(NULL, val); }
+roStatus JsonWriter::write(float val)				{ return _writeFloat(NULL, val); }
+roStatus JsonWriter::write(double val)				{ return _writeDouble(NULL, val); }
+roStatus JsonWriter::write(const roUtf8* val)		{ return write(NULL, val); }
+roStatus JsonWriter::write(const RangedString& val)	{ return write(NULL, val); }
+roStatus JsonWriter::write(const roByte* buf, roSize bufLen)	{ return write(NULL, buf, bufLen); }
+
 }   // namespace ro
@@ -10,8 +10,26 @@ namespace ro {
 
 struct OStream;
 
+/// Stage 1 of the parser: the offsets of all the structural characters ({}[]:,) outside strings,
+/// plus the start of every string (its opening quote) and other scalars, in document order.
+/// Works on 64 bytes blocks with SSE2 (AVX2 when compiled for it): escapes and quotes are turned
+/// into bit masks, and a prefix xor of the quotes give the in-string mask without any branch.
+/// Fail with json_parse_error if the document end inside a string.
+roStatus jsonStructuralIndex(const roUtf8* json, roSize size, Array<roUint32>& indices);
+
+/// What the stage 1 carry from one 64 bytes block to the next
+struct _JsonIndexState
+{
+	roSize pos;			///< Of the next block
+	roUint64 escaped;	///< The first byte of the next block is escaped
+	roUint64 inString;	///< All ones if the previous block end inside a string
+	roUint64 scalar;	///< The last byte of the previous block is part of a scalar
+};
+
 // See RFC4627:
 // http://tools.ietf.org/html/rfc4627
+/// nextEvent() jump from one structural character to the next, validating the grammar as it goes,
+/// with the stage 1 indexing a small chunk ahead of it.
 struct JsonParser : private NonCopyable
 {
 	struct Event { enum Enum {
@@ -57,34 +75,37 @@ struct JsonParser : private NonCopyable
 	const roUtf8*	getErrorMessage()		{ roAssert(_event == Event::Error); return _errStr.c_str(); }
 
 // Private
-	void			_skipWhiteSpace();
-	bool			_unInitializedCallback();
-	bool			_parseRoot();
-	bool			_parseBeginObject();
-	bool			_parseEndObject();
-	bool			_parseEnd();
-	bool			_parseBeginArray();
-	bool			_parseEndArray();
-	bool			_parseValue();
-	bool			_valueEnd();
-	bool			_parseName();
-	bool			_parseString();
-	bool			_parseStringImpl();
-	bool			_parseNumber();
-	bool			_parseNullTrueFalse();
+	/// What the next structural character should be
+	enum _State { _State_Error, _State_Root, _State_Value, _State_ObjectBegin, _State_ArrayBegin, _State_Name, _State_ValueEnd, _State_End };
+
+	bool			_parseNext();
+	bool			_indexNextChunk();
+	bool			_parseStringImpl(roUtf8*& it, bool raw);
+	bool			_parseNumber(roUtf8*& it);
+	bool			_parseNullTrueFalse(roUtf8*& it);
 	bool			_onError(roStatus st, const roUtf8* errMsg);
 
 	roUtf8*		_str;
-	roUtf8*		_it;
+	roUtf8*		_strEnd;
 	String		_tmpStr;
 	String		_errStr;
 	roStatus	_status;
 	Event::Enum	_event;
+	_State		_state;
+
+	/// Set by JsonDocument after parseInplace(): string values and numbers are only located and
+	/// their syntax checked, with _stringVal and _stringValLen giving the raw text, and numbers
+	/// reported as Event::Undefined
+	bool		_raw;
+	bool		_rawEscaped;	///< The raw string contains some escape
 
 	struct _StackElement { Event::Enum event; roSize elementCount; };
 	Array<_StackElement> _stack;
 
-	bool (JsonParser::*_nextFunc)();
+	_JsonIndexState	_indexState;
+	Array<roUint32>	_indices;	///< Of the structural characters in the current chunk
+	const roUint32*	_idx;
+	const roUint32*	_idxEnd;
 
 	bool		_boolVal;
 	roUtf8*		_stringVal;		roSize		_stringValLen;
@@ -125,6 +146,110 @@ struct BlockAllocator;
 // Dom style parsing
 JsonValue* jsonParseInplace(roUtf8* source, BlockAllocator& allocator, String* errorStr=NULL);
 
+struct JsonDocument;
+
+/// Position of a value in a JsonDocument, giving what JsonValue give but read from the tape on demand.
+/// Cheap to copy, a cursor not pointing to anything (not found, out of bound) is invalid and give nothing.
+struct JsonCursor
+{
+	JsonCursor() : _doc(NULL), _node(0), _parent(0), _index(0) {}
+
+	bool			isValid() const			{ return _doc != NULL; }
+
+	/// Numbers and strings are decoded on the first access, Error if that fail
+	JsonParser::Event::Enum type() const;
+	const roUtf8*	name() const;			///< Null for non object member
+
+	bool			getBool() const;
+	const roUtf8*	getString() const;		///< Null for non string
+	roSize			getStringLen() const;
+
+	template<typename T>
+	roStatus		getNumber(T& val) const;
+	bool			isNumber() const;
+
+	/// Member count for object, element count for array, 0 for the others
+	roSize			size() const;
+
+	/// The i-th element (or member) in O(1)
+	JsonCursor		child(roSize i) const;
+
+	/// Linear search, or a hash table look up for objects with at least JsonDocument::_hashThreshold members
+	JsonCursor		member(const roUtf8* name) const;
+
+	JsonCursor		firstChild() const		{ return child(0); }
+	JsonCursor		nextSibling() const;
+
+// Private
+	JsonDocument* _doc;
+	roUint32 _node;
+	roUint32 _parent;	///< Node of the enclosing container
+	roUint32 _index;	///< In the enclosing container
+};	// JsonCursor
+
+/// Dom style parsing into a compact tape, 16 bytes per value and no pointer.
+/// The values refer to the source by offset, string values are only unescaped and numbers only
+/// converted when they are read through a JsonCursor, hence the source must outlive the document
+/// and reading the same document from multiple threads need synchronization.
+/// Their syntax is checked by parse() all the same, only a number out of range is left to the read.
+///
+/// The children of a container are an array of node index, such that the child look up is O(1),
+/// object with many members have an open addressing hash table (on stringHash() of the name) right after.
+struct JsonDocument : private NonCopyable
+{
+	JsonDocument();
+
+	roStatus		parse(const roUtf8* source);
+
+	/// The source get altered as the values are decoded, but not owned
+	roStatus		parseInplace(roUtf8* source);
+
+	/// Invalid if the parsing failed
+	JsonCursor		root();
+
+	const roUtf8*	getErrorMessage() const	{ return _errStr.c_str(); }
+
+	/// The memory used by the tape, not counting the source
+	roSize			sizeInByte() const;
+
+// Private
+	static const roSize _hashThreshold = 16;
+
+	enum _Flag { _Flag_Escaped = 1, _Flag_Decoded = 2 };
+
+	struct _Range { roUint32 offset, size; };
+
+	struct _Node
+	{
+		roUint8		type;		///< JsonParser::Event::Enum, Undefined for a number not yet decoded
+		roUint8		flags;
+		roUint16	_padding;
+		roUint32	name;		///< Offset in the source, 0 for non object member
+		union {
+			_Range		range;	///< Of the string or number text, of the children for containers
+			bool		boolVal;
+			roInt64		int64Val;
+			roUint64	uint64Val;
+			double		doubleVal;
+		};
+	};
+
+	_Node*			_decode(roUint32 node);
+	roStatus		_onError(roStatus st, const roUtf8* errMsg);
+
+	roUtf8*			_source;
+	String			_tmpStr;
+	String			_errStr;
+	Array<_Node>	_nodes;		///< Root first, then every value in document order
+	Array<roUint32>	_children;	///< For each container, the node index of its children, followed by the hash slots if any
+};	// JsonDocument
+
+/// Write directly into the buffer lent by the OStream (see OStream::reserveWrite()), the filled part
+/// is committed whenever more room is needed, when the root value is closed, and on flush().
+/// Therefore nothing else should write to the stream in the middle of a root value.
+/// Integers are formatted with roI64toa() / roU64toa(), float and double with the shortest digits
+/// reading back to the same value (roFtoa() / roDtoa()), infinity and NaN are written as null.
+/// A '\0' follows the root value, such that the content of a MemoryOStream can be used as a C string.
 struct JsonWriter : private NonCopyable
 {
 	JsonWriter(OStream* stream=NULL);
@@ -132,10 +257,16 @@ struct JsonWriter : private NonCopyable
 
 	void setStream(OStream* stream);
 
+	/// One value per line indented by tabs, compact by default
+	void setPretty(bool pretty);
+
 	void beginDocument();
-	void endDocument();
+	roStatus endDocument();
 	void Reset();
 
+	/// Commit what is written so far to the stream
+	roStatus flush();
+
 // For array
 	roStatus beginArray(const roUtf8* name=NULL);
 	roStatus endArray();
@@ -175,12 +306,36 @@ struct JsonWriter : private NonCopyable
 	roStatus write(const roUtf8* name, const roByte* buf, roSize bufLen);
 
 // Private
-	roStatus flushStrBuf();
+	static const roSize _chunkSize = 4096;	///< Minimum size asked to OStream::reserveWrite()
+	enum State { _inObject, _inArray };
+
+	roStatus _reserve(roSize bytes);
+	roStatus _commit();
+	void _newLine(roSize depth);
+	roStatus _beginValue(const roUtf8* name);
+	roStatus _beginScalar(const roUtf8* name, roSize maxBytes);
+	roStatus _beginContainer(const roUtf8* name, State state, roUtf8 c);
+	roStatus _endContainer(State state, roUtf8 c);
+	roStatus _writeString(const roByte* str, roSize len);
+	roStatus _writeLiteral(const roUtf8* name, const roUtf8* literal, roSize len);
+	roStatus _writeInt(const roUtf8* name, roInt64 val);
+	roStatus _writeUint(const roUtf8* name, roUint64 val);
+	roStatus _writeFloat(const roUtf8* name, float val);
+	roStatus _writeDouble(const roUtf8* name, double val);
+
+	struct Level
+	{
+		State state;
+		bool hasValue;	///< Need a comma before the next value
+	};
+
 	OStream* _stream;
 	bool _beginDocument;
-	String _strBuf;
-	enum State { _inObject, _inArray };
-	Array<State> _stateStack;
+	bool _pretty;
+	roByte* _begin;		///< The region lent by _stream, NULL when nothing is reserved
+	roByte* _cur;
+	roByte* _end;
+	Array<Level> _stateStack;
 };  // JsonWriter
 
 
@@ -214,6 +369,26 @@ roStatus JsonValue::getNumber(T& val)
 	return roStatus::type_mismatch;
 }
 
+template<typename T>
+roStatus JsonCursor::getNumber(T& val) const
+{
+	if(!_doc) return roStatus::type_mismatch;
+
+	const JsonDocument::_Node* n = _doc->_decode(_node);
+	if(!n) return roStatus::json_parse_error;
+
+	if(n->type == JsonParser::Event::Integer64)
+		return roSafeAssign(val, n->int64Val);
+
+	if(n->type == JsonParser::Event::UInteger64)
+		return roSafeAssign(val, n->uint64Val);
+
+	if(n->type == JsonParser::Event::Double)
+		return roSafeAssign(val, n->doubleVal);
+
+	return roStatus::type_mismatch;
+}
+
 }   // namespace ro
 
 #endif	// __roJson_h__
@@ -14,8 +14,7 @@ roStatus JsonOutputSerializer::endArchive()
 {
 	roStatus st = writer.endObject();
 	if(!st) return st;
-	writer.endDocument();
-	return st;
+	return writer.endDocument();
 }
 
 template<class T>
@@ -53,10 +52,12 @@ roStatus JsonOutputSerializer::serialize_object(Field& field, void* fieldParent)
 	const char* name = field.name.isEmpty() ? NULL : field.name.c_str();
 	writer.beginObject(name);
 
+	// The members are relative to the object, not to its parent
+	void* self = const_cast<void*>(field.getConstPtr(fieldParent));
 	for(Field& f : type->fields) {
 		if(!f.type) return roStatus::pointer_is_null;
 		if(f.isConst) continue;	// We simply ignore any const member
-		roStatus st = f.type->serializeFunc(*this, f, fieldParent);
+		roStatus st = f.type->serializeFunc(*this, f, self);
 		if(!st) return st;
 	}
 
@@ -114,6 +115,14 @@ bool JsonOutputSerializer::isArrayEnded()
 
 roStatus JsonInputSerializer::beginArchive()
 {
+	if(document) {
+		_levels.clear();
+		_Level root = { document->root(), 0 };
+		if(root.container.type() != JsonParser::Event::BeginObject)
+			return roStatus::json_missing_root_object;
+		return _levels.pushBack(root);
+	}
+
 	JsonParser::Event::Enum e = parser.nextEvent();
 	parser.nextEvent();	// Make the parser one event ahead of the serialization system
 	return e == JsonParser::Event::BeginObject ? roStatus::ok : roStatus::json_missing_root_object;
@@ -121,6 +130,11 @@ roStatus JsonInputSerializer::beginArchive()
 
 roStatus JsonInputSerializer::endArchive()
 {
+	if(document) {
+		_levels.clear();
+		return roStatus::ok;
+	}
+
 	JsonParser::Event::Enum e = parser.currentEvent();
 	return e == JsonParser::Event::EndObject ? roStatus::ok : roStatus::json_missing_root_object;
 }
@@ -131,6 +145,14 @@ roStatus JsonInputSerializer::serialize_bool(Field& field, void* fieldParent)
 	bool* val = reinterpret_cast<bool*>(field.getPtr(fieldParent));
 	if(!val) return roStatus::pointer_is_null;
 
+	if(document) {
+		JsonCursor c;
+		roStatus st = _next(field.name.c_str(), c); if(!st) return st;
+		if(c.type() != JsonParser::Event::Bool) return roStatus::type_mismatch;
+		*val = c.getBool();
+		return roStatus::ok;
+	}
+
 	roStatus st = _checkName(field); if(!st) return st;
 	*val = parser.getBool();
 	parser.nextEvent();
@@ -144,6 +166,12 @@ roStatus _serialize(JsonInputSerializer& se, Field& field, void* fieldParent)
 	T* val = reinterpret_cast<T*>(field.getPtr(fieldParent));
 	if(!val) return roStatus::pointer_is_null;
 
+	if(se.document) {
+		JsonCursor c;
+		roStatus st = se._next(field.name.c_str(), c); if(!st) return st;
+		return c.getNumber(*val);
+	}
+
 	roStatus st = se._checkName(field); if(!st) return st;
 	st = se.parser.getNumber(*val); if(!st) return st;
 	se.parser.nextEvent();
@@ -168,6 +196,13 @@ roStatus JsonInputSerializer::serialize_string(Field& field, void* fieldParent)
 	const roUtf8** val = reinterpret_cast<const roUtf8**>(field.getPtr(fieldParent));
 	if(!val) return roStatus::pointer_is_null;
 
+	if(document) {
+		JsonCursor c;
+		roStatus st = _next(field.name.c_str(), c); if(!st) return st;
+		*val = c.getString();
+		return *val ? roStatus::ok : roStatus::json_expect_string;
+	}
+
 	roStatus st = _checkName(field); if(!st) return st;
 	*val = parser.getString();
 	parser.nextEvent();
@@ -179,6 +214,27 @@ roStatus JsonInputSerializer::serialize_object(Field& field, void* fieldParent)
 	Type* type = field.type;
 	if(!type) return roStatus::pointer_is_null;
 
+	// The members are relative to the object, not to its parent
+	void* self = field.getPtr(fieldParent);
+	if(!self) return roStatus::pointer_is_null;
+
+	if(document) {
+		_Level level = { JsonCursor(), 0 };
+		roStatus st = _next(field.name.c_str(), level.container); if(!st) return st;
+		if(level.container.type() != JsonParser::Event::BeginObject)
+			return roStatus::json_expect_object_begin;
+
+		st = _levels.pushBack(level); if(!st) return st;
+		for(Field& f : type->fields) {
+			if(!f.type) return roStatus::pointer_is_null;
+			if(f.isConst) continue;	// We simply ignore any const member
+			st = f.type->serializeFunc(*this, f, self);
+			if(!st) return st;
+		}
+		_levels.popBack();
+		return roStatus::ok;
+	}
+
 	roStatus st = _checkName(field); if(!st) return st;
 
 	if(parser.getCurrentProcessNext() != JsonParser::Event::BeginObject)
@@ -187,7 +243,7 @@ roStatus JsonInputSerializer::serialize_object(Field& field, void* fieldParent)
 	for(Field& f : type->fields) {
 		if(!f.type) return roStatus::pointer_is_null;
 		if(f.isConst) continue;	// We simply ignore any const member
-		st = f.type->serializeFunc(*this, f, fieldParent);
+		st = f.type->serializeFunc(*this, f, self);
 		if(!st) return st;
 	}
 
@@ -200,6 +256,14 @@ roStatus JsonInputSerializer::serialize_object(Field& field, void* fieldParent)
 
 roStatus JsonInputSerializer::beginArray(Field& field, roSize count)
 {
+	if(document) {
+		_Level level = { JsonCursor(), 0 };
+		roStatus st = _next(field.name.c_str(), level.container); if(!st) return st;
+		if(level.container.type() != JsonParser::Event::BeginArray)
+			return roStatus::json_expect_array_begin;
+		return _levels.pushBack(level);
+	}
+
 	roStatus st = _checkName(field); if(!st) return st;
 
 	if(parser.getCurrentProcessNext() != JsonParser::Event::BeginArray)
@@ -210,6 +274,13 @@ roStatus JsonInputSerializer::beginArray(Field& field, roSize count)
 
 roStatus JsonInputSerializer::endArray()
 {
+	if(document) {
+		if(_levels.size() < 2 || !isArrayEnded())
+			return roStatus::json_expect_array_end;
+		_levels.popBack();
+		return roStatus::ok;
+	}
+
 	if(parser.getCurrentProcessNext() != JsonParser::Event::EndArray)
 		return roStatus::json_expect_array_end;
 
@@ -218,6 +289,12 @@ roStatus JsonInputSerializer::endArray()
 
 roStatus JsonInputSerializer::serialize(float& val)
 {
+	if(document) {
+		JsonCursor c;
+		roStatus st = _next(NULL, c); if(!st) return st;
+		return c.getNumber(val);
+	}
+
 	roStatus st = parser.getNumber(val);
 	if(!st) return st;
 	parser.nextEvent();
@@ -226,6 +303,12 @@ roStatus JsonInputSerializer::serialize(float& val)
 
 roStatus JsonInputSerializer::serialize(double& val)
 {
+	if(document) {
+		JsonCursor c;
+		roStatus st = _next(NULL, c); if(!st) return st;
+		return c.getNumber(val);
+	}
+
 	roStatus st = parser.getNumber(val);
 	if(!st) return st;
 	parser.nextEvent();
@@ -234,6 +317,13 @@ roStatus JsonInputSerializer::serialize(double& val)
 
 roStatus JsonInputSerializer::serialize(const roUtf8*& val)
 {
+	if(document) {
+		JsonCursor c;
+		roStatus st = _next(NULL, c); if(!st) return st;
+		val = c.getString();
+		return val ? roStatus::ok : roStatus::json_expect_string;
+	}
+
 	if(parser.currentEvent() != JsonParser::Event::String)
 		return roStatus::json_expect_string;
 
@@ -244,6 +334,14 @@ roStatus JsonInputSerializer::serialize(const roUtf8*& val)
 
 roStatus JsonInputSerializer::serialize(roByte*& val, roSize& size)
 {
+	if(document) {
+		JsonCursor c;
+		roStatus st = _next(NULL, c); if(!st) return st;
+		val = (roByte*)c.getString();
+		size = c.getStringLen();
+		return val ? roStatus::ok : roStatus::json_expect_string;
+	}
+
 	if(parser.currentEvent() != JsonParser::Event::String)
 		return roStatus::json_expect_string;
 
@@ -256,9 +354,8 @@ roStatus JsonInputSerializer::serialize(roByte*& val, roSize& size)
 roStatus JsonInputSerializer::serialize(float* valArray, roSize count)
 {
 	for(roSize i=0; i<count; ++i) {
-		roStatus st = parser.getNumber(valArray[i]);
+		roStatus st = serialize(valArray[i]);
 		if(!st) return st;
-		parser.nextEvent();
 	}
 
 	return roStatus::ok;
@@ -266,9 +363,21 @@ roStatus JsonInputSerializer::serialize(float* valArray, roSize count)
 
 bool JsonInputSerializer::isArrayEnded()
 {
+	if(document)
+		return _levels.isEmpty() || _levels.back().next >= _levels.back().container.size();
+
 	return parser.currentEvent() == JsonParser::Event::EndArray;
 }
 
+roSize JsonInputSerializer::arrayCount()
+{
+	if(!document || _levels.isEmpty())
+		return roSize(-1);
+
+	const _Level& level = _levels.back();
+	return level.container.size() - level.next;
+}
+
 roStatus JsonInputSerializer::_checkName(Field& field)
 {
 	const char* name = field.name.isEmpty() ? NULL : field.name.c_str();
@@ -284,5 +393,24 @@ roStatus JsonInputSerializer::_checkName(Field& field)
 	return roStatus::ok;
 }
 
+roStatus JsonInputSerializer::_next(const roUtf8* name, JsonCursor& val)
+{
+	if(_levels.isEmpty())
+		return roStatus::json_missing_root_object;
+
+	_Level& level = _levels.back();
+	if(name && *name) {
+		if(level.container.type() != JsonParser::Event::BeginObject)
+			return roStatus::json_expect_object_name;
+		val = level.container.member(name);
+		return val.isValid() ? roStatus::ok : roStatus::serialization_member_mismatch;
+	}
+
+	if(level.next >= level.container.size())
+		return roStatus::json_expect_array_end;
+	val = level.container.child(level.next++);
+	return roStatus::ok;
+}
+
 }	// namespace Reflection
 }   // namespace ro
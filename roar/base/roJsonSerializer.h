@@ -41,9 +41,11 @@ struct JsonOutputSerializer : public Serializer
 	JsonWriter writer;
 };	// JsonOutputSerializer
 
+/// Read from the parser events by default, the members must then come in the same order as the fields.
+/// Set document to read from a JsonDocument instead, where members are looked up by name.
 struct JsonInputSerializer : public Serializer
 {
-	JsonInputSerializer() { isReading = true; }
+	JsonInputSerializer() : document(NULL) { isReading = true; }
 	roStatus	beginArchive	()									override;
 	roStatus	endArchive		()									override;
 	roStatus	serialize_bool	(Field& field, void* fieldParent)	override;
@@ -71,10 +73,16 @@ struct JsonInputSerializer : public Serializer
 
 // Reader interface
 	bool		isArrayEnded	()									override;
+	roSize		arrayCount		()									override;	///< Known only when reading from a JsonDocument
 
 	roStatus			_checkName		(Field& field);
+	roStatus			_next			(const roUtf8* name, JsonCursor& val);	///< Member by name, next element if null
 
 	JsonParser parser;
+	JsonDocument* document;
+
+	struct _Level { JsonCursor container; roSize next; };
+	Array<_Level> _levels;
 };	// JsonInputSerializer
 
 }	// namespace Reflection
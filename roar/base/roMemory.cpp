@@ -3,19 +3,30 @@
 #include <stdlib.h>
 #include "roUtility.h"
 
+#if roUSE_THREAD_CACHE_ALLOCATOR
+#	include "roThreadCacheAllocator.h"
+#	define _roMalloc(size)		ro::threadCacheAllocator.malloc(size)
+#	define _roRealloc(p, o, n)	ro::threadCacheAllocator.realloc(p, o, n)
+#	define _roFree(p)			ro::threadCacheAllocator.free(p)
+#else
+#	define _roMalloc(size)		::malloc(size)
+#	define _roRealloc(p, o, n)	::realloc(p, n)
+#	define _roFree(p)			::free(p)
+#endif
+
 roBytePtr roMalloc(roSize size)
 {
-	return ::malloc(size);
+	return _roMalloc(size);
 }
 
 roBytePtr roRealloc(void* originalPtr, roSize originalSize, roSize newSize)
 {
-	return ::realloc(originalPtr, newSize);
+	return _roRealloc(originalPtr, originalSize, newSize);
 }
 
 void roFree(void* ptr)
 {
-	::free(ptr);
+	_roFree(ptr);
 }
 
 namespace ro {
@@ -24,7 +35,7 @@ DefaultAllocator defaultAllocator;
 
 roBytePtr DefaultAllocator::malloc(roSize size)
 {
-	return ::malloc(size);
+	return _roMalloc(size);
 }
 
 roBytePtr DefaultAllocator::realloc(void* originalPtr, roSize originalSize, roSize newSize)
@@ -34,7 +45,7 @@ roBytePtr DefaultAllocator::realloc(void* originalPtr, roSize originalSize, roSi
 
 void DefaultAllocator::free(void* ptr)
 {
-	::free(ptr);
+	_roFree(ptr);
 }
 
 }	// namespace ro
@@ -12,6 +12,12 @@ inline void operator delete(void*, void*) {}
 #define _NEW_
 #endif	// _NEW_
 
+/// Define to 1 to route roMalloc() and DefaultAllocator to ThreadCacheAllocator,
+/// trading a 16 bytes header per allocation for lock free small allocations.
+#ifndef roUSE_THREAD_CACHE_ALLOCATOR
+#	define roUSE_THREAD_CACHE_ALLOCATOR 0
+#endif
+
 roBytePtr	roMalloc(roSize size);
 roBytePtr	roRealloc(void* originalPtr, roSize originalSize, roSize newSize);
 void		roFree(void* ptr);
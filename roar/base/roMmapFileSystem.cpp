@@ -0,0 +1,246 @@
+#include "pch.h"
+#include "roMmapFileSystem.h"
+#include "roRawFileSystem.h"
+#include "roMemory.h"
+#include "roTypeCast.h"
+#include "roUtility.h"
+#include "../platform/roPlatformHeaders.h"
+
+#if !roOS_WIN
+#	include <errno.h>
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+namespace ro {
+
+bool mmapFileSystemForLocalFiles = false;
+
+#if roOS_WIN
+
+Status mmapFileSystemOpenFile(const char* uri, void*& outFile)							{ return rawFileSystemOpenFile(uri, outFile); }
+bool mmapFileSystemReadWillBlock(void* file, roUint64 size)								{ return rawFileSystemReadWillBlock(file, size); }
+Status mmapFileSystemRead(void* file, void* buffer, roUint64 size, roUint64& bytesRead)	{ return rawFileSystemRead(file, buffer, size, bytesRead); }
+Status mmapFileSystemAtomicRead(void* file, void* buffer, roUint64 size)				{ return rawFileSystemAtomicRead(file, buffer, size); }
+Status mmapFileSystemSize(void* file, roUint64& bytes)									{ return rawFileSystemSize(file, bytes); }
+Status mmapFileSystemSeek(void* file, roInt64 offset, FileSystem::SeekOrigin origin)	{ return rawFileSystemSeek(file, offset, origin); }
+void mmapFileSystemCloseFile(void* file)												{ rawFileSystemCloseFile(file); }
+roBytePtr mmapFileSystemGetBuffer(void* file, roUint64 requestSize, roUint64& readableSize)	{ return rawFileSystemGetBuffer(file, requestSize, readableSize); }
+void mmapFileSystemTakeBuffer(void* file)												{ rawFileSystemTakeBuffer(file); }
+void mmapFileSystemUntakeBuffer(void* file, roBytePtr buf)								{ rawFileSystemUntakeBuffer(file, buf); }
+
+#else
+
+static DefaultAllocator _allocator;
+
+struct _MmapFile {
+	roByte* data;		///< NULL for empty file
+	roSize size;
+	roSize pos;
+	roSize advisedEnd;	///< Up to where MADV_WILLNEED was already given
+	roSize takenCount;	///< Number of buffers taken but not yet given back
+	bool closed;
+};
+
+static void _unmap(_MmapFile* impl)
+{
+	if(impl->data)
+		::munmap(impl->data, impl->size);
+	_allocator.deleteObj(impl);
+}
+
+Status mmapFileSystemOpenFile(const char* uri, void*& outFile)
+{
+	if(!uri) return Status::invalid_parameter;
+
+	int fd = ::open(uri, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		if(errno == ENOENT) return Status::file_not_found;
+		if(errno == EACCES) return Status::file_access_denied;
+		if(errno == EMFILE || errno == ENFILE) return Status::file_open_too_many_open_files;
+		return Status::file_open_error;
+	}
+
+	struct stat st;
+	if(::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || !roIsValidCast<roSize>(st.st_size)) {
+		::close(fd);
+		return Status::file_open_error;
+	}
+
+	_MmapFile ret = { NULL, num_cast<roSize>(st.st_size), 0, 0, 0, false };
+	if(ret.size > 0) {
+		void* p = ::mmap(NULL, ret.size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(p == MAP_FAILED) {
+			::close(fd);
+			return Status::file_open_error;
+		}
+		ret.data = (roByte*)p;
+		::madvise(p, ret.size, MADV_SEQUENTIAL);
+	}
+
+	// The mapping stay valid without the descriptor
+	::close(fd);
+
+	outFile = _allocator.newObj<_MmapFile>(ret).unref();
+	return Status::ok;
+}
+
+bool mmapFileSystemReadWillBlock(void* file, roUint64 size)
+{
+	_MmapFile* impl = (_MmapFile*)(file);
+	roAssert(impl); if(!impl || !impl->data) return false;
+
+	roSize begin = roMaxOf2(impl->pos, impl->advisedEnd);
+	roSize end = impl->pos + roMinOf2(clamp_cast<roSize>(size), impl->size - roMinOf2(impl->pos, impl->size));
+	if(begin >= end)
+		return false;
+
+	// Page fault will do the read anyway, just let it start earlier in the background
+	static const roSize pageSize = num_cast<roSize>(::sysconf(_SC_PAGESIZE));
+	roSize alignedBegin = begin - begin % pageSize;
+	::madvise(impl->data + alignedBegin, end - alignedBegin, MADV_WILLNEED);
+	impl->advisedEnd = end;
+
+	return false;
+}
+
+Status mmapFileSystemRead(void* file, void* buffer, roUint64 size, roUint64& bytesRead)
+{
+	bytesRead = 0;
+
+	_MmapFile* impl = (_MmapFile*)(file);
+	roAssert(impl); if(!impl) return Status::invalid_parameter;
+	if(impl->closed) return Status::file_not_open;
+
+	if(impl->pos >= impl->size)
+		return Status::file_ended;
+
+	roSize toRead = roMinOf2(clamp_cast<roSize>(size), impl->size - impl->pos);
+	roMemcpy(buffer, impl->data + impl->pos, toRead);
+	impl->pos += toRead;
+	bytesRead = toRead;
+
+	return toRead > 0 ? Status::ok : Status::file_ended;
+}
+
+Status mmapFileSystemAtomicRead(void* file, void* buffer, roUint64 size)
+{
+	_MmapFile* impl = (_MmapFile*)(file);
+	roAssert(impl); if(!impl) return Status::invalid_parameter;
+	if(impl->closed) return Status::file_not_open;
+
+	if(impl->pos >= impl->size || size > impl->size - impl->pos)
+		return Status::file_ended;
+
+	roUint64 bytesRead = 0;
+	return mmapFileSystemRead(file, buffer, size, bytesRead);
+}
+
+Status mmapFileSystemSize(void* file, roUint64& bytes)
+{
+	_MmapFile* impl = (_MmapFile*)(file);
+	roAssert(impl); if(!impl) return Status::invalid_parameter;
+	if(impl->closed) return Status::file_not_open;
+
+	bytes = impl->size;
+	return Status::ok;
+}
+
+Status mmapFileSystemSeek(void* file, roInt64 offset, FileSystem::SeekOrigin origin)
+{
+	_MmapFile* impl = (_MmapFile*)(file);
+	roAssert(impl); if(!impl) return Status::invalid_parameter;
+	if(impl->closed) return Status::file_not_open;
+
+	roInt64 base = 0;
+	if(origin == FileSystem::SeekOrigin_Current)
+		base = num_cast<roInt64>(impl->pos);
+	else if(origin == FileSystem::SeekOrigin_End)
+		base = num_cast<roInt64>(impl->size);
+
+	// Same as fseek, seeking beyond the end is fine and the next read will give file_ended
+	roInt64 newPos = base + offset;
+	if(newPos < 0 || !roIsValidCast<roSize>(newPos))
+		return Status::file_seek_error;
+
+	impl->pos = num_cast<roSize>(newPos);
+	impl->advisedEnd = 0;
+	return Status::ok;
+}
+
+void mmapFileSystemCloseFile(void* file)
+{
+	_MmapFile* impl = (_MmapFile*)(file);
+	roAssert(impl); if(!impl) return;
+
+	// Taken buffers point into the mapping, so the unmap wait for the last untakeBuffer()
+	impl->closed = true;
+	if(impl->takenCount == 0)
+		_unmap(impl);
+}
+
+roBytePtr mmapFileSystemGetBuffer(void* file, roUint64 requestSize, roUint64& readableSize)
+{
+	readableSize = 0;
+
+	_MmapFile* impl = (_MmapFile*)(file);
+	if(!impl || impl->closed || impl->pos >= impl->size) return NULL;
+
+	roByte* p = impl->data + impl->pos;
+	roSize readable = roMinOf2(clamp_cast<roSize>(requestSize), impl->size - impl->pos);
+	impl->pos += readable;
+	readableSize = readable;
+
+	return p;
+}
+
+void mmapFileSystemTakeBuffer(void* file)
+{
+	_MmapFile* impl = (_MmapFile*)(file);
+	if(!impl) return;
+	++impl->takenCount;
+}
+
+void mmapFileSystemUntakeBuffer(void* file, roBytePtr buf)
+{
+	_MmapFile* impl = (_MmapFile*)(file);
+	if(!impl || !buf) return;
+
+	roAssert((roByte*)buf >= impl->data && (roByte*)buf < impl->data + impl->size);
+	roAssert(impl->takenCount > 0);
+	if(impl->takenCount == 0) return;
+
+	if(--impl->takenCount == 0 && impl->closed)
+		_unmap(impl);
+}
+
+#endif
+
+void* mmapFileSystemOpenDir(const char* uri)	{ return rawFileSystemOpenDir(uri); }
+bool mmapFileSystemNextDir(void* dir)			{ return rawFileSystemNextDir(dir); }
+const char* mmapFileSystemDirName(void* dir)	{ return rawFileSystemDirName(dir); }
+void mmapFileSystemCloseDir(void* dir)			{ rawFileSystemCloseDir(dir); }
+
+
+// ----------------------------------------------------------------------
+
+FileSystem mmapFileSystem = {
+	mmapFileSystemOpenFile,
+	mmapFileSystemReadWillBlock,
+	mmapFileSystemRead,
+	mmapFileSystemAtomicRead,
+	mmapFileSystemSize,
+	mmapFileSystemSeek,
+	mmapFileSystemCloseFile,
+	mmapFileSystemGetBuffer,
+	mmapFileSystemTakeBuffer,
+	mmapFileSystemUntakeBuffer,
+	mmapFileSystemOpenDir,
+	mmapFileSystemNextDir,
+	mmapFileSystemDirName,
+	mmapFileSystemCloseDir
+};
+
+}	// namespace ro
@@ -0,0 +1,38 @@
+#ifndef __roMmapFileSystem_h__
+#define __roMmapFileSystem_h__
+
+#include "roFileSystem.h"
+
+namespace ro {
+
+/// Local files read through a read-only memory mapping of the whole file.
+/// getBuffer() return a pointer into the mapping without any copy, takeBuffer() keep
+/// the mapping alive after closeFile() until every taken buffer is given back by untakeBuffer().
+/// The mapping is advised as sequential, and readWillBlock() ask the kernel to read ahead the
+/// requested range (MADV_WILLNEED) instead of blocking.
+/// The file should not be truncated by others while opened, touching the lost pages would crash.
+/// On Windows it's the same as rawFileSystem.
+Status		mmapFileSystemOpenFile		(const char* uri, void*& outFile);
+bool		mmapFileSystemReadWillBlock	(void* file, roUint64 bytesToRead);
+Status		mmapFileSystemRead			(void* file, void* buffer, roUint64 bytesToRead, roUint64& bytesRead);
+Status		mmapFileSystemAtomicRead	(void* file, void* buffer, roUint64 bytesToRead);
+Status		mmapFileSystemSize			(void* file, roUint64& bytes);
+Status		mmapFileSystemSeek			(void* file, roInt64 offset, FileSystem::SeekOrigin origin);
+void		mmapFileSystemCloseFile		(void* file);
+roBytePtr	mmapFileSystemGetBuffer		(void* file, roUint64 requestSize, roUint64& readableSize);
+void		mmapFileSystemTakeBuffer	(void* file);
+void		mmapFileSystemUntakeBuffer	(void* file, roBytePtr buf);
+void*		mmapFileSystemOpenDir		(const char* uri);
+bool		mmapFileSystemNextDir		(void* dir);
+const char*	mmapFileSystemDirName		(void* dir);
+void		mmapFileSystemCloseDir		(void* dir);
+
+extern FileSystem mmapFileSystem;
+
+/// When true, the default fileSystem open local files with mmapFileSystem instead of rawFileSystem.
+/// False by default.
+extern bool mmapFileSystemForLocalFiles;
+
+}	// namespace ro
+
+#endif	// __roMmapFileSystem_h__
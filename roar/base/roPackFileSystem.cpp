@@ -0,0 +1,869 @@
+#include "pch.h"
+#include "roPackFileSystem.h"
+#include "roAlgorithm.h"
+#include "roArray.h"
+#include "roAtomic.h"
+#include "roCompressedStream.h"
+#include "roMemory.h"
+#include "roMutex.h"
+#include "roRawFileSystem.h"
+#include "roSharedPtr.h"
+#include "roString.h"
+#include "roStringHash.h"
+#include "roStringUtility.h"
+#include "roTypeCast.h"
+#include "roUtility.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+namespace ro {
+
+static DefaultAllocator _allocator;
+
+static const char _packMagic[4] = { 'r', 'o', 'P', 'K' };
+static const roUint32 _packVersion = 1;
+static const roUint64 _smallAlignment = 16;
+
+static_assert(sizeof(PackHeader) == 48, "PackHeader is part of the file format");
+static_assert(sizeof(PackEntry) == 40, "PackEntry is part of the file format");
+
+PackBuildOptions::PackBuildOptions()
+	: compressionLevel(6)
+	, smallFileSize(64 * 1024)
+	, pageAlignment(4096)
+	, minCompressRatio(0.9f)
+{}
+
+static roUint64 _alignUp(roUint64 v, roUint64 alignment)
+{
+	return (v + alignment - 1) / alignment * alignment;
+}
+
+// Byte wise, the same order is used for building and searching the table of content
+static int _nameCompare(const char* a, roSize aLen, const char* b, roSize bLen)
+{
+	int ret = memcmp(a, b, roMinOf2(aLen, bLen));
+	if(ret != 0) return ret;
+	return aLen < bLen ? -1 : (aLen > bLen ? 1 : 0);
+}
+
+static bool _isDirectory(const char* path, roUint64* size)
+{
+	struct stat st;
+	if(::stat(path, &st) != 0)
+		return false;
+	if(size)
+		*size = num_cast<roUint64>(st.st_size);
+	return (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+
+// ----------------------------------------------------------------------
+// Build
+
+struct _BuildEntry
+{
+	String name;
+	String path;
+	roUint64 size;
+};
+
+static Status _collectFiles(const String& directory, const String& prefix, Array<_BuildEntry>& entries)
+{
+	void* dir = rawFileSystemOpenDir(directory.c_str());
+	if(!dir)
+		return Status::ok;	// Empty directory
+
+	Status st = Status::ok;
+	do {
+		const char* name = rawFileSystemDirName(dir);
+		if(!name || !*name) continue;
+
+		_BuildEntry e;
+		e.path = directory;
+		e.path += "/";
+		e.path += name;
+		e.name = prefix;
+		e.name += name;
+
+		if(_isDirectory(e.path.c_str(), &e.size)) {
+			e.name += "/";
+			st = _collectFiles(e.path, e.name, entries);
+			if(!st) break;
+		}
+		else
+			entries.pushBack(e);
+	} while(rawFileSystemNextDir(dir));
+
+	rawFileSystemCloseDir(dir);
+	return st;
+}
+
+static Status _readWholeFile(const char* path, roUint64 size, ByteArray& data)
+{
+	void* file = NULL;
+	Status st = rawFileSystemOpenFile(path, file); if(!st) return st;
+	st = data.resizeNoInit(clamp_cast<roSize>(size));
+	if(st && size > 0)
+		st = rawFileSystemAtomicRead(file, data.typedPtr(), size);
+	rawFileSystemCloseFile(file);
+	return st;
+}
+
+static bool _writePadding(FILE* f, roUint64& pos, roUint64 alignment)
+{
+	static const roByte zeros[64] = { 0 };
+	roUint64 aligned = _alignUp(pos, alignment);
+	while(pos < aligned) {
+		roSize n = clamp_cast<roSize>(roMinOf2(aligned - pos, roUint64(sizeof(zeros))));
+		if(fwrite(zeros, 1, n, f) != n)
+			return false;
+		pos += n;
+	}
+	return true;
+}
+
+Status packArchiveBuild(const char* directory, const char* packPath, const PackBuildOptions& options)
+{
+	if(!directory || !packPath || options.pageAlignment == 0) return Status::invalid_parameter;
+
+	String dirPath = directory;
+	while(dirPath.size() > 1 && (dirPath.back() == '/' || dirPath.back() == '\\'))
+		dirPath.popBack(1);
+	if(!_isDirectory(dirPath.c_str(), NULL))
+		return Status::file_not_found;
+
+	Array<_BuildEntry> files;
+	Status st = _collectFiles(dirPath, "", files); if(!st) return st;
+	if(files.size() >= roUint32(-1) / 4) return Status::size_limit_reached;
+
+	roQuickSort(files.begin(), files.end(), [](const _BuildEntry& a, const _BuildEntry& b) {
+		return _nameCompare(a.name.c_str(), a.name.size(), b.name.c_str(), b.name.size()) < 0;
+	});
+
+	FILE* f = fopen(packPath, "wb");
+	if(!f) return Status::file_open_error;
+
+	PackHeader header;
+	roMemZeroStruct(header);
+	Array<PackEntry> toc;
+	String names;
+	ByteArray data, zipped;
+	roUint64 pos = 0;
+
+	if(fwrite(&header, sizeof(header), 1, f) != 1) st = Status::file_write_error;
+	pos += sizeof(header);
+
+	// Small files first, all next to each other, then the large ones aligned to page
+	for(int pass=0; pass<2 && st; ++pass) for(_BuildEntry& e : files) {
+		const bool small = e.size <= options.smallFileSize;
+		if(small != (pass == 0))
+			continue;
+
+		if(e.name.size() > 0xFFFF) { st = Status::size_limit_reached; break; }
+		st = _readWholeFile(e.path.c_str(), e.size, data);
+		if(!st) break;
+
+		const roByte* stored = data.typedPtr();
+		roUint64 storedSize = data.size();
+		roUint8 compression = PackEntry::Compression_None;
+
+		if(options.compressionLevel != 0 && data.size() > 0) {
+			st = gzipCompress(data.typedPtr(), data.size(), zipped, options.compressionLevel);
+			if(!st) break;
+			if(zipped.size() < data.size() * options.minCompressRatio) {
+				stored = zipped.typedPtr();
+				storedSize = zipped.size();
+				compression = PackEntry::Compression_GZip;
+			}
+		}
+
+		if(!_writePadding(f, pos, small ? _smallAlignment : options.pageAlignment)) { st = Status::file_write_error; break; }
+
+		PackEntry entry;
+		roMemZeroStruct(entry);
+		entry.offset = pos;
+		entry.storedSize = storedSize;
+		entry.originalSize = data.size();
+		entry.nameOffset = num_cast<roUint32>(names.size());
+		entry.nameHash = stringHash(e.name.c_str(), e.name.size());
+		entry.nameLength = num_cast<roUint16>(e.name.size());
+		entry.compression = compression;
+		entry.flags = small ? PackEntry::Flag_Small : 0;
+		names += e.name;
+
+		if(storedSize > 0 && fwrite(stored, 1, clamp_cast<roSize>(storedSize), f) != storedSize) { st = Status::file_write_error; break; }
+		pos += storedSize;
+
+		st = toc.pushBack(entry);
+	}
+
+	// The table of content keep the name order, regardless of where the data went
+	roQuickSort(toc.begin(), toc.end(), [&names](const PackEntry& a, const PackEntry& b) {
+		return _nameCompare(names.c_str() + a.nameOffset, a.nameLength, names.c_str() + b.nameOffset, b.nameLength) < 0;
+	});
+
+	roUint32 bucketCount = 1;
+	while(bucketCount < toc.size() * 2)
+		bucketCount *= 2;
+
+	Array<roUint32> buckets;
+	if(st) st = buckets.resize(bucketCount, 0);
+	for(roSize i=0; st && i<toc.size(); ++i) {
+		roUint32 b = toc[i].nameHash & (bucketCount - 1);
+		while(buckets[b] != 0)
+			b = (b + 1) & (bucketCount - 1);
+		buckets[b] = num_cast<roUint32>(i + 1);
+	}
+
+	if(st && !_writePadding(f, pos, _smallAlignment))
+		st = Status::file_write_error;
+
+	if(st) {
+		roMemcpy(header.magic, _packMagic, sizeof(_packMagic));
+		header.version = _packVersion;
+		header.entryCount = num_cast<roUint32>(toc.size());
+		header.bucketCount = bucketCount;
+		header.tocOffset = pos;
+		header.tocSize = toc.sizeInByte() + buckets.sizeInByte() + names.size();
+		header.nameSize = num_cast<roUint32>(names.size());
+
+		if( (toc.size() > 0 && fwrite(toc.typedPtr(), toc.sizeInByte(), 1, f) != 1) ||
+			fwrite(buckets.typedPtr(), buckets.sizeInByte(), 1, f) != 1 ||
+			(names.size() > 0 && fwrite(names.c_str(), names.size(), 1, f) != 1) ||
+			fseek(f, 0, SEEK_SET) != 0 ||
+			fwrite(&header, sizeof(header), 1, f) != 1)
+		{
+			st = Status::file_write_error;
+		}
+	}
+
+	if(fclose(f) != 0 && st)
+		st = Status::file_write_error;
+	if(!st)
+		::remove(packPath);
+
+	return st;
+}
+
+
+// ----------------------------------------------------------------------
+// Archive
+
+/// Decompressed entry or prefetched small files, kept alive by the files using it
+struct _PackMemory : public SharedObject<AtomicInteger>
+{
+	roUint64 offset;	///< In the archive, for prefetched data
+	ByteArray data;
+};	// _PackMemory
+
+struct _PackArchive : public SharedObject<AtomicInteger>
+{
+	_PackArchive() : file(NULL), entries(NULL), buckets(NULL), names(NULL) {}
+	~_PackArchive() { if(file) rawFileSystemCloseFile(file); }
+
+	Status open(const char* path)
+	{
+		Status st = rawFileSystemOpenFile(path, file); if(!st) return st;
+
+		roUint64 fileSize = 0;
+		st = rawFileSystemSize(file, fileSize); if(!st) return st;
+		st = rawFileSystemAtomicRead(file, &header, sizeof(header));
+		if(!st) return Status::data_corrupted;
+
+		if(memcmp(header.magic, _packMagic, sizeof(_packMagic)) != 0) return Status::data_corrupted;
+		if(header.version != _packVersion) return Status::not_supported;
+
+		const roUint64 expectedTocSize = roUint64(header.entryCount) * sizeof(PackEntry) + roUint64(header.bucketCount) * sizeof(roUint32) + header.nameSize;
+		if( header.tocOffset > fileSize || header.tocSize > fileSize - header.tocOffset ||
+			header.tocSize != expectedTocSize ||
+			header.bucketCount == 0 || (header.bucketCount & (header.bucketCount - 1)) != 0 ||
+			header.bucketCount <= header.entryCount)
+		{
+			return Status::data_corrupted;
+		}
+
+		st = toc.resizeNoInit(clamp_cast<roSize>(header.tocSize)); if(!st) return st;
+		st = readAt(header.tocOffset, toc.typedPtr(), toc.size()); if(!st) return st;
+
+		entries = (const PackEntry*)toc.typedPtr();
+		buckets = (const roUint32*)(entries + header.entryCount);
+		names = (const char*)(buckets + header.bucketCount);
+
+		for(roUint32 i=0; i<header.entryCount; ++i) {
+			const PackEntry& e = entries[i];
+			if( roUint64(e.nameOffset) + e.nameLength > header.nameSize ||
+				e.offset > header.tocOffset || e.storedSize > header.tocOffset - e.offset)
+			{
+				return Status::data_corrupted;
+			}
+		}
+		for(roUint32 i=0; i<header.bucketCount; ++i) {
+			if(buckets[i] > header.entryCount)
+				return Status::data_corrupted;
+		}
+
+		return Status::ok;
+	}
+
+	const PackEntry* find(const char* name, roSize len) const
+	{
+		const roUint32 hash = stringHash(name, len);
+		const roUint32 mask = header.bucketCount - 1;
+		for(roUint32 b = hash & mask; buckets[b] != 0; b = (b + 1) & mask) {
+			const PackEntry& e = entries[buckets[b] - 1];
+			if(e.nameHash == hash && e.nameLength == len && memcmp(names + e.nameOffset, name, len) == 0)
+				return &e;
+		}
+		return NULL;
+	}
+
+	/// Index of the first entry not less than name
+	roSize lowerBound(const char* name, roSize len) const
+	{
+		roSize begin = 0, end = header.entryCount;
+		while(begin < end) {
+			roSize mid = (begin + end) / 2;
+			if(_nameCompare(names + entries[mid].nameOffset, entries[mid].nameLength, name, len) < 0)
+				begin = mid + 1;
+			else
+				end = mid;
+		}
+		return begin;
+	}
+
+	bool entryHasPrefix(roSize index, const char* prefix, roSize len) const
+	{
+		return index < header.entryCount && entries[index].nameLength >= len &&
+			memcmp(names + entries[index].nameOffset, prefix, len) == 0;
+	}
+
+	/// Thread safe read at an absolute offset in the archive, through a view of its own
+	Status readAt(roUint64 offset, void* buf, roUint64 size)
+	{
+		if(size == 0) return Status::ok;
+		void* view = NULL;
+		Status st = rawFileSystemOpenView(file, offset, size, view); if(!st) return st;
+		st = rawFileSystemAtomicRead(view, buf, size);
+		rawFileSystemCloseFile(view);
+		return st;
+	}
+
+	/// The prefetched memory holding the whole stored data of the entry, if any
+	SharedPtr<_PackMemory> prefetchedFor(const PackEntry& e)
+	{
+		roScopeLock(mutex);
+		for(SharedPtr<_PackMemory>& m : prefetched) {
+			if(e.offset >= m->offset && e.offset + e.storedSize <= m->offset + m->data.size())
+				return m;
+		}
+		return NULL;
+	}
+
+	void* file;
+	PackHeader header;
+	ByteArray toc;
+	const PackEntry* entries;
+	const roUint32* buckets;
+	const char* names;
+	Mutex mutex;	///< For prefetched
+	Array<SharedPtr<_PackMemory> > prefetched;
+};	// _PackArchive
+
+struct _PackMount
+{
+	String mountPoint;	///< Empty or end with '/'
+	SharedPtr<_PackArchive> archive;
+};	// _PackMount
+
+static Mutex _mountMutex;
+static Array<_PackMount> _mounts;
+static AtomicInteger _mountCount;
+
+static String _normalizeMountPoint(const char* mountPoint)
+{
+	String ret = mountPoint ? mountPoint : "";
+	for(roSize i=0; i<ret.size(); ++i)
+		if(ret[i] == '\\') ret[i] = '/';
+	while(ret.size() >= 2 && ret[0] == '.' && ret[1] == '/')
+		ret.erase(0, 2);
+	if(ret.size() > 0 && ret.back() != '/')
+		ret += "/";
+	return ret;
+}
+
+/// Find the latest mounted archive for uri, outName is the uri without the mount point
+static SharedPtr<_PackArchive> _resolve(const char* uri, String& outName)
+{
+	if(!uri) return NULL;
+
+	outName = uri;
+	for(roSize i=0; i<outName.size(); ++i)
+		if(outName[i] == '\\') outName[i] = '/';
+	while(outName.size() >= 2 && outName[0] == '.' && outName[1] == '/')
+		outName.erase(0, 2);
+
+	roScopeLock(_mountMutex);
+	for(roSize i=_mounts.size(); i--; ) {
+		const String& mp = _mounts[i].mountPoint;
+		if(roStrnCmp(outName.c_str(), mp.c_str(), mp.size()) == 0) {
+			outName.erase(0, mp.size());
+			return _mounts[i].archive;
+		}
+		// The mount point itself without the trailing '/'
+		if(mp.size() > 0 && outName.size() + 1 == mp.size() && roStrnCmp(outName.c_str(), mp.c_str(), outName.size()) == 0) {
+			outName.clear();
+			return _mounts[i].archive;
+		}
+	}
+	return NULL;
+}
+
+Status packFileSystemMount(const char* packPath, const char* mountPoint)
+{
+	if(!packPath) return Status::invalid_parameter;
+
+	SharedPtr<_PackArchive> archive = new _PackArchive;
+	Status st = archive->open(packPath); if(!st) return st;
+
+	_PackMount mount;
+	mount.mountPoint = _normalizeMountPoint(mountPoint);
+	mount.archive = archive;
+
+	roScopeLock(_mountMutex);
+	st = _mounts.pushBack(mount); if(!st) return st;
+	_mountCount = num_cast<int>(_mounts.size());
+	return Status::ok;
+}
+
+Status packFileSystemUnmount(const char* mountPoint)
+{
+	String mp = _normalizeMountPoint(mountPoint);
+
+	roScopeLock(_mountMutex);
+	for(roSize i=_mounts.size(); i--; ) {
+		if(_mounts[i].mountPoint == mp) {
+			_mounts.removeAt(i);
+			_mountCount = num_cast<int>(_mounts.size());
+			return Status::ok;
+		}
+	}
+	return Status::not_found;
+}
+
+void packFileSystemUnmountAll()
+{
+	roScopeLock(_mountMutex);
+	_mounts.clear();
+	_mountCount = 0;
+}
+
+bool packFileSystemHasMount()
+{
+	return _mountCount > 0;
+}
+
+Status packFileSystemPrefetchDir(const char* uri)
+{
+	String prefix;
+	SharedPtr<_PackArchive> archive = _resolve(uri, prefix);
+	if(!archive) return Status::file_not_found;
+	if(prefix.size() > 0 && prefix.back() != '/')
+		prefix += "/";
+
+	// Small files under a directory are contiguous since they are stored in name order
+	roUint64 begin = roUint64(-1), end = 0;
+	for(roSize i=archive->lowerBound(prefix.c_str(), prefix.size()); archive->entryHasPrefix(i, prefix.c_str(), prefix.size()); ++i) {
+		const PackEntry& e = archive->entries[i];
+		if(!(e.flags & PackEntry::Flag_Small) || e.storedSize == 0)
+			continue;
+		begin = roMinOf2(begin, e.offset);
+		end = roMaxOf2(end, e.offset + e.storedSize);
+	}
+
+	if(begin >= end)
+		return Status::ok;
+
+	SharedPtr<_PackMemory> memory = new _PackMemory;
+	memory->offset = begin;
+	Status st = memory->data.resizeNoInit(clamp_cast<roSize>(end - begin)); if(!st) return st;
+	st = archive->readAt(begin, memory->data.typedPtr(), memory->data.size()); if(!st) return st;
+
+	roScopeLock(archive->mutex);
+	return archive->prefetched.pushBack(memory);
+}
+
+
+// ----------------------------------------------------------------------
+// File
+
+struct _PackFile
+{
+	SharedPtr<_PackArchive> archive;
+	const PackEntry* entry;
+	roUint64 pos;
+	SharedPtr<_PackMemory> memory;	///< Decompressed data or prefetched data, NULL when reading from the archive
+	const roByte* data;				///< Of the entry in memory, valid after _loadMemory()
+	bool memoryLoaded;
+	void* view;						///< Of the stored data in the archive, when reading from it
+	roSize takenCount;				///< Taken buffers not yet given back, untakeBuffer() need f to tell where they point to
+	bool closed;
+};	// _PackFile
+
+/// Readers of the same archive each have a view, with its own position and asynchronous read
+static Status _openView(_PackFile* f)
+{
+	if(f->view)
+		return Status::ok;
+
+	const PackEntry& e = *f->entry;
+	Status st = rawFileSystemOpenView(f->archive->file, e.offset, e.storedSize, f->view); if(!st) return st;
+
+	// Stored entry are read in place, the compressed one as a whole from the beginning
+	if(e.compression == PackEntry::Compression_None && f->pos > 0)
+		st = rawFileSystemSeek(f->view, num_cast<roInt64>(f->pos), FileSystem::SeekOrigin_Begin);
+	return st;
+}
+
+/// Compressed entry need to be in memory as a whole, the prefetched one is already in memory
+static Status _loadMemory(_PackFile* f)
+{
+	if(f->memoryLoaded)
+		return Status::ok;
+
+	const PackEntry& e = *f->entry;
+	SharedPtr<_PackMemory> prefetched = f->archive->prefetchedFor(e);
+
+	if(e.compression == PackEntry::Compression_None) {
+		if(prefetched) {
+			f->memory = prefetched;
+			f->data = prefetched->data.typedPtr() + (e.offset - prefetched->offset);
+		}
+		f->memoryLoaded = true;
+		return Status::ok;
+	}
+
+	if(e.compression != PackEntry::Compression_GZip)
+		return Status::not_supported;
+
+	const roByte* stored = NULL;
+	if(prefetched)
+		stored = prefetched->data.typedPtr() + (e.offset - prefetched->offset);
+	else {
+		// Straight from the view's buffer, which readWillBlock() may have filled already
+		Status st = _openView(f); if(!st) return st;
+		roUint64 readable = 0;
+		stored = rawFileSystemGetBuffer(f->view, e.storedSize, readable);
+		if(!stored || readable != e.storedSize) return Status::file_read_error;
+	}
+
+	SharedPtr<_PackMemory> memory = new _PackMemory;
+	memory->offset = e.offset;
+	Status st = memory->data.resizeNoInit(clamp_cast<roSize>(e.originalSize)); if(!st) return st;
+	roSize size = memory->data.size();
+	st = gzipDecompress(stored, clamp_cast<roSize>(e.storedSize), memory->data.typedPtr(), size);
+	if(!st) return st;
+	if(size != e.originalSize) return Status::data_corrupted;
+
+	f->memory = memory;
+	f->data = memory->data.typedPtr();
+	f->memoryLoaded = true;
+
+	// Not needed anymore, everything is in memory
+	if(f->view) {
+		rawFileSystemCloseFile(f->view);
+		f->view = NULL;
+	}
+	return Status::ok;
+}
+
+static void _deleteFile(_PackFile* f)
+{
+	if(f->view)
+		rawFileSystemCloseFile(f->view);
+	_allocator.deleteObj(f);
+}
+
+Status packFileSystemOpenFile(const char* uri, void*& outFile)
+{
+	String name;
+	SharedPtr<_PackArchive> archive = _resolve(uri, name);
+	if(!archive) return Status::file_not_found;
+
+	const PackEntry* entry = archive->find(name.c_str(), name.size());
+	if(!entry) return Status::file_not_found;
+
+	_PackFile* f = _allocator.newObj<_PackFile>().unref();
+	f->archive = archive;
+	f->entry = entry;
+	f->pos = 0;
+	f->data = NULL;
+	f->memoryLoaded = false;
+	f->view = NULL;
+	f->takenCount = 0;
+	f->closed = false;
+
+	outFile = f;
+	return Status::ok;
+}
+
+bool packFileSystemReadWillBlock(void* file, roUint64 size)
+{
+	_PackFile* f = (_PackFile*)(file);
+	roAssert(f); if(!f || f->closed) return false;
+
+	// Those already in memory never block, no io is needed to find out
+	const PackEntry& e = *f->entry;
+	if(!f->memoryLoaded && (e.compression == PackEntry::Compression_None || f->archive->prefetchedFor(e)))
+		_loadMemory(f);
+	if(f->memory)
+		return false;
+
+	// Let read() report the error
+	if(!_openView(f))
+		return false;
+
+	// The compressed one need all the stored data to decompress
+	if(!f->memoryLoaded)
+		return rawFileSystemReadWillBlock(f->view, e.storedSize);
+
+	if(f->pos >= e.originalSize)
+		return false;
+	return rawFileSystemReadWillBlock(f->view, roMinOf2(size, e.originalSize - f->pos));
+}
+
+Status packFileSystemRead(void* file, void* buffer, roUint64 size, roUint64& bytesRead)
+{
+	bytesRead = 0;
+
+	_PackFile* f = (_PackFile*)(file);
+	roAssert(f); if(!f) return Status::invalid_parameter;
+	if(f->closed) return Status::file_not_open;
+
+	Status st = _loadMemory(f); if(!st) return st;
+
+	const roUint64 fileSize = f->entry->originalSize;
+	if(f->pos >= fileSize)
+		return Status::file_ended;
+
+	roUint64 toRead = roMinOf2(size, fileSize - f->pos);
+	if(f->memory)
+		roMemcpy(buffer, f->data + f->pos, clamp_cast<roSize>(toRead));
+	else {
+		st = _openView(f); if(!st) return st;
+		roUint64 viewRead = 0;
+		st = rawFileSystemRead(f->view, buffer, toRead, viewRead);
+		if(!st) return st;
+		toRead = viewRead;
+	}
+
+	f->pos += toRead;
+	bytesRead = toRead;
+	return toRead > 0 ? Status::ok : Status::file_ended;
+}
+
+Status packFileSystemAtomicRead(void* file, void* buffer, roUint64 size)
+{
+	_PackFile* f = (_PackFile*)(file);
+	roAssert(f); if(!f) return Status::invalid_parameter;
+	if(f->pos >= f->entry->originalSize || size > f->entry->originalSize - f->pos)
+		return Status::file_ended;
+
+	roUint64 bytesRead = 0;
+	return packFileSystemRead(file, buffer, size, bytesRead);
+}
+
+Status packFileSystemSize(void* file, roUint64& bytes)
+{
+	_PackFile* f = (_PackFile*)(file);
+	roAssert(f); if(!f) return Status::invalid_parameter;
+	bytes = f->entry->originalSize;
+	return Status::ok;
+}
+
+Status packFileSystemSeek(void* file, roInt64 offset, FileSystem::SeekOrigin origin)
+{
+	_PackFile* f = (_PackFile*)(file);
+	roAssert(f); if(!f) return Status::invalid_parameter;
+
+	roInt64 base = 0;
+	if(origin == FileSystem::SeekOrigin_Current)
+		base = num_cast<roInt64>(f->pos);
+	else if(origin == FileSystem::SeekOrigin_End)
+		base = num_cast<roInt64>(f->entry->originalSize);
+
+	roInt64 newPos = base + offset;
+	if(newPos < 0)
+		return Status::file_seek_error;
+
+	f->pos = num_cast<roUint64>(newPos);
+
+	// The view of a stored entry follow, so the data it already buffered can be kept
+	if(f->view && f->entry->compression == PackEntry::Compression_None)
+		return rawFileSystemSeek(f->view, newPos, FileSystem::SeekOrigin_Begin);
+	return Status::ok;
+}
+
+void packFileSystemCloseFile(void* file)
+{
+	_PackFile* f = (_PackFile*)(file);
+	roAssert(f); if(!f) return;
+
+	// Taken buffers may point into memory, and untakeBuffer() look at it, keep f until the last one
+	f->closed = true;
+	if(f->takenCount == 0)
+		_deleteFile(f);
+}
+
+roBytePtr packFileSystemGetBuffer(void* file, roUint64 requestSize, roUint64& readableSize)
+{
+	readableSize = 0;
+
+	_PackFile* f = (_PackFile*)(file);
+	if(!f || f->closed || !_loadMemory(f)) return NULL;
+
+	const roUint64 fileSize = f->entry->originalSize;
+	if(f->pos >= fileSize)
+		return NULL;
+
+	roSize readable = clamp_cast<roSize>(roMinOf2(requestSize, fileSize - f->pos));
+
+	// Straight from memory without copy
+	if(f->memory) {
+		const roByte* p = f->data + f->pos;
+		f->pos += readable;
+		readableSize = readable;
+		return (roByte*)p;
+	}
+
+	// From the view's buffer, which takeBuffer() can give away
+	if(!_openView(f))
+		return NULL;
+
+	roBytePtr ret = rawFileSystemGetBuffer(f->view, readable, readableSize);
+	f->pos += readableSize;
+	return ret;
+}
+
+void packFileSystemTakeBuffer(void* file)
+{
+	_PackFile* f = (_PackFile*)(file);
+	if(!f) return;
+
+	++f->takenCount;
+	if(!f->memory && f->view)
+		rawFileSystemTakeBuffer(f->view);
+}
+
+void packFileSystemUntakeBuffer(void* file, roBytePtr buf)
+{
+	_PackFile* f = (_PackFile*)(file);
+	if(!f || !buf) return;
+
+	// Those not pointing into memory were given away by the view
+	const roByte* p = buf;
+	const bool inMemory = f->memory &&
+		p >= f->memory->data.typedPtr() && p < f->memory->data.typedPtr() + f->memory->data.size();
+	if(!inMemory)
+		rawFileSystemUntakeBuffer(f->view, buf);
+
+	roAssert(f->takenCount > 0);
+	if(f->takenCount == 0) return;
+
+	if(--f->takenCount == 0 && f->closed)
+		_deleteFile(f);
+}
+
+
+// ----------------------------------------------------------------------
+// Directory
+
+struct _PackDir
+{
+	SharedPtr<_PackArchive> archive;
+	String prefix;
+	roSize index;
+	String name;	///< The direct child of prefix, a file or a directory
+};	// _PackDir
+
+static bool _packDirAdvance(_PackDir& d)
+{
+	for(; d.archive->entryHasPrefix(d.index, d.prefix.c_str(), d.prefix.size()); ++d.index) {
+		const PackEntry& e = d.archive->entries[d.index];
+		const char* child = d.archive->names + e.nameOffset + d.prefix.size();
+		roSize len = e.nameLength - d.prefix.size();
+		const char* slash = (const char*)memchr(child, '/', len);
+		if(slash)
+			len = slash - child;
+
+		// Files under the same sub directory are next to each other
+		if(d.name.size() == len && memcmp(d.name.c_str(), child, len) == 0)
+			continue;
+
+		d.name.assign(child, len);
+		return true;
+	}
+	return false;
+}
+
+void* packFileSystemOpenDir(const char* uri)
+{
+	String prefix;
+	SharedPtr<_PackArchive> archive = _resolve(uri, prefix);
+	if(!archive) return NULL;
+	if(prefix.size() > 0 && prefix.back() != '/')
+		prefix += "/";
+
+	_PackDir* d = _allocator.newObj<_PackDir>().unref();
+	d->archive = archive;
+	d->prefix = prefix;
+	d->index = archive->lowerBound(prefix.c_str(), prefix.size());
+
+	if(!_packDirAdvance(*d)) {
+		_allocator.deleteObj(d);
+		return NULL;
+	}
+	return d;
+}
+
+bool packFileSystemNextDir(void* dir)
+{
+	_PackDir* d = (_PackDir*)(dir);
+	if(!d) return false;
+	return _packDirAdvance(*d);
+}
+
+const char* packFileSystemDirName(void* dir)
+{
+	_PackDir* d = (_PackDir*)(dir);
+	if(!d) return "";
+	return d->name.c_str();
+}
+
+void packFileSystemCloseDir(void* dir)
+{
+	_allocator.deleteObj((_PackDir*)(dir));
+}
+
+
+// ----------------------------------------------------------------------
+
+FileSystem packFileSystem = {
+	packFileSystemOpenFile,
+	packFileSystemReadWillBlock,
+	packFileSystemRead,
+	packFileSystemAtomicRead,
+	packFileSystemSize,
+	packFileSystemSeek,
+	packFileSystemCloseFile,
+	packFileSystemGetBuffer,
+	packFileSystemTakeBuffer,
+	packFileSystemUntakeBuffer,
+	packFileSystemOpenDir,
+	packFileSystemNextDir,
+	packFileSystemDirName,
+	packFileSystemCloseDir
+};
+
+}	// namespace ro
@@ -0,0 +1,91 @@
+#ifndef __roPackFileSystem_h__
+#define __roPackFileSystem_h__
+
+#include "roFileSystem.h"
+
+namespace ro {
+
+/// A read-only archive of many files, replacing thousands of openFile() on loose files with a single one.
+///
+/// Layout, all in little endian:
+///		PackHeader
+///		Small files data, contiguous in name order, each aligned to 16 bytes
+///		Large files data, each aligned to PackBuildOptions::pageAlignment
+///		Table of content: PackEntry[entryCount] sorted by name, roUint32 buckets[bucketCount], names
+///
+/// The buckets are an open addressing hash table (linear probing) on stringHash() of the name,
+/// holding the entry index + 1, so looking up a name is O(1).
+/// Since small files are stored in name order, those of a directory are next to each other,
+/// and packFileSystemPrefetchDir() bring them all in memory with a single read.
+struct PackHeader
+{
+	char		magic[4];		///< "roPK"
+	roUint32	version;
+	roUint32	entryCount;
+	roUint32	bucketCount;	///< Power of 2
+	roUint64	tocOffset;
+	roUint64	tocSize;
+	roUint32	nameSize;
+	roUint32	reserved[3];
+};	// PackHeader
+
+struct PackEntry
+{
+	enum Compression { Compression_None = 0, Compression_GZip = 1 };
+	enum Flag { Flag_Small = 1 };
+
+	roUint64	offset;			///< Of the stored data in the archive
+	roUint64	storedSize;
+	roUint64	originalSize;
+	roUint32	nameOffset;		///< In the names of the table of content, not null terminated
+	roUint32	nameHash;
+	roUint16	nameLength;
+	roUint8		compression;
+	roUint8		flags;
+	roUint32	reserved;
+};	// PackEntry
+
+struct PackBuildOptions
+{
+	PackBuildOptions();
+
+	int			compressionLevel;	///< zlib level, 0 to store without compression
+	roUint64	smallFileSize;		///< Files up to this size are stored contiguously
+	roUint64	pageAlignment;		///< For large files
+	float		minCompressRatio;	///< Keep the compressed data only if it's smaller than this ratio of the original
+};	// PackBuildOptions
+
+/// Pack all the files under directory, named by their path relative to it with '/' as separator.
+Status		packArchiveBuild			(const char* directory, const char* packPath, const PackBuildOptions& options=PackBuildOptions());
+
+/// Mount an archive, such that "mountPoint/name" open the entry "name"; mountPoint can be empty.
+/// The default fileSystem look into the mounted archives before the local files.
+Status		packFileSystemMount			(const char* packPath, const char* mountPoint);
+Status		packFileSystemUnmount		(const char* mountPoint);
+void		packFileSystemUnmountAll	();
+bool		packFileSystemHasMount		();
+
+/// Read the small files under the directory uri (recursively) with a single read,
+/// they are then served from memory until unmount.
+Status		packFileSystemPrefetchDir	(const char* uri);
+
+Status		packFileSystemOpenFile		(const char* uri, void*& outFile);
+bool		packFileSystemReadWillBlock	(void* file, roUint64 bytesToRead);
+Status		packFileSystemRead			(void* file, void* buffer, roUint64 bytesToRead, roUint64& bytesRead);
+Status		packFileSystemAtomicRead	(void* file, void* buffer, roUint64 bytesToRead);
+Status		packFileSystemSize			(void* file, roUint64& bytes);
+Status		packFileSystemSeek			(void* file, roInt64 offset, FileSystem::SeekOrigin origin);
+void		packFileSystemCloseFile		(void* file);
+roBytePtr	packFileSystemGetBuffer		(void* file, roUint64 requestSize, roUint64& readableSize);
+void		packFileSystemTakeBuffer	(void* file);
+void		packFileSystemUntakeBuffer	(void* file, roBytePtr buf);
+void*		packFileSystemOpenDir		(const char* uri);
+bool		packFileSystemNextDir		(void* dir);
+const char*	packFileSystemDirName		(void* dir);
+void		packFileSystemCloseDir		(void* dir);
+
+extern FileSystem packFileSystem;
+
+}	// namespace ro
+
+#endif	// __roPackFileSystem_h__
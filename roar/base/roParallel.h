@@ -0,0 +1,171 @@
+#ifndef __roParallel_h__
+#define __roParallel_h__
+
+#include "roTaskPool.h"
+#include "roAtomic.h"
+#include "roMemory.h"
+#include "roUtility.h"
+
+namespace ro {
+
+/// Invoke func(rangeBegin, rangeEnd) over the sub-ranges of [begin, end) using the TaskPool.
+/// The range is split lazily: a running chunk only splits off the second half of
+/// it's remaining range when there is an idle thread, or when an idle thread
+/// request it through Task::offload(). Therefore a TaskPool with no worker
+/// runs the whole loop on the calling thread with no task overhead at all.
+/// \param grain
+///		The minimum number of items per invocation of func (the last one can be smaller),
+///		= 0 : pick one base on the range size and the thread count
+/// The calling thread participates the work, and return once all sub-ranges are done.
+/// Example:
+/// @code
+/// parallelFor(taskPool, 0, count, 0, [&](roSize b, roSize e) {
+///		for(roSize i=b; i<e; ++i) data[i] *= 2;
+/// });
+/// @endcode
+template<class Func>
+void parallelFor(TaskPool& taskPool, roSize begin, roSize end, roSize grain, const Func& func);
+
+/// Similar to parallelFor(), func(rangeBegin, rangeEnd) returns the partial result of a sub-range,
+/// join(lhs, rhs) combines the partial results of two adjacent ranges, and always in range order,
+/// such that join need not be commutative.
+template<class T, class Func, class Join>
+T parallelReduce(TaskPool& taskPool, roSize begin, roSize end, roSize grain, const T& identity, const Func& func, const Join& join);
+
+/// Grain size used when 0 is passed to parallelFor() or parallelReduce()
+roSize parallelAutoGrain(const TaskPool& taskPool, roSize itemCount);
+
+
+// ----------------------------------------------------------------------
+
+template<class T, class Func, class Join>
+class _ParallelReduceTask : public Task
+{
+public:
+	_ParallelReduceTask(roSize begin, roSize end, roSize grain, const T& identity, const Func& func, const Join& join, volatile long& unstartedCount)
+		: _begin(begin), _end(end), _grain(grain)
+		, _identity(identity), _result(identity)
+		, _func(func), _join(join)
+		, _unstartedCount(unstartedCount)
+		, _offloadRequested(false), _splittable(true)
+		, _childCount(0)
+	{}
+
+	/// The owner is responsible to delete this task, after reading it's result
+	void run(TaskPool* taskPool) override
+	{
+		roAtomicDec(&_unstartedCount);
+		execute(*taskPool);
+	}
+
+	/// Only set a flag, the actual split is done by the running thread on it's next chunk boundary
+	bool offload(TaskPool* taskPool) override
+	{
+		(void)taskPool;
+		if(!_splittable || _offloadRequested)
+			return false;
+		_offloadRequested = true;
+		return true;
+	}
+
+	void execute(TaskPool& taskPool)
+	{
+		taskPool.beginOffload(this);
+
+		while(_begin < _end) {
+			if(_splittable && (_end - _begin < 2 * _grain || _childCount == maxChildCount))
+				_splittable = false;
+
+			// The idle count only drop once a woken thread get going, split only for those
+			// idle threads not yet having a child to pick up, re-checked on every split
+			if(_splittable && (_offloadRequested || roSize(_unstartedCount) < taskPool.idleThreadCount())) {
+				roSize mid = _begin + (_end - _begin) / 2;
+				_ParallelReduceTask* child = defaultAllocator.newObj<_ParallelReduceTask>(mid, _end, _grain, _identity, _func, _join, _unstartedCount).unref();
+				roAtomicInc(&_unstartedCount);
+				_children[_childCount] = child;
+				_childIds[_childCount] = taskPool.addFinalized(child);
+				++_childCount;
+				_end = mid;
+				_offloadRequested = false;
+				continue;
+			}
+
+			roSize next = _begin + roMinOf2(_grain, _end - _begin);
+			_result = _join(_result, _func(_begin, next));
+			_begin = next;
+		}
+
+		taskPool.endOffload(this);
+
+		// The children hold the later part of the range, the last spawned one is the nearest
+		for(roSize i=_childCount; i--; ) {
+			taskPool.wait(_childIds[i]);
+			_result = _join(_result, _children[i]->_result);
+			defaultAllocator.deleteObj(_children[i]);
+		}
+		_childCount = 0;
+	}
+
+	/// Each split halves the remaining range, so this is only hit with a ridiculous range
+	static const roSize maxChildCount = 32;
+
+	roSize _begin, _end;
+	roSize _grain;
+	T _identity;
+	T _result;
+	const Func& _func;
+	const Join& _join;
+	volatile long& _unstartedCount;	///< Children spawned but not yet run, shared by the whole reduction
+	volatile bool _offloadRequested;
+	volatile bool _splittable;
+	roSize _childCount;
+	_ParallelReduceTask* _children[maxChildCount];
+	TaskId _childIds[maxChildCount];
+};	// _ParallelReduceTask
+
+inline roSize parallelAutoGrain(const TaskPool& taskPool, roSize itemCount)
+{
+	// Around 8 chunks per thread, leaving room for balancing uneven work
+	roSize chunkCount = (taskPool.threadCount() + 1) * 8;
+	return roMaxOf2(roSize(1), itemCount / chunkCount);
+}
+
+template<class T, class Func, class Join>
+T parallelReduce(TaskPool& taskPool, roSize begin, roSize end, roSize grain, const T& identity, const Func& func, const Join& join)
+{
+	if(begin >= end)
+		return identity;
+
+	if(grain == 0)
+		grain = parallelAutoGrain(taskPool, end - begin);
+
+	volatile long unstartedCount = 0;
+	_ParallelReduceTask<T, Func, Join> root(begin, end, grain, identity, func, join, unstartedCount);
+	root.execute(taskPool);
+	return root._result;
+}
+
+struct _ParallelNullJoin
+{
+	int operator()(int, int) const { return 0; }
+};	// _ParallelNullJoin
+
+template<class Func>
+struct _ParallelForBody
+{
+	explicit _ParallelForBody(const Func& f) : func(f) {}
+	int operator()(roSize b, roSize e) const { func(b, e); return 0; }
+	const Func& func;
+};	// _ParallelForBody
+
+template<class Func>
+void parallelFor(TaskPool& taskPool, roSize begin, roSize end, roSize grain, const Func& func)
+{
+	_ParallelForBody<Func> body(func);
+	_ParallelNullJoin join;
+	parallelReduce(taskPool, begin, end, grain, 0, body, join);
+}
+
+}	// namespace ro
+
+#endif	// __roParallel_h__
@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "roRawFileSystem.h"
 #include "roArray.h"
+#include "roCondVar.h"
 #include "roString.h"
 #include "roTypeCast.h"
 #include "roCpuProfiler.h"
@@ -8,6 +9,22 @@
 #include <stdio.h>
 #include <sys/stat.h>
 
+#if !roOS_WIN
+#	include <dirent.h>
+#	include <errno.h>
+#	include <fcntl.h>
+#	include <pthread.h>
+#	include <sys/mman.h>
+#	include <sys/uio.h>
+#	include <unistd.h>
+#endif
+
+#if roOS_Linux && __has_include(<linux/io_uring.h>)
+#	include <linux/io_uring.h>
+#	include <sys/syscall.h>
+#	define roRAWFS_IO_URING 1
+#endif
+
 namespace ro {
 
 static DefaultAllocator _allocator;
@@ -15,6 +32,10 @@ static DefaultAllocator _allocator;
 FileSystem*	defaultFileSystem();
 void setDefaultFileSystem(FileSystem* fs);
 
+RawFileSystemOptions rawFileSystemOptions = {
+	RawFileSystemOptions::AsyncIo_Auto
+};
+
 #if roOS_WIN
 
 struct _RawFile {
@@ -25,8 +46,10 @@ struct _RawFile {
 	roSize bufOffset;
 	roSize bufSize;
 	roSize readable;
-	roUint64 fileSize;
+	roUint64 fileSize;	///< The end of a view
 	Status st;
+	roUint64 viewBegin;	///< Zero unless a view, where seek and size are relative to
+	bool isView;		///< Not owning file
 };
 
 Status rawFileSystemOpenFile(const char* uri, void*& outFile)
@@ -63,13 +86,23 @@ bool rawFileSystemReadWillBlock(void* file, roUint64 size)
 		return false;
 
 	// Get file size
-	if(impl->fileSize == 0) {
+	if(impl->fileSize == 0 && !impl->isView) {
 		if(!(impl->st = rawFileSystemSize(file, impl->fileSize)))
 			return impl->st;
 	}
 
 	size = roMinOf2(impl->fileSize, size);
 
+	// A view must not read into what follow it in the file
+	if(impl->isView && !impl->readInProgress) {
+		LARGE_INTEGER pos;
+		pos.LowPart = impl->overlap.Offset;
+		pos.HighPart = impl->overlap.OffsetHigh;
+		if(roUint64(pos.QuadPart) >= impl->fileSize)
+			return impl->st = Status::file_ended, false;
+		size = roMinOf2(size, impl->fileSize - pos.QuadPart);
+	}
+
 CheckProgress:
 	if(impl->readInProgress) {
 		DWORD transferred = 0;
@@ -78,6 +111,7 @@ CheckProgress:
 				return impl->st = Status::in_progress, true;
 
 			// If EOF or error occurred
+			impl->readInProgress = false;
 			return impl->st = Status::file_ended, false;
 		}
 
@@ -169,6 +203,11 @@ Status rawFileSystemSize(void* file, roUint64& bytes)
 	_RawFile* impl = (_RawFile*)(file);
 	roAssert(impl); if(!impl) return Status::invalid_parameter;
 
+	if(impl->isView) {
+		bytes = impl->fileSize - impl->viewBegin;
+		return Status::ok;
+	}
+
 	LARGE_INTEGER fileSize;
 	if(!GetFileSizeEx(impl->file, &fileSize))
 		return Status::file_error;
@@ -187,7 +226,7 @@ Status rawFileSystemSeek(void* file, roInt64 offset, FileSystem::SeekOrigin orig
 	if(origin == FileSystem::SeekOrigin_Begin) {
 		st = roIsValidCast(absOffset.QuadPart, offset);
 		if(!st) return st;
-		absOffset.QuadPart = offset;
+		absOffset.QuadPart = offset + roInt64(impl->viewBegin);
 	}
 	else if(origin == FileSystem::SeekOrigin_Current) {
 		absOffset.LowPart = impl->overlap.Offset;
@@ -195,7 +234,9 @@ Status rawFileSystemSeek(void* file, roInt64 offset, FileSystem::SeekOrigin orig
 		absOffset.QuadPart += offset;
 	}
 	else if(origin == FileSystem::SeekOrigin_End) {
-		if(!GetFileSizeEx(impl->file, &absOffset))
+		if(impl->isView)
+			absOffset.QuadPart = impl->fileSize;
+		else if(!GetFileSizeEx(impl->file, &absOffset))
 			return Status::file_seek_error;
 		absOffset.QuadPart -= offset;
 	}
@@ -204,6 +245,9 @@ Status rawFileSystemSeek(void* file, roInt64 offset, FileSystem::SeekOrigin orig
 		return Status::invalid_parameter;
 	}
 
+	if(absOffset.QuadPart < roInt64(impl->viewBegin))
+		return Status::file_seek_error;
+
 	impl->overlap.Internal = impl->overlap.InternalHigh = 0;
 	impl->overlap.Offset = absOffset.LowPart;
 	impl->overlap.OffsetHigh = absOffset.HighPart;
@@ -218,7 +262,16 @@ void rawFileSystemCloseFile(void* file)
 {
 	_RawFile* impl = (_RawFile*)(file);
 	roAssert(impl); if(!impl) return;
-	roVerify(CloseHandle(impl->file));
+
+	// Closing a view keep the handle open, the overlapped read must be done with buf before freeing it
+	if(impl->readInProgress) {
+		::CancelIoEx(impl->file, &impl->overlap);
+		while(!HasOverlappedIoCompleted(&impl->overlap))
+			::Sleep(0);
+	}
+
+	if(!impl->isView)
+		roVerify(CloseHandle(impl->file));
 	_allocator.free(impl->buf);
 	_allocator.deleteObj(impl);
 }
@@ -228,12 +281,20 @@ roBytePtr rawFileSystemGetBuffer(void* file, roUint64 requestSize, roUint64& rea
 	_RawFile* impl = (_RawFile*)(file);
 	if(!impl) { readableSize = 0; return NULL; }
 
-	while(impl->readable < requestSize && rawFileSystemReadWillBlock(file, requestSize - impl->readable)) {}
+	while(impl->readable < requestSize && rawFileSystemReadWillBlock(file, requestSize)) {}
+
+	// An overlapped read may still be writing after the readable bytes, let it finish before moving them
+	while(impl->readInProgress && rawFileSystemReadWillBlock(file, impl->readable + 1)) {}
+
+	// The buffer given should start at the allocation, so it can be taken
+	if(impl->bufOffset > 0) {
+		memmove(impl->buf, impl->buf + impl->bufOffset, impl->readable);
+		impl->bufOffset = 0;
+	}
 
 	readableSize = roMinOf2(requestSize, roUint64(impl->readable));
-	impl->bufOffset += impl->readable;
-	roAssert(readableSize <= impl->readable);
-	impl->readable -= num_cast<roSize>(readableSize);
+	impl->bufOffset = num_cast<roSize>(readableSize);
+	impl->readable -= impl->bufOffset;
 
 	return impl->buf;
 }
@@ -263,20 +324,536 @@ void rawFileSystemUntakeBuffer(void* file, roBytePtr buf)
 	_allocator.free(buf);
 }
 
+roPtrInt rawFileSystemNativeHandle(void* file)
+{
+	_RawFile* impl = (_RawFile*)(file);
+	roAssert(impl); if(!impl) return roPtrInt(INVALID_HANDLE_VALUE);
+	return roPtrInt(impl->file);
+}
+
+Status rawFileSystemOpenView(void* file, roUint64 offset, roUint64 size, void*& outView)
+{
+	_RawFile* impl = (_RawFile*)(file);
+	roAssert(impl); if(!impl) return Status::invalid_parameter;
+	if(offset + size < offset) return Status::invalid_parameter;
+
+	// Every overlapped read carry its own offset, nothing else need to be private
+	LARGE_INTEGER begin;
+	Status st = roIsValidCast(begin.QuadPart, offset); if(!st) return st;
+	begin.QuadPart = offset;
+
+	_RawFile ret = { impl->file, false, {0}, NULL, 0, 0, 0, offset + size };
+	ret.overlap.Offset = begin.LowPart;
+	ret.overlap.OffsetHigh = begin.HighPart;
+	ret.st = Status::ok;
+	ret.viewBegin = offset;
+	ret.isView = true;
+
+	outView = _allocator.newObj<_RawFile>(ret).unref();
+	return Status::ok;
+}
+
+bool rawFileSystemIoUringAvailable()
+{
+	return false;
+}
+
+#else
+
+// Asynchronous read, either by io_uring or by pread() on the background threads of _ReadThreadPool
+struct _AsyncRead {
+	int fd;
+	struct iovec iov;
+	roUint64 offset;
+	RawFileSystemOptions::AsyncIo engine;
+	int done;			///< Set to 1 with release semantic once result is available
+	roInt64 result;		///< Bytes read, or -errno
+	_AsyncRead* next;	///< Link in _ReadThreadPool's queue
+};
+
+static bool _asyncReadIsDone(_AsyncRead& r)
+{
+	return __atomic_load_n(&r.done, __ATOMIC_ACQUIRE) != 0;
+}
+
+static void _asyncReadSetDone(_AsyncRead& r, roInt64 result)
+{
+	r.result = result;
+	__atomic_store_n(&r.done, 1, __ATOMIC_RELEASE);
+}
+
+// Do the read on the calling thread, returning the result for _asyncReadSetDone()
+static roInt64 _asyncReadNow(_AsyncRead& r)
+{
+	ssize_t n;
+	do {
+		n = ::pread(r.fd, r.iov.iov_base, r.iov.iov_len, num_cast<off_t>(r.offset));
+	} while(n < 0 && errno == EINTR);
+	return n < 0 ? -errno : n;
+}
+
+// ----------------------------------------------------------------------
+
+#if roRAWFS_IO_URING
+
+// A single ring shared by all files, talking to the kernel with the raw syscalls (no liburing)
+struct _IoUring
+{
+	_IoUring() : fd(-1), toSubmit(0), inFlight(0), waiting(false) {}
+
+	bool init(roUint32 entries)
+	{
+		io_uring_params p;
+		roMemZeroStruct(p);
+		fd = (int)::syscall(__NR_io_uring_setup, entries, &p);
+		if(fd < 0)
+			return false;
+
+		sqRingSize = p.sq_off.array + p.sq_entries * sizeof(roUint32);
+		cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		if(p.features & IORING_FEAT_SINGLE_MMAP)
+			sqRingSize = cqRingSize = roMaxOf2(sqRingSize, cqRingSize);
+
+		sqRing = ::mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		cqRing = (p.features & IORING_FEAT_SINGLE_MMAP) ? sqRing :
+			::mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		sqes = (io_uring_sqe*)::mmap(NULL, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+		if(sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+			::close(fd);
+			fd = -1;
+			return false;
+		}
+
+		roByte* sq = (roByte*)sqRing;
+		sqTail	= (roUint32*)(sq + p.sq_off.tail);
+		sqMask	= *(roUint32*)(sq + p.sq_off.ring_mask);
+		sqArray	= (roUint32*)(sq + p.sq_off.array);
+		sqEntries = p.sq_entries;
+
+		roByte* cq = (roByte*)cqRing;
+		cqHead	= (roUint32*)(cq + p.cq_off.head);
+		cqTail	= (roUint32*)(cq + p.cq_off.tail);
+		cqMask	= *(roUint32*)(cq + p.cq_off.ring_mask);
+		cqes	= (io_uring_cqe*)(cq + p.cq_off.cqes);
+		cqEntries = p.cq_entries;
+
+		return true;
+	}
+
+	int enter(roUint32 submit, roUint32 minComplete, roUint32 flags)
+	{
+		return (int)::syscall(__NR_io_uring_enter, fd, submit, minComplete, flags, NULL, 0);
+	}
+
+	/// Returns false when the ring is full, the caller should fall back to something else
+	bool submit(_AsyncRead& r)
+	{
+		roScopeLock(mutex);
+
+		// Never have more in flight than the completion queue can hold
+		if(inFlight + toSubmit >= cqEntries || toSubmit >= sqEntries)
+			return false;
+
+		roUint32 tail = *sqTail;
+		roUint32 index = tail & sqMask;
+		io_uring_sqe* sqe = &sqes[index];
+		roMemZeroStruct(*sqe);
+		sqe->opcode = IORING_OP_READV;
+		sqe->fd = r.fd;
+		sqe->addr = (roUint64)&r.iov;
+		sqe->len = 1;
+		sqe->off = r.offset;
+		sqe->user_data = (roUint64)&r;
+		sqArray[index] = index;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+		++toSubmit;
+
+		_flush(0, 0);
+		return true;
+	}
+
+	/// For polling, never block on others that are submitting or reaping
+	void reap()
+	{
+		if(!mutex.tryLock())
+			return;
+		roScopeUnlockOnly(mutex);
+
+		// The one waiting in the kernel will reap, taking its completion here would leave it sleeping
+		if(!waiting)
+			_reap();
+	}
+
+	void wait(_AsyncRead& r)
+	{
+		roScopeLock(mutex);
+		while(true) {
+			if(!waiting)
+				_reap();
+			if(_asyncReadIsDone(r))
+				break;
+
+			// Only one thread wait in the kernel, the others wait for it to hand out the completions
+			if(waiting) {
+				mutex.waitNoLock();
+				continue;
+			}
+
+			if(toSubmit > 0)
+				_flush(0, 0);
+
+			// Nobody reap while waiting is set, so the kernel return as soon as any completion arrive
+			waiting = true;
+			{	roScopeUnlock(mutex);
+				while(enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno == EINTR) {}
+			}
+			waiting = false;
+			_reap();
+			mutex.broadcast();
+		}
+	}
+
+// Private
+	void _flush(roUint32 minComplete, roUint32 flags)
+	{
+		int ret;
+		do {
+			ret = enter(toSubmit, minComplete, flags);
+		} while(ret < 0 && errno == EINTR);
+
+		// Any not consumed will be given again on next enter
+		if(ret > 0) {
+			roUint32 submitted = roMinOf2(toSubmit, (roUint32)ret);
+			toSubmit -= submitted;
+			inFlight += submitted;
+		}
+	}
+
+	void _reap()
+	{
+		roUint32 head = *cqHead;
+		roUint32 tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+		for(; head != tail; ++head) {
+			io_uring_cqe* cqe = &cqes[head & cqMask];
+			_AsyncRead* r = (_AsyncRead*)cqe->user_data;
+			--inFlight;
+			_asyncReadSetDone(*r, cqe->res);
+		}
+		__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+	}
+
+	int fd;
+	void* sqRing;
+	void* cqRing;
+	roSize sqRingSize, cqRingSize;
+	roUint32* sqTail;
+	roUint32* sqArray;
+	roUint32 sqMask, sqEntries;
+	io_uring_sqe* sqes;
+	roUint32* cqHead;
+	roUint32* cqTail;
+	roUint32 cqMask, cqEntries;
+	io_uring_cqe* cqes;
+	roUint32 toSubmit;	///< Filled in the submission queue but not yet taken by the kernel
+	roUint32 inFlight;
+	bool waiting;		///< A thread is waiting in the kernel, without holding the mutex
+	CondVar mutex;		///< Signaled when the waiting thread has reaped the completions
+};	// _IoUring
+
+#endif	// roRAWFS_IO_URING
+
+// ----------------------------------------------------------------------
+
+// Fallback when io_uring is not available, pread() on a few threads
+struct _ReadThreadPool
+{
+	_ReadThreadPool() : head(NULL), tail(NULL) {}
+
+	bool init(roSize threadCount)
+	{
+		for(roSize i=0; i<threadCount; ++i) {
+			pthread_t h;
+			if(::pthread_create(&h, NULL, &_threadFunc, this) != 0)
+				return i > 0;
+			::pthread_detach(h);
+		}
+		return true;
+	}
+
+	void submit(_AsyncRead& r)
+	{
+		roScopeLock(queue);
+		r.next = NULL;
+		if(tail) tail->next = &r;
+		else head = &r;
+		tail = &r;
+		queue.signal();
+	}
+
+	void wait(_AsyncRead& r)
+	{
+		roScopeLock(completed);
+		while(!_asyncReadIsDone(r))
+			completed.waitNoLock();
+	}
+
+// Private
+	static void* _threadFunc(void* p)
+	{
+		_ReadThreadPool& self = *(_ReadThreadPool*)p;
+		while(true) {
+			_AsyncRead* r = NULL;
+			{	roScopeLock(self.queue);
+				while(!self.head)
+					self.queue.waitNoLock();
+				r = self.head;
+				self.head = r->next;
+				if(!self.head) self.tail = NULL;
+			}
+
+			const roInt64 result = _asyncReadNow(*r);
+
+			roScopeLock(self.completed);
+			_asyncReadSetDone(*r, result);
+			self.completed.broadcast();
+		}
+		return NULL;
+	}
+
+	CondVar queue;
+	CondVar completed;
+	_AsyncRead* head;
+	_AsyncRead* tail;
+};	// _ReadThreadPool
+
+// ----------------------------------------------------------------------
+
+static Mutex _asyncIoMutex;
+#if roRAWFS_IO_URING
+static _IoUring* _ioUring = NULL;
+static bool _ioUringTried = false;
+#endif
+static _ReadThreadPool* _readThreadPool = NULL;
+
+static _ReadThreadPool* _getReadThreadPool()
+{
+	roScopeLock(_asyncIoMutex);
+	if(!_readThreadPool) {
+		_readThreadPool = _allocator.newObj<_ReadThreadPool>().unref();
+		if(!_readThreadPool->init(4)) {
+			_allocator.deleteObj(_readThreadPool);
+			_readThreadPool = NULL;
+		}
+	}
+	return _readThreadPool;
+}
+
+#if roRAWFS_IO_URING
+static _IoUring* _getIoUring()
+{
+	roScopeLock(_asyncIoMutex);
+	if(!_ioUringTried) {
+		_ioUringTried = true;
+		_ioUring = _allocator.newObj<_IoUring>().unref();
+		if(!_ioUring->init(256)) {
+			_allocator.deleteObj(_ioUring);
+			_ioUring = NULL;
+		}
+	}
+	return _ioUring;
+}
+#endif
+
+bool rawFileSystemIoUringAvailable()
+{
+#if roRAWFS_IO_URING
+	return _getIoUring() != NULL;
 #else
+	return false;
+#endif
+}
+
+/// Resolve AsyncIo_Auto, and those not available, to what will actually be used
+static RawFileSystemOptions::AsyncIo _resolveAsyncIo(RawFileSystemOptions::AsyncIo asyncIo)
+{
+	if(asyncIo == RawFileSystemOptions::AsyncIo_None)
+		return asyncIo;
+
+	if(asyncIo != RawFileSystemOptions::AsyncIo_ThreadPool && rawFileSystemIoUringAvailable())
+		return RawFileSystemOptions::AsyncIo_IoUring;
+
+	return _getReadThreadPool() ? RawFileSystemOptions::AsyncIo_ThreadPool : RawFileSystemOptions::AsyncIo_None;
+}
+
+static void _asyncReadSubmit(_AsyncRead& r, RawFileSystemOptions::AsyncIo asyncIo)
+{
+	r.done = 0;
+	r.result = 0;
+
+#if roRAWFS_IO_URING
+	// The thread pool take over when the ring is full
+	if(asyncIo == RawFileSystemOptions::AsyncIo_IoUring && _ioUring->submit(r)) {
+		r.engine = asyncIo;
+		return;
+	}
+#endif
+
+	// Not even a thread could be started, the read is already done when returning
+	_ReadThreadPool* pool = _getReadThreadPool();
+	if(!pool) {
+		r.engine = RawFileSystemOptions::AsyncIo_None;
+		_asyncReadSetDone(r, _asyncReadNow(r));
+		return;
+	}
+
+	r.engine = RawFileSystemOptions::AsyncIo_ThreadPool;
+	pool->submit(r);
+}
+
+static bool _asyncReadPoll(_AsyncRead& r)
+{
+	if(_asyncReadIsDone(r))
+		return true;
+#if roRAWFS_IO_URING
+	if(r.engine == RawFileSystemOptions::AsyncIo_IoUring)
+		_ioUring->reap();
+#endif
+	return _asyncReadIsDone(r);
+}
+
+static void _asyncReadWait(_AsyncRead& r)
+{
+#if roRAWFS_IO_URING
+	if(r.engine == RawFileSystemOptions::AsyncIo_IoUring)
+		return _ioUring->wait(r);
+#endif
+	if(r.engine == RawFileSystemOptions::AsyncIo_ThreadPool)
+		_readThreadPool->wait(r);
+	roAssert(_asyncReadIsDone(r));
+}
+
+// ----------------------------------------------------------------------
 
 struct _RawFile {
-	FILE* file;
+	int fd;
+	RawFileSystemOptions::AsyncIo asyncIo;
 	roBytePtr buf;
 	roSize bufSize;
+	roSize bufOffset;	///< Start of the data not yet given to the user
+	roSize readable;
+	roUint64 filePos;	///< File offset right after the buffered data
+	roUint64 fileSize;	///< As of open, only used to size the asynchronous reads; the end of a view
+	roUint64 viewBegin;	///< Zero unless a view, where seek and size are relative to
+	bool isView;		///< Not owning fd
+	bool ended;
+	bool readInProgress;
+	_AsyncRead req;		///< At most one read in flight, writing to buf + bufOffset + readable
+	Status st;
 };
 
+static const roSize _minAsyncReadSize = 4 * 1024;
+
+// Bytes to read from the file for having size bytes in the buffer
+static roSize _bytesToRead(_RawFile* impl, roUint64 size)
+{
+	if(impl->readable >= size || impl->filePos >= impl->fileSize)
+		return 0;
+	return clamp_cast<roSize>(roMinOf2(size - impl->readable, impl->fileSize - impl->filePos));
+}
+
+// Make room for size more bytes after the buffered data, compacting it to the front
+static void _reserve(_RawFile* impl, roSize size)
+{
+	if(impl->bufOffset > 0) {
+		memmove(impl->buf, impl->buf + impl->bufOffset, impl->readable);
+		impl->bufOffset = 0;
+	}
+
+	roSize bufSize = impl->readable + size;
+	if(bufSize > impl->bufSize) {
+		bufSize = roMaxOf2(bufSize, impl->bufSize + impl->bufSize / 2);
+		impl->buf = _allocator.realloc(impl->buf, impl->bufSize, bufSize);
+		impl->bufSize = bufSize;
+	}
+}
+
+static void _completeRead(_RawFile* impl)
+{
+	impl->readInProgress = false;
+	roInt64 result = impl->req.result;
+	if(result < 0)
+		impl->st = Status::file_read_error;
+	else if(result == 0)
+		impl->ended = true;
+	else {
+		impl->readable += num_cast<roSize>(result);
+		impl->filePos += num_cast<roUint64>(result);
+	}
+}
+
+// The read in flight write into buf, it must finish before touching buf
+static void _finishReadInProgress(_RawFile* impl)
+{
+	if(!impl->readInProgress)
+		return;
+	_asyncReadWait(impl->req);
+	_completeRead(impl);
+}
+
+static void _readSync(_RawFile* impl, roUint64 size)
+{
+	_finishReadInProgress(impl);
+
+	// The file may have grown since opened
+	struct stat st;
+	if(!impl->isView && ::fstat(impl->fd, &st) == 0)
+		impl->fileSize = num_cast<roUint64>(st.st_size);
+
+	while(!impl->ended && impl->st) {
+		roSize toRead = _bytesToRead(impl, size);
+		if(toRead == 0)
+			break;
+
+		_reserve(impl, toRead);
+		ssize_t n = ::pread(impl->fd, impl->buf + impl->readable, toRead, num_cast<off_t>(impl->filePos));
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0)
+			impl->st = Status::file_read_error;
+		else if(n == 0)
+			impl->ended = true;
+		else {
+			impl->readable += n;
+			impl->filePos += n;
+		}
+	}
+}
+
 Status rawFileSystemOpenFile(const char* uri, void*& outFile)
 {
 	if(!uri) return Status::invalid_parameter;
 
-	_RawFile ret = { fopen(uri, "rb"), NULL, 0 };
-	if(!ret.file) return Status::file_not_found;
+	int fd = ::open(uri, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		if(errno == ENOENT) return Status::file_not_found;
+		if(errno == EACCES) return Status::file_access_denied;
+		if(errno == EMFILE || errno == ENFILE) return Status::file_open_too_many_open_files;
+		return Status::file_open_error;
+	}
+
+	struct stat st;
+	if(::fstat(fd, &st) != 0) {
+		::close(fd);
+		return Status::file_open_error;
+	}
+
+	_RawFile ret;
+	roMemZeroStruct(ret);
+	ret.fd = fd;
+	ret.asyncIo = _resolveAsyncIo(rawFileSystemOptions.asyncIo);
+	ret.fileSize = num_cast<roUint64>(st.st_size);
+	ret.st = Status::ok;
 
 	outFile = _allocator.newObj<_RawFile>(ret).unref();
 	return Status::ok;
@@ -284,8 +861,38 @@ Status rawFileSystemOpenFile(const char* uri, void*& outFile)
 
 bool rawFileSystemReadWillBlock(void* file, roUint64 size)
 {
-	roAssert(file);
-	return false;
+	_RawFile* impl = (_RawFile*)(file);
+	roAssert(impl); if(!impl) return false;
+
+	// Without asynchronous io, read() simply block
+	if(impl->asyncIo == RawFileSystemOptions::AsyncIo_None)
+		return false;
+
+	while(true) {
+		if(impl->readInProgress) {
+			if(!_asyncReadPoll(impl->req))
+				return true;
+			_completeRead(impl);
+		}
+
+		if(impl->ended || !impl->st)
+			return false;
+
+		roSize toRead = _bytesToRead(impl, size);
+		if(toRead == 0)
+			return false;
+
+		// Avoid tiny reads when polled with small size
+		toRead = clamp_cast<roSize>(roMinOf2(roUint64(roMaxOf2(toRead, _minAsyncReadSize)), impl->fileSize - impl->filePos));
+
+		_reserve(impl, toRead);
+		impl->req.fd = impl->fd;
+		impl->req.iov.iov_base = impl->buf + impl->readable;
+		impl->req.iov.iov_len = toRead;
+		impl->req.offset = impl->filePos;
+		impl->readInProgress = true;
+		_asyncReadSubmit(impl->req, impl->asyncIo);
+	}
 }
 
 Status rawFileSystemRead(void* file, void* buffer, roUint64 size, roUint64& bytesRead)
@@ -294,10 +901,48 @@ Status rawFileSystemRead(void* file, void* buffer, roUint64 size, roUint64& byte
 
 	_RawFile* impl = (_RawFile*)(file);
 	roAssert(impl); if(!impl) return Status::invalid_parameter;
-	if(!impl->file) return Status::file_not_open;
+	if(impl->fd < 0) return Status::file_not_open;
+
+	_finishReadInProgress(impl);
+
+	// First from what was read ahead
+	roSize fromBuf = clamp_cast<roSize>(roMinOf2(size, roUint64(impl->readable)));
+	if(fromBuf > 0)
+		roMemcpy(buffer, impl->buf + impl->bufOffset, fromBuf);
+	impl->bufOffset += fromBuf;
+	impl->readable -= fromBuf;
+	if(impl->readable == 0)
+		impl->bufOffset = 0;
+	bytesRead = fromBuf;
+
+	// Then straight into the caller's buffer
+	while(bytesRead < size && !impl->ended && impl->st) {
+		roUint64 left = size - bytesRead;
+		if(impl->isView) {
+			if(impl->filePos >= impl->fileSize) {
+				impl->ended = true;
+				break;
+			}
+			left = roMinOf2(left, impl->fileSize - impl->filePos);
+		}
 
-	bytesRead = num_cast<roUint64>(fread(buffer, 1, clamp_cast<roSize>(size), impl->file));
-	return bytesRead > 0 ? Status::ok : Status::file_ended;
+		roSize toRead = clamp_cast<roSize>(roMinOf2(left, roUint64(1) << 30));
+		ssize_t n = ::pread(impl->fd, (roByte*)buffer + bytesRead, toRead, num_cast<off_t>(impl->filePos));
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0)
+			impl->st = Status::file_read_error;
+		else if(n == 0)
+			impl->ended = true;
+		else {
+			bytesRead += n;
+			impl->filePos += n;
+		}
+	}
+
+	if(bytesRead > 0)
+		return Status::ok;
+	return impl->st ? Status::file_ended : impl->st;
 }
 
 Status rawFileSystemAtomicRead(void* file, void* buffer, roUint64 size)
@@ -313,9 +958,15 @@ Status rawFileSystemSize(void* file, roUint64& bytes)
 {
 	_RawFile* impl = (_RawFile*)(file);
 	roAssert(impl); if(!impl) return Status::invalid_parameter;
-	if(!impl->file) return Status::file_not_open;
+	if(impl->fd < 0) return Status::file_not_open;
+
+	if(impl->isView) {
+		bytes = impl->fileSize - impl->viewBegin;
+		return Status::ok;
+	}
+
 	struct stat st;
-	if(fstat(fileno(impl->file), &st) != 0)
+	if(fstat(impl->fd, &st) != 0)
 		return Status::file_error;
 
 	bytes = num_cast<roUint64>(st.st_size);
@@ -326,31 +977,72 @@ Status rawFileSystemSeek(void* file, roInt64 offset, FileSystem::SeekOrigin orig
 {
 	_RawFile* impl = (_RawFile*)(file);
 	roAssert(impl); if(!impl) return Status::invalid_parameter;
-	if(!impl->file) return Status::file_not_open;
+	if(impl->fd < 0) return Status::file_not_open;
 
-	Status st = roIsValidCast<long>(offset);
-	if(!st) return st;
-	return fseek(impl->file, num_cast<long>(offset), origin) == 0 ? Status::ok : Status::file_seek_error;
+	_finishReadInProgress(impl);
+
+	roInt64 bufBegin = num_cast<roInt64>(impl->filePos - impl->readable);
+	roInt64 base = num_cast<roInt64>(impl->viewBegin);
+	if(origin == FileSystem::SeekOrigin_Current)
+		base = bufBegin;
+	else if(origin == FileSystem::SeekOrigin_End) {
+		roUint64 size = 0;
+		Status st = rawFileSystemSize(file, size); if(!st) return st;
+		base += num_cast<roInt64>(size);
+	}
+
+	roInt64 newPos = base + offset;
+	if(newPos < roInt64(impl->viewBegin))
+		return Status::file_seek_error;
+
+	// Keep the buffered data when seeking forward within it
+	if(newPos >= bufBegin && newPos <= roInt64(impl->filePos)) {
+		roSize skip = num_cast<roSize>(newPos - bufBegin);
+		impl->bufOffset += skip;
+		impl->readable -= skip;
+	}
+	else {
+		impl->bufOffset = 0;
+		impl->readable = 0;
+		impl->filePos = num_cast<roUint64>(newPos);
+	}
+
+	impl->ended = false;
+	impl->st = Status::ok;
+	return Status::ok;
 }
 
 void rawFileSystemCloseFile(void* file)
 {
 	_RawFile* impl = (_RawFile*)(file);
 	roAssert(impl); if(!impl) return;
-	fclose(impl->file);
+	_finishReadInProgress(impl);
+	if(!impl->isView)
+		::close(impl->fd);
 	_allocator.free(impl->buf);
 	_allocator.deleteObj(impl);
 }
 
 roBytePtr rawFileSystemGetBuffer(void* file, roUint64 requestSize, roUint64& readableSize)
 {
+	readableSize = 0;
 	_RawFile* impl = (_RawFile*)(file);
-	if(!impl) { readableSize = 0; return NULL; }
-	const roSize rqSize = clamp_cast<roSize>(requestSize);
-	impl->buf = _allocator.realloc(impl->buf, impl->bufSize, rqSize);
-	impl->bufSize = rqSize;
-	Status st = rawFileSystemRead(file, impl->buf, rqSize, readableSize);
-	if(!st) return NULL;
+	if(!impl) return NULL;
+
+	while(rawFileSystemReadWillBlock(file, requestSize))
+		_asyncReadWait(impl->req);
+
+	// Synchronously for the rest, without asynchronous io or when the file has grown
+	if(impl->readable < requestSize)
+		_readSync(impl, requestSize);
+
+	// The buffer given should start at the allocation, so it can be taken
+	_reserve(impl, 0);
+
+	readableSize = roMinOf2(requestSize, roUint64(impl->readable));
+	impl->bufOffset = num_cast<roSize>(readableSize);
+	impl->readable -= impl->bufOffset;
+
 	return impl->buf;
 }
 
@@ -358,8 +1050,23 @@ void rawFileSystemTakeBuffer(void* file)
 {
 	_RawFile* impl = (_RawFile*)(file);
 	if(!impl) return;
-	impl->buf = NULL;
-	impl->bufSize = 0;
+
+	_finishReadInProgress(impl);
+
+	// The whole buffer can give to the client
+	if(impl->readable == 0) {
+		impl->buf = NULL;
+		impl->bufSize = 0;
+		impl->bufOffset = 0;
+	}
+	// Else we need to keep part of the buffer than haven't read by the client
+	else {
+		roBytePtr oldBuf = impl->buf;
+		impl->buf = _allocator.malloc(impl->readable);
+		impl->bufSize = impl->readable;
+		roMemcpy(impl->buf, oldBuf + impl->bufOffset, impl->readable);
+		impl->bufOffset = 0;
+	}
 }
 
 void rawFileSystemUntakeBuffer(void* file, roBytePtr buf)
@@ -367,6 +1074,35 @@ void rawFileSystemUntakeBuffer(void* file, roBytePtr buf)
 	_allocator.free(buf);
 }
 
+roPtrInt rawFileSystemNativeHandle(void* file)
+{
+	_RawFile* impl = (_RawFile*)(file);
+	roAssert(impl); if(!impl) return -1;
+	return impl->fd;
+}
+
+Status rawFileSystemOpenView(void* file, roUint64 offset, roUint64 size, void*& outView)
+{
+	_RawFile* impl = (_RawFile*)(file);
+	roAssert(impl); if(!impl) return Status::invalid_parameter;
+	if(impl->fd < 0) return Status::file_not_open;
+	if(offset + size < offset) return Status::invalid_parameter;
+
+	// Every read is a pread() at filePos, nothing else need to be private
+	_RawFile ret;
+	roMemZeroStruct(ret);
+	ret.fd = impl->fd;
+	ret.asyncIo = impl->asyncIo;
+	ret.filePos = offset;
+	ret.fileSize = offset + size;
+	ret.viewBegin = offset;
+	ret.isView = true;
+	ret.st = Status::ok;
+
+	outView = _allocator.newObj<_RawFile>(ret).unref();
+	return Status::ok;
+}
+
 #endif
 
 
@@ -460,23 +1196,58 @@ void rawFileSystemCloseDir(void* dir)
 
 #else
 
+struct OpenDirContext
+{
+	OpenDirContext() : handle(NULL), entry(NULL) {}
+	~OpenDirContext() { if(handle) ::closedir(handle); }
+
+	DIR* handle;
+	struct dirent* entry;
+};	// OpenDirContext
+
+static bool _nextDirEntry(OpenDirContext& dirCtx)
+{
+	// Skip the ./ and ../
+	do {
+		dirCtx.entry = ::readdir(dirCtx.handle);
+	} while(dirCtx.entry && (roStrCmp(dirCtx.entry->d_name, ".") == 0 || roStrCmp(dirCtx.entry->d_name, "..") == 0));
+
+	return dirCtx.entry != NULL;
+}
+
 void* rawFileSystemOpenDir(const char* uri)
 {
-	return NULL;
+	if(roStrLen(uri) == 0) return NULL;
+
+	AutoPtr<OpenDirContext> dirCtx = _allocator.newObj<OpenDirContext>();
+	dirCtx->handle = ::opendir(uri);
+
+	if(!dirCtx->handle || !_nextDirEntry(*dirCtx))
+		dirCtx.deleteObject();
+
+	return dirCtx.unref();
 }
 
 bool rawFileSystemNextDir(void* dir)
 {
-	return false;
+	OpenDirContext* dirCtx = static_cast<OpenDirContext*>(dir);
+	if(!dirCtx) return false;
+
+	return _nextDirEntry(*dirCtx);
 }
 
 const char* rawFileSystemDirName(void* dir)
 {
-	return NULL;
+	OpenDirContext* dirCtx = static_cast<OpenDirContext*>(dir);
+	if(!dirCtx || !dirCtx->entry) return "";
+
+	return dirCtx->entry->d_name;
 }
 
 void rawFileSystemCloseDir(void* dir)
 {
+	OpenDirContext* dirCtx = static_cast<OpenDirContext*>(dir);
+	_allocator.deleteObj(dirCtx);
 }
 
 #endif
@@ -15,13 +15,38 @@ void		rawFileSystemCloseFile		(void* file);
 roBytePtr	rawFileSystemGetBuffer		(void* file, roUint64 requestSize, roUint64& readableSize);
 void		rawFileSystemTakeBuffer		(void* file);
 void		rawFileSystemUntakeBuffer	(void* file, roBytePtr buf);
+roPtrInt	rawFileSystemNativeHandle	(void* file);	///< HANDLE on Windows, file descriptor otherwise
 void*		rawFileSystemOpenDir		(const char* uri);
 bool		rawFileSystemNextDir		(void* dir);
 const char*	rawFileSystemDirName		(void* dir);
 void		rawFileSystemCloseDir		(void* dir);
 
+/// Open [offset, offset + size) of a file opened by rawFileSystemOpenFile() as a file of its own.
+/// It share the handle but not the position nor the buffer, so many views can read the same file
+/// from different threads without locking. Close it with rawFileSystemCloseFile() before the file.
+Status		rawFileSystemOpenView		(void* file, roUint64 offset, roUint64 size, void*& outView);
+
 extern FileSystem rawFileSystem;
 
+/// How rawFileSystem read files asynchronously on POSIX, Windows always use overlapped io.
+/// With asynchronous io, readWillBlock() submit a read of the requested size and return true until it's done,
+/// so loader tasks can reSchedule() instead of blocking a worker thread.
+struct RawFileSystemOptions
+{
+	enum AsyncIo {
+		AsyncIo_Auto,		///< io_uring when the kernel support it, else AsyncIo_ThreadPool
+		AsyncIo_IoUring,	///< Same as AsyncIo_Auto, for being explicit
+		AsyncIo_ThreadPool,	///< pread() on a few background threads
+		AsyncIo_None,		///< readWillBlock() always return false and read() block
+	};
+
+	AsyncIo asyncIo;		///< Apply to files opened afterward
+};
+
+extern RawFileSystemOptions rawFileSystemOptions;
+
+bool		rawFileSystemIoUringAvailable();
+
 }	// namespace ro
 
 #endif	// __roRawFileSystem_h__
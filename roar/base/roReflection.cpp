@@ -54,16 +54,51 @@ roStatus Type::serialize(Serializer& se, const roUtf8* varName, void* val)
 	return (*serializeFunc)(se, field, val);
 }
 
+roStatus serialize_bool(Serializer& se, Field& field, void* fieldParent)
+{
+	return se.serialize_bool(field, fieldParent);
+}
+
 roStatus serialize_int8(Serializer& se, Field& field, void* fieldParent)
 {
 	return se.serialize_int8(field, fieldParent);
 }
 
+roStatus serialize_int16(Serializer& se, Field& field, void* fieldParent)
+{
+	return se.serialize_int16(field, fieldParent);
+}
+
+roStatus serialize_int32(Serializer& se, Field& field, void* fieldParent)
+{
+	return se.serialize_int32(field, fieldParent);
+}
+
+roStatus serialize_int64(Serializer& se, Field& field, void* fieldParent)
+{
+	return se.serialize_int64(field, fieldParent);
+}
+
 roStatus serialize_uint8(Serializer& se, Field& field, void* fieldParent)
 {
 	return se.serialize_uint8(field, fieldParent);
 }
 
+roStatus serialize_uint16(Serializer& se, Field& field, void* fieldParent)
+{
+	return se.serialize_uint16(field, fieldParent);
+}
+
+roStatus serialize_uint32(Serializer& se, Field& field, void* fieldParent)
+{
+	return se.serialize_uint32(field, fieldParent);
+}
+
+roStatus serialize_uint64(Serializer& se, Field& field, void* fieldParent)
+{
+	return se.serialize_uint64(field, fieldParent);
+}
+
 roStatus serialize_float(Serializer& se, Field& field, void* fieldParent)
 {
 	return se.serialize_float(field, fieldParent);
@@ -44,6 +44,9 @@ struct Serializer
 	// For reader to poll if the array is ended
 	virtual bool	 isArrayEnded		() = 0;
 
+	// Number of elements of the array just began, roSize(-1) if the format cannot tell in advance
+	virtual roSize	 arrayCount			() { return roSize(-1); }
+
 	bool isReading;
 };
 
@@ -88,16 +88,30 @@ Type* Registry::getType()
 // Below are designed for extending the reflection system
 
 typedef roStatus (*SerializeFunc)(Serializer& se, Field& field, void* fieldParent);
+roStatus serialize_bool(Serializer& se, Field& field, void* fieldParent);
 roStatus serialize_int8(Serializer& se, Field& field, void* fieldParent);
+roStatus serialize_int16(Serializer& se, Field& field, void* fieldParent);
+roStatus serialize_int32(Serializer& se, Field& field, void* fieldParent);
+roStatus serialize_int64(Serializer& se, Field& field, void* fieldParent);
 roStatus serialize_uint8(Serializer& se, Field& field, void* fieldParent);
+roStatus serialize_uint16(Serializer& se, Field& field, void* fieldParent);
+roStatus serialize_uint32(Serializer& se, Field& field, void* fieldParent);
+roStatus serialize_uint64(Serializer& se, Field& field, void* fieldParent);
 roStatus serialize_float(Serializer& se, Field& field, void* fieldParent);
 roStatus serialize_double(Serializer& se, Field& field, void* fieldParent);
 roStatus serialize_string(Serializer& se, Field& field, void* fieldParent);
 roStatus serialize_generic(Serializer& se, Field& field, void* fieldParent);
 
 template<class T>	SerializeFunc	getSerializeFunc(T*)								{ return serialize_generic; }
+inline				SerializeFunc	getSerializeFunc(bool*)								{ return serialize_bool; }
 inline				SerializeFunc	getSerializeFunc(roInt8*)							{ return serialize_int8; }
+inline				SerializeFunc	getSerializeFunc(roInt16*)							{ return serialize_int16; }
+inline				SerializeFunc	getSerializeFunc(roInt32*)							{ return serialize_int32; }
+inline				SerializeFunc	getSerializeFunc(roInt64*)							{ return serialize_int64; }
 inline				SerializeFunc	getSerializeFunc(roUint8*)							{ return serialize_uint8; }
+inline				SerializeFunc	getSerializeFunc(roUint16*)							{ return serialize_uint16; }
+inline				SerializeFunc	getSerializeFunc(roUint32*)							{ return serialize_uint32; }
+inline				SerializeFunc	getSerializeFunc(roUint64*)							{ return serialize_uint64; }
 inline				SerializeFunc	getSerializeFunc(float*)							{ return serialize_float; }
 inline				SerializeFunc	getSerializeFunc(double*)							{ return serialize_double; }
 inline				SerializeFunc	getSerializeFunc(char**)							{ return serialize_string; }
@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "roRegex.h"
+#include "roHashMap.h"
 #include "roLog.h"
 #include "roTypeOf.h"
 #include "roTypeCast.h"
@@ -77,13 +78,18 @@ bool alternation(Graph& graph, Node& node, Edge& edge, RangedString& s) { return
 
 bool parse_nodes(Graph& graph, const RangedString& f);
 
+struct RegexProgram;
+
 struct Regex::Graph
 {
 	Graph()
+		: program(NULL)
 	{
 		clear();
 	}
 
+	~Graph();
+
 	void clear()
 	{
 		regex = NULL;
@@ -191,6 +197,8 @@ struct Regex::Graph
 	TinyArray<Edge, 128> edges;
 	roUint16 currentNodeIdx;
 	roUint16 endNodeIdx;
+
+	RegexProgram* program;	// NULL if the pattern is not supported by RegexProgram
 };	// Graph
 
 Regex::Compiled::Compiled()
@@ -295,6 +303,17 @@ static bool isWordChar(char c)
 	return roIsAlpha(c) || roIsDigit(c) || c == '_';
 }
 
+// The character before the beginning of string is considered as non-word
+static bool isWordBoundary(const RangedString& srcString, const roUtf8* s)
+{
+	bool cIsWorld = isWordChar(*s);
+	bool prevIsWorld = s > srcString.begin && isWordChar(s[-1]);
+	return
+		(s == srcString.begin && cIsWorld) ||
+		(prevIsWorld != cIsWorld) ||
+		(cIsWorld && s + 1 == srcString.end);
+}
+
 bool match_charClass(Graph& graph, char f, RangedString& s)
 {
 	roUtf8 c = *s.begin;
@@ -318,20 +337,9 @@ bool match_charClass(Graph& graph, char f, RangedString& s)
 		if(!isWordChar(c)) return ++s.begin, true;
 		break;
 	case 'b':
-	{	bool cIsWorld = isWordChar(c);
-		return
-			(s.begin == graph.srcString.begin && cIsWorld) ||
-			(isWordChar(*(s.begin - 1)) != cIsWorld) ||
-			(cIsWorld && s.begin + 1 == graph.srcString.end);
-	}	break;
+		return isWordBoundary(graph.srcString, s.begin);
 	case 'B':
-	{	bool cIsWorld = isWordChar(c);
-		return !(
-			(s.begin == graph.srcString.begin && cIsWorld) ||
-			(isWordChar(*(s.begin - 1)) != cIsWorld) ||
-			(cIsWorld && s.begin + 1 == graph.srcString.end)
-		);
-	}	break;
+		return !isWordBoundary(graph.srcString, s.begin);
 	default:
 		break;
 	}
@@ -596,11 +604,13 @@ bool parse_raw(Graph& graph, const RangedString& f, const roUtf8*& i)
 
 	// Search for end of raw string
 	const roUtf8* end2 = i;
+	const roUtf8* lastChar = i;
 	for(; end2 < f.end; ++end2) {
 		if(roStrChr(str_symbols, *end2))
 			break;
 		if(isCharSet(end2))
 			break;
+		lastChar = end2;
 		if(*end2 == '\\')	// Go though any escape character
 			++end2;
 	}
@@ -608,9 +618,10 @@ bool parse_raw(Graph& graph, const RangedString& f, const roUtf8*& i)
 	roAssert(end2 != i);
 	const roUtf8* end1 = end2;
 
-	// See if any repetition follow the string, if yes we divide the string into 2 parts
+	// See if any repetition follow the string, if yes we divide the string into 2 parts,
+	// an escaped character as the last one is kept as a whole. Test case: "a\\.+b", "a..b"
 	if(end2 != f.end && roStrChr(str_repeatition, *end2))
-		end1 = end2 - 1;
+		end1 = lastChar;
 
 	// Deal with first part
 	if(end1 > i) {
@@ -807,18 +818,21 @@ bool parse_nodes(Graph& graph, const RangedString& f)
 	// Scan till next '|' or till end
 	for(const roUtf8* i = f.begin; i <= f.end; ++i)
 	{
-		if(*i == '\\') {
+		// Never read outside f, it may not be null terminated
+		const roUtf8 c = (i < f.end) ? *i : '\0';
+
+		if(c == '\\') {
 			++i;
 			continue;
 		}
 
 		if( bracketCount1 == 0 && bracketCount2 == 0 &&
-			((i[-1] != '\\' && i[0] == '|') || i == f.end)
+			((c == '|' && (i == f.begin || i[-1] != '\\')) || i == f.end)
 		)
 		{
 			// Add alternate node for the first encountered '|', adding this
 			// extra node help preventing un-necessary interaction with '(' node
-			if(i[0] == '|' && firstEncounter) {
+			if(c == '|' && firstEncounter) {
 				Node node = { RangedString("|") };
 				graph.push2(node, alternation);
 				altNodeIdx = graph.currentNodeIdx;
@@ -831,7 +845,7 @@ bool parse_nodes(Graph& graph, const RangedString& f)
 			// Introduce extra node at each alternation, such that alternation will not interfere
 			// with any edge redirection.
 			// For instance match "a|0+a" with "0" should not success
-			if(i[0] == '|') {
+			if(c == '|') {
 				Node node = { RangedString("|->") };
 				node.userdata[0] = (void*)graph.capturingGroupCountStack.back();
 				node.userdata[1] = (void*)graph.capturingGroupCount;
@@ -842,11 +856,11 @@ bool parse_nodes(Graph& graph, const RangedString& f)
 			begin = i + 1;
 		}
 
-		bracketCount1 += (*i == '(') ? 1 : 0;
-		bracketCount1 -= (*i == ')') ? 1 : 0;
-		bracketCount2 += (*i == '[') ? 1 : 0;
+		bracketCount1 += (c == '(') ? 1 : 0;
+		bracketCount1 -= (c == ')') ? 1 : 0;
+		bracketCount2 += (c == '[') ? 1 : 0;
 		// Due to the complexing of handling ']' in character set, we simply make a check before decrement
-		bracketCount2 -= (*i == ']' && bracketCount2) ? 1 : 0;
+		bracketCount2 -= (c == ']' && bracketCount2) ? 1 : 0;
 	}
 
 	// If there were alternation, adjust the edges
@@ -917,6 +931,1139 @@ bool matchNodes(Graph& graph, Node& node, RangedString& s)
 	return --graph.branchLevel, false;
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Program
+// The pattern is also compiled into a flat program (Thompson's construction), see:
+// http://swtch.com/~rsc/regexp/regexp2.html and http://swtch.com/~rsc/regexp/regexp3.html
+// A DFA built lazily while matching find where the match begin and end, a Pike VM then run over
+// the match only if there are capturing groups, or over the whole string for the word boundary
+// which the DFA can't see. Both in linear time no matter how much the backtracking would explore.
+// The parser accept a subset of what parse_nodes() does, mirroring how it splits alternation
+// and groups, anything else (custom matcher for instance) keep using the backtracking.
+
+namespace {
+
+static const roUint32 noIndex = roUint32(-1);
+static const roSize maxProgramSize = 8192;		// Counted repetition is expanded
+static const roSize maxDfaMemory = 1 << 20;		// Per DFA, the DFA is reset when exceeded
+static const roSize minDfaInput = 1024;		// Total input of a program before the DFA states pay off over the Pike VM
+static const roSize maxCachedPrograms = 64;		// Per thread, for the one-shot match()
+
+// Only op_split, op_loopHead, op_set and op_match are visited once per position, that's enough to
+// end any cycle consuming nothing since it always pass the head of a loop
+enum InstOp
+{
+	op_set,				// Consume a byte in sets[x]
+	op_split,			// Continue at x, then at y with a lower priority
+	op_loop,			// Same as op_split at the end of a loop, visited again by an iteration matching nothing
+	op_loopHead,		// Continue at the next one
+	op_jump,			// Continue at x
+	op_save,			// Record the position into capture slot x
+	op_begin,			// Only at the beginning of string
+	op_end,				// Only at the end of string
+	op_wordBoundary,
+	op_match,
+};
+
+static bool isVisitedOnce(roUint8 op)
+{
+	return op == op_split || op == op_loopHead || op == op_set || op == op_match;
+}
+
+struct Inst
+{
+	roUint8 op;
+	roUint32 x;
+	roUint32 y;
+};
+
+enum TermType
+{
+	term_set,
+	term_begin,
+	term_end,
+	term_wordBoundary,
+	term_group,
+	term_sequence,
+	term_alternation,
+};
+
+// Parsed pattern, a tree linked by index
+struct Term
+{
+	roUint8 type;
+	roUint32 x;			// Index of the set, or of the capturing group (noIndex for non-capturing)
+	roUint32 child;		// First child of group, sequence and alternation
+	roUint32 sibling;
+	roSize min, max;	// Repetition, max is roSize(-1) for infinity
+	bool greedy;
+};
+
+enum CharSetKind
+{
+	charSet_any,
+	charSet_raw,		// Single character, may be escaped
+	charSet_class,		// \d, \s, \w...
+	charSet_set,		// [...]
+};
+
+struct CharSet
+{
+	roUint8 kind;
+	RangedString f;
+	roUint32 bits[2][8];	// Case sensitive and insensitive
+};
+
+struct DfaState
+{
+	DfaState** next;	// Per byte class, NULL if not computed yet
+	roUint32* pcs;		// Instructions waiting for a byte or the end of string, in priority order
+	roUint32 pcCount;	// 0 for the dead state
+	roUint32 hash;
+	bool isMatch;
+	roInt8 endMatch;	// Whether it match at the end of string, -1 if not computed yet
+};	// DfaState
+
+struct DfaKey
+{
+	const roUint32* pcs;
+	roUint32 pcCount;
+	roUint32 hash;
+};	// DfaKey
+
+struct DfaStateHasher
+{
+	static roSize	hash(const DfaState* s)								{ return s->hash; }
+	static roSize	hash(const DfaKey& k)								{ return k.hash; }
+	static bool		equal(const DfaState* lhs, const DfaState* rhs)		{ return lhs == rhs; }
+	static bool		equal(const DfaState* lhs, const DfaKey& rhs)
+	{
+		return lhs->pcCount == rhs.pcCount && memcmp(lhs->pcs, rhs.pcs, rhs.pcCount * sizeof(roUint32)) == 0;
+	}
+};	// DfaStateHasher
+
+struct PikeJob
+{
+	roUint32 pc;
+	roUint32 slot;			// noIndex for following pc, otherwise restore the slot to value
+	const roUtf8* value;
+};	// PikeJob
+
+struct PikeList
+{
+	roSize count;
+	Array<roUint32> pcs;		// Sized for all instructions, since a thread never visit the same pc twice
+	Array<const roUtf8*> caps;	// slotCount per thread
+};	// PikeList
+
+}	// namespace
+
+struct RegexDfa;
+
+struct RegexProgram : private NonCopyable
+{
+	RegexProgram();
+	~RegexProgram();
+
+	// Return false if the pattern is not supported
+	bool compile(const RangedString& regString);
+
+	bool match(Regex& regex, const RangedString& srcString, const char* options);
+
+// Private
+	roUint32	_newTerm(roUint8 type);
+	roUint32	_newSet(roUint8 kind, const RangedString& f);
+	roUint32	_parseAlternation(const roUtf8* begin, const roUtf8* end);
+	roUint32	_parseSequence(const roUtf8* begin, const roUtf8* end);
+	roUint32	_parseItem(const roUtf8*& i, const roUtf8* end);
+	bool		_parseRepetition(const roUtf8*& i, const roUtf8* end, Term& term);
+
+	roUint32	_pc() const { return roUint32(_out->size()); }
+	bool		_emit(roUint8 op, roUint32 x=0, roUint32 y=0);
+	bool		_emitTerm(roUint32 t, bool reversed);
+	bool		_emitItem(roUint32 t, bool reversed);
+
+	void		_buildSets(bool caseInsensitive);
+	bool		_inSet(roUint32 set, roUint8 c, bool caseInsensitive) const { return (sets[set].bits[caseInsensitive][c >> 5] >> (c & 31)) & 1; }
+
+	void		_newGeneration();
+	bool		_closure(const Array<Inst>& program, roUint32 pc, bool atBegin, bool atEnd, bool reversed, Array<roUint32>& out);
+	void		_pushJob(roUint32 pc, roUint32 slot, const roUtf8* value);
+	void		_addThread(PikeList& list, roUint32 pc, const roUtf8* sp, const roUtf8* const* caps, const RangedString& srcString);
+	bool		_runPike(const RangedString& srcString, const roUtf8* from, const roUtf8* to, bool caseInsensitive, bool anchored);
+
+	Array<Term> terms;
+	Array<CharSet> sets;
+	Array<Inst> insts;			// Forward, with the capture slots
+	Array<Inst> reversedInsts;	// For finding where the match begins, once the forward DFA found where it ends
+	roUint32 unanchoredEntry;	// Skip any byte with the lowest priority before entering the pattern
+	roUint32 captureCount;
+	bool hasWordBoundary;
+	bool anchoredAtBegin;		// Every option begin with '^'
+	bool setsBuilt[2];
+	RegexDfa* dfa[2][2];		// [caseInsensitive][reversed]
+	roUint64 _inputSize;		// Of all the match() so far
+
+	// Scratch memory
+	Array<Inst>* _out;
+	Array<roUint32> _marks;
+	roUint32 _generation;
+	Array<roUint32> _stack;
+	Array<PikeJob> _jobs;
+	roSize _jobCount;
+	Array<const roUtf8*> _caps;
+	Array<const roUtf8*> _matchCaps;	// Of the last match found by _runPike()
+	PikeList _lists[2];
+};	// RegexProgram
+
+// Each state is the ordered set of instructions the NFA could be at, states and transitions are
+// created on demand and cached, such that a byte cost a table lookup once the cache is warm.
+// The forward DFA stop at the first match in priority order (leftmost-first, as the backtracking),
+// the reversed one keep the longest match which is where the leftmost match begin.
+struct RegexDfa : private NonCopyable
+{
+	RegexDfa(RegexProgram& program, bool caseInsensitive, bool reversed);
+	~RegexDfa();
+
+	// Scan [from, to), backward if reversed, at is where the last match found end.
+	// Return false if out of cache memory
+	bool		search(const roUtf8* from, const roUtf8* to, bool fromBoundary, roUint32 entry, const roUtf8*& at);
+	void		clear();
+
+// Private
+	DfaState*	_state();
+	DfaState*	_start(roUint32 entry, bool atBoundary);
+	DfaState*	_next(DfaState* s, roUint8 c);
+	bool		_endMatch(DfaState* s, bool atBothEnds);
+
+	RegexProgram& _program;
+	const Array<Inst>& _insts;
+	bool _caseInsensitive;
+	bool _reversed;
+	roUint8 _classMap[256];
+	roSize _classCount;
+	HashSet<DfaState*, DfaStateHasher> _states;
+	DfaState* _startStates[2][2];	// [unanchored][atBoundary]
+	roSize _memoryUsed;
+	Array<roUint32> _pcs;
+};	// RegexDfa
+
+Regex::Graph::~Graph()
+{
+	delete program;
+}
+
+RegexProgram::RegexProgram()
+	: unanchoredEntry(0)
+	, captureCount(0)
+	, hasWordBoundary(false)
+	, anchoredAtBegin(false)
+	, _inputSize(0)
+	, _out(NULL)
+	, _generation(0)
+	, _jobCount(0)
+{
+	setsBuilt[0] = setsBuilt[1] = false;
+	dfa[0][0] = dfa[0][1] = dfa[1][0] = dfa[1][1] = NULL;
+}
+
+RegexProgram::~RegexProgram()
+{
+	delete dfa[0][0];
+	delete dfa[0][1];
+	delete dfa[1][0];
+	delete dfa[1][1];
+}
+
+roUint32 RegexProgram::_newTerm(roUint8 type)
+{
+	Term term = { type, noIndex, noIndex, noIndex, 1, 1, true };
+	if(!terms.pushBack(term))
+		return noIndex;
+	return num_cast<roUint32>(terms.size() - 1);
+}
+
+roUint32 RegexProgram::_newSet(roUint8 kind, const RangedString& f)
+{
+	CharSet set = { kind, f };
+	if(!sets.pushBack(set))
+		return noIndex;
+
+	roUint32 t = _newTerm(term_set);
+	if(t != noIndex)
+		terms[t].x = num_cast<roUint32>(sets.size() - 1);
+	return t;
+}
+
+// Split at '|' exactly the same way as parse_nodes()
+roUint32 RegexProgram::_parseAlternation(const roUtf8* begin, const roUtf8* end)
+{
+	roUint32 alternation = _newTerm(term_alternation);
+	roUint32 last = noIndex;
+	const roUtf8* optionBegin = begin;
+	roSize bracketCount1 = 0;
+	roSize bracketCount2 = 0;
+
+	for(const roUtf8* i = begin; i <= end; ++i) {
+		const roUtf8 c = (i < end) ? *i : '\0';
+
+		if(c == '\\') {
+			if(i + 1 >= end) return noIndex;
+			++i;
+			continue;
+		}
+
+		// parse_nodes() doesn't split at an escaped backslash followed by '|'
+		if(c == '|' && i > begin && i[-1] == '\\')
+			return noIndex;
+
+		if(bracketCount1 == 0 && bracketCount2 == 0 && (c == '|' || i == end)) {
+			roUint32 option = _parseSequence(optionBegin, i);
+			if(option == noIndex) return noIndex;
+
+			if(last == noIndex)
+				terms[alternation].child = option;
+			else
+				terms[last].sibling = option;
+			last = option;
+			optionBegin = i + 1;
+		}
+
+		bracketCount1 += (c == '(') ? 1 : 0;
+		bracketCount1 -= (c == ')') ? 1 : 0;
+		bracketCount2 += (c == '[') ? 1 : 0;
+		bracketCount2 -= (c == ']' && bracketCount2) ? 1 : 0;
+	}
+
+	// Unbalanced brackets, parse_nodes() silently ignore the last option
+	if(optionBegin != end + 1)
+		return noIndex;
+
+	// No alternation at all
+	if(terms[last].sibling == noIndex && terms[alternation].child == last)
+		return last;
+
+	return alternation;
+}
+
+roUint32 RegexProgram::_parseSequence(const roUtf8* begin, const roUtf8* end)
+{
+	roUint32 sequence = _newTerm(term_sequence);
+	if(sequence == noIndex) return noIndex;
+
+	roUint32 last = noIndex;
+	for(const roUtf8* i = begin; i < end; ) {
+		roUint32 item = _parseItem(i, end);
+		if(item == noIndex) return noIndex;
+
+		if(last == noIndex)
+			terms[sequence].child = item;
+		else
+			terms[last].sibling = item;
+		last = item;
+	}
+
+	return sequence;
+}
+
+roUint32 RegexProgram::_parseItem(const roUtf8*& i, const roUtf8* end)
+{
+	const roUtf8 c = *i;
+	roUint32 t = noIndex;
+	bool repeatable = true;
+
+	if(c == '\\') {
+		if(i + 1 >= end) return noIndex;
+		const roUtf8 c2 = i[1];
+
+		// parse_charClass() doesn't know '\B', it's matched as 'B' by the backtracking
+		if(c2 == 'B')
+			return noIndex;
+
+		if(c2 == 'b') {
+			t = _newTerm(term_wordBoundary);
+			hasWordBoundary = true;
+			repeatable = false;
+		}
+		else
+			t = _newSet(roStrChr(str_charClass, c2) ? charSet_class : charSet_raw, RangedString(i, i + 2));
+		i += 2;
+	}
+	else if(c == '[') {
+		// Look for corresponding ']' as parse_charSet()
+		const roUtf8* begin = ++i;
+		for(; true; ++i) {
+			if(i >= end) return noIndex;
+			if(*i == '\\' && i + 1 >= end) return noIndex;
+
+			roUtf8 nonEscaped = *i;
+			roUtf8 escaped = doEscape(i);
+			if(escaped == ']' && nonEscaped == ']' && i[-1] != '[' && i[-1] != '^') {
+				++i;
+				break;
+			}
+		}
+
+		// Word boundary in a character set depends on the neighbours
+		RangedString f(begin, i - 1);
+		for(const roUtf8* j = f.begin; j + 1 < f.end; ++j) {
+			if(j[0] == '\\' && j[1] == 'b')
+				return noIndex;
+		}
+
+		t = _newSet(charSet_set, f);
+	}
+	else if(c == '(') {
+		const roUtf8* begin = ++i;
+
+		bool capturing = true;
+		if(i + 1 < end && i[0] == '?' && i[1] == ':') {
+			i += 2;
+			begin = i;
+			capturing = false;
+		}
+
+		// Look for corresponding ')' as parse_group()
+		for(roSize parenthesesCount = 1; true; ++i) {
+			if(i >= end) return noIndex;
+			if(*i == '\\' && i + 1 >= end) return noIndex;
+
+			char escaped = doEscape(i);
+			parenthesesCount += (escaped == '(') ? 1 : 0;
+			parenthesesCount -= (escaped == ')') ? 1 : 0;
+			if(parenthesesCount == 0) break;
+		}
+
+		const roUtf8* groupEnd = i++;
+
+		// Capturing groups are numbered by the order of their '('
+		t = _newTerm(term_group);
+		if(t == noIndex) return noIndex;
+		if(capturing)
+			terms[t].x = captureCount++;
+
+		roUint32 child = _parseAlternation(begin, groupEnd);
+		if(child == noIndex) return noIndex;
+		terms[t].child = child;
+	}
+	else if(c == '^') {
+		t = _newTerm(term_begin);
+		repeatable = false;
+		++i;
+	}
+	else if(c == '$') {
+		// May be a custom matcher
+		if(i + 1 < end && roIsDigit(i[1])) return noIndex;
+		t = _newTerm(term_end);
+		repeatable = false;
+		++i;
+	}
+	else if(roStrChr(str_symbols, c))
+		return noIndex;
+	else {
+		t = _newSet(c == '.' ? charSet_any : charSet_raw, RangedString(i, i + 1));
+		++i;
+	}
+
+	if(t == noIndex)
+		return noIndex;
+
+	if(i < end && roStrChr(str_repeatition, *i)) {
+		if(!repeatable || !_parseRepetition(i, end, terms[t]))
+			return noIndex;
+
+		// parse_repeatition() handle only one of them
+		if(i < end && roStrChr(str_repeatition, *i))
+			return noIndex;
+	}
+
+	return t;
+}
+
+bool RegexProgram::_parseRepetition(const roUtf8*& i, const roUtf8* end, Term& term)
+{
+	const roUtf8 c = *(i++);
+
+	if(c == '?') {
+		term.min = 0;
+		term.max = 1;
+		return true;	// No lazy version as parse_repeatition()
+	}
+	else if(c == '+' || c == '*') {
+		term.min = (c == '+') ? 1 : 0;
+		term.max = roSize(-1);
+	}
+	else {
+		// Counted repetition is expanded, keep it small
+		static const roSize maxCount = 1000;
+		roSize min = 0, max = 0;
+
+		const roUtf8* p = i;
+		for(; i < end && roIsDigit(*i) && min <= maxCount; ++i)
+			min = min * 10 + (*i - '0');
+		if(i == p) return false;
+		max = min;
+
+		if(i < end && *i == ',') {
+			p = ++i;
+			for(; i < end && roIsDigit(*i) && max <= maxCount; ++i)
+				max = (i == p ? 0 : max * 10) + (*i - '0');
+			if(i == p) max = roSize(-1);
+		}
+
+		if(i >= end || *i != '}') return false;
+		++i;
+
+		if(min > max || min > maxCount || (max > maxCount && max != roSize(-1)))
+			return false;
+
+		term.min = min;
+		term.max = max;
+	}
+
+	if(i < end && *i == '?') {
+		term.greedy = false;
+		++i;
+	}
+
+	return true;
+}
+
+bool RegexProgram::_emit(roUint8 op, roUint32 x, roUint32 y)
+{
+	Inst inst = { op, x, y };
+	return _out->size() < maxProgramSize && _out->pushBack(inst);
+}
+
+// The item with it's repetition
+bool RegexProgram::_emitTerm(roUint32 t, bool reversed)
+{
+	const Term term = terms[t];
+	const bool infinite = (term.max == roSize(-1));
+
+	// With infinite repetition, the last mandatory copy loops back to itself as "x+"
+	roSize copies = term.min;
+	if(infinite && copies > 0)
+		--copies;
+
+	for(roSize i=0; i<copies; ++i) {
+		if(!_emitItem(t, reversed))
+			return false;
+	}
+
+	// "x+" is "head: x loop(head, next)", "x*" is "head: split(x, next) x loop(head, next)".
+	// An iteration matching nothing find the head already visited and exit the loop with it's
+	// captures, as the backtracking does for "(a?)*"
+	if(infinite) {
+		const roUint32 head = _pc();
+		if(!_emit(term.min > 0 ? op_loopHead : op_split)) return false;
+		if(!_emitItem(t, reversed)) return false;
+		const roUint32 loop = _pc();
+		if(!_emit(op_loop)) return false;
+
+		const roUint32 next = _pc();
+		if(term.min == 0) {
+			(*_out)[head].x = term.greedy ? head + 1 : next;
+			(*_out)[head].y = term.greedy ? next : head + 1;
+		}
+		(*_out)[loop].x = term.greedy ? head : next;
+		(*_out)[loop].y = term.greedy ? next : head;
+		return true;
+	}
+
+	// Optional copies are nested as "(x(x)?)?"
+	TinyArray<roUint32, 16> splits;
+	for(roSize i=term.min; i<term.max; ++i) {
+		if(!splits.pushBack(_pc())) return false;
+		if(!_emit(op_split)) return false;
+		if(!_emitItem(t, reversed)) return false;
+	}
+
+	for(roUint32 split : splits) {
+		Inst& inst = (*_out)[split];
+		inst.x = term.greedy ? split + 1 : _pc();
+		inst.y = term.greedy ? _pc() : split + 1;
+	}
+
+	return true;
+}
+
+// The item without it's repetition
+bool RegexProgram::_emitItem(roUint32 t, bool reversed)
+{
+	const Term term = terms[t];
+
+	switch(term.type) {
+	case term_set:
+		return _emit(op_set, term.x);
+	case term_begin:
+		return _emit(op_begin);
+	case term_end:
+		return _emit(op_end);
+	case term_wordBoundary:
+		return _emit(op_wordBoundary);
+	case term_group:
+	{	// The reversed program is only for finding the beginning of match
+		const bool capturing = (term.x != noIndex && !reversed);
+		if(capturing && !_emit(op_save, 2 * term.x + 2)) return false;
+		if(!_emitItem(term.child, reversed)) return false;
+		if(capturing && !_emit(op_save, 2 * term.x + 3)) return false;
+		return true;
+	}
+	case term_sequence:
+	{	TinyArray<roUint32, 16> items;
+		for(roUint32 i = term.child; i != noIndex; i = terms[i].sibling) {
+			if(!items.pushBack(i)) return false;
+		}
+
+		for(roSize i=0; i<items.size(); ++i) {
+			if(!_emitTerm(items[reversed ? items.size() - i - 1 : i], reversed))
+				return false;
+		}
+		return true;
+	}
+	case term_alternation:
+	{	// Options are tried from left to right
+		TinyArray<roUint32, 16> jumps;
+		for(roUint32 i = term.child; i != noIndex; i = terms[i].sibling) {
+			if(terms[i].sibling == noIndex) {
+				if(!_emitItem(i, reversed)) return false;
+				break;
+			}
+
+			const roUint32 split = _pc();
+			if(!_emit(op_split, split + 1)) return false;
+			if(!_emitItem(i, reversed)) return false;
+			if(!jumps.pushBack(_pc())) return false;
+			if(!_emit(op_jump)) return false;
+			(*_out)[split].y = _pc();
+		}
+
+		for(roUint32 jump : jumps)
+			(*_out)[jump].x = _pc();
+		return true;
+	}
+	default:
+		break;
+	}
+
+	return false;
+}
+
+bool RegexProgram::compile(const RangedString& regString)
+{
+	const roUint32 root = _parseAlternation(regString.begin, regString.end);
+	if(root == noIndex)
+		return false;
+
+	// Slot 0 and 1 for the whole match
+	_out = &insts;
+	if(!_emit(op_save, 0)) return false;
+	if(!_emitItem(root, false)) return false;
+	if(!_emit(op_save, 1)) return false;
+	if(!_emit(op_match)) return false;
+
+	roUint32 any = _newSet(charSet_any, RangedString());
+	if(any == noIndex) return false;
+
+	unanchoredEntry = _pc();
+	if(!_emit(op_split, 0, unanchoredEntry + 1)) return false;
+	if(!_emit(op_set, terms[any].x)) return false;
+	if(!_emit(op_jump, unanchoredEntry)) return false;
+
+	// The word boundary depends on both neighbours, which a DFA doesn't see
+	if(!hasWordBoundary) {
+		_out = &reversedInsts;
+		if(!_emitItem(root, true)) return false;
+		if(!_emit(op_match)) return false;
+	}
+
+	_out = NULL;
+
+	// Nothing can be reached from the entry other than at the beginning of string
+	Array<roUint32> pcs;
+	_newGeneration();
+	_closure(insts, 0, false, false, false, pcs);
+	anchoredAtBegin = pcs.isEmpty();
+
+	return true;
+}
+
+// Use the very same functions as the backtracking, such that both agree on every character
+void RegexProgram::_buildSets(bool caseInsensitive)
+{
+	if(setsBuilt[caseInsensitive])
+		return;
+	setsBuilt[caseInsensitive] = true;
+
+	Graph graph;
+	graph.charCmpFunc = caseInsensitive ? charCaseCmp : charCmp;
+	Node node = { RangedString() };
+
+	for(CharSet& set : sets) {
+		roUint32* bits = set.bits[caseInsensitive];
+		roZeroMemory(bits, sizeof(set.bits[0]));
+
+		Edge edge = { set.f, NULL, 0, 0 };
+		const roUtf8* f = set.f.begin;
+		const roUtf8 escaped = (set.kind == charSet_raw) ? doEscape(f) : '\0';
+
+		for(roSize i=0; i<256; ++i) {
+			roUtf8 c = roUtf8(i);
+			RangedString s(&c, &c + 1);
+
+			bool in = false;
+			switch(set.kind) {
+			case charSet_any:	in = true; break;
+			case charSet_raw:	in = graph.charCmpFunc(c, escaped); break;
+			case charSet_class:	in = match_charClass(graph, set.f.begin[1], s); break;
+			case charSet_set:	in = match_charSet(graph, node, edge, s); break;
+			}
+
+			if(in)
+				bits[i >> 5] |= 1u << (i & 31);
+		}
+	}
+}
+
+void RegexProgram::_newGeneration()
+{
+	const roSize size = roMaxOf2(insts.size(), reversedInsts.size());
+	if(_marks.size() < size || ++_generation == 0) {
+		_marks.resize(size);
+		roZeroMemory(_marks.typedPtr(), _marks.sizeInByte());
+		_generation = 1;
+	}
+}
+
+// Follow the empty transitions from pc in priority order, out receive the instructions waiting for
+// a byte, the match, and the assertions about the end of string which the scan is heading to.
+// Return true if a match is reached, where the forward DFA cut the lower priorities
+bool RegexProgram::_closure(const Array<Inst>& program, roUint32 pc, bool atBegin, bool atEnd, bool reversed, Array<roUint32>& out)
+{
+	_stack.clear();
+	_stack.pushBack(pc);
+
+	bool matched = false;
+	while(!_stack.isEmpty()) {
+		pc = _stack.back();
+		_stack.popBack();
+
+		while(true) {
+			const Inst& inst = program[pc];
+			if(isVisitedOnce(inst.op)) {
+				if(_marks[pc] == _generation)
+					break;
+				_marks[pc] = _generation;
+			}
+
+			if(inst.op == op_jump) {
+				pc = inst.x;
+				continue;
+			}
+			if(inst.op == op_split || inst.op == op_loop) {
+				_stack.pushBack(inst.y);
+				pc = inst.x;
+				continue;
+			}
+			if(inst.op == op_loopHead || inst.op == op_save || inst.op == op_wordBoundary) {
+				++pc;	// Word boundary never go to the DFA, pass through is fine for the anchoredAtBegin check
+				continue;
+			}
+			if(inst.op == op_begin || inst.op == op_end) {
+				const bool isBegin = (inst.op == op_begin);
+				if(isBegin ? atBegin : atEnd) {
+					++pc;
+					continue;
+				}
+
+				// To be checked when the scan reach the end
+				if(isBegin == reversed && _marks[pc] != _generation) {
+					_marks[pc] = _generation;
+					out.pushBack(pc);
+				}
+				break;
+			}
+
+			out.pushBack(pc);
+			if(inst.op == op_match) {
+				matched = true;
+				if(!reversed) {
+					_stack.clear();
+					return true;
+				}
+			}
+			break;
+		}
+	}
+
+	return matched;
+}
+
+void RegexProgram::_pushJob(roUint32 pc, roUint32 slot, const roUtf8* value)
+{
+	if(_jobCount == _jobs.size() && !_jobs.resize(roMaxOf2(_jobs.size() * 2, roSize(16)))) {
+		roAssert(false && "Out of memory");
+		return;
+	}
+
+	PikeJob job = { pc, slot, value };
+	_jobs[_jobCount++] = job;
+}
+
+void RegexProgram::_addThread(PikeList& list, roUint32 pc, const roUtf8* sp, const roUtf8* const* caps, const RangedString& srcString)
+{
+	const roSize slotCount = _caps.size();
+	roMemcpy(_caps.typedPtr(), caps, slotCount * sizeof(*caps));
+
+	_jobCount = 0;
+	_pushJob(pc, noIndex, NULL);
+
+	// Saved slots are restored once the higher priority path is done, before the next one
+	while(_jobCount) {
+		const PikeJob job = _jobs[--_jobCount];
+
+		if(job.slot != noIndex) {
+			_caps[job.slot] = job.value;
+			continue;
+		}
+
+		for(pc = job.pc; true; ) {
+			const Inst& inst = insts[pc];
+			if(isVisitedOnce(inst.op)) {
+				if(_marks[pc] == _generation)
+					break;
+				_marks[pc] = _generation;
+			}
+
+			if(inst.op == op_jump) {
+				pc = inst.x;
+				continue;
+			}
+			if(inst.op == op_split || inst.op == op_loop) {
+				_pushJob(inst.y, noIndex, NULL);
+				pc = inst.x;
+				continue;
+			}
+			if(inst.op == op_loopHead) {
+				++pc;
+				continue;
+			}
+			if(inst.op == op_save) {
+				_pushJob(0, inst.x, _caps[inst.x]);
+				_caps[inst.x] = sp;
+				++pc;
+				continue;
+			}
+
+			bool pass = false;
+			switch(inst.op) {
+			case op_begin:				pass = (sp == srcString.begin); break;
+			case op_end:				pass = (sp == srcString.end); break;
+			case op_wordBoundary:		pass = sp < srcString.end && isWordBoundary(srcString, sp); break;
+			default:
+				list.pcs[list.count] = pc;
+				roMemcpy(&list.caps[list.count * slotCount], _caps.typedPtr(), slotCount * sizeof(*caps));
+				++list.count;
+				break;
+			}
+
+			if(!pass)
+				break;
+			++pc;
+		}
+	}
+}
+
+// Threads run in lock step from the position from, in priority order. A thread reaching the match
+// cut all those after it, the captures of the match are left in _matchCaps.
+// Nothing after the position to is looked at, when it's known to be where the match end
+bool RegexProgram::_runPike(const RangedString& srcString, const roUtf8* from, const roUtf8* to, bool caseInsensitive, bool anchored)
+{
+	const roSize slotCount = 2 * (captureCount + 1);
+	if(!_caps.resize(slotCount) || !_matchCaps.resize(slotCount))
+		return false;
+
+	for(PikeList& list : _lists) {
+		list.count = 0;
+		if(!list.pcs.resize(insts.size()) || !list.caps.resize(insts.size() * slotCount))
+			return false;
+	}
+
+	TinyArray<const roUtf8*, 32> noCaps;
+	noCaps.resize(slotCount, NULL);
+
+	PikeList* clist = &_lists[0];
+	PikeList* nlist = &_lists[1];
+
+	_newGeneration();
+	_addThread(*clist, anchored ? 0 : unanchoredEntry, from, noCaps.typedPtr(), srcString);
+
+	bool matched = false;
+	for(const roUtf8* sp = from; clist->count; ++sp) {
+		_newGeneration();
+		nlist->count = 0;
+
+		for(roSize i=0; i<clist->count; ++i) {
+			const roUint32 pc = clist->pcs[i];
+			const roUtf8** threadCaps = &clist->caps[i * slotCount];
+			const Inst& inst = insts[pc];
+
+			if(inst.op == op_match) {
+				matched = true;
+				roMemcpy(_matchCaps.typedPtr(), threadCaps, slotCount * sizeof(*threadCaps));
+				break;
+			}
+
+			if(sp < to && _inSet(inst.x, roUint8(*sp), caseInsensitive))
+				_addThread(*nlist, pc + 1, sp + 1, threadCaps, srcString);
+		}
+
+		roSwap(clist, nlist);
+		if(sp == to)
+			break;
+	}
+
+	return matched;
+}
+
+bool RegexProgram::match(Regex& regex, const RangedString& srcString, const char* options)
+{
+	const bool caseInsensitive = options && roStrChr(options, 'i');
+	const bool anchored = anchoredAtBegin || (options && roStrChr(options, 'b'));
+
+	regex._srcString = srcString;
+	regex.result.clear();
+	_buildSets(caseInsensitive);
+
+	// Find where the match end, then where it begin by scanning backward from there
+	const roUtf8* begin = srcString.begin;
+	const roUtf8* end = srcString.end;
+	bool found = false;
+
+	// Building the DFA states cost more than what they save until enough input went through this program
+	_inputSize += srcString.size();
+	const bool useDfa = !reversedInsts.isEmpty() && (dfa[caseInsensitive][0] || _inputSize >= minDfaInput);
+
+	if(useDfa) {
+		if(!dfa[caseInsensitive][0])
+			dfa[caseInsensitive][0] = new RegexDfa(*this, caseInsensitive, false);
+		if(!dfa[caseInsensitive][1])
+			dfa[caseInsensitive][1] = new RegexDfa(*this, caseInsensitive, true);
+
+		RegexDfa& forward = *dfa[caseInsensitive][0];
+		RegexDfa& backward = *dfa[caseInsensitive][1];
+
+		const roUtf8* at = NULL;
+		if(!forward.search(srcString.begin, srcString.end, true, anchored ? 0 : unanchoredEntry, at))
+			forward.clear();
+		else if(!at)
+			return false;
+		else if(anchored) {
+			end = at;
+			found = true;
+		}
+		else if(backward.search(at, srcString.begin, at == srcString.end, 0, begin) && begin) {
+			end = at;
+			found = true;
+		}
+		else {
+			backward.clear();
+			begin = srcString.begin;
+		}
+	}
+
+	if(found && captureCount == 0) {
+		regex.result.pushBack(RangedString(begin, end));
+		return true;
+	}
+
+	// The Pike VM only needed for the captures once the DFA found the match, or if it used up it's memory
+	if(!_runPike(srcString, begin, end, caseInsensitive, anchored || found))
+		return false;
+
+	const roUtf8** caps = _matchCaps.typedPtr();
+	regex.result.pushBack(RangedString(caps[0], caps[1]));
+	for(roSize i=1; i<=captureCount; ++i) {
+		const roUtf8* capBegin = caps[i * 2];
+		const roUtf8* capEnd = caps[i * 2 + 1];
+		regex.result.pushBack((capBegin && capEnd && capBegin <= capEnd) ? RangedString(capBegin, capEnd) : RangedString(""));
+	}
+
+	return true;
+}
+
+RegexDfa::RegexDfa(RegexProgram& program, bool caseInsensitive, bool reversed)
+	: _program(program)
+	, _insts(reversed ? program.reversedInsts : program.insts)
+	, _caseInsensitive(caseInsensitive)
+	, _reversed(reversed)
+	, _memoryUsed(0)
+{
+	roZeroMemory(_startStates, sizeof(_startStates));
+
+	// Bytes that no set tell apart share the same column in the transition table
+	roZeroMemory(_classMap, sizeof(_classMap));
+	_classCount = 1;
+	for(roSize s=0; s<program.sets.size(); ++s) {
+		roUint16 remap[256][2];
+		memset(remap, 0xFF, sizeof(remap));
+
+		roSize count = 0;
+		for(roSize i=0; i<256; ++i) {
+			roUint16& to = remap[_classMap[i]][program._inSet(num_cast<roUint32>(s), roUint8(i), caseInsensitive)];
+			if(to == 0xFFFF)
+				to = roUint16(count++);
+			_classMap[i] = roUint8(to);
+		}
+		_classCount = count;
+	}
+}
+
+RegexDfa::~RegexDfa()
+{
+	clear();
+}
+
+void RegexDfa::clear()
+{
+	for(DfaState* s : _states)
+		roFree(s);
+	_states.clear();
+	roZeroMemory(_startStates, sizeof(_startStates));
+	_memoryUsed = 0;
+}
+
+// Find or create the state of _pcs
+DfaState* RegexDfa::_state()
+{
+	const roUint32 count = num_cast<roUint32>(_pcs.size());
+	DfaKey key = { _pcs.typedPtr(), count, count };
+	for(roUint32 pc : _pcs)
+		key.hash = pc + (key.hash << 6) + (key.hash << 16) - key.hash;
+
+	DfaState* const* found = _states.find(key);
+	if(found)
+		return *found;
+
+	const roSize size = sizeof(DfaState) + _classCount * sizeof(DfaState*) + count * sizeof(roUint32);
+	if(_memoryUsed + size > maxDfaMemory)
+		return NULL;
+
+	DfaState* s = roMalloc(size).cast<DfaState>();
+	if(!s) return NULL;
+
+	s->next = reinterpret_cast<DfaState**>(s + 1);
+	s->pcs = reinterpret_cast<roUint32*>(s->next + _classCount);
+	s->pcCount = count;
+	s->hash = key.hash;
+	s->isMatch = false;
+	s->endMatch = -1;
+	roZeroMemory(s->next, _classCount * sizeof(DfaState*));
+	roMemcpy(s->pcs, _pcs.typedPtr(), count * sizeof(roUint32));
+
+	for(roUint32 pc : _pcs)
+		s->isMatch |= (_insts[pc].op == op_match);
+
+	if(!_states.insert(s)) {
+		roFree(s);
+		return NULL;
+	}
+
+	_memoryUsed += size;
+	return s;
+}
+
+// The beginning of the scan satisfy '^' (or '$' when reversed) only if it's a boundary of the string
+DfaState* RegexDfa::_start(roUint32 entry, bool atBoundary)
+{
+	DfaState*& s = _startStates[entry != 0][atBoundary];
+	if(s) return s;
+
+	_pcs.clear();
+	_program._newGeneration();
+	_program._closure(_insts, entry, atBoundary && !_reversed, atBoundary && _reversed, _reversed, _pcs);
+	return s = _state();
+}
+
+DfaState* RegexDfa::_next(DfaState* s, roUint8 c)
+{
+	_pcs.clear();
+	_program._newGeneration();
+
+	for(roUint32 i=0; i<s->pcCount; ++i) {
+		const roUint32 pc = s->pcs[i];
+		const Inst& inst = _insts[pc];
+		if(inst.op != op_set || !_program._inSet(inst.x, c, _caseInsensitive))
+			continue;
+		if(_program._closure(_insts, pc + 1, false, false, _reversed, _pcs) && !_reversed)
+			break;
+	}
+
+	DfaState* next = _state();
+	if(next)
+		s->next[_classMap[c]] = next;
+	return next;
+}
+
+// Follow the pending assertions now that the scan reached the end of string.
+// atBothEnds if the string scanned is empty, where '^' and '$' are both satisfied
+bool RegexDfa::_endMatch(DfaState* s, bool atBothEnds)
+{
+	if(!atBothEnds && s->endMatch >= 0)
+		return s->endMatch > 0;
+
+	Array<roUint32> pcs;
+	_program._newGeneration();
+
+	bool matched = s->isMatch;
+	for(roUint32 i=0; i<s->pcCount && !matched; ++i) {
+		const roUint32 pc = s->pcs[i];
+		if(_insts[pc].op == op_match || _insts[pc].op == op_set)
+			continue;
+		matched = _program._closure(_insts, pc, _reversed || atBothEnds, !_reversed || atBothEnds, true, pcs);
+	}
+
+	if(!atBothEnds)
+		s->endMatch = matched ? 1 : 0;
+	return matched;
+}
+
+bool RegexDfa::search(const roUtf8* from, const roUtf8* to, bool fromBoundary, roUint32 entry, const roUtf8*& at)
+{
+	DfaState* s = _start(entry, fromBoundary);
+	if(!s) return false;
+
+	const roUtf8* p = from;
+	at = s->isMatch ? p : NULL;
+
+	if(!_reversed) {
+		while(p < to && s->pcCount) {
+			const roUint8 c = roUint8(*p);
+			DfaState* next = s->next[_classMap[c]];
+			if(!next && !(next = _next(s, c))) return false;
+			s = next;
+			++p;
+			if(s->isMatch) at = p;
+		}
+	}
+	else {
+		while(p > to && s->pcCount) {
+			const roUint8 c = roUint8(p[-1]);
+			DfaState* next = s->next[_classMap[c]];
+			if(!next && !(next = _next(s, c))) return false;
+			s = next;
+			--p;
+			if(s->isMatch) at = p;
+		}
+	}
+
+	if(p == to && s->pcCount && _endMatch(s, p == from && fromBoundary))
+		at = p;
+
+	return true;
+}
+
 Regex::Regex()
 	: logLevel(0)
 {
@@ -951,6 +2098,8 @@ roStatus Regex::compile(const roUtf8* reg, Compiled& compiled, const IArray<Cust
 
 	Graph& graph = *compiled.graph;
 	graph.clear();
+	delete graph.program;
+	graph.program = NULL;
 	graph.customMatchers = &customMatcher;
 	graph.regString = compiled.regexStr;
 	graph.charCmpFunc = charCmp;
@@ -970,9 +2119,55 @@ roStatus Regex::compile(const roUtf8* reg, Compiled& compiled, const IArray<Cust
 		debugNodes(graph);
 	}
 
+	// Custom matchers can only run on the backtracking
+	graph.program = new RegexProgram;
+	if(!graph.program->compile(graph.regString)) {
+		delete graph.program;
+		graph.program = NULL;
+	}
+
 	return roStatus::ok;
 }
 
+// The one-shot match() mostly see the same few literal patterns, keep them compiled.
+// Per thread, since a RegexProgram carry its own scratch memory and DFA.
+struct _RegexProgramCache
+{
+	~_RegexProgramCache() { clear(); }
+
+	void clear()
+	{
+		for(auto& e : programs)
+			delete e.value;
+		programs.clear();
+	}
+
+	/// NULL if the pattern is not supported by RegexProgram
+	RegexProgram* get(const RangedString& regString)
+	{
+		if(RegexProgram** p = programs.find(regString))
+			return *p;
+
+		// Patterns made at runtime could grow it without bound
+		if(programs.size() >= maxCachedPrograms)
+			clear();
+
+		RegexProgram* program = new RegexProgram;
+		if(!program->compile(regString)) {
+			delete program;
+			program = NULL;
+		}
+
+		if(!programs.insert(regString.toString(), program)) {
+			delete program;
+			return NULL;
+		}
+		return program;
+	}
+
+	HashMap<String, RegexProgram*> programs;
+};	// _RegexProgramCache
+
 bool Regex::match(const roUtf8* s, const roUtf8* f, const char* options)
 {
 	RangedString regString(f, f + roStrLen(f));
@@ -995,6 +2190,10 @@ bool Regex::match(RangedString srcString, const Compiled& compiled, const char*
 
 bool Regex::match(RangedString srcString, RangedString regString, const IArray<CustomMatcher>& customMatcher, const char* options)
 {
+	static thread_local _RegexProgramCache cache;
+	if(RegexProgram* program = cache.get(regString))
+		return program->match(*this, srcString, options);
+
 	Graph graph;
 	graph.regex = this;
 	graph.customMatchers = &customMatcher;
@@ -1027,6 +2226,9 @@ bool Regex::match(RangedString srcString, const Compiled& compiled, const IArray
 
 	Graph& graph = *compiled.graph;
 
+	if(graph.program)
+		return graph.program->match(*this, srcString, options);
+
 	graph.regex = this;
 	graph.customMatchers = &customMatcher;
 	graph.srcString = srcString;
@@ -114,6 +114,7 @@ roStatusEnum( json_expect_number )
 
 // Serialization
 roStatusEnum( serialization_member_mismatch )
+roStatusEnum( serialization_schema_mismatch )
 
 // Image
 roStatusEnum( image_invalid_header )
@@ -107,7 +107,7 @@ roUint64 ticksSinceProgramStatup()
 #else
 	timeval tv;
 	::gettimeofday(&tv, nullptr);
-	ret = reinterpret_cast<const roUint64&>(tv);
+	ret = roUint64(tv.tv_sec) * 1000000 + tv.tv_usec;	// In micro seconds, see ticksToSeconds()
 #endif
 
 	return ret;
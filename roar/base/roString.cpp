@@ -3,6 +3,7 @@
 #include "roStringUtility.h"
 #include "roArray.h"
 #include "roAtomic.h"
+#include "roFrameArena.h"
 #include "roMemory.h"
 #include "roMutex.h"
 #include "roReflection.h"
@@ -51,7 +52,10 @@ String::String(const RangedString& rangedStr)
 
 String::~String()
 {
-	clear();
+	if(FrameArena* arena = _arena())
+		arena->free(_cstr - sizeof(FrameArena*));
+	else
+		clear();
 }
 
 String& String::operator=(const char* str)
@@ -101,9 +105,17 @@ roSize& String::_capacity() const
 	return _cstr ? *(((roSize*)_cstr) + 1) : (roSize&)_zero;
 }
 
+FrameArena* String::_arena() const
+{
+	if(!(_capacity() & _arenaFlag))
+		return NULL;
+	return *(FrameArena**)(_cstr - sizeof(FrameArena*));
+}
+
 Status String::_reserve(roSize size, bool forceRealloc)
 {
-	roSize currentCap = _capacity();
+	FrameArena* arena = _arena();
+	roSize currentCap = _capacity() & ~_arenaFlag;
 
 	if(currentCap >= size && !forceRealloc)
 		return Status::ok;
@@ -112,12 +124,28 @@ Status String::_reserve(roSize size, bool forceRealloc)
 	roSize newCapacity = roMaxOf2<roSize>(roSize(size * 1.5) + 1, 8u);
 	roSize headerSize = sizeof(roSize) * 2;
 	roSize takeCareNullTerminator = 1;
-	char* newPtr = _allocator.realloc(
-		currentCap ? _cstr : NULL,
-		headerSize + currentCap + takeCareNullTerminator,
-		headerSize + newCapacity + takeCareNullTerminator
-	);
-	if(!newPtr) return Status::not_enough_memory;
+	char* newPtr = NULL;
+
+	if(arena) {
+		roSize arenaHeaderSize = sizeof(FrameArena*);
+		newPtr = arena->realloc(
+			_cstr - arenaHeaderSize,
+			arenaHeaderSize + headerSize + currentCap + takeCareNullTerminator,
+			arenaHeaderSize + headerSize + newCapacity + takeCareNullTerminator
+		);
+		if(!newPtr) return Status::not_enough_memory;
+		newPtr += arenaHeaderSize;
+		newCapacity |= _arenaFlag;
+	}
+	else {
+		newPtr = _allocator.realloc(
+			currentCap ? _cstr : NULL,
+			headerSize + currentCap + takeCareNullTerminator,
+			headerSize + newCapacity + takeCareNullTerminator
+		);
+		if(!newPtr) return Status::not_enough_memory;
+	}
+
 	_cstr = newPtr;
 	_capacity() = newCapacity;
 	_size() = currentSize;
@@ -239,6 +267,13 @@ Status String::insert(roSize idx, const char* str, roSize count)
 
 void String::clear()
 {
+	// Keep the buffer of an arena string, such that it stick with the arena
+	if(_arena()) {
+		_size() = 0;
+		_str()[0] = '\0';
+		return;
+	}
+
 	if(_capacity())
 		_allocator.free(_cstr);
 	_cstr = const_cast<char*>(_emptyString);
@@ -504,56 +539,89 @@ struct ConstString::Node
 	StringHash hash;
 	StringHash lowerCaseHash;
 	Node* next;
-	AtomicInteger refCount;
+	volatile long refCount;
 	roSize size;	///< Length of the string
 	const char* stringValue() const { return reinterpret_cast<const char*>(this + 1); }
 };	// Node
 
+/// The table is split into shards, each with it's own lock and buckets, selected by the hash value.
+/// Copying a ConstString, or destroying one which is not the last reference, is a lock free atomic
+/// operation; the reference count can only rise from zero or fall to zero with the shard locked.
+/// Growing a shard is incremental: the old buckets are kept and migrated a few at a time by the
+/// following add() and remove() calls.
 struct ConstStringHashTable
 {
 	typedef ConstString::Node Node;
 
-	ConstStringHashTable() : _count(0), _buckets(1, NULL), _nullNode(add(""))
+	static const roSize shardCount = 32;
+	static const roSize initBucketSize = 16;
+	static const roSize migrateStep = 8;	///< Number of old buckets to migrate per operation
+
+	struct Shard
+	{
+		Shard() : count(0), migrated(0), buckets(initBucketSize, NULL) {}
+
+		Mutex mutex;
+		roSize count;		///< The actual number of elements in this shard, can be <=> buckets.size()
+		roSize migrated;	///< Number of oldBuckets already moved into buckets
+		Array<Node*> buckets;
+		Array<Node*> oldBuckets;	///< Not empty while growing
+		char _padding[64];	///< Avoid false sharing between shards
+	};	// Shard
+
+	ConstStringHashTable() : _nullNode(_add("", 0))
 	{
-		++_nullNode.refCount;
 	}
 
 	~ConstStringHashTable()
 	{
 		remove(_nullNode);
-		roAssert(_count == 0 && "All instance of ConstString should be destroyed before ConstStringHashTable");
+		for(Shard& s : _shards)
+			roAssert(s.count == 0 && "All instance of ConstString should be destroyed before ConstStringHashTable");
 	}
 
-	Node& find(StringHash hash) const
+	static Shard& shardOf(Shard* shards, StringHash hash)
 	{
-		roScopeLock(_mutex);
+		// The bucket index use the lower bits, use a mixed upper bits for the shard
+		return shards[(hash * 0x9E3779B1u) >> 27];
+	}
 
-		const roSize index = hash % _buckets.size();
-		for(Node* n = _buckets[index]; n; n = n->next) {
-			if(n->hash != hash)
-				continue;
-			return *n;
-		}
-		return _nullNode;
+	/// Return the node with a reference added
+	Node& find(StringHash hash)
+	{
+		Shard& s = shardOf(_shards, hash);
+		roScopeLock(s.mutex);
+
+		// Multiple strings may share the same hash, the first one is returned
+		Node* n = findIn(s, hash, NULL, 0);
+		if(!n)
+			n = &_nullNode;
+		roAtomicInc(&n->refCount);
+		return *n;
 	}
 
+	/// Return the node with a reference added
 	Node& add(const char* str, roSize count=0)
 	{
-		if(!str)
+		if(!str || *str == '\0') {
+			roAtomicInc(&_nullNode.refCount);
 			return _nullNode;
+		}
+		return _add(str, count);
+	}
 
+	Node& _add(const char* str, roSize count)
+	{
 		const StringHash hash = stringHash(str, count);
-		const roSize length = count == 0 ? roStrLen(str) : count;
+		const roSize length = count == 0 ? roStrLen(str) : roStrLen(str, count);
 
-		roScopeLock(_mutex);
-		const roSize index = hash % _buckets.size();
+		Shard& s = shardOf(_shards, hash);
+		roScopeLock(s.mutex);
+		migrate(s);
 
-		// Find any string with the same hash value
-		for(Node* n = _buckets[index]; n; n = n->next) {
-			if(n->hash == hash) {
-				roAssert(roStrnCmp(n->stringValue(), str, length) == 0 && "String hash collision in ConstString" );
-				return *n;
-			}
+		if(Node* n = findIn(s, hash, str, length)) {
+			roAtomicInc(&n->refCount);
+			return *n;
 		}
 
 		if(Node* n = _allocator.malloc(sizeof(Node) + length + 1).cast<Node>()) {
@@ -561,68 +629,121 @@ struct ConstStringHashTable
 			((char*)n->stringValue())[length] = '\0';
 			n->hash = hash;
 			n->lowerCaseHash = 0;	// We will assign it lazily
-			n->refCount = 0;
+			n->refCount = 1;
 			n->size = length;
 
-			n->next = _buckets[index];
-			_buckets[index] = n;
-			++_count;
+			Node*& head = s.buckets[hash % s.buckets.size()];
+			n->next = head;
+			head = n;
+			++s.count;
 
 			// Enlarge the bucket if necessary
-			if(_count * 2 > _buckets.size() * 3)
-				resizeBucket(_buckets.size() * 2);
+			if(s.count * 2 > s.buckets.size() * 3)
+				grow(s);
 
 			return *n;
 		}
+
+		roAtomicInc(&_nullNode.refCount);
 		return _nullNode;
 	}
 
 	void remove(Node& node)
 	{
-		if(--node.refCount != 0)
+		// Fast path, we are not the last reference
+		for(long c = node.refCount; c > 1; c = node.refCount) {
+			if(roAtomicCompareAndSwap(&node.refCount, c, c - 1) == c)
+				return;
+		}
+
+		Shard& s = shardOf(_shards, node.hash);
+		roScopeLock(s.mutex);
+
+		// Someone may have picked up the node with add() before we get the lock
+		if(roAtomicDec(&node.refCount) != 0)
 			return;
 
-		roScopeLock(_mutex);
-		const roSize index = node.hash % _buckets.size();
-		Node* last = NULL;
-
-		for(Node* n = _buckets[index]; n; last = n, n = n->next) {
-			if(n->hash == node.hash) {
-				if(last)
-					last->next = n->next;
-				else
-					_buckets[index] = n->next;
-				_allocator.free(n);
-				--_count;
+		migrate(s);
+		Node** bucket = (!s.oldBuckets.isEmpty() && node.hash % s.oldBuckets.size() >= s.migrated)
+			? &s.oldBuckets[node.hash % s.oldBuckets.size()]
+			: &s.buckets[node.hash % s.buckets.size()];
+
+		for(Node** p = bucket; *p; p = &(*p)->next) {
+			if(*p == &node) {
+				*p = node.next;
+				_allocator.free(&node);
+				--s.count;
 				return;
 			}
 		}
 		roAssert(false);
 	}
 
-	void resizeBucket(roSize bucketSize)
+	/// Search for the node with the same hash, and also the same content if str is not null
+	static Node* findIn(Shard& s, StringHash hash, const char* str, roSize length)
+	{
+		roAssert(s.mutex.isLocked());
+
+		if(!s.oldBuckets.isEmpty()) {
+			const roSize index = hash % s.oldBuckets.size();
+			if(index >= s.migrated) {
+				if(Node* n = findInBucket(s.oldBuckets[index], hash, str, length))
+					return n;
+			}
+		}
+		return findInBucket(s.buckets[hash % s.buckets.size()], hash, str, length);
+	}
+
+	static Node* findInBucket(Node* n, StringHash hash, const char* str, roSize length)
 	{
+		for(; n; n = n->next) {
+			if(n->hash != hash)
+				continue;
+			if(!str || (n->size == length && memcmp(n->stringValue(), str, length) == 0))
+				return n;
+		}
+		return NULL;
+	}
+
+	static void grow(Shard& s)
+	{
+		// Finish any pending migration first, which is rare as it needs the shard to double again
+		while(!s.oldBuckets.isEmpty())
+			migrate(s);
+
 		Array<Node*> newBuckets;
-		newBuckets.resize(bucketSize, NULL);
+		newBuckets.resize(s.buckets.size() * 2, NULL);
+		roSwap(s.oldBuckets, s.buckets);
+		roSwap(s.buckets, newBuckets);
+		s.migrated = 0;
+	}
+
+	static void migrate(Shard& s)
+	{
+		if(s.oldBuckets.isEmpty())
+			return;
 
-		roAssert(_mutex.isLocked());
-		for(Node* i : _buckets) {
-			for(Node* n = i; n; ) {
+		const roSize bucketSize = s.buckets.size();
+		const roSize end = roMinOf2(s.migrated + migrateStep, s.oldBuckets.size());
+		for(; s.migrated < end; ++s.migrated) {
+			for(Node* n = s.oldBuckets[s.migrated]; n; ) {
 				Node* next = n->next;
-				const roSize index = n->hash % bucketSize;
-				n->next = newBuckets[index];
-				newBuckets[index] = n;
+				Node*& head = s.buckets[n->hash % bucketSize];
+				n->next = head;
+				head = n;
 				n = next;
 			}
 		}
 
-		roSwap(_buckets, newBuckets);
+		if(s.migrated == s.oldBuckets.size()) {
+			s.oldBuckets.clear();
+			s.oldBuckets.condense();
+			s.migrated = 0;
+		}
 	}
 
-	mutable Mutex _mutex;
-	roSize _count;	///< The actual number of elements in this table, can be <=> _buckets.size()
-	Array<Node*> _buckets;
-	Node& _nullNode;
+	Shard _shards[shardCount];
+	Node& _nullNode;	///< The empty string, always have a reference hold by the table
 };	// ConstStringHashTable
 
 static ConstStringHashTable& _constStringHashTable()
@@ -634,7 +755,6 @@ static ConstStringHashTable& _constStringHashTable()
 ConstString::ConstString()
 	: _node(&_constStringHashTable().add(""))
 {
-	++_node->refCount;
 #if roDEBUG
 	_debugStr = c_str();
 #endif
@@ -643,7 +763,6 @@ ConstString::ConstString()
 ConstString::ConstString(const char* str)
 	: _node(&_constStringHashTable().add(str))
 {
-	++_node->refCount;
 #if roDEBUG
 	_debugStr = c_str();
 #endif
@@ -652,7 +771,6 @@ ConstString::ConstString(const char* str)
 ConstString::ConstString(const char* str, roSize count)
 	: _node(&_constStringHashTable().add(str, count))
 {
-	++_node->refCount;
 #if roDEBUG
 	_debugStr = c_str();
 #endif
@@ -661,7 +779,6 @@ ConstString::ConstString(const char* str, roSize count)
 ConstString::ConstString(const RangedString& str)
 	: _node(&_constStringHashTable().add(str.begin, str.size()))
 {
-	++_node->refCount;
 #if roDEBUG
 	_debugStr = c_str();
 #endif
@@ -670,7 +787,6 @@ ConstString::ConstString(const RangedString& str)
 ConstString::ConstString(StringHash hash)
 	: _node(&_constStringHashTable().find(hash))
 {
-	++_node->refCount;
 #if roDEBUG
 	_debugStr = c_str();
 #endif
@@ -679,7 +795,7 @@ ConstString::ConstString(StringHash hash)
 ConstString::ConstString(const ConstString& rhs)
 	: _node(rhs._node)
 {
-	++_node->refCount;
+	roAtomicInc(&_node->refCount);
 #if roDEBUG
 	_debugStr = c_str();
 #endif
@@ -697,9 +813,9 @@ ConstString& ConstString::operator=(const char* rhs)
 
 ConstString& ConstString::operator=(const ConstString& rhs)
 {
+	roAtomicInc(&rhs._node->refCount);
 	_constStringHashTable().remove(*_node);
 	_node = rhs._node;
-	++_node->refCount;
 #if roDEBUG
 	_debugStr = c_str();
 #endif
@@ -746,10 +862,11 @@ bool ConstString::isEmpty() const {
 	return *_node->stringValue() == '\0';
 }
 
+// NOTE: Strings are interned, comparing the node handle real hash collisions
 bool ConstString::operator==(const StringHash& rhs) const	{ return hash() == rhs; }
-bool ConstString::operator==(const ConstString& rhs) const	{ return hash() == rhs.hash(); }
-bool ConstString::operator> (const ConstString& rhs) const	{ return hash() > rhs.hash(); }
-bool ConstString::operator< (const ConstString& rhs) const	{ return hash() < rhs.hash(); }
+bool ConstString::operator==(const ConstString& rhs) const	{ return _node == rhs._node; }
+bool ConstString::operator> (const ConstString& rhs) const	{ return hash() > rhs.hash() || (hash() == rhs.hash() && _node > rhs._node); }
+bool ConstString::operator< (const ConstString& rhs) const	{ return hash() < rhs.hash() || (hash() == rhs.hash() && _node < rhs._node); }
 
 roStatus Reflection::serialize_roString(Serializer& se, Field& field, void* fieldParent)
 {
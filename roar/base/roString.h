@@ -9,6 +9,7 @@
 namespace ro {
 
 struct RangedString;
+struct FrameArena;
 
 ///	A light weight replacement for std::string
 /// Assume using UTF-8 encoding
@@ -100,8 +101,13 @@ struct String
 
 	char* _str() const;
 	roSize& _size() const;
-	roSize& _capacity() const;
+	roSize& _capacity() const;	///< May carry _arenaFlag
 	Status _reserve(roSize size, bool forceRealloc);
+
+	/// Non-null if the buffer comes from a FrameArena, in such case the arena
+	/// pointer is stored just before _cstr, see ArenaString in roFrameArena.h
+	FrameArena* _arena() const;
+	static const roSize _arenaFlag = roSize(1) << (sizeof(roSize) * 8 - 1);
 };	// String
 
 
@@ -87,11 +87,13 @@ inline void* _strFormatFunc(long val) {	// Seems the type 'long' is treated diff
 inline void* _strFormatFunc(unsigned long val) {
 	return _strFormatFunc(roUint64(val));
 }
+// Floating point are always passed by pointer, since calling _strFormat_double() through a
+// function pointer taking an integer argument put the value in the wrong register on some ABI (eg. x64 System V)
 inline void* _strFormatFunc(float val) {
-	return sizeof(val) != sizeof(void*) ? (void*)_strFormat_floatptr : (void*)_strFormat_float;
+	return (void*)_strFormat_floatptr;
 }
 inline void* _strFormatFunc(double val) {
-	return sizeof(val) != sizeof(void*) ? (void*)_strFormat_doubleptr : (void*)_strFormat_double;
+	return (void*)_strFormat_doubleptr;
 }
 inline void* _strFormatFunc(const roUtf8* val) {
 	return (void*)_strFormat_utf8;
@@ -139,10 +141,10 @@ inline const roPtrInt _strFormatArg(const roUint64& val) {
 	return sizeof(val) != sizeof(roPtrInt) ? (roPtrInt)&val : (roPtrInt)val;
 }
 inline const roPtrInt _strFormatArg(const float& val) {
-	return sizeof(val) != sizeof(roPtrInt) ? (roPtrInt)&val : (roPtrInt)(*(int*)(&val));
+	return (roPtrInt)&val;
 }
 inline const roPtrInt _strFormatArg(const double& val) {
-	return sizeof(val) != sizeof(roPtrInt) ? (roPtrInt)&val : (roPtrInt)(*(int*)(&val));
+	return (roPtrInt)&val;
 }
 inline const roPtrInt _strFormatArg(roUtf8* val) {
 	return (roPtrInt)val;
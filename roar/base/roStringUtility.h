@@ -159,7 +159,12 @@ roSize		roToString		(char* str, roSize strBufSize, roUint32 val, const char* opt
 roSize		roToString		(char* str, roSize strBufSize, roUint64 val, const char* option=NULL);
 roSize		roToString		(char* str, roSize strBufSize, const void* ptrVal, const char* option=NULL);	// Convert pointer into hex string
 
+/// Shortest representation reading back to the same value, returns the end of the written string, no '\0' is written.
+/// Needs up to 25 bytes of strBuf for roDtoa, 20 for roI64toa and roU64toa
 char*		roDtoa			(double value, char* strBuf);
+char*		roFtoa			(float value, char* strBuf);
+char*		roI64toa		(roInt64 value, char* strBuf);
+char*		roU64toa		(roUint64 value, char* strBuf);
 
 // ----------------------------------------------------------------------
 // String encodings
@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "roTaskPool.h"
+#include "roAtomic.h"
 #include "roCpuProfiler.h"
 #include "roMemory.h"
 #include "../platform/roPlatformHeaders.h"
@@ -18,24 +19,33 @@ class TaskPool::TaskProxy
 public:
 	TaskProxy();
 
-	volatile TaskId id;		///< 0 for invalid id
-	Task* task;				///< Once complete it will set to NULL
+	/// 0 for invalid id. Read the 32 bits generation instead of the 64 bits id, so it's never torn on 32 bits cpu
+	TaskId id() const { return liveGeneration ? (TaskId(liveGeneration) << 32) | index : 0; }
+	bool holds(TaskId taskId) const { return taskId != 0 && liveGeneration == roUint32(taskId >> 32) && index == roUint32(taskId); }
+
+	volatile roUint32 liveGeneration;	///< Generation of the TaskId holding this slot, 0 if the slot is free
+	Task* volatile task;	///< Once complete it will set to NULL, use _claimTask() to take it for running
 	bool finalized;			///< Attributes like dependency, affinity, parent cannot be set after the task is finalized
 	ThreadId affinity;
 	TaskPool* taskPool;
 	TaskProxy* parent;		///< A task is consider completed only if all it's children are completed.
 	TaskProxy* dependency;	///< This task cannot be start until the depending task completes.
-	TaskId dependencyId;	///< The dependency valid only if dependency->id == dependencyId
-	int openChildCount;		///< When a task completes, it reduces the openChildCount of it's parent. When this figure reaches zero, the work is completed.
+	TaskId dependencyId;	///< The dependency valid only if dependency->holds(dependencyId)
+	volatile long openChildCount;	///< When a task completes, it reduces the openChildCount of it's parent. When this figure reaches zero, the work is completed.
 	int suspensionCount;	///< Keep how many times the task is suspended.
 
-	TaskProxy* nextFree;
-	TaskProxy* nextOpen, *prevOpen;
+	roUint32 index;			///< Slot index inside TaskList, never change
+	roUint32 generation;	///< Bumped every time the slot is reused, never reset, wrap around after 2^32 reuses
+	volatile long waiterCount;	///< Threads sleeping in _wait() for this slot, never reset since a waiter may outlive the task
+	roUint32 nextFree;		///< Slot index + 1 of the next free entry, 0 for none
 	TaskProxy* nextPending, *prevPending;
+
+	/// Reset to the just constructed state, except the index, generation and waiterCount
+	void reset();
 };	// TaskProxy
 
 TaskPool::TaskProxy::TaskProxy()
-	: id(0)
+	: liveGeneration(0)
 	, task(NULL)
 	, finalized(false)
 	, affinity(0)
@@ -44,72 +54,305 @@ TaskPool::TaskProxy::TaskProxy()
 	, dependency(NULL), dependencyId(0)
 	, openChildCount(0)
 	, suspensionCount(0)
-	, nextFree(NULL)
-	, nextOpen(NULL), prevOpen(NULL)
+	, index(0)
+	, generation(0)
+	, waiterCount(0)
+	, nextFree(0)
 	, nextPending(NULL), prevPending(NULL)
 {
 }
 
+// NOTE: waiterCount is left untouched, a waiter may change it at the same time
+void TaskPool::TaskProxy::reset()
+{
+	liveGeneration = 0;
+	task = NULL;
+	finalized = false;
+	affinity = 0;
+	taskPool = NULL;
+	parent = NULL;
+	dependency = NULL;
+	dependencyId = 0;
+	openChildCount = 0;
+	suspensionCount = 0;
+	nextFree = 0;
+	nextPending = prevPending = NULL;
+}
+
+Task* TaskPool::_claimTask(TaskProxy* p)
+{
+	Task* task = p->task;
+	if(task && roAtomicCompareAndSwapPtr(reinterpret_cast<void* volatile*>(&p->task), task, NULL) == task)
+		return task;
+	return NULL;
+}
+
+// Indices of WorkerQueue are free running and allowed to wrap around
+static roFORCEINLINE long _queueIdxDiff(long a, long b) { return long((unsigned long)a - (unsigned long)b); }
+static roFORCEINLINE long _queueIdxAdd(long a, long b) { return long((unsigned long)a + (unsigned long)b); }
+
+/// Chase-Lev work stealing deque, see "Dynamic Circular Work-Stealing Deque" by Chase and Lev,
+/// and "Correct and Efficient Work-Stealing for Weak Memory Models" by Le et al.
+/// push() and pop() can only be called by the owning thread, while steal() can be called by any thread.
+/// Every TaskProxy inside the queue is retained, so it will never be reused before being popped.
+class TaskPool::WorkerQueue
+{
+public:
+	WorkerQueue();
+	~WorkerQueue();
+
+	void push(TaskProxy* p);
+	TaskProxy* pop();
+	TaskProxy* steal();
+
+	bool isEmpty() const { return _queueIdxDiff(_bottom, _top) <= 0; }
+
+protected:
+	struct Buffer
+	{
+		long mask;			///< Capacity - 1, capacity is always power of 2
+		Buffer* retired;	///< Buffers being replaced are kept alive until the queue destroy, since stealer may still reading it
+		TaskProxy* volatile items[1];
+	};
+
+	Buffer* _grow(Buffer* buf, long bottom, long top);
+
+	volatile long _top;
+	char _padding1[64 - sizeof(long)];		///< Keep _top and _bottom in different cache line
+	volatile long _bottom;
+	char _padding2[64 - sizeof(long)];
+	Buffer* volatile _buffer;
+};	// WorkerQueue
+
+TaskPool::WorkerQueue::WorkerQueue()
+	: _top(0), _bottom(0)
+{
+	static const long initCapacity = 256;
+	_buffer = _allocator.malloc(sizeof(Buffer) + sizeof(TaskProxy*) * (initCapacity - 1)).cast<Buffer>();
+	_buffer->mask = initCapacity - 1;
+	_buffer->retired = NULL;
+}
+
+TaskPool::WorkerQueue::~WorkerQueue()
+{
+	roAssert(isEmpty());
+	Buffer* buf = _buffer;
+	while(buf) {
+		Buffer* next = buf->retired;
+		_allocator.free(buf);
+		buf = next;
+	}
+}
+
+TaskPool::WorkerQueue::Buffer* TaskPool::WorkerQueue::_grow(Buffer* buf, long bottom, long top)
+{
+	long capacity = (buf->mask + 1) * 2;
+	Buffer* newBuf = _allocator.malloc(sizeof(Buffer) + sizeof(TaskProxy*) * (capacity - 1)).cast<Buffer>();
+	newBuf->mask = capacity - 1;
+	newBuf->retired = buf;
+
+	for(long i=top; i != bottom; i = _queueIdxAdd(i, 1))
+		newBuf->items[i & newBuf->mask] = buf->items[i & buf->mask];
+
+	roMemoryBarrier();
+	_buffer = newBuf;
+	return newBuf;
+}
+
+void TaskPool::WorkerQueue::push(TaskProxy* p)
+{
+	long b = _bottom;
+	long t = _top;
+	Buffer* buf = _buffer;
+
+	if(_queueIdxDiff(b, t) > buf->mask)
+		buf = _grow(buf, b, t);
+
+	buf->items[b & buf->mask] = p;
+	roMemoryBarrier();	// Make sure the item is visible before the new bottom
+	_bottom = _queueIdxAdd(b, 1);
+}
+
+TaskPool::TaskProxy* TaskPool::WorkerQueue::pop()
+{
+	long b = _queueIdxAdd(_bottom, -1);
+	Buffer* buf = _buffer;
+	roAtomicExchange(&_bottom, b);	// Store with full fence, before reading _top
+	long t = _top;
+
+	if(_queueIdxDiff(b, t) < 0) {	// Empty
+		_bottom = _queueIdxAdd(b, 1);
+		return NULL;
+	}
+
+	TaskProxy* p = buf->items[b & buf->mask];
+	if(b != t)	// Still more than one item
+		return p;
+
+	// Fighting with stealers for the last item
+	if(roAtomicCompareAndSwap(&_top, t, _queueIdxAdd(t, 1)) != t)
+		p = NULL;
+	_bottom = _queueIdxAdd(b, 1);
+	return p;
+}
+
+TaskPool::TaskProxy* TaskPool::WorkerQueue::steal()
+{
+	long t = _top;
+	roMemoryBarrier();
+	long b = _bottom;
+
+	if(_queueIdxDiff(b, t) <= 0)
+		return NULL;
+
+	Buffer* buf = _buffer;
+	TaskProxy* p = buf->items[t & buf->mask];
+	if(roAtomicCompareAndSwap(&_top, t, _queueIdxAdd(t, 1)) != t)
+		return NULL;	// Lost the race to another stealer or the owner
+
+	return p;
+}
+
 TaskPool::TaskList::TaskList()
 	: count(0)
-	, idCounter(0)
-	, freeBegin(NULL)
+	, _freeHead(0)
+	, _slotCount(0)
 {
+	roMemZeroStruct(_chunks);
 }
 
 TaskPool::TaskList::~TaskList()
 {
 	roAssert(count == 0);
-	while(freeBegin) {
-		TaskProxy* next = freeBegin->nextFree;
-		roAssert(!freeBegin->task);
-		_allocator.deleteObj(freeBegin);
-		freeBegin = next;
+	for(roSize i=0; i<maxChunkCount; ++i) {
+		TaskProxy* chunk = _chunks[i];
+		if(!chunk)
+			continue;
+		for(roSize j=0; j<chunkSize; ++j) {
+			roAssert(!chunk[j].task);
+			chunk[j].~TaskProxy();
+		}
+		_allocator.free(chunk);
 	}
 }
 
 TaskPool::TaskProxy* TaskPool::TaskList::alloc()
 {
-	++count;
-	++idCounter;
+	roAtomicInc(&count);
+
+	TaskProxy* ret = NULL;
+
+	// Pop from the free list
+	while(true) {
+		// NOTE: The read may be torn on 32 bits cpu, the CAS will fail in that case
+		roInt64 head = _freeHead;
+		roUint32 slot = roUint32(head);
+		if(slot == 0)
+			break;
+
+		// NOTE: The proxy memory is never freed, it's safe to read nextFree even it's
+		// being popped by another thread, the CAS will fail in that case
+		TaskProxy* p = at(slot - 1);
+		if(!p)
+			continue;
+		roInt64 newHead = (head & ~roInt64(0xFFFFFFFF)) | p->nextFree;
+		if(roAtomicCompareAndSwap64(&_freeHead, head, newHead) == head) {
+			ret = p;
+			break;
+		}
+	}
+
+	// Free list exhausted, take a new slot
+	if(!ret) {
+		roSize slot = roSize(roAtomicInc(&_slotCount) - 1);
+
+		// All the slots the index part of TaskId can address are in use
+		if(slot >= maxChunkCount * chunkSize) {
+			roAtomicDec(&_slotCount);
+			roAtomicDec(&count);
+			return NULL;
+		}
 
-	if(!freeBegin)
-		freeBegin = _allocator.newObj<TaskProxy>().unref();
+		roSize chunkIdx = slot >> chunkBits;
+		TaskProxy* chunk = _chunks[chunkIdx];
+		if(!chunk) {
+			chunk = _allocator.malloc(sizeof(TaskProxy) * chunkSize).cast<TaskProxy>();
+			for(roSize i=0; i<chunkSize; ++i) {
+				new (&chunk[i]) TaskProxy();
+				chunk[i].index = roUint32((chunkIdx << chunkBits) + i);
+			}
 
-	TaskProxy* ret = freeBegin;
-	freeBegin = ret->nextFree;
-	ret->nextFree = NULL;
+			// Some other thread may allocating the same chunk at the same time
+			void* volatile* pChunk = reinterpret_cast<void* volatile*>(&_chunks[chunkIdx]);
+			if(roAtomicCompareAndSwapPtr(pChunk, NULL, chunk) != NULL) {
+				for(roSize i=0; i<chunkSize; ++i)
+					chunk[i].~TaskProxy();
+				_allocator.free(chunk);
+				chunk = _chunks[chunkIdx];
+			}
+		}
 
-	ret->id = idCounter;
-	roAssert(ret->task == NULL);
+		ret = &chunk[slot & (chunkSize - 1)];
+	}
 
+	roAssert(ret->liveGeneration == 0 && ret->task == NULL);
+
+	// Generation 0 is skipped, so a TaskId is never 0
+	if(++ret->generation == 0)
+		ret->generation = 1;
+
+	ret->liveGeneration = ret->generation;
 	return ret;
 }
 
-void TaskPool::TaskList::free(TaskProxy* id)
+void TaskPool::TaskList::free(TaskProxy* p)
 {
-#if roDEBUG
-	for(TaskProxy* p = freeBegin; p; p = p->nextFree)
-		roAssert(p != id);
-#endif
+	roAssert(p->liveGeneration != 0 && "Double free of TaskProxy");
+	p->reset();
+
+	while(true) {
+		roInt64 head = _freeHead;
+		p->nextFree = roUint32(head);
+
+		// Bump the ABA tag on every push
+		roInt64 tag = (head & ~roInt64(0xFFFFFFFF)) + (roInt64(1) << 32);
+		roInt64 newHead = tag | (p->index + 1);
+		if(roAtomicCompareAndSwap64(&_freeHead, head, newHead) == head)
+			break;
+	}
 
-	*id = TaskProxy();
-	id->nextFree = freeBegin;
-	freeBegin = id;
 	roAssert(count > 0);
-	--count;
+	roAtomicDec(&count);
+}
+
+TaskPool::TaskProxy* TaskPool::TaskList::find(TaskId id)
+{
+	TaskProxy* p = at(roUint32(id));
+	return (p && p->holds(id)) ? p : NULL;
+}
+
+TaskPool::TaskProxy* TaskPool::TaskList::at(roSize index)
+{
+	roSize chunkIdx = index >> chunkBits;
+	if(chunkIdx >= maxChunkCount)
+		return NULL;
+	TaskProxy* chunk = _chunks[chunkIdx];
+	return chunk ? &chunk[index & (chunkSize - 1)] : NULL;
 }
 
 TaskPool::TaskPool()
 	: _keepRun(true)
-	, _openTasks(NULL)
 	, _pendingTasksHead(NULL), _pendingTasksTail(NULL)
 	, _pendingTaskCount(0)
 	, _threadCount(0)
 	, _workerWaitCount(0)
 	, _threadHandles(NULL)
 	, _mainThreadId(TaskPool::threadId())
+	, _schedulerMode(SchedulerMode::SharedQueue)
+	, _workerQueues(NULL)
+	, _workerIndexCounter(0)
 	, _avgTaskPerSecond(0)
+	, _offloadHead(NULL)
 {
 	_pendingTasksHead = _allocator.newObj<TaskProxy>().unref();
 	_pendingTasksTail = _allocator.newObj<TaskProxy>().unref();
@@ -124,8 +367,7 @@ TaskPool::~TaskPool()
 	roScopeLock(condVar);
 
 	_keepRun = false;
-	while(_openTasks)
-		_wait(_openTasks, tId);
+	_waitAll(tId);
 
 	condVar.broadcast();
 
@@ -145,6 +387,12 @@ TaskPool::~TaskPool()
 
 	_allocator.free(_threadHandles);
 
+	if(_workerQueues) {
+		for(roSize i=0; i<_threadCount+1; ++i)
+			_workerQueues[i].~WorkerQueue();
+		_allocator.free(_workerQueues);
+	}
+
 	_allocator.deleteObj(_pendingTasksHead);
 	_allocator.deleteObj(_pendingTasksTail);
 }
@@ -177,11 +425,18 @@ void TaskPool::waitForTaskAvailable(unsigned timeoutInMs)
 	_waitForTaskAvailableNoLock(timeoutInMs);
 }
 
-void TaskPool::_waitForTaskAvailableNoLock(unsigned timeoutInMs)
+void TaskPool::_waitForTaskAvailableNoLock(unsigned timeoutInMs, TaskProxy* waitFor, TaskId waitForId)
 {
-	++_workerWaitCount;
-	condVar.waitNoLock(timeoutInMs);
-	--_workerWaitCount;
+	// NOTE: Tasks are pushed to the worker queues and freed without locking condVar. The other side
+	// first publish it's change then check _workerWaitCount, while we first count ourself then check,
+	// with a full fence on both sides at least one of us see the other. The wake up is done with
+	// condVar locked, so it cannot slip in-between our check and the wait.
+	roAtomicInc(&_workerWaitCount);
+
+	if(!_hasQueuedTask() && (!waitFor || waitFor->holds(waitForId)))
+		condVar.waitNoLock(timeoutInMs);
+
+	roAtomicDec(&_workerWaitCount);
 }
 
 void defaultThreadFunction(TaskPool* pool)
@@ -192,26 +447,55 @@ void defaultThreadFunction(TaskPool* pool)
 	while(pool->keepRun()) {
 		pool->doSomeTask(0);
 
-		if(pool->_keepRun)
+		// Before going to sleep, see if any running task can share it's work
+		if(pool->_keepRun && !pool->_requestOffload())
 			pool->waitForTaskAvailable();
 	}
 }
 
+struct WorkerTls
+{
+	TaskPool* pool;
+	roSize index;
+	roUint32 randomSeed;
+};
+
+static thread_local WorkerTls _workerTls = { NULL, 0, 0 };
+
+void taskPoolThreadEntry(TaskPool* pool)
+{
+	if(pool->_workerQueues) {
+		_workerTls.pool = pool;
+		_workerTls.index = roAtomicInc(&pool->_workerIndexCounter) - 1;
+		roAssert(_workerTls.index < pool->_threadCount);
+	}
+
+	(pool->threadFunction())(pool);
+	_workerTls.pool = NULL;
+}
+
 #ifdef roUSE_PTHREAD
 static void* _threadFunc(void* p) {
 #else
 static DWORD WINAPI _threadFunc(LPVOID p) {
 #endif
-	TaskPool* pool = reinterpret_cast<TaskPool*>(p);
-	(pool->threadFunction())(pool);
+	taskPoolThreadEntry(reinterpret_cast<TaskPool*>(p));
 	return 0;
 }
 
-void TaskPool::init(roSize threadCount, ThreadFunction threadFunction)
+void TaskPool::init(roSize threadCount, ThreadFunction threadFunction, SchedulerMode mode)
 {
 	roAssert(!_threadHandles);
 	_threadCount = threadCount;
 	_threadHandles = _allocator.malloc(threadCount * sizeof(roSize));
+	_schedulerMode = mode;
+
+	if(mode == SchedulerMode::WorkStealing) {
+		// The extra one is for the main thread
+		_workerQueues = _allocator.malloc((threadCount + 1) * sizeof(WorkerQueue)).cast<WorkerQueue>();
+		for(roSize i=0; i<threadCount+1; ++i)
+			new (&_workerQueues[i]) WorkerQueue();
+	}
 
 	if(!threadFunction)
 		_threadFunction = defaultThreadFunction;
@@ -229,22 +513,24 @@ void TaskPool::init(roSize threadCount, ThreadFunction threadFunction)
 
 TaskId TaskPool::beginAdd(Task* task, ThreadId affinity)
 {
-	roScopeLock(condVar);
-
+	// NOTE: No one can see the proxy before we return it's id, no need to lock for the setup
 	TaskProxy* proxy = taskList.alloc();
+	if(!proxy)
+		return 0;
 	proxy->taskPool = this;
 	proxy->task = task;
 	proxy->affinity = affinity;
 
-	if(_openTasks) _openTasks->prevOpen = proxy;
-	proxy->nextOpen = _openTasks;
-	_openTasks = proxy;
-
-	_addPendingTask(proxy);
-
 	_retainTask(proxy);	// Don't let this task to finish, before we call finishAdd()
 
-	return proxy->id;
+	// For work stealing, the task is scheduled on finishAdd() since
+	// it's dependency and suspension are not known yet
+	if(!_workerQueues) {
+		roScopeLock(condVar);
+		_addPendingTask(proxy);
+	}
+
+	return proxy->id();
 }
 
 struct FuncTask : public Task
@@ -261,7 +547,10 @@ struct FuncTask : public Task
 TaskId TaskPool::beginAdd(const std::function<void()>& func, ThreadId affinity)
 {
 	FuncTask* t = _allocator.newObj<FuncTask>(func).unref();
-	return beginAdd(t, affinity);
+	const TaskId id = beginAdd(t, affinity);
+	if(!id)
+		_allocator.deleteObj(t);
+	return id;
 }
 
 void TaskPool::addChild(TaskId parent, TaskId child)
@@ -297,25 +586,44 @@ void TaskPool::dependsOn(TaskId src, TaskId on)
 
 void TaskPool::finishAdd(TaskId id)
 {
-	roScopeLock(condVar);
+	TaskProxy* p = _findProxyById(id);
+	if(!p)
+		return;
 
-	if(TaskProxy* p = _findProxyById(id)) {
-		roAssert(!p->finalized && "Please call finishAdd() only once");
+	roAssert(!p->finalized && "Please call finishAdd() only once");
+
+	if(!_workerQueues) {
+		roScopeLock(condVar);
 		p->finalized = true;
 		_releaseTask(p);
+		return;
+	}
+
+	// Only the adding thread knows the id so far, no lock needed unless going to the pending list
+	p->finalized = true;
+	if(_pushQueuedTask(p))
+		_signalWorker();
+	else {
+		roScopeLock(condVar);
+		_addPendingTask(p);
 	}
+
+	// The task may already been stolen and run by another thread
+	if(_releaseTask(p))
+		_notifyTaskFreed(p);
 }
 
 TaskId TaskPool::addFinalized(Task* task, TaskId parent, TaskId dependency, ThreadId affinity)
 {
-	roScopeLock(condVar);
-
 	TaskProxy* proxy = taskList.alloc();
+	if(!proxy)
+		return 0;
 	proxy->taskPool = this;
 	proxy->task = task;
 	proxy->affinity = affinity;
 	proxy->finalized = true;
 
+	// NOTE: No one can see the proxy yet, the parent and dependency can be setup without lock
 	if(parent != 0) {
 		TaskProxy* parentProxy = _findProxyById(parent);
 		roAssert(parentProxy && !parentProxy->finalized && "Parameter 'parent' has already finalized");
@@ -329,19 +637,26 @@ TaskId TaskPool::addFinalized(Task* task, TaskId parent, TaskId dependency, Thre
 		proxy->dependencyId = dependency;
 	}
 
-	if(_openTasks) _openTasks->prevOpen = proxy;
-	proxy->nextOpen = _openTasks;
-	_openTasks = proxy;
+	// Keep the id before the proxy is visible to others, it may run and get freed at any time after
+	const TaskId id = proxy->id();
 
-	_addPendingTask(proxy);
+	if(_pushQueuedTask(proxy))
+		_signalWorker();
+	else {
+		roScopeLock(condVar);
+		_addPendingTask(proxy);
+	}
 
-	return proxy->id;
+	return id;
 }
 
 TaskId TaskPool::addFinalized(const std::function<void()>& func, TaskId parent, TaskId dependency, ThreadId affinity)
 {
 	FuncTask* t = _allocator.newObj<FuncTask>(func).unref();
-	return addFinalized(t, parent, dependency, affinity);
+	const TaskId id = addFinalized(t, parent, dependency, affinity);
+	if(!id)
+		_allocator.deleteObj(t);
+	return id;
 }
 
 bool TaskPool::keepRun() const
@@ -366,16 +681,28 @@ void TaskPool::wait(TaskId id)
 	ThreadId tId = threadId();
 	roScopeLock(condVar);
 	if(TaskProxy* p = _findProxyById(id))
-		_wait(p, tId);
+		_wait(p, id, tId);
 }
 
 void TaskPool::waitAll()
 {
 	ThreadId tId = threadId();
 	roScopeLock(condVar);
+	_waitAll(tId);
+}
 
-	while(_openTasks)
-		_wait(_openTasks, tId);
+void TaskPool::_waitAll(ThreadId tId)
+{
+	roAssert(condVar.isLocked());
+
+	// Keep scanning the slots, since the running tasks may add more tasks
+	while(taskList.count > 0) {
+		for(roSize i=0; i<taskList.slotCount(); ++i) {
+			TaskProxy* p = taskList.at(i);
+			if(TaskId id = p ? p->id() : 0)
+				_wait(p, id, tId);
+		}
+	}
 }
 
 #if DEBUG_PRINT
@@ -384,18 +711,16 @@ static const int _debugMaxIndent = 10;
 static const char _debugIndent[_debugMaxIndent+1] = "          ";
 #endif
 
-void TaskPool::_wait(TaskProxy* p, ThreadId tId)
+void TaskPool::_wait(TaskProxy* p, TaskId id, ThreadId tId)
 {
 	roAssert(condVar.isLocked());
-	if(!p) return;
+	if(!p || !p->holds(id)) return;
 
 #if DEBUG_PRINT
-	printf("%sBegin _wait(%d)\n", _debugIndent + _debugMaxIndent - _debugWaitCount, p->id);
+	printf("%sBegin _wait(%llu)\n", _debugIndent + _debugMaxIndent - _debugWaitCount, (unsigned long long)p->id());
 	++_debugWaitCount;
 #endif
 
-	TaskId id = p->id;
-
 	// NOTE: No need to check for dependency, making the dependency chain faster
 	// to clear up, at the expense of deeper callstack.
 	if(_matchAffinity(p, tId)) {
@@ -403,16 +728,25 @@ void TaskPool::_wait(TaskProxy* p, ThreadId tId)
 
 		// Check if the task has been re-scheduled or having child tasks such that
 		// the task is still not consider finished.
-		if(p->id == id)
+		if(p->holds(id))
 			goto DoOtherTasks;
 	}
 	else {
 		// Do other tasks until the task in question has finished
 		// by other threads or it's child got finished too.
 	DoOtherTasks:
-		// If p->id not equals to id, it means the task is really finished,
+		// Let the thread freeing the task know that someone need a wake up
+		++p->waiterCount;
+
+		// If p no longer holds id, it means the task is really finished,
 		// and the proxy may get reused with a new id.
-		while(p->id == id) {
+		while(p->holds(id)) {
+			if(TaskProxy* p2 = _popQueuedTask()) {
+				roScopeUnlock(condVar);
+				_doQueuedTask(p2);
+				continue;
+			}
+
 			TaskProxy* p2 = _pendingTasksHead->nextPending;
 
 			// Search for a task having no dependency, to prevent dead lock
@@ -424,21 +758,29 @@ void TaskPool::_wait(TaskProxy* p, ThreadId tId)
 			if(p2 && p2 != _pendingTasksTail)
 				_doTask(p2, tId);
 			else {
+				bool offloaded = false;
+				if(_offloadHead) {
+					roScopeUnlock(condVar);
+					offloaded = _requestOffload();
+				}
+
 				// If no more task can do, we wait
-				_waitForTaskAvailableNoLock(unsigned(-1));
+				if(!offloaded && p->holds(id))
+					_waitForTaskAvailableNoLock(unsigned(-1), p, id);
 			}
 		}
+
+		--p->waiterCount;
 	}
 
 #if DEBUG_PRINT
 	--_debugWaitCount;
-	printf("%sEnd _wait(%d)\n", _debugIndent + _debugMaxIndent - _debugWaitCount, p->id);
+	printf("%sEnd _wait(%llu)\n", _debugIndent + _debugMaxIndent - _debugWaitCount, (unsigned long long)p->id());
 #endif
 }
 
 bool TaskPool::isDone(TaskId id)
 {
-	roScopeLock(condVar);
 	return _findProxyById(id) == NULL;
 }
 
@@ -463,6 +805,15 @@ void TaskPool::resume(TaskId id)
 
 void TaskPool::doSomeTask(float timeout)
 {
+	CountDownTimer countDown(timeout);
+
+	// The lock free path first
+	while(TaskProxy* p = _popQueuedTask()) {
+		_doQueuedTask(p);
+		if(timeout > 0 && countDown.isExpired(_avgTaskPerSecond))
+			return;
+	}
+
 	roScopeLock(condVar);
 
 	TaskProxy* p = _pendingTasksHead->nextPending;
@@ -471,7 +822,6 @@ void TaskPool::doSomeTask(float timeout)
 	if(p == _pendingTasksTail)
 		return;
 
-	CountDownTimer countDown(timeout);
 	ThreadId tId = threadId();
 
 	// A counter for preventing endless looping of the mixed p->nextPending/p->dependency chasing
@@ -492,7 +842,7 @@ void TaskPool::doSomeTask(float timeout)
 		}
 		else {
 			// Hunt for most depending job, to prevent job starvation.
-			p = (p->dependency && (p->dependency->id == p->dependencyId)) ? p->dependency : p->nextPending;
+			p = (p->dependency && p->dependency->holds(p->dependencyId)) ? p->dependency : p->nextPending;
 
 			if(++loopCount > _pendingTaskCount) {
 				if(_workerWaitCount > 0)
@@ -510,22 +860,27 @@ void TaskPool::_doTask(TaskProxy* p, ThreadId tId)
 	
 	if(!p || !p->task) return;
 
+	// NOTE: In work stealing mode, a task not in the pending list may be run, freed and even
+	// reused by another thread without locking condVar, leave it to _popQueuedTask()
+	if(_workerQueues && !p->prevPending) return;
+
 #if DEBUG_PRINT
-	printf("%sBegin _doTask(%d)\n", _debugIndent + _debugMaxIndent - _debugWaitCount, p->id);
+	printf("%sBegin _doTask(%llu)\n", _debugIndent + _debugMaxIndent - _debugWaitCount, (unsigned long long)p->id());
 #endif
 
-	Task* task = p->task;
-	p->task = NULL;
+	Task* task = _claimTask(p);
+	if(!task) return;
 
 	roAssert(p->finalized);
-	_removePendingTask(p);
+	if(p->prevPending)
+		_removePendingTask(p);
 
 	// NOTE: _wait() may trigger many things, therefore we need to _retainTask() here
 	_retainTask(p);
 
 	if(TaskProxy* dep = p->dependency) {
-		if(dep->id == p->dependencyId) {
-			_wait(dep, tId);
+		if(dep->holds(p->dependencyId)) {
+			_wait(dep, p->dependencyId, tId);
 		}
 	}
 
@@ -537,7 +892,7 @@ void TaskPool::_doTask(TaskProxy* p, ThreadId tId)
 	}
 
 #if DEBUG_PRINT
-	printf("%sEnd _doTask(%d)\n", _debugIndent + _debugMaxIndent - _debugWaitCount, p->id);
+	printf("%sEnd _doTask(%llu)\n", _debugIndent + _debugMaxIndent - _debugWaitCount, (unsigned long long)p->id());
 #endif
 
 	if(TaskProxy* parent = p->parent)
@@ -552,43 +907,88 @@ void TaskPool::_doTask(TaskProxy* p, ThreadId tId)
 	}
 }
 
-TaskPool::TaskProxy* TaskPool::_findProxyById(TaskId id)
+void TaskPool::_doQueuedTask(TaskProxy* p)
 {
-	roAssert(condVar.isLocked());
+	// A suspended task is handed over to the shared pending list, where resume() can pick it up
+	Task* task = p->suspensionCount == 0 ? _claimTask(p) : NULL;
 
-	if(!_openTasks) return NULL;
-	
-	// Search for the id in the open list
-	TaskProxy* proxy = _openTasks;
-	while(proxy) {
-		if(proxy->id == id) return proxy;
-		proxy = proxy->nextOpen;
+	if(task) {
+		task->_proxy = p;
+		task->run(this);
+		task = NULL;	// The task may be deleted, never use the pointer up to this point
+
+		TaskProxy* parent = p->parent;
+		if(parent && _releaseTask(parent))
+			_notifyTaskFreed(parent);
+	}
+	// Otherwise someone else run the task via _doTask(), or it's suspended
+	else if(p->task && p->suspensionCount > 0) {
+		roScopeLock(condVar);
+		if(p->task && p->suspensionCount > 0 && !p->prevPending)
+			_addPendingTask(p);
 	}
 
-	return NULL;
+	if(_releaseTask(p))	// Paired with _retainTask() in _pushQueuedTask()
+		_notifyTaskFreed(p);
+}
+
+TaskPool::TaskProxy* TaskPool::_findProxyById(TaskId id)
+{
+	return taskList.find(id);
 }
 
 void TaskPool::_retainTask(TaskProxy* p)
 {
-	p->openChildCount++;
+	roAtomicInc(&p->openChildCount);
 }
 
-void TaskPool::_releaseTask(TaskProxy* p)
+bool TaskPool::_releaseTask(TaskProxy* p)
 {
-	roAssert(condVar.isLocked());
-	roAssert(p->finalized);
-	p->openChildCount--;
-	if(p->openChildCount == 0 && !p->task)
-		_removeOpenTask(p);
+	// NOTE: A child may finish before it's parent got finalized, the retain
+	// made by beginAdd() still keep the parent alive in that case
+	roAssert(p->finalized || p->openChildCount > 1);
+
+	// NOTE: The task pointer is only set back by reSchedule(), while the proxy is retained by the runner
+	if(roAtomicDec(&p->openChildCount) != 0 || p->task)
+		return false;
+
+	_freeTask(p);
+	return true;
 }
 
-void TaskPool::_removeOpenTask(TaskProxy* p)
+void TaskPool::_notifyTaskFreed(TaskProxy* p)
+{
+	// Paired with the fence in _waitForTaskAvailableNoLock()
+	roMemoryBarrier();
+	if(_workerWaitCount == 0)
+		return;
+
+	// Only the threads waiting on this very task, and the pending tasks which may depend on it,
+	// have something to do with the completion. Most tasks finish with no one waiting for them.
+	if(p->waiterCount == 0 && _pendingTaskCount == 0)
+		return;
+
+	// NOTE: We need to do broadcast rather than signal, every thread waiting on the task should
+	// return, and we don't know which worker match the affinity of the pending tasks
+	roScopeLock(condVar);
+	condVar.broadcast();
+}
+
+void TaskPool::_signalWorker()
+{
+	// Paired with the fence in _waitForTaskAvailableNoLock()
+	roMemoryBarrier();
+	if(_workerWaitCount == 0)
+		return;
+
+	// Any thread can run a queued task, waking one is enough
+	roScopeLock(condVar);
+	condVar.signal();
+}
+
+void TaskPool::_freeTask(TaskProxy* p)
 {
-	roAssert(condVar.isLocked());
 	roAssert(!p->task);
-	if(p->prevOpen) p->prevOpen->nextOpen = p->nextOpen;
-	if(p->nextOpen) p->nextOpen->prevOpen = p->prevOpen;
-	if(p == _openTasks) _openTasks = p->nextOpen;
 	taskList.free(p);
 }
 
@@ -622,6 +1022,85 @@ void TaskPool::_addPendingTask(TaskProxy* p)
 	}
 }
 
+void TaskPool::_scheduleTask(TaskProxy* p)
+{
+	roAssert(condVar.isLocked());
+
+	if(!_pushQueuedTask(p)) {
+		_addPendingTask(p);
+		return;
+	}
+
+	// Any thread can run it, no need to broadcast
+	if(_workerWaitCount > 0)
+		condVar.signal();
+}
+
+bool TaskPool::_pushQueuedTask(TaskProxy* p)
+{
+	roAssert(p->finalized);
+
+	WorkerQueue* queue = _currentWorkerQueue();
+	if(!queue || p->affinity != 0 || p->suspensionCount > 0 || _hasOutstandingDependency(p))
+		return false;
+
+	_retainTask(p);	// Paired with _releaseTask() in _doQueuedTask()
+	queue->push(p);
+	return true;
+}
+
+TaskPool::WorkerQueue* TaskPool::_currentWorkerQueue()
+{
+	if(!_workerQueues)
+		return NULL;
+	if(_workerTls.pool == this)
+		return &_workerQueues[_workerTls.index];
+	if(threadId() == _mainThreadId)
+		return &_workerQueues[_threadCount];
+	return NULL;
+}
+
+TaskPool::TaskProxy* TaskPool::_popQueuedTask()
+{
+	if(!_workerQueues)
+		return NULL;
+
+	WorkerQueue* queue = _currentWorkerQueue();
+	if(queue) {
+		if(TaskProxy* p = queue->pop())
+			return p;
+	}
+
+	// Steal from others, start at a random victim to spread the contention
+	roUint32& seed = _workerTls.randomSeed;
+	if(seed == 0) seed = roUint32(threadId()) | 1;
+	seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;	// xorshift32
+
+	const roSize queueCount = _threadCount + 1;
+	const roSize begin = seed % queueCount;
+	for(roSize i=0; i<queueCount; ++i) {
+		WorkerQueue* victim = &_workerQueues[(begin + i) % queueCount];
+		if(victim == queue)
+			continue;
+		if(TaskProxy* p = victim->steal())
+			return p;
+	}
+
+	return NULL;
+}
+
+bool TaskPool::_hasQueuedTask() const
+{
+	if(!_workerQueues)
+		return false;
+
+	for(roSize i=0; i<_threadCount+1; ++i) {
+		if(!_workerQueues[i].isEmpty())
+			return true;
+	}
+	return false;
+}
+
 void TaskPool::_removePendingTask(TaskProxy* p)
 {
 	roAssert(condVar.isLocked());
@@ -647,7 +1126,7 @@ bool TaskPool::_matchAffinity(TaskProxy* p, ThreadId tId)
 bool TaskPool::_hasOutstandingDependency(TaskPool::TaskProxy* p)
 {
 	return	p->dependency &&
-		p->dependency->id == p->dependencyId;	// Check if task finished
+		p->dependency->holds(p->dependencyId);	// Check if task finished
 }
 
 namespace {
@@ -675,6 +1154,44 @@ void TaskPool::addCallback(TaskId id, Callback callback, void* userData, ThreadI
 	addFinalized(t, 0, id, affinity);
 }
 
+void TaskPool::beginOffload(Task* task)
+{
+	roAssert(task && !task->_offloadPrev && !task->_offloadNext && _offloadHead != task);
+	roScopeLock(_offloadMutex);
+	task->_offloadNext = _offloadHead;
+	if(_offloadHead)
+		_offloadHead->_offloadPrev = task;
+	_offloadHead = task;
+}
+
+void TaskPool::endOffload(Task* task)
+{
+	// NOTE: Taking the lock also make sure no one is still inside task->offload()
+	roScopeLock(_offloadMutex);
+	if(task->_offloadPrev)
+		task->_offloadPrev->_offloadNext = task->_offloadNext;
+	else {
+		roAssert(_offloadHead == task);
+		_offloadHead = task->_offloadNext;
+	}
+	if(task->_offloadNext)
+		task->_offloadNext->_offloadPrev = task->_offloadPrev;
+	task->_offloadPrev = task->_offloadNext = NULL;
+}
+
+bool TaskPool::_requestOffload()
+{
+	if(!_offloadHead)
+		return false;
+
+	roScopeLock(_offloadMutex);
+	for(Task* t = _offloadHead; t; t = t->_offloadNext) {
+		if(t->offload(this))
+			return true;
+	}
+	return false;
+}
+
 void Task::reSchedule(bool suspend)
 {
 	TaskPool::TaskProxy* p = reinterpret_cast<TaskPool::TaskProxy*>(this->_proxy);
@@ -682,11 +1199,11 @@ void Task::reSchedule(bool suspend)
 	roScopeLock(p->taskPool->condVar);
 
 	p->task = this;
-	p->taskPool->_addPendingTask(p);
 	p->suspensionCount += suspend;
+	p->taskPool->_scheduleTask(p);
 
 #if DEBUG_PRINT
-	printf("%sreSchedule(%d)\n", _debugIndent + _debugMaxIndent - _debugWaitCount, p->id);
+	printf("%sreSchedule(%llu)\n", _debugIndent + _debugMaxIndent - _debugWaitCount, (unsigned long long)p->id());
 #endif
 }
 
@@ -698,11 +1215,11 @@ void Task::reSchedule(bool suspend, ThreadId affinity)
 
 	p->task = this;
 	p->affinity = affinity;
-	p->taskPool->_addPendingTask(p);
 	p->suspensionCount += suspend;
+	p->taskPool->_scheduleTask(p);
 
 #if DEBUG_PRINT
-	printf("%sreSchedule(%d)\n", _debugIndent + _debugMaxIndent - _debugWaitCount, p->id);
+	printf("%sreSchedule(%llu)\n", _debugIndent + _debugMaxIndent - _debugWaitCount, (unsigned long long)p->id());
 #endif
 }
 
@@ -8,13 +8,15 @@ namespace ro {
 
 class TaskPool;
 
-typedef roUint32 TaskId;
+/// A TaskId packs the slot index of it's TaskProxy (lower 32 bits) together with a
+/// 32 bits generation counter, the generation is bumped every time the slot is reused.
+typedef roUint64 TaskId;
 typedef roPtrInt ThreadId;
 
 class Task
 {
 public:
-	Task() : _proxy(nullptr) {}
+	Task() : _proxy(nullptr), _offloadPrev(nullptr), _offloadNext(nullptr) {}
 	virtual ~Task() {}
 
 	/// Derived class will do actual work in this function.
@@ -23,7 +25,10 @@ public:
 	virtual void run(TaskPool* taskPool) = 0;
 
 	/// When there are idling thread in the TaskPool, it may request
-	/// a Task to off load part of it's work to another new Task
+	/// a Task to off load part of it's work to another new Task.
+	/// Only invoked in-between TaskPool::beginOffload() and TaskPool::endOffload(),
+	/// from an idle thread while run() is in progress, so it must be thread safe.
+	/// Return true if the task is going to off load some work.
 	virtual bool offload(TaskPool* taskPool) { (void)taskPool; return false; }
 
 protected:
@@ -36,6 +41,7 @@ protected:
 private:
 	friend class TaskPool;
 	void* _proxy;	/// For use with reSchedule()
+	Task* _offloadPrev, *_offloadNext;	/// Link list of TaskPool::beginOffload()
 };	// Task
 
 
@@ -53,8 +59,15 @@ public:
 
 	typedef void (*ThreadFunction)(TaskPool*);
 
+	/// SharedQueue: All pending tasks go through a single list guarded by condVar.
+	/// WorkStealing: Each worker thread (plus the main thread) owns a lock-free
+	/// Chase-Lev deque, tasks ready to run are pushed to the deque of the adding
+	/// thread and idle threads steal from the others. Tasks with affinity, outstanding
+	/// dependency or suspension still go through the shared list.
+	enum class SchedulerMode { SharedQueue, WorkStealing };
+
 // Operations
-	void init(roSize threadCount, ThreadFunction threadFunction= NULL);
+	void init(roSize threadCount, ThreadFunction threadFunction= NULL, SchedulerMode mode=SchedulerMode::SharedQueue);
 
 	/// You can addChild() and dependsOn() in-between beginAdd() and finishAdd()
 	/// The task will begin to process as soon as possible
@@ -62,6 +75,7 @@ public:
 	///		= 0 : any thread can run this task
 	///		= threadId : the only thread that can run this task
 	///		= ~threadId : the only thread that can NOT run this task
+	/// Return 0 when all the 2^taskIdIndexBits slots are in use, the task is not taken then
 	TaskId beginAdd(Task* task, ThreadId affinity=0);
 	TaskId beginAdd(const std::function<void()>& func, ThreadId affinity=0);
 
@@ -75,12 +89,13 @@ public:
 	void finishAdd(TaskId id);
 
 	/// Add the task, set the properties and finish the add, all in a single function call
+	/// Return 0 like beginAdd() when running out of slots
 	TaskId addFinalized(Task* task, TaskId parent=0, TaskId dependency=0, ThreadId affinity=0);
 	TaskId addFinalized(const std::function<void()>& func, TaskId parent=0, TaskId dependency=0, ThreadId affinity=0);
 
-	/// @note The TaskId may be reused for another task that you
-	/// were NOT waiting for, but that's not the problem since the
-	/// task should be finished anyway.
+	/// @note Thanks to the generation stored in TaskId, waiting on a finished
+	/// task will not wait for another task reusing the same slot, unless the
+	/// slot is reused 2^32 times in-between.
 	void wait(TaskId id);
 
 	/// A task will not be pick up by the TaskPool to run, if it's suspended.
@@ -90,7 +105,7 @@ public:
 	void suspend(TaskId id);
 	void resume(TaskId id);
 
-	/// Check if a task is finished.
+	/// Check if a task is finished. Lock free.
 	bool isDone(TaskId id);
 
 	/// If you know your thread have some idle time,
@@ -117,24 +132,39 @@ public:
 	/// For use in custom thread function
 	void waitForTaskAvailable(unsigned timeoutInMs=unsigned(-1));
 
+	/// Let idle threads call task->offload() while the task is running,
+	/// the task must call endOffload() before it finish or get deleted.
+	void beginOffload(Task* task);
+	void endOffload(Task* task);
+
 // Attributes
 	/// To get the current thread id, which is use for setting affinity
 	static ThreadId threadId();
 
-	roSize taskCount() const { return taskList.count; }
+	roSize taskCount() const { return roSize(taskList.count); }
 	roSize threadCount() const { return _threadCount; }
 
 	ThreadId mainThreadId() const { return _mainThreadId; }
 	ThreadFunction threadFunction() const { return _threadFunction; }
+	SchedulerMode schedulerMode() const { return _schedulerMode; }
+
+	/// Number of threads waiting for a task to run, a hint for splitting work
+	roSize idleThreadCount() const { return roSize(_workerWaitCount); }
 
 protected:
 	class TaskProxy;
+	class WorkerQueue;
 
 	friend void defaultThreadFunction(TaskPool*);
+	friend void taskPoolThreadEntry(TaskPool*);
 	void _doTask(TaskProxy* id, ThreadId threadI);
 
-	void _wait(TaskProxy* id, ThreadId threadId);
+	/// Wait until the proxy no longer holding the given id
+	void _wait(TaskProxy* p, TaskId id, ThreadId threadId);
 
+	void _waitAll(ThreadId threadId);
+
+	/// O(1) and lock free, return NULL if the task already finished
 	TaskProxy* _findProxyById(TaskId id);
 
 	/// Hold the TaskProxy such that it's member will not reset even
@@ -143,9 +173,17 @@ protected:
 
 	/// If the retain count reach zero, it means absolutely no one (potentially)
 	/// interested in the task any more, the proxy can be safely reused.
-	void _releaseTask(TaskProxy* p);
+	/// Lock free, return true if the proxy is freed, see _notifyTaskFreed().
+	bool _releaseTask(TaskProxy* p);
+
+	/// Wake up the threads which may be waiting for a proxy freed by _releaseTask(),
+	/// condVar should NOT be locked. Cost nothing if no one is waiting.
+	void _notifyTaskFreed(TaskProxy* p);
 
-	void _removeOpenTask(TaskProxy* p);
+	/// Wake up one idle thread for a task pushed by _pushQueuedTask(), condVar should NOT be locked.
+	void _signalWorker();
+
+	void _freeTask(TaskProxy* p);
 
 	void _addPendingTask(TaskProxy* p);
 
@@ -156,40 +194,93 @@ protected:
 
 	bool _hasOutstandingDependency(TaskProxy* p);
 
-	void _waitForTaskAvailableNoLock(unsigned timeoutInMs);
+	/// Return immediately if waitFor no longer holding waitForId
+	void _waitForTaskAvailableNoLock(unsigned timeoutInMs, TaskProxy* waitFor=NULL, TaskId waitForId=0);
+
+	/// Put a finalized task into the worker queue of the calling thread if possible,
+	/// otherwise into the shared pending list. condVar should be locked.
+	void _scheduleTask(TaskProxy* p);
+
+	/// Lock free, put a finalized task into the worker queue of the calling thread.
+	/// Return false if the task has to go through the shared pending list instead.
+	bool _pushQueuedTask(TaskProxy* p);
+
+	/// Pop from the worker queue of the calling thread, or steal from others. Lock free.
+	TaskProxy* _popQueuedTask();
+
+	/// Run a task obtained from _popQueuedTask(), condVar should NOT be locked.
+	void _doQueuedTask(TaskProxy* p);
 
+	/// Take the ownership of the task for running, only one thread will success.
+	static Task* _claimTask(TaskProxy* p);
+
+	WorkerQueue* _currentWorkerQueue();
+	bool _hasQueuedTask() const;
+
+	/// Ask the tasks registered by beginOffload() to off load some work,
+	/// return true if any of them accepted. condVar should NOT be locked.
+	bool _requestOffload();
+
+	/// Limit the number of slots, the index part of TaskId itself has 32 bits
+	static const roUint32 taskIdIndexBits = 20;
+	static const roUint32 taskIdIndexMask = (1 << taskIdIndexBits) - 1;
+
+	/// A slab of TaskProxy, allocated in chunks which never move nor free until
+	/// the TaskPool destroy, such that a TaskId can be mapped back to it's proxy in O(1).
+	/// alloc() and free() are lock free, using a Treiber stack of slot index with a 32 bits ABA tag.
 	class TaskList
 	{
 	public:
 		TaskList();
 		~TaskList();
 
+		/// Return NULL when all the slots are in use
 		TaskProxy* alloc();
 
-		void free(TaskProxy* id);
+		void free(TaskProxy* p);
+
+		/// Return NULL if the id is no longer valid
+		TaskProxy* find(TaskId id);
 
-		roSize count;
-		TaskId idCounter;
-		TaskProxy* freeBegin;	///< Point to the first free entry
+		/// Access by slot index, may return NULL for a slot which is being allocated
+		TaskProxy* at(roSize index);
+
+		/// Number of slots ever allocated, for iterating with at()
+		roSize slotCount() const { return roSize(_slotCount); }
+
+		static const roUint32 chunkBits = 10;
+		static const roUint32 chunkSize = 1 << chunkBits;
+		static const roUint32 maxChunkCount = (taskIdIndexMask + 1) >> chunkBits;
+
+		volatile long count;		///< Number of tasks in use
+		volatile roInt64 _freeHead;	///< Slot index + 1 of the first free entry on the lower 32 bits, plus an ABA tag on the upper 32 bits
+		volatile long _slotCount;
+		TaskProxy* volatile _chunks[maxChunkCount];
 	};	// TaskList
 
 	TaskList taskList;
 	ThreadFunction _threadFunction;
 
 	bool _keepRun;
-	TaskProxy* _openTasks;			///< Tasks which are not completed yet.
 	TaskProxy* _pendingTasksHead;	///< Tasks which are not assigned to any worker yet, head of link list.
 	TaskProxy* _pendingTasksTail;	///< Tasks which are not assigned to any worker yet, tail of link list.
 	roSize _pendingTaskCount;
 
 	roSize _threadCount;
-	roSize _workerWaitCount;
+	volatile long _workerWaitCount;	///< Changed atomically, read without lock to decide whether to wake up anyone
 	void** _threadHandles;
 
 	ThreadId _mainThreadId;
 
+	SchedulerMode _schedulerMode;
+	WorkerQueue* _workerQueues;		///< One per worker thread plus one for the main thread, only for SchedulerMode::WorkStealing
+	volatile long _workerIndexCounter;
+
 	float _avgTaskPerSecond;		///< We keep some statistic for making doSomeTask() more efficient
 
+	Task* volatile _offloadHead;	///< Tasks registered by beginOffload(), guarded by _offloadMutex
+	Mutex _offloadMutex;
+
 	mutable CondVar condVar;
 };	// TaskPool
 
@@ -66,15 +66,25 @@ roEXCP_TRY
 	if(!st) roEXCP_THROW;
 
 	static const unsigned loopCount = 10;
-	char buf[1024];
+	static const roSize chunkSize = 1024;
 
 	// If data not ready, give up in this round and do it again in next schedule
-	if(fileSystem.readWillBlock(stream, sizeof(buf) * loopCount))
+	if(fileSystem.readWillBlock(stream, chunkSize * loopCount))
 		return reSchedule();
 
+	// Append from the file system's own buffer, saving a copy for mmapFileSystem
 	for(unsigned i=0; i<loopCount; ++i) {
 		roUint64 bytesRead = 0;
-		st = fileSystem.read(stream, buf, sizeof(buf), bytesRead);
+		roBytePtr buf = fileSystem.getBuffer(stream, chunkSize, bytesRead);
+
+		if(buf && bytesRead > 0) {
+			data.append((char*)buf, num_cast<size_t>(bytesRead));
+			continue;
+		}
+
+		// An empty buffer may be the end of file or an error, read() tell which
+		char c;
+		st = fileSystem.read(stream, &c, 1, bytesRead);
 
 		if(st == Status::file_ended) {
 			nextFun = &TextLoader::convert;
@@ -82,7 +92,7 @@ roEXCP_TRY
 		}
 
 		if(!st) roEXCP_THROW;
-		data.append(buf, num_cast<size_t>(bytesRead));
+		data.append(&c, num_cast<size_t>(bytesRead));
 	}
 
 roEXCP_CATCH
@@ -0,0 +1,275 @@
+#include "pch.h"
+#include "roThreadCacheAllocator.h"
+#include "roMemory.h"
+#include "roMutex.h"
+#include "roUtility.h"
+#include <stdlib.h>
+
+namespace ro {
+
+ThreadCacheAllocator threadCacheAllocator;
+
+namespace {
+
+static const roUint32 _magic = 0x7CAC4E5A;
+static const roUint32 _largeClass = roUint32(-1);
+static const roUint32 _classCount = 12;
+static const roSize _spanSize = 64 * 1024;
+
+/// Block size of each size class, 16 bytes apart up to 128, then 32 bytes apart
+static const roUint32 _classSize[_classCount] = { 16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256 };
+
+/// Map (size + 15) / 16 to the size class
+static const roUint8 _classLookup[ThreadCacheAllocator::maxSmallSize / 16 + 1] = {
+	0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11, 11
+};
+
+/// Keep the user pointer 16 bytes aligned on both 32 and 64 bits
+struct BlockHeader
+{
+	roUint32 sizeClass;
+	roUint32 magic;
+	roUint64 size;		///< Usable size of the block
+};	// BlockHeader
+
+static_assert(sizeof(BlockHeader) == 16, "BlockHeader should be 16 bytes");
+
+/// Singly link list through the first pointer of the free block's payload
+struct FreeList
+{
+	void* head;
+	roUint32 count;
+};	// FreeList
+
+struct Depot
+{
+	Mutex mutex[_classCount];
+	FreeList lists[_classCount];
+};	// Depot
+
+/// POD such that it is still accessible after the thread local destructors run
+struct ThreadCache
+{
+	enum State { NotInit = 0, Alive, Dead };
+	FreeList lists[_classCount];
+	int state;
+};	// ThreadCache
+
+static thread_local ThreadCache _threadCache;
+
+struct ThreadCacheReleaser
+{
+	~ThreadCacheReleaser()
+	{
+		ThreadCacheAllocator::flushThreadCache();
+		_threadCache.state = ThreadCache::Dead;
+	}
+};	// ThreadCacheReleaser
+
+static roFORCEINLINE roUint32 _sizeClassOf(roSize size)
+{
+	return _classLookup[(size + 15) >> 4];
+}
+
+/// Number of blocks moving between a thread cache and the depot at once
+static roFORCEINLINE roUint32 _batchCount(roUint32 sizeClass)
+{
+	roUint32 slotSize = _classSize[sizeClass] + sizeof(BlockHeader);
+	return roClamp(roUint32(8 * 1024 / slotSize), 8u, 128u);
+}
+
+static roFORCEINLINE BlockHeader* _header(const void* ptr)
+{
+	BlockHeader* h = (BlockHeader*)ptr - 1;
+	roAssert(h->magic == _magic && "Pointer not allocated by ThreadCacheAllocator");
+	return h;
+}
+
+static roFORCEINLINE void* _pop(FreeList& list)
+{
+	void* p = list.head;
+	list.head = *(void**)p;
+	--list.count;
+	return p;
+}
+
+static roFORCEINLINE void _push(FreeList& list, void* p)
+{
+	*(void**)p = list.head;
+	list.head = p;
+	++list.count;
+}
+
+// Never destroyed, such that it out lives any static object that may still free memory
+static Depot& _depot()
+{
+	static Depot* depot = new(::malloc(sizeof(Depot))) Depot();
+	return *depot;
+}
+
+static ThreadCache* _currentThreadCache()
+{
+	if(_threadCache.state == ThreadCache::Alive)
+		return &_threadCache;
+	if(_threadCache.state == ThreadCache::Dead)
+		return NULL;
+
+	// Touching it register the thread exit callback
+	static thread_local ThreadCacheReleaser releaser;
+	(void)releaser;
+	_threadCache.state = ThreadCache::Alive;
+	return &_threadCache;
+}
+
+/// Carve a new span into blocks, depot.mutex[sizeClass] should be locked
+static bool _growDepot(Depot& depot, roUint32 sizeClass)
+{
+	roByte* span = (roByte*)::malloc(_spanSize);
+	if(!span) return false;
+
+	roSize slotSize = _classSize[sizeClass] + sizeof(BlockHeader);
+	roSize slotCount = _spanSize / slotSize;
+
+	// Push in reverse such that blocks are handed out in address order
+	for(roSize i=slotCount; i--; ) {
+		BlockHeader* h = (BlockHeader*)(span + i * slotSize);
+		h->sizeClass = sizeClass;
+		h->magic = _magic;
+		h->size = _classSize[sizeClass];
+		_push(depot.lists[sizeClass], h + 1);
+	}
+	return true;
+}
+
+/// Move up to maxCount blocks from the depot to the list
+static void _fetchFromDepot(roUint32 sizeClass, FreeList& to, roUint32 maxCount)
+{
+	Depot& depot = _depot();
+	roScopeLock(depot.mutex[sizeClass]);
+
+	FreeList& from = depot.lists[sizeClass];
+	if(!from.head && !_growDepot(depot, sizeClass))
+		return;
+
+	while(from.head && maxCount--)
+		_push(to, _pop(from));
+}
+
+/// Move count blocks from the list to the depot
+static void _releaseToDepot(roUint32 sizeClass, FreeList& from, roUint32 count)
+{
+	Depot& depot = _depot();
+	roScopeLock(depot.mutex[sizeClass]);
+
+	FreeList& to = depot.lists[sizeClass];
+	while(from.head && count--)
+		_push(to, _pop(from));
+}
+
+}	// namespace
+
+roBytePtr ThreadCacheAllocator::malloc(roSize size)
+{
+	if(size > maxSmallSize) {
+		BlockHeader* h = (BlockHeader*)::malloc(sizeof(BlockHeader) + size);
+		if(!h) return NULL;
+		h->sizeClass = _largeClass;
+		h->magic = _magic;
+		h->size = size;
+		return h + 1;
+	}
+
+	roUint32 sizeClass = _sizeClassOf(size);
+
+	if(ThreadCache* cache = _currentThreadCache()) {
+		FreeList& list = cache->lists[sizeClass];
+		if(!list.head)
+			_fetchFromDepot(sizeClass, list, _batchCount(sizeClass));
+		return list.head ? _pop(list) : NULL;
+	}
+
+	// The thread is shutting down, go to the depot directly
+	FreeList list = { NULL, 0 };
+	_fetchFromDepot(sizeClass, list, 1);
+	return list.head;
+}
+
+roBytePtr ThreadCacheAllocator::realloc(void* originalPtr, roSize originalSize, roSize newSize)
+{
+	(void)originalSize;
+
+	if(!originalPtr)
+		return malloc(newSize);
+
+	if(newSize == 0) {
+		free(originalPtr);
+		return NULL;
+	}
+
+	BlockHeader* h = _header(originalPtr);
+
+	// Grow (or shrink) in place within the size class
+	if(h->sizeClass != _largeClass && newSize <= h->size)
+		return originalPtr;
+
+	// Large to large, libc may grow in place
+	if(h->sizeClass == _largeClass && newSize > maxSmallSize) {
+		BlockHeader* newH = (BlockHeader*)::realloc(h, sizeof(BlockHeader) + newSize);
+		if(!newH) return NULL;
+		newH->size = newSize;
+		return newH + 1;
+	}
+
+	roBytePtr newPtr = malloc(newSize);
+	if(!newPtr) return NULL;
+	roMemcpy(newPtr, originalPtr, roMinOf2(roSize(h->size), newSize));
+	free(originalPtr);
+	return newPtr;
+}
+
+void ThreadCacheAllocator::free(void* ptr)
+{
+	if(!ptr) return;
+
+	BlockHeader* h = _header(ptr);
+	roUint32 sizeClass = h->sizeClass;
+
+	if(sizeClass == _largeClass) {
+		::free(h);
+		return;
+	}
+
+	if(ThreadCache* cache = _currentThreadCache()) {
+		FreeList& list = cache->lists[sizeClass];
+		_push(list, ptr);
+
+		// Keep one batch for later allocation, the rest goes back to the depot
+		roUint32 batch = _batchCount(sizeClass);
+		if(list.count > 2 * batch)
+			_releaseToDepot(sizeClass, list, list.count - batch);
+		return;
+	}
+
+	FreeList list = { NULL, 0 };
+	_push(list, ptr);
+	_releaseToDepot(sizeClass, list, 1);
+}
+
+roSize ThreadCacheAllocator::usableSize(const void* ptr)
+{
+	return ptr ? roSize(_header(ptr)->size) : 0;
+}
+
+void ThreadCacheAllocator::flushThreadCache()
+{
+	if(_threadCache.state != ThreadCache::Alive)
+		return;
+
+	for(roUint32 i=0; i<_classCount; ++i) {
+		FreeList& list = _threadCache.lists[i];
+		if(list.count)
+			_releaseToDepot(i, list, list.count);
+	}
+}
+
+}	// namespace ro
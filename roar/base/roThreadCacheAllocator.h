@@ -0,0 +1,42 @@
+#ifndef __roThreadCacheAllocator_h__
+#define __roThreadCacheAllocator_h__
+
+#include "roBytePtr.h"
+#include "roNonCopyable.h"
+
+namespace ro {
+
+/// An allocator for small objects, inspired by tcmalloc.
+/// Requests up to maxSmallSize bytes are rounded up to a size class, and served
+/// from a free list owned by the calling thread without any locking.
+/// A thread cache which runs empty fetches a batch of blocks from the central depot,
+/// and one which grows too large (eg. a thread keep freeing blocks allocated
+/// by another thread) gives a batch back to the depot.
+/// Larger requests are forwarded to libc.
+///
+/// Every block carries a 16 bytes header recording it's size class, therefore
+/// free() need no size and realloc() can grow in place within the size class.
+/// Memory used by small blocks is recycled through the depot but never returned to libc.
+///
+/// Define roUSE_THREAD_CACHE_ALLOCATOR to 1 to route roMalloc() and DefaultAllocator to it.
+struct ThreadCacheAllocator : private NonCopyable
+{
+	roBytePtr malloc(roSize size);
+	roBytePtr realloc(void* originalPtr, roSize originalSize, roSize newSize);
+	void free(void* ptr);
+
+	/// The number of bytes the block can hold without re-allocation
+	static roSize usableSize(const void* ptr);
+
+	/// Give all cached blocks of the calling thread back to the depot.
+	/// Automatically done when a thread exit.
+	static void flushThreadCache();
+
+	static const roSize maxSmallSize = 256;
+};	// ThreadCacheAllocator
+
+extern ThreadCacheAllocator threadCacheAllocator;
+
+}	// namespace ro
+
+#endif	// __roThreadCacheAllocator_h__
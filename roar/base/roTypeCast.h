@@ -32,9 +32,11 @@ inline roStatus roIsValidCast<double>(float src)
 template<>
 inline roStatus roIsValidCast<float>(double src)
 {
+	// Losing the precision a float doesn't have is fine, the tolerance is relative to the magnitude
 	const float f = (float)src;
 	const double diff = src - f;
-	const double epsilon = 1e-7;
+	const double relative = (src < 0 ? -src : src) * 1.1920929e-7;	// FLT_EPSILON
+	const double epsilon = relative > 1e-7 ? relative : 1e-7;
 	return (diff > -epsilon && diff < epsilon) ? roStatus::ok : roStatus::numeric_cast_overflow;
 }
 
@@ -2,6 +2,8 @@
 #include "roDnsResolve.h"
 #include "roSocket.h"
 #include "../base/roArray.h"
+#include "../base/roCoRoutine.h"
+#include "../base/roHashMap.h"
 #include "../base/roLog.h"
 #include "../base/roStopWatch.h"
 #include "../base/roString.h"
@@ -15,6 +17,9 @@
 #	include <svcguid.h>		// For using WSALookupService
 #	include <windns.h>		// DNS API
 #	pragma comment(lib, "dnsapi.lib")
+#else
+#	include <arpa/inet.h>
+#	include <stdio.h>
 #endif
 
 // Reference:
@@ -44,7 +49,16 @@ enum Type
 	T_CNAME	= 5,	// Canonical name
 	T_SOA	= 6,	// Start of authority zone
 	T_PTR	= 12,	// domain name pointer
-	T_MX	= 15	// mail routing information
+	T_MX	= 15,	// mail routing information
+	T_AAAA	= 28	// IPv6 host address
+};
+
+// Response code in the header
+enum RCode
+{
+	R_NOERROR	= 0,
+	R_SERVFAIL	= 2,
+	R_NXDOMAIN	= 3	// The name does not exist
 };
 
 // DNS header structure
@@ -190,6 +204,21 @@ roStatus _readName(String& outStr, roByte* buffer, roByte*& reader, const roByte
 	return _fromDnsNameFormat(outStr);
 }
 
+/// Answer of one host name and query type, positive or negative
+struct DnsCacheEntry
+{
+	roStatus		status;		///< ok, or the failure to be replayed until expired
+	Array<roByte>	addresses;	///< addressSize bytes each, in network byte order
+	roSize			addressSize;	///< 4 for A, 16 for AAAA
+	double			expireTime;	///< In seconds, see _dnsNow()
+	roSize			roundRobin;
+};	// DnsCacheEntry
+
+static double _dnsNow()
+{
+	return ticksToSeconds(ticksSinceProgramStatup());
+}
+
 struct DNSResolver
 {
 	DNSResolver() : isInited(false) {}
@@ -197,14 +226,28 @@ struct DNSResolver
 	roStatus init();
 
 	SockAddr	getDNSAddr();
-	bool		getCachedAddr(const char* host, SockAddr& addr);
-	roStatus	resolve(const roUtf8* hostname, roUint32& ip, float timeout=5.f);
+	void		setServer(const SockAddr& server);
+	void		clearCache();
+
+	/// Give the addresses of the cache, or query the server if it's not cached or expired.
+	/// The addresses are rotated on each call, so that the first one follows a round-robin.
+	roStatus	resolve(const roUtf8* hostname, roUint16 type, Array<roByte>& addresses, float timeout=5.f);
+
+	roStatus	_query(const roUtf8* hostname, roUint16 type, DnsCacheEntry& entry, float timeout);
+	bool		_findCache(const String& key, roStatus& st, Array<roByte>& addresses);
 
 	bool isInited;
 	roUint8 logLevel;
 	RecursiveMutex mutex;
 	TinyArray<SockAddr, 8> addresses;
 
+	/// Settings
+	float negativeTtl = 60;		// Used if the negative answer has no SOA record
+	float maxTtl = 3600 * 24;
+
+	/// Guarded by mutex
+	HashMap<String, DnsCacheEntry> cache;
+
 #if roOS_WIN
 	roStatus _initFunction();
 	roStatus _getDnsServers();
@@ -217,85 +260,19 @@ struct DNSResolver
 	} DNSCACHEENTRY, *PDNSCACHEENTRY;
 	typedef int(WINAPI *DnsGetCacheDataTable)(PDNSCACHEENTRY*);
 	DnsGetCacheDataTable _dnsGetCacheDataTable;
-#endif
-};	// DNSResolver
-
-#if roOS_WIN
-bool DNSResolver::getCachedAddr(const char* host, SockAddr& addr)
-{
-	if(!isInited && !init())
-		return false;
-
-#if 1
-	// NOTE: Seems DNS_QUERY_NO_WIRE_QUERY didn't work correctly, it always fail
-	return false;
-
-	// Reference:
-	// http://venom630.free.fr/geo/autre_chose/cachedns.html
-	// http://stackoverflow.com/questions/7998176/retrieving-whats-in-the-dns-cache
-	PDNSCACHEENTRY entry;
-	if(!_dnsGetCacheDataTable || _dnsGetCacheDataTable(&entry) != TRUE)
-		return false;
-
-	Array<roUint16> wstr;
-	{	roSize len = 0;
-		if(!roUtf8ToUtf16(NULL, len, host, roSize(-1))) return false;
-		if(!wstr.resize(len+1)) return false;
-		if(!roUtf8ToUtf16(wstr.typedPtr(), len, host, roSize(-1))) return false;
-		wstr[len] = 0;
-	}
-
-	for(; entry; entry = entry->pNext) {
-		if(wcsicmp(entry->pszName, wstr.bytePtr()) != 0)
-			continue;
-
-		PDNS_RECORD pDnsRecord = NULL;
-		DNS_STATUS status = DnsQuery_W(
-			entry->pszName,
-			DNS_TYPE_ANY,				// Type of the record to be queried.
-			DNS_QUERY_NO_WIRE_QUERY,	// We want cached value only 
-			NULL,						// Contains DNS server IP address.
-			&pDnsRecord,				// Resource record that contains the response.
-			NULL);						// Reserved for future use.
-
-		if(status != S_OK || !pDnsRecord)
-			return false;
-
-		addr.setIp(ntohl(pDnsRecord->Data.A.IpAddress));
-		DnsRecordListFree(pDnsRecord, DnsFreeRecordListDeep);
-		break;
-	}
 #else
-	// Reference: http://support.microsoft.com/kb/831226
-	PDNS_RECORD pDnsRecord = NULL;
-	DNS_STATUS status = DnsQuery_UTF8(
-		host,
-		DNS_TYPE_A,					// Type of the record to be queried.
-		DNS_QUERY_NO_WIRE_QUERY,	// We want cached value only
-		NULL,						// Contains DNS server IP address.
-		&pDnsRecord,				// Resource record that contains the response.
-		NULL);						// Reserved for future use.
-
-	if(status != 0)
-		return false;
-
-	roUint32 addVal = pDnsRecord->Data.A.IpAddress;
-	addVal = ntohl(addVal);
-	addr.setIp(addVal);
-	String str;
-	addr.asString(str);
-	DnsRecordListFree(pDnsRecord, DnsFreeRecordListDeep);
+	roStatus _getDnsServers();
 #endif
+};	// DNSResolver
 
-	if(logLevel > 0) {
-		String str;
-		addr.asString(str);
-		roLog("info", "DNS cache found for %s, ip:%s\n", host, str.c_str());
-	}
-
-	return true;
-}
+/// Queries in flight on this thread, for coalescing the resolve of the same name.
+/// Waiters are resumed with the status of the query, coroutines cannot be resumed
+/// across threads, therefore each thread sends it's own query at most.
+/// Freed when the last query completes, and by the thread exit for those left behind.
+typedef HashMap<String, Array<Coroutine*> > _DnsInFlight;
+static thread_local _DnsInFlight _dnsInFlight;
 
+#if roOS_WIN
 roStatus DNSResolver::_initFunction()
 {
 	HINSTANCE hLib = ::LoadLibraryA("DNSAPI.dll");
@@ -351,12 +328,35 @@ roStatus DNSResolver::_getDnsServers()
 
 	return roStatus::ok;
 }
+#else
+roStatus DNSResolver::_getDnsServers()
+{
+	FILE* f = fopen("/etc/resolv.conf", "r");
+	if(!f) return roStatus::file_not_found;
+
+	char line[256];
+	char ip[64];
+	while(fgets(line, sizeof(line), f)) {
+		if(sscanf(line, " nameserver %63s", ip) != 1)
+			continue;
+
+		// Only IPv4 is supported by SockAddr
+		in_addr a;
+		if(inet_pton(AF_INET, ip, &a) != 1)
+			continue;
+
+		addresses.pushBack(SockAddr(ntohl(a.s_addr), 53));
+	}
+
+	fclose(f);
+	return roStatus::ok;
+}
 #endif
 
 roStatus DNSResolver::init()
 {
-	logLevel = 1;
-	ScopeRecursiveLock lock(mutex);
+	logLevel = 0;
+	ScopeLock<RecursiveMutex> lock(mutex);
 	addresses.clear();
 
 #if roOS_WIN
@@ -366,6 +366,8 @@ roStatus DNSResolver::init()
 
 	st = _getDnsServers();
 	if(!st) return st;
+#else
+	_getDnsServers();
 #endif
 
 	{	// Use the open DNS servers as last resort
@@ -391,7 +393,7 @@ roStatus DNSResolver::init()
 
 SockAddr DNSResolver::getDNSAddr()
 {
-	ScopeRecursiveLock lock(mutex);
+	ScopeLock<RecursiveMutex> lock(mutex);
 
 	if(!isInited)
 		roVerify(init());
@@ -401,15 +403,114 @@ SockAddr DNSResolver::getDNSAddr()
 	return addresses[index];
 }
 
-roStatus DNSResolver::resolve(const roUtf8* hostname_, roUint32& ip, float timeout)
+void DNSResolver::setServer(const SockAddr& server)
 {
-	String hostname = hostname_;
-	SockAddr addr;
-	if(getCachedAddr(hostname.c_str(), addr))
-		return roStatus::ok;
+	ScopeLock<RecursiveMutex> lock(mutex);
+	if(!isInited)
+		roVerify(init());
+
+	addresses.clear();
+	addresses.pushBack(server);
+}
+
+void DNSResolver::clearCache()
+{
+	ScopeLock<RecursiveMutex> lock(mutex);
+	cache.clear();
+}
+
+bool DNSResolver::_findCache(const String& key, roStatus& st, Array<roByte>& addresses)
+{
+	ScopeLock<RecursiveMutex> lock(mutex);
+
+	DnsCacheEntry* e = cache.find(key);
+	if(!e) return false;
+
+	if(e->expireTime <= _dnsNow()) {
+		cache.remove(key);
+		return false;
+	}
+
+	st = e->status;
+	if(!st) return true;
+
+	// Rotate for round-robin
+	const roSize count = e->addresses.size();
+	const roSize offset = count ? (e->roundRobin++ % (count / e->addressSize)) * e->addressSize : 0;
+	st = addresses.resizeNoInit(count);
+	if(!st) return true;
+	roMemcpy(addresses.typedPtr(), e->addresses.typedPtr() + offset, count - offset);
+	roMemcpy(addresses.typedPtr() + count - offset, e->addresses.typedPtr(), offset);
+	return true;
+}
+
+roStatus DNSResolver::resolve(const roUtf8* hostname, roUint16 type, Array<roByte>& addresses, float timeout)
+{
+	if(!hostname || !*hostname)
+		return roStatus::invalid_parameter;
+
+	// Host names are case insensitive
+	String key = (type == T_AAAA) ? "AAAA " : "A ";
+	roStatus st = key.append(hostname);
+	if(!st) return st;
+	roToLower(key.c_str());
+
+	Coroutine* coroutine = Coroutine::current();
+
+	while(true) {
+		if(_findCache(key, st, addresses))
+			return st;
+
+		// Wait for the same query already sent by another coroutine
+		Array<Coroutine*>* waiters = _dnsInFlight.find(key);
+		if(!waiters || !coroutine)
+			break;
+
+		waiters->pushBack(coroutine);
+		st = (roStatus::Code)(roPtrInt)coroutine->suspend();
+		if(!st) return st;
+
+		// An answer with zero TTL is not cached, then we do our own query
+	}
+
+	_dnsInFlight.insert(key, Array<Coroutine*>());
+
+	DnsCacheEntry entry;
+	entry.addressSize = (type == T_AAAA) ? 16 : 4;
+	entry.roundRobin = 0;
+	st = _query(hostname, type, entry, timeout);
+
+	if(st)
+		addresses = entry.addresses;
+
+	// Positive and negative answers are cached, while timeout and server failure are not
+	if(st || st == roStatus::net_resolve_host_fail) {
+		ScopeLock<RecursiveMutex> lock(mutex);
+		entry.roundRobin = 1;
+		if(entry.expireTime > _dnsNow())
+			cache.insert(key, std::move(entry));
+	}
+
+	// Since resume only put the waiters back to the schedule list, they will read the cache after we return
+	Array<Coroutine*> waiters = std::move(*_dnsInFlight.find(key));
+	_dnsInFlight.remove(key);
+	if(_dnsInFlight.isEmpty())
+		_dnsInFlight = _DnsInFlight();
+	for(roSize i=0; i<waiters.size(); ++i)
+		waiters[i]->resume((void*)st._code);
 
+	return st;
+}
+
+roStatus DNSResolver::_query(const roUtf8* hostname_, roUint16 type, DnsCacheEntry& entry, float timeout)
+{
+	String hostname = hostname_;
 	roStatus st;
 
+	entry.status = roStatus::net_resolve_host_fail;
+	entry.addresses.clear();
+	entry.expireTime = 0;
+
 	CoSocket socket;
 	st = socket.create(BsdSocket::UDP);
 	if(!st) return st;
@@ -438,7 +539,7 @@ roStatus DNSResolver::resolve(const roUtf8* hostname_, roUint32& ip, float timeo
 		if(!st) return st;
 
 		Question question;
-		question.qtype = htons(1);	// We are requesting the ipv4 address
+		question.qtype = htons(type);
 		question.qclass = htons(1);	// Its internet
 
 		sendBuf.resize(sizeof(DnsHeader) + hostname.size() + sizeof(Question));
@@ -475,6 +576,9 @@ roStatus DNSResolver::resolve(const roUtf8* hostname_, roUint32& ip, float timeo
 		if(!st)
 			return st;
 
+		if(recvLen < sendBuf.sizeInByte())
+			continue;
+
 		dnsHeader = buf.castedPtr<DnsHeader>();
 		dnsHeader->id = ntohs(dnsHeader->id);
 		dnsHeader->q_count = ntohs(dnsHeader->q_count);
@@ -482,13 +586,15 @@ roStatus DNSResolver::resolve(const roUtf8* hostname_, roUint32& ip, float timeo
 		dnsHeader->auth_count = ntohs(dnsHeader->auth_count);
 		dnsHeader->add_count = ntohs(dnsHeader->add_count);
 
-		if(dnsHeader->id != randomKey)
+		if(dnsHeader->id != randomKey) {
+			dnsHeader = NULL;
 			continue;
+		}
 
 		break;
 	}
 
-	if(timeout > 0 && timer.isExpired())
+	if(!dnsHeader)
 		return roStatus::timed_out;
 
 	if(dnsHeader->qr != 1)
@@ -498,66 +604,156 @@ roStatus DNSResolver::resolve(const roUtf8* hostname_, roUint32& ip, float timeo
 //	if(dnsHeader->tc)	// If truncated
 //		return roStatus::data_corrupted;
 
-	if(dnsHeader->ans_count == 0)
+	if(dnsHeader->rcode != R_NOERROR && dnsHeader->rcode != R_NXDOMAIN)
 		return roStatus::net_resolve_host_fail;
 
-	Array<ResourceRecord> answers;
-
-	st = answers.resize(dnsHeader->ans_count);
-	if(!st) return st;
-
 	roByte* reader = buf.bytePtr() + sizeof(DnsHeader) + hostname.size() + sizeof(Question);
 	roByte* readerEnd = buf.bytePtr() + recvLen;
 
 	if(logLevel > 0)
 		roLog("info", "Reading DNS response (%u)\n", randomKey);
 
-	// Reading answers
+	// Reading answers and the authority section, the later contains the SOA record for negative caching.
+	// The TTL of the whole answer is the minimum among the records, including CNAME
 	// TODO: Use data stream to simplify the buffer bounds checking
-	for(roSize i=0; i<dnsHeader->ans_count; ++i)
+	roUint32 ttl = TypeOf<roUint32>::valueMax();
+	roUint32 soaTtl = TypeOf<roUint32>::valueMax();
+	const roSize addressSize = (type == T_AAAA) ? 16 : 4;
+	const roSize recordCount = dnsHeader->ans_count + dnsHeader->auth_count;
+	String name;
+
+	for(roSize i=0; i<recordCount; ++i)
 	{
-		st = _readName(answers[i].name, buf.bytePtr(), reader, readerEnd);
+		st = _readName(name, buf.bytePtr(), reader, readerEnd);
 		if(!st) return st;
 
-		answers[i].resource = reinterpret_cast<ResponseData*>(reader);
+		if(reader + sizeof(ResponseData) > readerEnd)
+			return roStatus::index_out_of_range;
+
+		ResponseData rdata;
+		roMemcpy(&rdata, reader, sizeof(ResponseData));
 		reader += sizeof(ResponseData);
 
-		ResponseData& rdata = *answers[i].resource;
 		rdata.type = ntohs(rdata.type);
 		rdata._class = ntohs(rdata._class);
 		rdata.ttl = ntohl(rdata.ttl);
 		rdata.data_len = ntohs(rdata.data_len);
 
-		struct sockaddr_in a;
-
-		switch(rdata.type) {
-		case T_A:	// If its an ipv4 address
-			answers[i].rdata.resize(rdata.data_len);
-			roMemcpy(answers[i].rdata.c_str(), reader, rdata.data_len);
-			reader += rdata.data_len;
-
-			a.sin_addr.s_addr = *(roUint32*)answers[i].rdata.c_str();	// Working without ntohl
+		if(reader + rdata.data_len > readerEnd)
+			return roStatus::index_out_of_range;
 
-			if(logLevel > 0)
-				roLog("\t", "%s %s\n", answers[i].name.c_str(), inet_ntoa(a.sin_addr));
+		const bool isAnswer = i < dnsHeader->ans_count;
 
-			break;
-		case T_MX:
-		default:
-			st = _readName(answers[i].rdata, buf.bytePtr(), reader, readerEnd);
+		if(isAnswer && rdata.type == type && rdata.data_len == addressSize) {
+			st = entry.addresses.insert(entry.addresses.size(), reader, reader + addressSize);
 			if(!st) return st;
-			break;
+			ttl = roMinOf2(ttl, rdata.ttl);
+
+			if(logLevel > 0 && type == T_A) {
+				struct in_addr a;
+				roMemcpy(&a.s_addr, reader, 4);
+				roLog("\t", "%s %s\n", name.c_str(), inet_ntoa(a));
+			}
+		}
+		else if(isAnswer)
+			ttl = roMinOf2(ttl, rdata.ttl);
+		else if(rdata.type == T_SOA && rdata.data_len >= 20) {
+			// Negative TTL is the minimum of the SOA TTL and it's MINIMUM field, which is the last of the rdata
+			roUint32 minimum;
+			roMemcpy(&minimum, reader + rdata.data_len - 4, 4);
+			soaTtl = roMinOf2(rdata.ttl, ntohl(minimum));
 		}
+
+		reader += rdata.data_len;
 	}
 
+	if(entry.addresses.isEmpty()) {
+		float negative = soaTtl != TypeOf<roUint32>::valueMax() ? float(soaTtl) : negativeTtl;
+		entry.expireTime = _dnsNow() + roMinOf2(negative, maxTtl);
+		return roStatus::net_resolve_host_fail;
+	}
+
+	entry.status = roStatus::ok;
+	entry.expireTime = _dnsNow() + roMinOf2(float(ttl), maxTtl);
 	return roStatus::ok;
 }
 
 static DNSResolver _dnsResolver;
 
-}	// namespace
+roStatus dnsResolveAll(const roUtf8* hostname, Array<roUint32>& ipv4, Array<DnsIpv6>& ipv6, float timeout)
+{
+	ipv4.clear();
+	ipv6.clear();
+
+	// Query AAAA in parallel
+	roStatus st6 = roStatus::undefined;
+	Array<roByte> bytes6;
+	bool done6 = false;
+	roStatus st = coRun([&]() {
+		st6 = _dnsResolver.resolve(hostname, T_AAAA, bytes6, timeout);
+		done6 = true;
+	}, "dnsResolveAll AAAA", roKB(16));
+	if(!st) return st;
+
+	Array<roByte> bytes4;
+	roStatus st4 = _dnsResolver.resolve(hostname, T_A, bytes4, timeout);
+
+	while(!done6)
+		coYield();
+
+	for(roSize i=0; i+4<=bytes4.size(); i+=4) {
+		roUint32 ip;
+		roMemcpy(&ip, &bytes4[i], 4);
+		ipv4.pushBack(ntohl(ip));
+	}
+
+	for(roSize i=0; i+16<=bytes6.size(); i+=16) {
+		DnsIpv6 ip;
+		roMemcpy(ip.bytes, &bytes6[i], 16);
+		ipv6.pushBack(ip);
+	}
+
+	if(st4 || st6)
+		return roStatus::ok;
+	return st4;
+}
+
+void dnsSetServer(const SockAddr& server)
+{
+	_dnsResolver.setServer(server);
+}
+
+void dnsClearCache()
+{
+	_dnsResolver.clearCache();
+}
+
+}	// namespace ro
 
 roStatus roGetHostByName(const roUtf8* hostname, roUint32& ip, float timeout)
 {
-	return ro::_dnsResolver.resolve(hostname, ip, timeout);
+	ip = 0;
+	if(!hostname)
+		return roStatus::pointer_is_null;
+
+	// Numeric address and localhost need no query
+	in_addr a;
+	if(inet_pton(AF_INET, hostname, &a) == 1) {
+		ip = ntohl(a.s_addr);
+		return roStatus::ok;
+	}
+	if(roStrCaseCmp(hostname, "localhost") == 0) {
+		ip = ro::SockAddr::ipLoopBack();
+		return roStatus::ok;
+	}
+
+	ro::Array<roByte> addresses;
+	roStatus st = ro::_dnsResolver.resolve(hostname, ro::T_A, addresses, timeout);
+	if(!st) return st;
+	if(addresses.size() < 4)
+		return roStatus::net_resolve_host_fail;
+
+	roMemcpy(&ip, addresses.typedPtr(), 4);
+	ip = ntohl(ip);
+	return roStatus::ok;
 }
@@ -1,8 +1,40 @@
 #ifndef __network_roDnsResolve_h__
 #define __network_roDnsResolve_h__
 
+#include "../base/roArray.h"
 #include "../base/roStatus.h"
+#include "../platform/roOS.h"
 
+/// Resolve the IPv4 address of hostname, in host byte order.
+/// The answers are cached according to their TTL, failures are cached too (negative caching),
+/// and concurrent resolve of the same name on the same thread share one query.
+/// If the host has multiple addresses, successive calls return them in round-robin order.
 roStatus roGetHostByName(const roUtf8* hostname, roUint32& ipv4, float timeout=5.f);
 
+// Windows uses the system resolver, which has it's own cache
+#if !roOS_WIN
+
+namespace ro {
+
+struct SockAddr;
+
+/// IPv6 address in network byte order
+struct DnsIpv6
+{
+	roUint8 bytes[16];
+};	// DnsIpv6
+
+/// Resolve all the IPv4 (A) and IPv6 (AAAA) addresses of hostname, the two queries are sent in parallel.
+/// Same as roGetHostByName(), the answers are cached and rotated for round-robin.
+roStatus	dnsResolveAll	(const roUtf8* hostname, Array<roUint32>& ipv4, Array<DnsIpv6>& ipv6, float timeout=5.f);
+
+/// Send the queries to this server instead of the system ones, for instance a local stand-in in test
+void		dnsSetServer	(const SockAddr& server);
+
+void		dnsClearCache	();
+
+}	// namespace ro
+
+#endif
+
 #endif	// __network_roDnsResolve_h__
@@ -2,10 +2,16 @@
 #define __network_roHttp_h__
 
 #include "roSocket.h"
+#include "../base/roArray.h"
+#include "../base/roAtomic.h"
 #include "../base/roLinkList.h"
+#include "../base/roHashMap.h"
 #include "../base/roMap.h"
 #include "../base/roMemory.h"
+#include "../base/roMutex.h"
+#include "../base/roSharedPtr.h"
 #include "../base/roString.h"
+#include "../base/roTaskPool.h"
 #include <functional>
 
 namespace ro {
@@ -98,8 +104,10 @@ struct HttpResponseHeader
 		Continue,					// 100 - Everything so far is OK, client should continue the request
 		SwitchingProtocol,			// 101 - Response to an Upgrade
 		OK,							// 200 - The request has succeeded
+		PartialContent,				// 206 - Part of the resource, as requested by the Range header
 		NotModified,				// 304 - Not modified
 		NotFound,					// 404 - The server can not find requested resource
+		RangeNotSatisfiable,		// 416 - The Range header is outside the size of the resource
 		InternalServerError,		// 500 - The server has encountered a situation it doesn't know how to handle
 	};
 
@@ -148,6 +156,7 @@ struct HttpResponseHeader
 	Status		addField		(const char* field, const char* value);
 	Status		addField		(HeaderField field, const char* value);
 	Status		addField		(HeaderField field, roUint64 value);
+	Status		addField		(HeaderField field, roUint64 value1, roUint64 value2, roUint64 value3);
 
 	/// Parse and get information from responseString
 	bool		getField		(const char* option, String& value) const;
@@ -174,15 +183,67 @@ struct HttpOptions
 
 struct IStream;
 
-struct HttpConnection : public MapNode<SockAddr, HttpConnection>
+struct Coroutine;
+struct HttpConnectionHost;
+
+/// A keep-alive connection of HttpClient, owned by HttpConnections
+struct HttpConnection : public ListNode<HttpConnection>
 {
-	CoSocket socket;
+	HttpConnection();
+
+	CoSocket	socket;
+	SockAddr	address;
+	String		pending;		///< Bytes received after the last response, the beginning of the next one when pipelining
+	double		idleSince;		///< Time in seconds when it was returned to the pool
+	roSize		requestCount;	///< Number of responses read from this connection
+	bool		secure;			///< Https handshake done
+	bool		reusable;		///< Set to false and checkin() will close it
+
+// Private
+	HttpConnectionHost* _host;
 };	// HttpConnection
 
+struct HttpConnectionHost : public MapNode<SockAddr, HttpConnectionHost>
+{
+	LinkList<HttpConnection> idle;	///< Least recently used at the front
+	Array<Coroutine*> waiters;		///< Waiting in checkout() for a connection to be returned
+	roSize	activeCount = 0;		///< Checked out, including those still connecting
+	bool	pipelining = false;		///< The server answered HTTP/1.1 without closing the connection
+};	// HttpConnectionHost
+
+/// Pool of keep-alive connections of HttpClient, grouped by server address.
+/// A connection serves one coroutine at a time, checkout() takes the most recently used idle one,
+/// or connects a new one, and checkin() returns it. When maxConnectionsPerHost connections are
+/// all checked out, checkout() suspends the calling coroutine until one is returned.
+/// An idle connection is closed after idleTimeout, and is checked not being closed by the server before reuse.
+/// @note Not thread safe, use one pool per thread.
 struct HttpConnections
 {
-	roStatus getConnection(const SockAddr& address, HttpConnection*& outConnection);
-	Map<HttpConnection> connections;
+	HttpConnections();
+	~HttpConnections();
+
+// Operations
+	roStatus	checkout		(const SockAddr& address, HttpConnection*& outConnection);
+	void		checkin			(HttpConnection* connection);
+
+	void		evictIdle		();	///< Close the idle connections timed out, called by checkin() already
+	void		clear			();	///< Close all idle connections
+
+// Attributes
+	roSize		idleCount		() const;
+	roSize		activeCount		() const;
+
+	roSize		maxConnectionsPerHost;	///< Default 6, as most browsers do
+	roSize		maxPipelineDepth;		///< Max number of requests sent before reading the responses, 1 to disable pipelining
+	float		idleTimeout;			///< In seconds, shorter than the server's keep-alive timeout to avoid reusing a closing connection
+	float		connectTimeout;			///< In seconds
+
+	roSize		connectCount;			///< Statistics of new connections made
+	roSize		reuseCount;				///< Statistics of idle connections reused
+
+// Private
+	void		_wakeWaiter		(HttpConnectionHost& host);
+	Map<HttpConnectionHost> _hosts;
 };	// HttpConnections
 
 struct HttpClient
@@ -193,6 +254,13 @@ struct HttpClient
 	typedef	roStatus	(*ReplyFunc)(const HttpResponseHeader& response, IStream& body, void* userPtr);
 			roStatus	request		(const HttpRequestHeader& header, ReplyFunc replyFunc, void* userPtr=NULL, HttpConnections* connectionPool=NULL);
 
+	/// Perform a batch of idempotent requests (GET / HEAD), replyFunc is invoked with userPtrs[i] (userPtrs can be NULL)
+	/// in the same order, except the redirected requests which are followed after all the others.
+	/// When the server is known to keep the connection alive, up to connectionPool.maxPipelineDepth requests
+	/// to the same host are sent together before reading their responses, saving a round trip per request.
+	/// Requests not answered before the server closed the connection are sent again through a new one.
+			roStatus	requestPipelined(const HttpRequestHeader* headers, roSize count, ReplyFunc replyFunc, void* const* userPtrs, HttpConnections& connectionPool);
+
 	roUint8	logLevel;	// 0 for no logging, larger for more
 	bool	useHttpCompression;
 	String	proxy;
@@ -210,29 +278,66 @@ struct HttpServer
 		Connection();
 
 		roStatus	response(HttpResponseHeader& header);
+
+		/// The header is taken (header.string become empty) by os, and sent
+		/// together with the first write, or when the request finished.
 		roStatus	response(HttpResponseHeader& header, OStream*& os);
 		roStatus	response(HttpResponseHeader& header, OStream*& os, roSize contentSize);
 
+		/// Response with part of a file opened by rawFileSystemOpenFile(), the content
+		/// is sent by CoSocket::sendFile(), without passing through user space.
+		roStatus	responseFile(HttpResponseHeader& header, void* rawFile, roUint64 offset, roUint64 size);
+
+		/// Response with a body known in advance, compressed in one go if the client accept gzip.
+		/// With a non empty etag, the ETag field is added, and the compressed body is kept by the server
+		/// (up to gzipCacheMaxSize), so that later responses of the same etag skip the compression.
+		/// The compressed response carries the etag with a "-gz" suffix, and Vary: Accept-Encoding
+		/// is added whenever gzip is enabled.
+		roStatus	responseBody(HttpResponseHeader& header, const void* body, roSize size, const char* etag=NULL);
+
 		roStatus	_processHeader(HttpRequestHeader& header);
+		roStatus	_sendWithBody(HttpResponseHeader& header, const void* body, roSize size);
 
 		HttpVersion httpVersion;
 		bool		keepAlive = false;
 		bool		supportGZip = false;
 		bool		supportChunkEncoding = false;
 
+		HttpServer*	server = NULL;
 		CoSocket	socket;
 		AutoPtr<OStream> oStream;
+		String		_received;	///< Received after the last request header, the next requests if the client is pipelining
 	};	// HttpServer::Connection
 
 	Status	init();
 
 	typedef std::function<roStatus(Connection& connection, HttpRequestHeader& request)> OnRequest;
+
+	/// Accept and serve one connection on the socket listened by init(),
+	/// call it in a loop from as many coroutines as the concurrency you want.
 	roStatus	start();
 
+	/// Serve on threadCount threads, init() is not needed. Each thread runs it's own
+	/// CoroutineScheduler, with backlog coroutines accepting on it's own listening socket,
+	/// the kernel then balance the connections among them (SO_REUSEPORT).
+	/// A connection never leave the thread accepted it, so the callbacks of the same
+	/// connection are always invoked on the same thread, but different connections
+	/// may invoke them concurrently.
+	/// Return after all threads are listening, or fail if any of them cannot listen.
+	roStatus	startThreads();
+	void		stopThreads();	///< Close all listening socket and connection, then join the threads
+
 	/// Settings
 	roUint16 port = 80;
 	unsigned backlog = 256;	// The backlog pass to CoSocket::listen
+	unsigned threadCount = 1;	// For startThreads(), more than 1 requires SO_REUSEPORT support
 	float keepAliveTimeout = 15;
+	int gzipLevel = 6;	// zlib level of gzip responses, 1 (fastest) to 9 (smallest), 0 to never compress
+	roSize gzipCacheMaxSize = 16 * 1024 * 1024;	// Total size of compressed bodies kept by etag, see Connection::responseBody()
+
+	/// Statistics
+	AtomicInteger gzipCacheHitCount;
+	AtomicInteger gzipCacheMissCount;
 
 	/// Callbacks
 	OnRequest onRequest;
@@ -273,7 +378,28 @@ struct HttpServer
 	LinkList<Connection> pooledConnections;
 
 // Private
+	roStatus	_listen(CoSocket& socket, bool reusePort);
+	roStatus	_serve(CoSocket& listenSocket, LinkList<Connection>& connections);
+	void		_runThread();
+
+	struct GZipBody : public SharedObject<AtomicInteger>, public ListNode<GZipBody>
+	{
+		String etag;
+		ByteArray data;
+	};	// GZipBody
+
+	SharedPtr<GZipBody> _gzipBody(const void* body, roSize size, const char* etag);
+
 	CoSocket	_socketListen;
+	TaskPool	_threads;
+	AtomicInteger _threadStartedCount;
+	AtomicInteger _threadFailedCount;
+	volatile bool _threadKeepRun = false;
+
+	Mutex _gzipCacheMutex;
+	LinkList<GZipBody> _gzipCacheLru;				///< Least recently used at the front, the bodies are owned by _gzipCache
+	HashMap<String, SharedPtr<GZipBody> > _gzipCache;
+	roSize _gzipCacheSize = 0;
 };	// HttpServer
 
 }	// namespace ro
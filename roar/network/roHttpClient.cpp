@@ -1,10 +1,12 @@
 #include "pch.h"
 #include "roHttp.h"
 #include "roSecureSocket.h"
+#include "../base/roCoRoutine.h"
 #include "../base/roCompressedStream.h"
 #include "../base/roIOStream.h"
 #include "../base/roLog.h"
 #include "../base/roRegex.h"
+#include "../base/roStopWatch.h"
 #include "../base/roStringFormat.h"
 #include "../base/roTypeCast.h"
 
@@ -26,30 +28,193 @@ namespace ro {
 
 static DefaultAllocator _allocator;
 
+static double _timeNow()
+{
+	return ticksToSeconds(ticksSinceProgramStatup());
+}
+
 //////////////////////////////////////////////////////////////////////////
 // HttpClient connection pool
 
-roStatus HttpConnections::getConnection(const SockAddr& address, HttpConnection*& outConnection)
+HttpConnection::HttpConnection()
 {
-	outConnection = connections.find(address);
-	if(outConnection)
-		return roStatus::ok;
+	idleSince = 0;
+	requestCount = 0;
+	secure = false;
+	reusable = true;
+	_host = NULL;
+}
+
+HttpConnections::HttpConnections()
+{
+	maxConnectionsPerHost = 6;
+	maxPipelineDepth = 8;
+	idleTimeout = 30;
+	connectTimeout = 10;
+	connectCount = 0;
+	reuseCount = 0;
+}
 
-	AutoPtr<HttpConnection> newConn(_allocator.newObj<HttpConnection>());
-	newConn->setKey(address);
-	connections.insert(*newConn);
-	newConn->socket.create(BsdSocket::TCP);
+HttpConnections::~HttpConnections()
+{
+	clear();
+	roAssert(_hosts.size() == 0 && "Some connections are still checked out");
+}
+
+// An idle keep-alive connection becomes readable only when the server closed it (or sent
+// something unexpected), either way it cannot serve another request.
+static bool _isIdleConnectionAlive(HttpConnection& connection)
+{
+	if(!connection.pending.isEmpty())
+		return false;
+
+	bool checkRead = true, checkWrite = false, checkError = true;
+	if(connection.socket.select(checkRead, checkWrite, checkError) != 0)
+		return false;
+
+	return !checkRead && !checkError;
+}
+
+roStatus HttpConnections::checkout(const SockAddr& address, HttpConnection*& outConnection)
+{
+	outConnection = NULL;
+	HttpConnectionHost* host = NULL;
+
+	while(true) {
+		// Find it again after waiting, the host may have been evicted
+		host = _hosts.find(address);
+		if(!host) {
+			AutoPtr<HttpConnectionHost> newHost(_allocator.newObj<HttpConnectionHost>());
+			if(!newHost.ptr()) return roStatus::not_enough_memory;
+			newHost->setKey(address);
+			_hosts.insert(*newHost);
+			host = newHost.unref();
+		}
+
+		// Take the most recently used one, the older ones are more likely closed by the server
+		const double now = _timeNow();
+		while(!host->idle.isEmpty()) {
+			HttpConnection* connection = &host->idle.back();
+			connection->removeThis();
+
+			if(now - connection->idleSince < idleTimeout && _isIdleConnectionAlive(*connection)) {
+				++host->activeCount;
+				++reuseCount;
+				outConnection = connection;
+				return roStatus::ok;
+			}
+
+			_allocator.deleteObj(connection);
+		}
+
+		if(host->activeCount < maxConnectionsPerHost)
+			break;
+
+		// Wait for checkin()
+		Coroutine* coroutine = Coroutine::current();
+		if(!coroutine || !host->waiters.pushBack(coroutine))
+			return roStatus::not_enough_memory;
+		coroutine->suspend();
+	}
+
+	AutoPtr<HttpConnection> connection(_allocator.newObj<HttpConnection>());
+	if(!connection.ptr()) return roStatus::not_enough_memory;
+	connection->address = address;
+	connection->_host = host;
+
+	// Count it before connect(), which suspend
+	++host->activeCount;
+
+	roStatus st = connection->socket.create(BsdSocket::TCP);
+	if(st)
+		st = connection->socket.connect(address, connectTimeout);
 
-	roStatus st = newConn->socket.connect(address);
 	if(!st) {
-		outConnection = NULL;
+		--host->activeCount;
+		_wakeWaiter(*host);
 		return st;
 	}
 
-	outConnection = newConn.unref();
+	++connectCount;
+	outConnection = connection.unref();
 	return roStatus::ok;
 }
 
+void HttpConnections::checkin(HttpConnection* connection)
+{
+	if(!connection)
+		return;
+
+	HttpConnectionHost* host = connection->_host;
+	roAssert(host && host->getMap() == &_hosts);
+	roAssert(host->activeCount > 0);
+	--host->activeCount;
+
+	if(connection->reusable && connection->pending.isEmpty() && idleTimeout > 0) {
+		connection->idleSince = _timeNow();
+		host->idle.pushBack(*connection);
+	}
+	else
+		_allocator.deleteObj(connection);
+
+	_wakeWaiter(*host);
+	evictIdle();
+}
+
+void HttpConnections::evictIdle()
+{
+	const double now = _timeNow();
+
+	for(HttpConnectionHost* host = _hosts.findMin(); host; ) {
+		while(!host->idle.isEmpty() && now - host->idle.front().idleSince >= idleTimeout)
+			_allocator.deleteObj(&host->idle.front());
+
+		HttpConnectionHost* next = host->next();
+		if(host->idle.isEmpty() && host->activeCount == 0 && host->waiters.isEmpty())
+			_allocator.deleteObj(host);
+		host = next;
+	}
+}
+
+void HttpConnections::clear()
+{
+	for(HttpConnectionHost* host = _hosts.findMin(); host; ) {
+		while(!host->idle.isEmpty())
+			_allocator.deleteObj(&host->idle.front());
+
+		HttpConnectionHost* next = host->next();
+		if(host->activeCount == 0 && host->waiters.isEmpty())
+			_allocator.deleteObj(host);
+		host = next;
+	}
+}
+
+roSize HttpConnections::idleCount() const
+{
+	roSize count = 0;
+	for(const HttpConnectionHost* host = const_cast<Map<HttpConnectionHost>&>(_hosts).findMin(); host; host = host->next())
+		count += host->idle.size();
+	return count;
+}
+
+roSize HttpConnections::activeCount() const
+{
+	roSize count = 0;
+	for(const HttpConnectionHost* host = const_cast<Map<HttpConnectionHost>&>(_hosts).findMin(); host; host = host->next())
+		count += host->activeCount;
+	return count;
+}
+
+void HttpConnections::_wakeWaiter(HttpConnectionHost& host)
+{
+	if(host.waiters.isEmpty())
+		return;
+
+	Coroutine* coroutine = host.waiters.front();
+	host.waiters.removeAt(0);
+	coroutine->resume();
+}
+
 
 //////////////////////////////////////////////////////////////////////////
 // HttpClient
@@ -60,15 +225,21 @@ HttpClient::HttpClient()
 	useHttpCompression = true;
 }
 
-static AutoPtr<IStream> _getStream(const HttpResponseHeader& response, const RangedString& preSocketBuf, CoSocket& socket)
+// rawStream points to the stream reading the socket, before any decompression
+static AutoPtr<IStream> _getStream(const HttpResponseHeader& response, const RangedString& preSocketBuf, CoSocket& socket, bool noBody, IStream*& rawStream)
 {
 	AutoPtr<IStream> istream;
 
 	roUint64 contentLength = 0;
-	RangedString transferEncoding, tillCloseConnection;
+	RangedString transferEncoding;
 
 	// Determine the encoding
-	if(response.getField(HttpResponseHeader::HeaderField::ContentLength, contentLength)) {
+	if(noBody) {
+		// Create a null stream, stays at the beginning of the pre-socket buffer
+		AutoPtr<MemoryIStream> s = _allocator.newObj<MemoryIStream>((roByte*)preSocketBuf.begin, 0);
+		istream = std::move(s);
+	}
+	else if(response.getField(HttpResponseHeader::HeaderField::ContentLength, contentLength)) {
 		AutoPtr<HttpClientSizedIStream> s = _allocator.newObj<HttpClientSizedIStream>(socket, clamp_cast<roSize>(contentLength));
 		s->begin = (roByte*)preSocketBuf.begin;
 		s->end = (roByte*)preSocketBuf.end;
@@ -85,22 +256,20 @@ static AutoPtr<IStream> _getStream(const HttpResponseHeader& response, const Ran
 		s->current = s->begin;
 		istream = std::move(s);
 	}
-	else if(response.cmpFieldNoCase(HttpResponseHeader::HeaderField::Connection, "close")) {
+	else {
+		// Without the length, the content ends when the server close the connection
 		AutoPtr<HttpClientReadTillEndIStream> s = _allocator.newObj<HttpClientReadTillEndIStream>(socket);
 		s->begin = (roByte*)preSocketBuf.begin;
 		s->end = (roByte*)preSocketBuf.end;
 		s->current = s->begin;
 		istream = std::move(s);
 	}
-	else {
-		// Create a null stream
-		AutoPtr<MemoryIStream> s = _allocator.newObj<MemoryIStream>();
-		istream = std::move(s);
-	}
+
+	rawStream = istream.ptr();
 
 	// Any compression?
 	RangedString contentEncoding;
-	if(response.getField(HttpResponseHeader::HeaderField::ContentEncoding, contentEncoding)) {
+	if(!noBody && response.getField(HttpResponseHeader::HeaderField::ContentEncoding, contentEncoding)) {
 		if(contentEncoding.cmpNoCase("gzip") == 0) {
 			AutoPtr<GZipIStream> s = _allocator.newObj<GZipIStream>();
 			s->init(std::move(istream));
@@ -112,63 +281,54 @@ static AutoPtr<IStream> _getStream(const HttpResponseHeader& response, const Ran
 	return istream;
 }
 
-static roStatus _skipStreamData(const HttpResponseHeader& response, IStream& istream)
+static roStatus _skipStreamData(IStream& istream)
 {
-	roStatus st = roStatus::ok;
+	roStatus st;
 
-	if(response.cmpFieldNoCase(HttpResponseHeader::HeaderField::Connection, "keep-alive")) {
-		// Read all the remaining data
-		roByte buf[128];
-		roUint64 read = 0;
-		do {
-			st = istream.read(buf, sizeof(buf), read);
-		} while(st);
+	// Read all the remaining data
+	roByte buf[1024];
+	roUint64 read = 0;
+	do {
+		st = istream.read(buf, sizeof(buf), read);
+	} while(st);
 
-		if(st == roStatus::end_of_data)
-			st = roStatus::ok;
-	}
+	if(st == roStatus::end_of_data)
+		st = roStatus::ok;
 
 	return st;
 }
 
-roStatus HttpClient::request(const HttpRequestHeader& orgHeader, ReplyFunc replyFunc, void* userPtr, HttpConnections* connectionPool)
+// Whether the server keeps the connection open after this response, which is the default of HTTP/1.1
+static bool _isKeepAlive(const HttpResponseHeader& response)
 {
-	roStatus st;
-	HttpRequestHeader header = orgHeader;
+	if(response.cmpFieldNoCase(HttpResponseHeader::HeaderField::Connection, "close"))
+		return false;
+	if(response.cmpFieldNoCase(HttpResponseHeader::HeaderField::Connection, "keep-alive"))
+		return true;
 
-	HttpConnection* connection = NULL;
-	HttpConnections dummyPool;
-
-roEXCP_TRY
-	if(!replyFunc)
-		return roStatus::pointer_is_null;
-
-	String protocol, host, resourcePath;
+	RangedString version;
+	return response.getField(HttpResponseHeader::HeaderField::Version, version) && version == "1.1";
+}
 
-// Loop for location redirection
-const roSize maxRedirect = 10;
-roSize redirectCount = 0;
-while(true) {
-	String responseStr;
-	roSize contentStartPos = 0;
-	bool hasValidFullPath = false;
+// Fill in the default fields, and find out the address to connect
+static roStatus _prepareRequest(const HttpClient& client, HttpRequestHeader& header, String& protocol, SockAddr& addr)
+{
+	roStatus st = roStatus::ok;
+	String host, resourcePath;
 
 	// Prepare request string
 	{
 		RangedString acceptEncoding;
-		if(useHttpCompression && !header.getField(HttpRequestHeader::HeaderField::AcceptEncoding, acceptEncoding))
+		if(client.useHttpCompression && !header.getField(HttpRequestHeader::HeaderField::AcceptEncoding, acceptEncoding))
 			header.addField(HttpRequestHeader::HeaderField::AcceptEncoding, "gzip");
 
-		if(!header.getField(HttpRequestHeader::HeaderField::Host, host)) {
-			st = roStatus::http_bad_header;
-			roEXCP_THROW;
-		}
+		if(!header.getField(HttpRequestHeader::HeaderField::Host, host))
+			return roStatus::http_bad_header;
 
-		if(!header.getField(HttpRequestHeader::HeaderField::Resource, resourcePath)) {
-			st = roStatus::http_bad_header;
-			roEXCP_THROW;
-		}
+		if(!header.getField(HttpRequestHeader::HeaderField::Resource, resourcePath))
+			return roStatus::http_bad_header;
 
+		bool hasValidFullPath = false;
 		{	RangedString protocol_, host_, path_;
 			hasValidFullPath = splitUrl(RangedString(resourcePath), protocol_, host_, path_);
 
@@ -181,23 +341,22 @@ while(true) {
 		}
 
 		// Make sure the resource path is a full path, when we were using proxy
-		if(!proxy.isEmpty()) {
+		if(!client.proxy.isEmpty()) {
 			if(!hasValidFullPath) {
 				String tmp;
 				st = strFormat(tmp, "{}://{}{}", protocol, host, resourcePath);
-				if(!st) roEXCP_THROW;
+				if(!st) return st;
 				roSwap(tmp, resourcePath);
 			}
 		}
 	}
 
 	// Parse address string
-	SockAddr addr;
 	String serverToConnect = host;
 	{	bool parseOk = false;
 
-		if(!proxy.isEmpty())
-			serverToConnect = proxy;
+		if(!client.proxy.isEmpty())
+			serverToConnect = client.proxy;
 
 		if(serverToConnect.find(':') != String::npos)
 			parseOk = addr.parse(serverToConnect.c_str());
@@ -206,201 +365,405 @@ while(true) {
 
 		if(!parseOk) {
 			roLog("error", "Fail to resolve server %s\n", serverToConnect.c_str());
-			st =  Status::net_resolve_host_fail;
-			roEXCP_THROW;
+			return Status::net_resolve_host_fail;
 		}
 	}
 
-	{	// Look for existing connection suitable for this request
-		if(!connectionPool)
-			connectionPool = &dummyPool;
+	if(client.logLevel > 0)
+		roLog("info", "HttpClient - Connecting to %s\n", serverToConnect.c_str());
 
-		if(logLevel > 0)
-			roLog("info", "HttpClient - Connecting to %s\n", serverToConnect.c_str());
+	return st;
+}
 
-		st = connectionPool->getConnection(addr, connection);
-		if(!st) roEXCP_THROW;
+static roStatus _secureConnection(const HttpClient& client, HttpConnection& connection, const HttpRequestHeader& header)
+{
+	if(connection.secure)
+		return roStatus::ok;
 
-		roAssert(connection);
-		connection->removeThis();
-	}
+	roStatus st;
 
-	// Handling with https
-	if(roStrCaseCmp(protocol.c_str(), "https") == 0)
-	{
-		// Send https connect request to proxy
-		if(!proxy.isEmpty()) {
-			String requestStr;
-			st = strFormat(requestStr, "CONNECT {} HTTP/1.1\r\nHost: {}\r\n\r\n", host, host);
-			if(!st) roEXCP_THROW;
-
-			roSize len = requestStr.size();
-			st = connection->socket.send(requestStr.c_str(), len);
-			if(!st) roEXCP_THROW;
-		}
+	// Send https connect request to proxy
+	if(!client.proxy.isEmpty()) {
+		String host, requestStr;
+		header.getField(HttpRequestHeader::HeaderField::Host, host);
+		st = strFormat(requestStr, "CONNECT {} HTTP/1.1\r\nHost: {}\r\n\r\n", host, host);
+		if(!st) return st;
 
-		st = secureSocketHandshake(connection->socket);
-		if(!st) roEXCP_THROW;
+		st = connection.socket.send(requestStr.c_str(), requestStr.size());
+		if(!st) return st;
 	}
 
-	// Send request string
-	{	String requestStr = header.string;
+	st = secureSocketHandshake(connection.socket);
+	if(!st) return st;
 
-		requestStr += "\r\n";
-		roSize len = requestStr.size();
+	connection.secure = true;
+	return st;
+}
 
-		if(logLevel > 1)
-			roLog("info", "HttpClient - Sending request string:\n%s", requestStr.c_str());
-		else if(logLevel > 0)
-			roLog("info", "HttpClient - Sending request string\n");
+// Read the response header, the bytes following it are left in responseStr, starting from contentStartPos
+static roStatus _readResponseHeader(HttpConnection& connection, String& responseStr, roSize& contentStartPos, HttpResponseHeader& response)
+{
+	static const char headerTerminator[] = "\r\n\r\n";
+	static const roSize maxHeaderSize = 8 * 1024;
+	const roSize terminatorSize = sizeof(headerTerminator) - 1;
+	const roSize stepSize = 512;
+	roSize searchIdx = 0;
+
+	// Continue with what was received together with the previous response
+	roSwap(responseStr, connection.pending);
+	connection.pending.clear();
+
+	while(true) {
+		roSize pos = responseStr.find(headerTerminator, searchIdx);
+		if(pos != responseStr.npos) {
+			// Header terminator found
+			response.string.assign(responseStr.c_str(), pos);
+			contentStartPos = pos + terminatorSize;
+			return roStatus::ok;
+		}
 
-		st = connection->socket.send(requestStr.c_str(), len);
-		if(!st) roEXCP_THROW;
-	}
+		if(responseStr.size() > maxHeaderSize)
+			return roStatus::http_bad_header;
 
-	// Read response
-	HttpResponseHeader response;
-	static const roSize maxResponseSize = 8 * 1024;
-	{	static const char headerTerminator[] = "\r\n\r\n";
-		roSize terminatorSize = sizeof(headerTerminator) - 1;
-		roSize stepSize = 64;
-		roSize searchIdx = 0;
-		responseStr.reserve(stepSize);
+		searchIdx = responseStr.size() < terminatorSize ? 0 : responseStr.size() - terminatorSize;
 
-		if(logLevel > 0)
-			roLog("info", "HttpClient - Reading response\n");
+		roStatus st = responseStr.reserve(responseStr.size() + stepSize);
+		if(!st) return st;
 
-		while(true) {
-			roSize len = responseStr._capacity() - responseStr.size();
-			if((responseStr.size() + len) > maxResponseSize) {
-				st = roStatus::http_bad_header;
-				roEXCP_THROW;
-			}
+		roSize len = stepSize;
+		st = connection.socket.receive(responseStr.c_str() + responseStr.size(), len);
+		if(!st) return st;
 
-			st = connection->socket.receive(responseStr.c_str() + responseStr.size(), len);
-			if(!st) roEXCP_THROW;
+		if(len == 0)
+			return roStatus::net_connection_close;
 
-			if(len == 0) {
-				st = roStatus::net_connection_close;
-				roEXCP_THROW;
-			}
+		st = responseStr.incSize(len);
+		if(!st) return st;
+	}
+}
+
+// Read one response and pass it to replyFunc, or give the location to redirect.
+// responded tells whether any byte of the response is received, if not, the request can be
+// sent again through another connection.
+static roStatus _readResponse(const HttpClient& client, HttpConnection& connection, bool isHeadRequest, HttpClient::ReplyFunc replyFunc, void* userPtr, String& redirectLocation, bool& responded)
+{
+	roStatus st;
+	String responseStr;
+	roSize contentStartPos = 0;
+	HttpResponseHeader response;
 
-			st = responseStr.incSize(len);
-			if(!st) roEXCP_THROW;
+	responded = !connection.pending.isEmpty();
+	redirectLocation.clear();
 
-			roSize pos = responseStr.find(headerTerminator, searchIdx);
-			if(pos == responseStr.npos) {
-				searchIdx = responseStr.size();
-				responseStr.reserve(responseStr.size() + stepSize);
-				searchIdx = searchIdx < terminatorSize ? 0 : searchIdx - terminatorSize;
-			}
-			else {
-				// Header terminator found
-				response.string.assign(responseStr.c_str(), pos);
-				contentStartPos = pos + terminatorSize;
-				break;
-			}
-		}
-	}
+	if(client.logLevel > 0)
+		roLog("info", "HttpClient - Reading response\n");
 
-	if(logLevel > 1)
+	st = _readResponseHeader(connection, responseStr, contentStartPos, response);
+	responded |= !responseStr.isEmpty();
+	if(!st) return st;
+
+	if(client.logLevel > 1)
 		roLog("info", "HttpClient - Response string:\n%s\n", response.string.c_str());
 
 	// Get status code
 	roUint64 statusCode = 0;
-	if(!response.getField(HttpResponseHeader::HeaderField::Status, statusCode)) {
-		st = roStatus::http_bad_header;
-		roEXCP_THROW;
-	}
+	if(!response.getField(HttpResponseHeader::HeaderField::Status, statusCode))
+		return roStatus::http_bad_header;
 
-	if(logLevel > 0)
+	if(client.logLevel > 0)
 		roLog("info", "HttpClient - Status code: %u\n", statusCode);
 
-	AutoPtr<IStream> istream;
+	const bool keepAlive = _isKeepAlive(response);
+	const bool noBody = isHeadRequest || statusCode / 100 == 1 || statusCode == 204 || statusCode == 304;
+
+	IStream* rawStream = NULL;
+	AutoPtr<IStream> istream = _getStream(
+		response,
+		RangedString(responseStr.c_str() + contentStartPos, responseStr.end()),
+		connection.socket, noBody, rawStream
+	);
 
 	// Decode status code
 	switch(statusCode)
 	{
+	case 301:		// Moved Permanently
+	case 302: {		// Found (http redirect)
+		RangedString location;
+		if(!response.getField(HttpResponseHeader::HeaderField::Location, location))
+			return roStatus::http_bad_header;
+
+		redirectLocation = location.toString();
+		if(client.logLevel > 0)
+			roLog("info", "HttpClient - Redirecting to: %s\n", redirectLocation.c_str());
+	}	break;
 	case 100:		// Continue
 	case 200:		// OK
+	case 204:		// No Content
+	case 206:		// Partial Content
+	case 304:		// Not Modified
 	case 400:		// Bad request
 	case 401:		// Unauthorized
 	case 404:		// Not found
 	case 416:		// Requested Range not satisfiable
 	{
-		istream = std::move(_getStream(
-			response,
-			RangedString(responseStr.c_str() + contentStartPos, responseStr.end()),
-			connection->socket
-		));
-
-		if(logLevel > 0)
+		if(client.logLevel > 0)
 			roLog("info", "HttpClient - Read body content\n");
 
 		st = (*replyFunc)(response, *istream, userPtr);
+		if(!st) return st;
 	}	break;
-	case 206:		// Partial Content
+	default:
 		break;
-	case 301:		// Moved Permanently
-	case 302: {		// Found (http redirect)
-		RangedString redirectLocation;
-		if(!response.getField(HttpResponseHeader::HeaderField::Location, redirectLocation)) {
-			st = roStatus::http_bad_header;
-			roEXCP_THROW;
-		}
+	}
 
-		String str = redirectLocation.toString();
-		if(logLevel > 0)
-			roLog("info", "HttpClient - Redirecting to: %s\n", str.c_str());
+	++connection.requestCount;
+	connection.reusable = keepAlive;
+	if(connection._host)
+		connection._host->pipelining = keepAlive && !response.cmpFieldNoCase(HttpResponseHeader::HeaderField::Version, "1.0");
+
+	// For keep-alive to work, we need to read till end of the http response
+	// if the client callback didn't do so. Whatever left belongs to the next pipelined response.
+	if(keepAlive) {
+		st = _skipStreamData(*rawStream);
+		if(!st) return st;
+
+		const char* leftover = (const char*)rawStream->current;
+		roAssert(leftover >= responseStr.c_str() + contentStartPos && leftover <= responseStr.end());
+		// NOTE: Not using assign(), the following response may contains binary data
+		st = connection.pending.resize(responseStr.end() - leftover);
+		if(!st) return st;
+		roMemcpy(connection.pending.c_str(), leftover, connection.pending.size());
+	}
+
+	return st;
+}
+
+roStatus HttpClient::request(const HttpRequestHeader& orgHeader, ReplyFunc replyFunc, void* userPtr, HttpConnections* connectionPool)
+{
+	roStatus st;
+	HttpRequestHeader header = orgHeader;
+
+	HttpConnection* connection = NULL;
+	HttpConnections dummyPool;
+	if(!connectionPool)
+		connectionPool = &dummyPool;
 
-		st = header.make(HttpRequestHeader::Method::Get, str.c_str());
+roEXCP_TRY
+	if(!replyFunc)
+		return roStatus::pointer_is_null;
+
+// Loop for location redirection
+const roSize maxRedirect = 10;
+roSize redirectCount = 0;
+while(true) {
+	String protocol, redirectLocation;
+	SockAddr addr;
+
+	st = _prepareRequest(*this, header, protocol, addr);
+	if(!st) roEXCP_THROW;
+
+	const bool isHeadRequest = header.getMethod() == HttpRequestHeader::Method::Head;
+
+	// A reused connection can be closed by the server at any moment, try again with another one
+	// if it happened before anything is received.
+	while(true) {
+		st = connectionPool->checkout(addr, connection);
 		if(!st) roEXCP_THROW;
 
-		++redirectCount;
-		if(redirectCount > maxRedirect) {
-			st = roStatus::http_max_redirect_reached;
-			roEXCP_THROW;
-		}
+		const bool reused = connection->requestCount > 0;
+		bool responded = false;
 
-		// Release connection back to pool
-		if(response.cmpFieldNoCase(HttpResponseHeader::HeaderField::Connection, "close")) {
-			// Can be deleted since server will close this connection and while we are redirecting to another location (new connection needed)
-			roDelete(connection);
-		}
-		else {
-			connectionPool->connections.insert(*connection);
+		// Handling with https
+		st = roStatus::ok;
+		if(roStrCaseCmp(protocol.c_str(), "https") == 0)
+			st = _secureConnection(*this, *connection, header);
+
+		// Send request string
+		if(st) {
+			IoVec bufs[] = { { header.string.c_str(), header.string.size() }, { "\r\n", 2 } };
 
-			istream = std::move(_getStream(
-				response,
-				RangedString(responseStr.c_str() + contentStartPos, responseStr.end()),
-				connection->socket
-			));
+			if(logLevel > 1)
+				roLog("info", "HttpClient - Sending request string:\n%s\r\n", header.string.c_str());
+			else if(logLevel > 0)
+				roLog("info", "HttpClient - Sending request string\n");
 
-			st = _skipStreamData(response, *istream);
+			st = connection->socket.send(bufs, roCountof(bufs));
 		}
 
-		if(!st) roEXCP_THROW;
+		if(st)
+			st = _readResponse(*this, *connection, isHeadRequest, replyFunc, userPtr, redirectLocation, responded);
 
-		// Back to the start of the location redirect loop
-		continue;
-	}	break;
-	default:
+		if(st)
+			break;
+
+		connection->reusable = false;
+		if(!reused || responded)
+			roEXCP_THROW;
+
+		if(logLevel > 0)
+			roLog("info", "HttpClient - Connection closed by server, retrying with a new one\n");
+
+		connectionPool->checkin(connection);
+		connection = NULL;
+	}
+
+	// Release connection back to pool
+	connectionPool->checkin(connection);
+	connection = NULL;
+
+	if(redirectLocation.isEmpty())
 		break;
+
+	++redirectCount;
+	if(redirectCount > maxRedirect) {
+		st = roStatus::http_max_redirect_reached;
+		roEXCP_THROW;
 	}
 
-	// For keep-alive to work, we need to read till end of the http response
-	// if the client callback didn't do so.
-	st = _skipStreamData(response, *istream);
+	st = header.make(HttpRequestHeader::Method::Get, redirectLocation.c_str());
 	if(!st) roEXCP_THROW;
 
-	break;
+	// Back to the start of the location redirect loop
 }	// End of location redirection loop
 
 roEXCP_CATCH
 roEXCP_END
 	// Release connection back to pool
-	if(connection)
-		connectionPool->connections.insert(*connection);
+	if(connection) {
+		if(!st)
+			connection->reusable = false;
+		connectionPool->checkin(connection);
+	}
+
+	return st;
+}
+
+roStatus HttpClient::requestPipelined(const HttpRequestHeader* headers, roSize count, ReplyFunc replyFunc, void* const* userPtrs, HttpConnections& connectionPool)
+{
+	if(!replyFunc || (count && !headers))
+		return roStatus::pointer_is_null;
+
+	struct Item {
+		HttpRequestHeader header;
+		SockAddr addr;
+		bool pipelinable;
+		bool isHeadRequest;
+	};
+
+	roStatus st;
+	Array<Item> items;
+	st = items.resize(count);
+	if(!st) return st;
+
+	for(roSize i=0; i<count; ++i) {
+		Item& item = items[i];
+		String protocol;
+		item.header = headers[i];
+		st = _prepareRequest(*this, item.header, protocol, item.addr);
+		if(!st) return st;
+
+		// Https and the non-idempotent methods go through request()
+		const HttpRequestHeader::Method method = item.header.getMethod();
+		item.isHeadRequest = method == HttpRequestHeader::Method::Head;
+		item.pipelinable = roStrCaseCmp(protocol.c_str(), "http") == 0 && (method == HttpRequestHeader::Method::Get || item.isHeadRequest);
+	}
+
+	// Answered with a redirection, to be followed after the others
+	Array<roSize> redirected;
+	Array<String> redirectLocations;
+
+	for(roSize next = 0; next < count; ) {
+		Item& first = items[next];
+		void* userPtr = userPtrs ? userPtrs[next] : NULL;
+
+		if(!first.pipelinable) {
+			st = request(headers[next], replyFunc, userPtr, &connectionPool);
+			if(!st) return st;
+			++next;
+			continue;
+		}
+
+		HttpConnection* connection = NULL;
+		st = connectionPool.checkout(first.addr, connection);
+		if(!st) return st;
+
+		// Until the server proved it keeps the connection alive, send one request only
+		roSize depth = 1;
+		if(connection->_host->pipelining) {
+			while(depth < connectionPool.maxPipelineDepth && next + depth < count) {
+				const Item& item = items[next + depth];
+				if(!item.pipelinable || item.addr != first.addr)
+					break;
+				++depth;
+			}
+		}
+
+		// Send them all in one go
+		Array<IoVec> bufs;
+		for(roSize i=0; i<depth; ++i) {
+			const String& str = items[next + i].header.string;
+			IoVec buf1 = { str.c_str(), str.size() };
+			IoVec buf2 = { "\r\n", 2 };
+			bufs.pushBack(buf1);
+			bufs.pushBack(buf2);
+		}
+
+		if(logLevel > 0)
+			roLog("info", "HttpClient - Sending %u pipelined requests\n", depth);
+
+		const bool reused = connection->requestCount > 0;
+		st = connection->socket.send(bufs.typedPtr(), bufs.size());
+
+		// The responses come in the same order of the requests
+		roSize answered = 0;
+		bool responded = false;
+		while(st && answered < depth) {
+			const roSize i = next + answered;
+			String redirectLocation;
+			st = _readResponse(*this, *connection, items[i].isHeadRequest, replyFunc, userPtrs ? userPtrs[i] : NULL, redirectLocation, responded);
+			if(!st) break;
+
+			++answered;
+			if(!redirectLocation.isEmpty()) {
+				redirected.pushBack(i);
+				redirectLocations.pushBack(redirectLocation);
+			}
+
+			// The server is closing the connection, send the rest again through another one
+			if(!connection->reusable)
+				break;
+		}
+
+		if(!st) {
+			connection->reusable = false;
+			connectionPool.checkin(connection);
+
+			// Fail unless the connection was closed by the server before anything received
+			if(responded || (answered == 0 && !reused))
+				return st;
+
+			if(logLevel > 0)
+				roLog("info", "HttpClient - Connection closed by server, sending %u requests again\n", depth - answered);
+			st = roStatus::ok;
+		}
+		else {
+			// Responses of the requests not answered may still arrive
+			if(answered < depth)
+				connection->reusable = false;
+			connectionPool.checkin(connection);
+		}
+
+		next += answered;
+	}
+
+	for(roSize i=0; i<redirected.size(); ++i) {
+		HttpRequestHeader header;
+		st = header.make(HttpRequestHeader::Method::Get, redirectLocations[i].c_str());
+		if(!st) return st;
+
+		st = request(header, replyFunc, userPtrs ? userPtrs[redirected[i]] : NULL, &connectionPool);
+		if(!st) return st;
+	}
 
 	return st;
 }
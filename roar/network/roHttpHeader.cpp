@@ -254,12 +254,14 @@ bool HttpRequestHeader::cmpFieldNoCase(HeaderField option, const char* value) co
 //////////////////////////////////////////////////////////////////////////
 // HttpResponseHeader
 
-static const StaticArray<const char*, 6>  _responseCodeStringMapping = {
+static const StaticArray<const char*, 8>  _responseCodeStringMapping = {
 	"100 Continue",
 	"101 Switching Protocols",
 	"200 OK",
+	"206 Partial Content",
 	"304 Not Modified",
 	"404 Not Found",
+	"416 Range Not Satisfiable",
 	"500 Internal Server Error",
 };
 
@@ -331,6 +333,17 @@ Status HttpResponseHeader::addField(HeaderField field, roUint64 value)
 	return Status::invalid_parameter;
 }
 
+Status HttpResponseHeader::addField(HeaderField field, roUint64 value1, roUint64 value2, roUint64 value3)
+{
+	switch(field) {
+	case HeaderField::ContentRange:
+		return strFormat(string, "Content-Range: bytes {}-{}/{}\r\n", value1, value2, value3);
+	default: break;
+	}
+
+	return Status::invalid_parameter;
+}
+
 bool HttpResponseHeader::getField(const char* field, String& value) const
 {
 	RangedString rangedStr;
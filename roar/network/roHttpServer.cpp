@@ -1,30 +1,60 @@
 #include "pch.h"
 #include "roHttp.h"
+#include "../base/roCoRoutine.h"
 #include "../base/roCompressedStream.h"
 #include "../base/roLog.h"
 #include "../base/roRegex.h"
-#include "../base/roRingBuffer.h"
 #include "../base/roSha1.h"
 #include "../base/roTypeCast.h"
 #include "../base/roUtility.h"
 #include <limits.h>
 
+#if !roOS_WIN
+#	include <sys/socket.h>	// For MSG_MORE
+#endif
+
 namespace ro {
 
 static DefaultAllocator _allocator;
 
+// The response header is held by the OStream and sent together with the first write
+// (or in closeWrite() if nothing written), so that a small response costs one system call.
 struct HttpServerFixedSizeOStream : public OStream
 {
-	HttpServerFixedSizeOStream(CoSocket& socket, roSize size) : _socket(socket), _contentSize(size), _remainingSize(size) {}
+	HttpServerFixedSizeOStream(CoSocket& socket, String& header, roUint64 size) : _socket(socket), _contentSize(size), _remainingSize(size) { roSwap(_header, header); }
 
 	virtual	Status write(const void* buffer, roUint64 bytesToWrite) override
 	{
-		roUint64 toWrite = roMinOf2(bytesToWrite, _remainingSize);
-		roStatus st = _socket.send(buffer, toWrite);
+		IoVec buf = { buffer, clamp_cast<roSize>(bytesToWrite) };
+		return writev(&buf, 1);
+	}
+
+	// The header (if not yet sent) and all the buffers in one go
+	virtual Status writev(const IoVec* bufs, roSize count) override
+	{
+		TinyArray<IoVec, 16> v;
+		roStatus st = v.pushBack(IoVec{ _header.c_str(), _header.size() });
 		if (!st) return st;
-		if (toWrite != bytesToWrite)
-			return roStatus::size_limit_reached;
+
+		roUint64 toWrite = 0;
+		bool truncated = false;
+		for (roSize i = 0; i < count && !truncated; ++i) {
+			IoVec buf = bufs[i];
+			if (buf.size > _remainingSize - toWrite) {
+				buf.size = clamp_cast<roSize>(_remainingSize - toWrite);
+				truncated = true;
+			}
+			st = v.pushBack(buf);
+			if (!st) return st;
+			toWrite += buf.size;
+		}
+
+		st = _socket.send(v.typedPtr(), v.size());
+		if (!st) return st;
+		_header.clear();
 		_remainingSize -= toWrite;
+		if (truncated)
+			return roStatus::size_limit_reached;
 		return st;
 	}
 
@@ -44,21 +74,39 @@ struct HttpServerFixedSizeOStream : public OStream
 			st = roStatus::http_content_size_mismatch;
 		}
 
+		if (!_header.isEmpty()) {
+			Status st2 = _socket.send(_header.c_str(), _header.size());
+			if (st) st = st2;
+			_header.clear();
+		}
+
 		_contentSize = _remainingSize = 0;
 		return st;
 	}
 
 	CoSocket& _socket;
+	String _header;
 	roUint64 _contentSize;
 	roUint64 _remainingSize;
 };	// HttpServerFixedSizeOStream
 
 struct HttpServerChunkedSizeOStream : public OStream
 {
-	HttpServerChunkedSizeOStream(CoSocket& socket) : _socket(socket) {}
+	HttpServerChunkedSizeOStream(CoSocket& socket, String& header) : _socket(socket) { roSwap(_header, header); }
 
 	virtual	Status write(const void* buffer, roUint64 bytesToWrite) override
 	{
+		IoVec buf = { buffer, clamp_cast<roSize>(bytesToWrite) };
+		return writev(&buf, 1);
+	}
+
+	// All the buffers as a single chunk frame, in one go
+	virtual Status writev(const IoVec* bufs, roSize count) override
+	{
+		roUint64 bytesToWrite = 0;
+		for (roSize i = 0; i < count; ++i)
+			bytesToWrite += bufs[i].size;
+
 		if (bytesToWrite == 0)
 			return roStatus::ok;
 
@@ -67,13 +115,71 @@ struct HttpServerChunkedSizeOStream : public OStream
 		roAssert(written < (int)sizeof(buf));
 		if(written < 0)
 			return roStatus::string_encoding_error;
-		roStatus st = _socket.send(buf, written);
+
+		TinyArray<IoVec, 16> v;
+		roStatus st = v.pushBack(IoVec{ _header.c_str(), _header.size() });
+		if (!st) return st;
+		st = v.pushBack(IoVec{ buf, roSize(written) });
+		if (!st) return st;
+		st = v.pushBack(bufs, count);
+		if (!st) return st;
+		st = v.pushBack(IoVec{ "\r\n", 2 });
+		if (!st) return st;
+
+		st = _socket.send(v.typedPtr(), v.size());
 		if (!st) return st;
-		st = _socket.send(buffer, bytesToWrite);
+
+		_header.clear();
+		_written += bytesToWrite;
+		return st;
+	}
+
+	// Lend our own buffer, with room for the chunk size line before and the "\r\n" after,
+	// such that the chunk is sent from where the data was produced
+	virtual Status reserveWrite(roSize minBytes, roByte*& outBuf, roSize& outBytes) override
+	{
+		roSize size;
+		roStatus st = roSafeAdd(minBytes, _headRoom + 2, size);
+		if (!st) return st;
+		if (_chunk.size() < size) {
+			st = _chunk.resizeNoInit(size);
+			if (!st) return st;
+		}
+
+		outBuf = _chunk.typedPtr() + _headRoom;
+		outBytes = _chunk.size() - _headRoom - 2;
+		return roStatus::ok;
+	}
+
+	virtual Status commitWrite(roSize bytesWritten) override
+	{
+		if (bytesWritten == 0)
+			return roStatus::ok;
+
+		roByte* data = _chunk.typedPtr() + _headRoom;
+		roAssert(bytesWritten <= _chunk.size() - _headRoom - 2);
+
+		char buf[_headRoom];
+		int written = snprintf(buf, sizeof(buf), "%llx\r\n", (roUint64)bytesWritten);
+		roAssert(written < (int)sizeof(buf));
+		if(written < 0)
+			return roStatus::string_encoding_error;
+
+		roByte* frame = data - written;
+		roMemcpy(frame, buf, written);
+		data[bytesWritten] = '\r';
+		data[bytesWritten + 1] = '\n';
+
+		IoVec bufs[] = {
+			{ _header.c_str(), _header.size() },
+			{ frame, written + bytesWritten + 2 }
+		};
+		roStatus st = _socket.send(bufs, roCountof(bufs));
 		if (!st) return st;
 
-		_written += written;
-		return _socket.send("\r\n", 2);
+		_header.clear();
+		_written += bytesWritten;
+		return st;
 	}
 
 	virtual roUint64 posWrite() const override
@@ -83,12 +189,22 @@ struct HttpServerChunkedSizeOStream : public OStream
 
 	virtual Status closeWrite() override
 	{
+		IoVec bufs[] = {
+			{ _header.c_str(), _header.size() },
+			{ "0\r\n\r\n", 5 }
+		};
 		_written = 0;
-		return _socket.send("0\r\n\r\n", 5);
+		roStatus st = _socket.send(bufs, roCountof(bufs));
+		_header.clear();
+		return st;
 	}
 
+	static const roSize _headRoom = 32;
+
 	CoSocket& _socket;
-	roSize _written = 0;
+	String _header;
+	ByteArray _chunk;
+	roUint64 _written = 0;
 };	// HttpServerChunkedSizeOStream
 
 //////////////////////////////////////////////////////////////////////////
@@ -101,17 +217,27 @@ HttpServer::HttpServer()
 
 HttpServer::~HttpServer()
 {
+	stopThreads();
+	_gzipCacheLru.removeAll();
 	roVerify(BsdSocket::closeApplication() == 0);
 }
 
 Status HttpServer::init()
+{
+	return _listen(_socketListen, false);
+}
+
+roStatus HttpServer::_listen(CoSocket& socket, bool reusePort)
 {
 	roStatus st;
-	SockAddr anyAddr(SockAddr::ipAny(), 80);
+	SockAddr anyAddr(SockAddr::ipAny(), port);
 
-	st = _socketListen.create(BsdSocket::TCP); if(!st) return st;
-	st = _socketListen.bind(anyAddr); if(!st) return st;
-	st = _socketListen.listen(backlog); if(!st) return st;
+	st = socket.create(BsdSocket::TCP); if(!st) return st;
+	if (reusePort) {
+		st = socket.setReusePort(true); if(!st) return st;
+	}
+	st = socket.bind(anyAddr); if(!st) return st;
+	st = socket.listen(backlog); if(!st) return st;
 
 	return Status::ok;
 }
@@ -120,7 +246,7 @@ HttpServer::Connection::Connection()
 {
 }
 
-static roStatus responseCommon(HttpServer::Connection& connection, HttpResponseHeader& header, roSize* contentSize)
+static roStatus responseCommon(HttpServer::Connection& connection, HttpResponseHeader& header, roUint64* contentSize)
 {
 	header.addField(HttpResponseHeader::HeaderField::Server, "Roar");
 	header.addField(HttpResponseHeader::HeaderField::Connection, connection.keepAlive ? "keep-alive" : "close");
@@ -141,7 +267,7 @@ static roStatus responseCommon(HttpServer::Connection& connection, HttpResponseH
 
 	header.string += "\r\n";
 
-	return connection.socket.send(header.string.c_str(), header.string.size());
+	return roStatus::ok;
 }
 
 roStatus HttpServer::Connection::response(HttpResponseHeader& header)
@@ -159,10 +285,10 @@ roStatus HttpServer::Connection::response(HttpResponseHeader& header, OStream*&
 	if (!st) return st;
 
 	// TODO: Resue oStream if the type was the same
-	oStream = _allocator.newObj<HttpServerChunkedSizeOStream>(socket);
+	oStream = _allocator.newObj<HttpServerChunkedSizeOStream>(socket, header.string);
 	if (supportGZip) {
 		auto zip = _allocator.newObj<GZipOStream>();
-		zip->init(std::move(oStream));
+		zip->init(std::move(oStream), 0, server ? server->gzipLevel : Z_DEFAULT_COMPRESSION);
 		oStream = std::move(zip);
 	}
 
@@ -176,42 +302,104 @@ roStatus HttpServer::Connection::response(HttpResponseHeader& header, OStream*&
 	if (supportGZip)
 		return response(header, os);
 
-	roStatus st = responseCommon(*this, header, &contentSize);
+	roUint64 size = contentSize;
+	roStatus st = responseCommon(*this, header, &size);
 	if (!st) return st;
 
 	// TODO: Resue oStream if the type was the same
-	oStream = _allocator.newObj<HttpServerFixedSizeOStream>(socket, contentSize);
+	oStream = _allocator.newObj<HttpServerFixedSizeOStream>(socket, header.string, size);
 	os = oStream.ptr();
 	return st;
 }
 
+roStatus HttpServer::Connection::responseFile(HttpResponseHeader& header, void* rawFile, roUint64 offset, roUint64 size)
+{
+	roStatus st = responseCommon(*this, header, &size);
+	if (!st) return st;
+
+	// Let the header wait for the file content, instead of going out as a packet on it's own
+	int flags = 0;
+#ifdef MSG_MORE
+	flags = MSG_MORE;
+#endif
+
+	st = socket.send(header.string.c_str(), header.string.size(), flags);
+	if (!st) return st;
+
+	return socket.sendFile(rawFile, offset, size);
+}
+
+roStatus HttpServer::Connection::_sendWithBody(HttpResponseHeader& header, const void* body, roSize size)
+{
+	roUint64 contentSize = size;
+	roStatus st = responseCommon(*this, header, &contentSize);
+	if (!st) return st;
+
+	IoVec bufs[] = {
+		{ header.string.c_str(), header.string.size() },
+		{ body, size }
+	};
+	return socket.send(bufs, roCountof(bufs));
+}
+
+roStatus HttpServer::Connection::responseBody(HttpResponseHeader& header, const void* body, roSize size, const char* etag)
+{
+	// Let caches in between keep the plain and gzip variants apart
+	if (server && server->gzipLevel > 0)
+		header.addField(HttpResponseHeader::HeaderField::Vary, "Accept-Encoding");
+
+	SharedPtr<HttpServer::GZipBody> zipped;
+	if (supportGZip && server)
+		zipped = server->_gzipBody(body, size, etag);
+
+	// Not worth it for incompressible body
+	if (!zipped || zipped->data.size() >= size) {
+		if (etag && etag[0])
+			header.addField(HttpResponseHeader::HeaderField::ETag, etag);
+		return _sendWithBody(header, body, size);
+	}
+
+	// The gzip variant is different bytes, so it needs it's own strong ETag: "v1" -> "v1-gz"
+	if (etag && etag[0]) {
+		String zippedEtag(etag);
+		if (zippedEtag.size() > 1 && zippedEtag.back() == '"')
+			zippedEtag.insert(zippedEtag.size() - 1, "-gz");
+		else
+			zippedEtag += "-gz";
+		header.addField(HttpResponseHeader::HeaderField::ETag, zippedEtag.c_str());
+	}
+
+	header.addField(HttpResponseHeader::HeaderField::ContentEncoding, "gzip");
+	return _sendWithBody(header, zipped->data.typedPtr(), zipped->data.size());
+}
+
 Status HttpServer::Connection::_processHeader(HttpRequestHeader& header)
 {
-	// Read from socket
 	Status st;
-	char* rPtr = NULL;
-	roByte* wPtr = NULL;
-	const char* messageContent = NULL;
 	static const char headerTerminator[] = "\r\n\r\n";
+	const roSize terminatorSize = sizeof(headerTerminator) - 1;
 
-	RingBuffer ringBuf;
-	while(!messageContent) {
-		roSize byteSize = roKB(1);
-		st = ringBuf.write(byteSize, wPtr);
-		if(!st) return st;
+	// The request may be received already together with the previous one, when the client is pipelining
+	roSize searchIdx = 0;
+	roSize pos = 0;
+	while((pos = _received.find(headerTerminator, searchIdx)) == String::npos) {
+		searchIdx = _received.size() < terminatorSize ? 0 : _received.size() - terminatorSize;
 
-		st = socket.receive(wPtr, byteSize);
-		if (!st || byteSize == 0) return st;
+		// Read from socket
+		roSize byteSize = roKB(1);
+		st = _received.reserve(_received.size() + byteSize);
+		if (!st) return st;
 
-		ringBuf.commitWrite(byteSize);
+		st = socket.receive(_received.c_str() + _received.size(), byteSize);
+		if (!st) return st;
+		if (byteSize == 0) return roStatus::end_of_data;
 
-		// Check if header complete
-		rPtr = (char*)ringBuf.read(byteSize);
-		messageContent = roStrnStr(rPtr, byteSize, headerTerminator);
+		st = _received.incSize(byteSize);
+		if (!st) return st;
 	}
 
-	ringBuf.commitRead(messageContent - rPtr + (sizeof(headerTerminator) - 1));
-	header.string = String(rPtr, messageContent - rPtr);
+	header.string.assign(_received.c_str(), pos);
+	_received.erase(0, pos + terminatorSize);
 
 	RangedString rstr;
 	httpVersion = header.getVersion();
@@ -219,10 +407,10 @@ Status HttpServer::Connection::_processHeader(HttpRequestHeader& header)
 	if (httpVersion >= HttpVersion::v1_1) {
 		supportChunkEncoding = true;
 
-		if (header.getField(HttpRequestHeader::HeaderField::Connection, rstr))
-			keepAlive = rstr.cmpNoCase("close") != 0;	// keep-alive is on by default, unless "close" is specified
+		// keep-alive is on by default, unless "close" is specified
+		keepAlive = !header.getField(HttpRequestHeader::HeaderField::Connection, rstr) || rstr.cmpNoCase("close") != 0;
 
-		if (header.getField(HttpRequestHeader::HeaderField::AcceptEncoding, rstr))
+		if ((!server || server->gzipLevel > 0) && header.getField(HttpRequestHeader::HeaderField::AcceptEncoding, rstr))
 			supportGZip = (rstr.findNoCase("gzip") != RangedString::npos);
 	}
 
@@ -230,16 +418,25 @@ Status HttpServer::Connection::_processHeader(HttpRequestHeader& header)
 }
 
 roStatus HttpServer::start()
+{
+	return _serve(_socketListen, activeConnections);
+}
+
+roStatus HttpServer::_serve(CoSocket& listenSocket, LinkList<Connection>& connections)
 {
 	roStatus st;
 	typedef HttpRequestHeader::HeaderField ReqHeaderField;
-	SockAddr anyAddr(SockAddr::ipAny(), port);
 
 	Connection c;
-	st = _socketListen.accept(c.socket); if (!st) return st;
+	c.server = this;
+	st = listenSocket.accept(c.socket); if (!st) return st;
+
+	// Responses are written with as few send as possible, Nagle would only hold the last
+	// segment until the delayed ACK
+	c.socket.setNoDelay(true);
 
 	c.removeThis();
-	activeConnections.pushBack(c);
+	connections.pushBack(c);
 
 	do {
 		HttpRequestHeader header;
@@ -265,10 +462,143 @@ roStatus HttpServer::start()
 		}
 	} while (c.keepAlive);
 
+	// The client closed the connection in-between requests
+	if (st == roStatus::end_of_data)
+		st = roStatus::ok;
+
 	c.socket.close();
 	return st;
 }
 
+roStatus HttpServer::startThreads()
+{
+	roAssert(!_threadKeepRun && "startThreads() already called");
+	if (threadCount == 0)
+		return roStatus::invalid_parameter;
+
+	_threadKeepRun = true;
+	_threadStartedCount = 0;
+	_threadFailedCount = 0;
+	if (_threads.threadCount() == 0)
+		_threads.init(threadCount);
+	roAssert(_threads.threadCount() == threadCount && "threadCount cannot be changed after startThreads()");
+
+	for (unsigned i = 0; i < threadCount; ++i)
+		_threads.addFinalized([this]() { _runThread(); });
+
+	while (_threadStartedCount < int(threadCount))
+		TaskPool::sleep(1);
+
+	if (_threadFailedCount > 0) {
+		stopThreads();
+		return threadCount > 1 ? roStatus::not_supported : roStatus::net_error;
+	}
+
+	return roStatus::ok;
+}
+
+void HttpServer::stopThreads()
+{
+	if (!_threadKeepRun)
+		return;
+
+	_threadKeepRun = false;
+	_threads.waitAll();
+}
+
+void HttpServer::_runThread()
+{
+	// Everything below is confined to this thread
+	CoroutineScheduler scheduler;
+	CoSocket listenSocket;
+	LinkList<Connection> connections;
+
+	if (!scheduler.init() || !_listen(listenSocket, threadCount > 1)) {
+		++_threadFailedCount;
+		++_threadStartedCount;
+		scheduler.stop();
+		return;
+	}
+	++_threadStartedCount;
+
+	for (unsigned i = 0; i < backlog; ++i) {
+		scheduler.add([&]() {
+			// When accept keep failing (eg. out of file descriptors), back off instead of
+			// spinning, so the stop watcher and other connections still get their turn
+			float backoff = 0;
+			while (_threadKeepRun) {
+				if (_serve(listenSocket, connections)) {
+					backoff = 0;
+					continue;
+				}
+				backoff = roClamp(backoff * 2, 0.001f, 0.1f);
+				coSleep(backoff);
+			}
+		}, "HttpServer connection loop", roKB(64));
+	}
+
+	scheduler.add([&]() {
+		while (_threadKeepRun)
+			coSleep(0.05f);
+
+		// Closing the listening socket fail the pending accept, and shutting down
+		// the connections let them leave the keep alive loop.
+		listenSocket.close();
+		for (Connection* c = connections.begin(); c != connections.end(); c = c->next())
+			c->socket.shutDownRead();
+	}, "HttpServer stop watcher", roKB(16));
+
+	scheduler.runTillAllFinish();
+	scheduler.stop();
+}
+
+SharedPtr<HttpServer::GZipBody> HttpServer::_gzipBody(const void* body, roSize size, const char* etag)
+{
+	const bool cacheable = etag && etag[0] && gzipCacheMaxSize > 0;
+
+	if (cacheable) {
+		ScopeLock<Mutex> lock(_gzipCacheMutex);
+		if (SharedPtr<GZipBody>* cached = _gzipCache.find(etag)) {
+			_gzipCacheLru.moveBack(**cached);
+			++gzipCacheHitCount;
+			return *cached;
+		}
+	}
+
+	// Compress outside the lock, other threads may serve other bodies meanwhile
+	SharedPtr<GZipBody> zipped = new GZipBody;
+	if (!gzipCompress(body, size, zipped->data, gzipLevel))
+		return SharedPtr<GZipBody>();
+
+	if (!cacheable)
+		return zipped;
+
+	++gzipCacheMissCount;
+	if (zipped->data.size() > gzipCacheMaxSize)
+		return zipped;
+
+	ScopeLock<Mutex> lock(_gzipCacheMutex);
+
+	// Someone else compressed the same body at the same time
+	if (SharedPtr<GZipBody>* cached = _gzipCache.find(etag))
+		return *cached;
+
+	zipped->etag = etag;
+	_gzipCache.insert(zipped->etag, zipped);
+	_gzipCacheLru.pushBack(*zipped);
+	_gzipCacheSize += zipped->data.size();
+
+	// Evict the least recently used, a body still being sent is kept alive by it's SharedPtr
+	while (_gzipCacheSize > gzipCacheMaxSize) {
+		SharedPtr<GZipBody> lru = &_gzipCacheLru.front();
+		_gzipCacheSize -= lru->data.size();
+		lru->removeThis();
+		_gzipCache.remove(lru->etag);
+	}
+
+	return zipped;
+}
+
 roStatus HttpServer::webSocketResponse(Connection& connection, HttpRequestHeader& request)
 {
 	RangedString key;
@@ -24,9 +24,11 @@
 #	include <inttypes.h>
 #	include <netdb.h>
 #	include <netinet/in.h>
+#	include <netinet/tcp.h>
 #	include <signal.h>
 #	include <sys/socket.h>
 #	include <sys/types.h>
+#	include <sys/uio.h>
 #	include <unistd.h>
 #   include <string.h>  // For memset
 #endif
@@ -338,19 +340,8 @@ bool SockAddr::operator<(const SockAddr& rhs) const
 
 roUint32 SockAddr::ipLoopBack()
 {
-	static roUint32 ret = 0;
-
-#if roOS_WIN
-		ret = 2130706433;
-#endif
-
-	if(ret == 0) {
-		SockAddr addr;
-		roVerify(addr.parse("localhost", 0));
-		ret = addr.ip();
-	}
-
-	return ret;
+	// NOTE: Don't resolve "localhost" here, the default SockAddr constructor calls us
+	return INADDR_LOOPBACK;
 }
 
 roUint32 SockAddr::ipAny()
@@ -444,7 +435,7 @@ roStatus BsdSocket::create(SocketType type)
 	default: return getLastError(), errorToStatus(lastError);
 	}
 
-#if !roOS_WIN
+#if !roOS_WIN && defined(SO_NOSIGPIPE)
 	{	// Disable SIGPIPE: http://unix.derkeiler.com/Mailing-Lists/FreeBSD/net/2007-03/msg00007.html
 		// More reference: http://beej.us/guide/bgnet/output/html/multipage/sendman.html
 		// http://discuss.joelonsoftware.com/default.asp?design.4.575720.7
@@ -506,6 +497,16 @@ roStatus BsdSocket::setReceiveBuffSize(roSize size)
 	return _setOption(SOL_SOCKET, SO_RCVBUF, &n, sizeof(n));
 }
 
+roStatus BsdSocket::setReusePort(bool b)
+{
+#ifdef SO_REUSEPORT
+	int a = b ? 1 : 0;
+	return _setOption(SOL_SOCKET, SO_REUSEPORT, &a, sizeof(a));
+#else
+	return b ? roStatus::not_supported : roStatus::ok;
+#endif
+}
+
 roStatus BsdSocket::bind(const SockAddr& endPoint)
 {
 	sockaddr addr = endPoint.asSockAddr();
@@ -554,7 +555,7 @@ ErrorCode BsdSocket::select(bool& checkRead, bool& checkWrite, bool& checkError)
 	FD_ZERO(&readSet);
 	FD_ZERO(&writeSet);
 	FD_ZERO(&errorSet);
-	SOCKET s = (SOCKET)fd();
+	socket_t s = fd();
 	FD_SET(s, &readSet);
 	FD_SET(s, &writeSet);
 	FD_SET(s, &errorSet);
@@ -563,7 +564,7 @@ ErrorCode BsdSocket::select(bool& checkRead, bool& checkWrite, bool& checkError)
 	timeout.tv_sec = 0;
 	timeout.tv_usec = 0;
 
-	int ret = ::select(1,
+	int ret = ::select(int(s) + 1,
 		checkRead ? &readSet : NULL,
 		checkWrite ? &writeSet : NULL,
 		checkError ? &errorSet : NULL,
@@ -588,6 +589,10 @@ ErrorCode BsdSocket::select(bool& checkRead, bool& checkWrite, bool& checkError)
 
 roStatus BsdSocket::send(const void* data, roSize& len, int flags)
 {
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;	// Linux has no SO_NOSIGPIPE
+#endif
+
 	roSize remain = len;
 	roSize sent = 0;
 	const char* p = (const char*)data;
@@ -606,6 +611,56 @@ roStatus BsdSocket::send(const void* data, roSize& len, int flags)
 	return lastError = OK, roStatus::ok;
 }
 
+roStatus BsdSocket::send(const IoVec* bufs, roSize count, roSize& len, int flags)
+{
+	len = 0;
+	if(count == 0)
+		return lastError = OK, roStatus::ok;
+	if(!bufs)
+		return roStatus::pointer_is_null;
+
+	// Anything beyond will be left for the next call, since len tells how much is sent
+	static const roSize maxBufs = 64;
+	count = roMinOf2(count, maxBufs);
+
+#if roOS_WIN
+	WSABUF wsaBufs[maxBufs];
+	for(roSize i=0; i<count; ++i) {
+		wsaBufs[i].buf = (CHAR*)bufs[i].data;
+		wsaBufs[i].len = clamp_cast<ULONG>(bufs[i].size);
+	}
+
+	DWORD sent = 0;
+	if(::WSASend(fd(), wsaBufs, num_cast<DWORD>(count), &sent, flags, NULL, NULL) != 0)
+		return lastError = getLastError(), errorToStatus(lastError);
+
+	len = num_cast<roSize>(sent);
+#else
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+
+	iovec iov[maxBufs];
+	for(roSize i=0; i<count; ++i) {
+		iov[i].iov_base = (void*)bufs[i].data;
+		iov[i].iov_len = bufs[i].size;
+	}
+
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+
+	ssize_t ret = ::sendmsg(fd(), &msg, flags);
+	if(ret < 0)
+		return lastError = getLastError(), errorToStatus(lastError);
+
+	len = num_cast<roSize>(ret);
+#endif
+
+	return lastError = OK, roStatus::ok;
+}
+
 roStatus BsdSocket::receive(void* buf, roSize& len, int flags)
 {
 	int ret = ::recv(fd(), (char*)buf, clamp_cast<int>(len), flags);
@@ -716,6 +771,16 @@ bool BsdSocket::isBlockingMode() const
 	return _isBlockingMode;
 }
 
+SockAddr BsdSocket::boundEndPoint() const
+{
+	sockaddr addr;
+	::memset(&addr, 0, sizeof(addr));
+	socklen_t len = sizeof(addr);
+	if(::getsockname(fd(), &addr, &len) == OK)
+		return SockAddr(addr);
+	return SockAddr(addr);
+}
+
 SockAddr BsdSocket::remoteEndPoint() const
 {
 	sockaddr addr;
@@ -754,11 +819,22 @@ void BsdSocket::setFd(const socket_t& f) {
 	*reinterpret_cast<socket_t*>(_fd) = f;
 }
 
+void BsdSocket::swap(BsdSocket& rhs) {
+	roSwap(lastError, rhs.lastError);
+	roSwap(_socketType, rhs._socketType);
+	roSwapMemory(_fd, rhs._fd, sizeof(_fd));
+	roSwap(_isBlockingMode, rhs._isBlockingMode);
+}
+
 void BsdSocket::_setFd(const socket_t& f) {
 	*reinterpret_cast<socket_t*>(_fd) = f;
 }
 
 }	// namespace ro
 
-#include "roSocket.iocp.inc"
-//#include "roSocket.select.inc"
\ No newline at end of file
+// Both the epoll and select io event backend use the readiness based CoSocket
+#if roOS_WIN
+#	include "roSocket.iocp.inc"
+#else
+#	include "roSocket.select.inc"
+#endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef __network_roSocket_h__
 #define __network_roSocket_h__
 
+#include "../base/roIoVec.h"
 #include "../base/roNonCopyable.h"
 #include "../base/roStatus.h"
 #include "../platform/roCompiler.h"
@@ -79,7 +80,6 @@ struct SockAddr
 	roUint8 _sockAddr[16];
 };	// SockAddr
 
-
 // ----------------------------------------------------------------------
 
 /// Cross-platform BSD socket class
@@ -117,6 +117,7 @@ struct BsdSocket : NonCopyable
 	roStatus	setSendTimeout		(float seconds);
 	roStatus	setSendBuffSize		(roSize size);
 	roStatus	setReceiveBuffSize	(roSize size);
+	roStatus	setReusePort		(bool b);	///< Let multiple sockets bind to the same port, return not_supported if the platform hasn't SO_REUSEPORT
 
 	roStatus	bind				(const SockAddr& endPoint);
 
@@ -136,6 +137,11 @@ struct BsdSocket : NonCopyable
 	ErrorCode	select				(bool& checkRead, bool& checkWrite, bool& checkError);
 
 	roStatus	send				(const void* data, roSize& len, int flags=0);
+
+	///	Gather the buffers and send them using a single system call (sendmsg / WSASend).
+	///	\param len Returns the number of bytes sent, which can be less than the total if the socket is non-blocking
+	roStatus	send				(const IoVec* bufs, roSize count, roSize& len, int flags=0);
+
 	roStatus	receive				(void* buf, roSize& len, int flags=0);
 	roStatus	sendTo				(const void* data, roSize len, const SockAddr& destEndPoint, int flags=0);
 	roStatus	receiveFrom			(void* buf, roSize& len, SockAddr& srcEndPoint, int flags=0);
@@ -149,6 +155,9 @@ struct BsdSocket : NonCopyable
 	roStatus	shutDownReadWrite	();
 	roStatus	close				();
 
+	/// Exchange the underlying socket, for handing over an established connection
+	void		swap				(BsdSocket& rhs);
+
 // Attributes
 	SocketType	socketType			() const;
 
@@ -212,6 +221,13 @@ struct CoSocket : public BsdSocket
 	// If written is non-null, it will return as quick as possible and tell you how much data written
 	roStatus	send			(const void* data, roSize len, int flags=0, roSize* written=NULL);
 
+	/// Send all the buffers, for instance a header together with it's body, in as few system calls as possible
+	roStatus	send			(const IoVec* bufs, roSize count, int flags=0);
+
+	/// Send part of a file opened by rawFileSystemOpenFile(), without copying the content to user space
+	/// if the platform supports it (sendfile / TransmitFile). The file position is left undefined.
+	roStatus	sendFile		(void* rawFile, roUint64 offset, roUint64 size);
+
 	roStatus	receive			(void* buf, roSize& len, int flags=0);
 	roStatus	sendTo			(const void* data, roSize len, const SockAddr& destEndPoint, int flags=0);
 	roStatus	receiveFrom		(void* buf, roSize& len, SockAddr& srcEndPoint, float timeout=0.f, int flags=0);
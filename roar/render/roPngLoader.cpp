@@ -206,7 +206,7 @@ void PngLoader::processData(TaskPool* taskPool)
 {
 	roScopeProfile(__FUNCTION__);
 
-	char buff[1024*8];
+	static const roSize chunkSize = 1024*8;
 
 	if(setjmp(png_jmpbuf(png_ptr)))
 		nextFun = &PngLoader::abort;
@@ -220,14 +220,24 @@ void PngLoader::processData(TaskPool* taskPool)
 			break;
 		}
 
-		if(fileSystem.readWillBlock(stream, sizeof(buff))) {
+		if(fileSystem.readWillBlock(stream, chunkSize)) {
 			// Re-schedule the load operation
 			return reSchedule(false, ~taskPool->mainThreadId());
 		}
 
+		// Use the file system's own buffer, which point straight into the file mapping with mmapFileSystem
 		roUint64 bytesRead = 0;
-		st = fileSystem.read(stream, buff, sizeof(buff), bytesRead);
+		roBytePtr buff = fileSystem.getBuffer(stream, chunkSize, bytesRead);
+
+		// An empty buffer may be the end of file or an error, read() tell which
+		png_byte c;
+		if(!buff || bytesRead == 0) {
+			buff = &c;
+			st = fileSystem.read(stream, &c, 1, bytesRead);
+		}
+
 		if(!st || bytesRead == 0) {
+			roLog("error", "PngLoader: Fail to read file '%s', reason: %s\n", texture->uri().c_str(), st.c_str());
 			nextFun = &PngLoader::abort;
 			break;
 		}
@@ -2,6 +2,7 @@
 #include "roSubSystems.h"
 #include "render/roFont.h"
 #include "base/roCpuProfiler.h"
+#include "base/roFrameArena.h"
 #include "base/roLog.h"
 #include "base/roMemoryProfiler.h"
 #include "base/roResource.h"
@@ -178,6 +179,9 @@ void SubSystems::tick()
 {
 	roScopeProfile(__FUNCTION__);
 
+	// Scratch data of the last frame is no longer needed
+	FrameArena::current().tick();
+
 	if(taskPool)
 		taskPool->doSomeTask(1.0f / 100.0f);
 
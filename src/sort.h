@@ -1,17 +1,19 @@
 #ifndef __SORT_H__
 #define __SORT_H__
 
-#include "taskpool.h"
+#include "../roar/base/roParallel.h"
 
 /*!	A parallel merge sort algorithm
-	The type T should be bitwise movable
+	The type T should be bitwise movable.
+	Blocks of MinItemCountPerTask items are sorted with parallelFor(), then merged
+	bottom up, where each pass merges pairs of adjacent runs with parallelFor() again.
 
 	Example:
 	@code
 	struct Comparator {
 		static bool isCorrectOrder(int a, int b) { return a < b; }
 	};
-	TaskPool taskPool;
+	ro::TaskPool taskPool;
 	int data[] = { 3, 6, 1, 2 };
 	Sorter<int, Comparator, 1024> sorter(&data[0], 4, &taskPool);
 	sorter.sort();
@@ -21,49 +23,33 @@ template<class T, class Comparator, int MinItemCountPerTask>
 class Sorter
 {
 public:
-	Sorter(T* data, unsigned count, TaskPool* taskPool)
+	Sorter(T* data, unsigned count, ro::TaskPool* taskPool)
 	{
 		_data = data;
 		_count = count;
-		_tempToFree = rhnew<T>(count);
+		_tempToFree = roMalloc(count * sizeof(T));
 		_temp = (T*)_tempToFree;
 		_taskPool = taskPool;
-		_taskToWait = 0;
 	}
 
-	Sorter(T* data, unsigned count, T* temp, TaskPool* taskPool)
+	Sorter(T* data, unsigned count, T* temp, ro::TaskPool* taskPool)
 	{
 		_data = data;
 		_count = count;
 		_tempToFree = NULL;
 		_temp = temp;
 		_taskPool = taskPool;
-		_taskToWait = 0;
 	}
 
 	~Sorter()
 	{
-		if(_taskPool)
-			_taskPool->wait(_taskToWait);
-		rhdelete(_tempToFree);
+		roFree(_tempToFree);
 	}
 
 	void sort();
 
 public:
-	T* _data;
-	T* _temp;
-	void* _tempToFree;
-	unsigned _count;
-	TaskPool* _taskPool;
-	TaskId _taskToWait;
-};
-
-template<class T, class Comparator, int MinItemCountPerTask>
-class SorterTask : public Task
-{
-public:
-	void swap(T& a, T& b)
+	static void swap(T& a, T& b)
 	{
 		T c = a;
 		a = b;
@@ -74,22 +60,19 @@ public:
 
 	void sort(int start, int count);
 
-	void run(TaskPool* taskPool);
-
-	void runTask(TaskPool* taskPool, int start, int count, int splitCount);
-
-	Sorter<T, Comparator, MinItemCountPerTask>* _sorter;
-
-	int _start, _count;
-	int _splitCount;
+	T* _data;
+	T* _temp;
+	void* _tempToFree;
+	unsigned _count;
+	ro::TaskPool* _taskPool;
 };
 
 template<class T, class Comparator, int MinItemCountPerTask>
-void SorterTask<T, Comparator ,MinItemCountPerTask>::merge(int iA, int nA, int iB, int nB)
+void Sorter<T, Comparator, MinItemCountPerTask>::merge(int iA, int nA, int iB, int nB)
 {
 	T* p;
-	T* data = _sorter->_data;
-	T* temp = _sorter->_temp;
+	T* data = _data;
+	T* temp = _temp;
 	int iC, nC;
 	
 	// Find first item not already at its place
@@ -134,7 +117,7 @@ void SorterTask<T, Comparator ,MinItemCountPerTask>::merge(int iA, int nA, int i
 }
 
 template<class T, class Comparator, int MinItemCountPerTask>
-void SorterTask<T, Comparator, MinItemCountPerTask>::sort(int start, int count)
+void Sorter<T, Comparator, MinItemCountPerTask>::sort(int start, int count)
 {
 	int half;
 
@@ -142,11 +125,11 @@ void SorterTask<T, Comparator, MinItemCountPerTask>::sort(int start, int count)
 	{
 	case 0:
 	case 1:
-		ASSERT(false);
+		roAssert(false);
 		return;
 	case 2:
 	{	
-		T* data = _sorter->_data + start;
+		T* data = _data + start;
 		
 		if(!Comparator::isCorrectOrder(data[0], data[1]))
 			swap(data[0], data[1]); 
@@ -155,7 +138,7 @@ void SorterTask<T, Comparator, MinItemCountPerTask>::sort(int start, int count)
 	
 	case 3:
 	{
-		T* data = _sorter->_data + start;
+		T* data = _data + start;
 		T tmp;
 
 		int k	= (Comparator::isCorrectOrder(data[0], data[1]) ? 1:0)
@@ -182,7 +165,7 @@ void SorterTask<T, Comparator, MinItemCountPerTask>::sort(int start, int count)
 				swap(data[0], data[2]);
 				break;
 			default:
-				ASSERT(false);
+				roAssert(false);
 		}
 
 		if(!Comparator::isCorrectOrder(data[0], data[1]))
@@ -209,49 +192,43 @@ void SorterTask<T, Comparator, MinItemCountPerTask>::sort(int start, int count)
 }
 
 template<class T, class Comparator, int MinItemCountPerTask>
-void SorterTask<T, Comparator, MinItemCountPerTask>::run(TaskPool* taskPool)
+void Sorter<T, Comparator, MinItemCountPerTask>::sort()
 {
-	runTask(taskPool, _start, _count, _splitCount);
-}
+	if(_count < 2)
+		return;
 
-template<class T, class Comparator, int MinItemCountPerTask>
-void SorterTask<T, Comparator, MinItemCountPerTask>::runTask(TaskPool* taskPool, int start, int count, int splitCount)
-{
-	if(count < MinItemCountPerTask || splitCount > 4) {
-		sort(start, count);
+	if(!_taskPool) {
+		sort(0, _count);
 		return;
 	}
 
-	int half = count / 2;
-
-	// Sort each half
-	SorterTask newTask;
-	newTask._sorter = _sorter;
-	newTask._start = start;
-	newTask._count = half;
-	newTask._splitCount = splitCount + 1;
-
-	TaskId taskId = taskPool->addFinalized(&newTask);
-	
-	runTask(taskPool, start + half, count - half, splitCount + 1);
-
-	taskPool->wait(taskId);
-	
-	// Merge result
-	merge(start, half, start+half, count-half);
-}
-
-template<class T, class Comparator, int MinItemCountPerTask>
-void Sorter<T, Comparator, MinItemCountPerTask>::sort()
-{
-	SorterTask<T, Comparator, MinItemCountPerTask> sorterTask;
-	sorterTask._sorter = this;
-	sorterTask._splitCount = 0;
-
-	if(!_taskPool)
-		sorterTask.sort(0, _count);
-	else
-		sorterTask.runTask(_taskPool, 0, _count, 0);
+	// Sort each block, the last one may be smaller
+	const int blockSize = MinItemCountPerTask < 4 ? 4 : MinItemCountPerTask;
+	const int count = int(_count);
+	const roSize blockCount = (count + blockSize - 1) / blockSize;
+
+	ro::parallelFor(*_taskPool, 0, blockCount, 1, [&](roSize b, roSize e) {
+		for(roSize i=b; i<e; ++i) {
+			int start = int(i) * blockSize;
+			int n = roMinOf2(blockSize, count - start);
+			if(n > 1)
+				sort(start, n);
+		}
+	});
+
+	// Merge adjacent pairs of sorted runs, doubling the run size on each pass
+	for(int runSize = blockSize; runSize < count; runSize *= 2) {
+		const roSize pairCount = (count + 2 * runSize - 1) / (2 * runSize);
+		ro::parallelFor(*_taskPool, 0, pairCount, 1, [&](roSize b, roSize e) {
+			for(roSize i=b; i<e; ++i) {
+				int start = int(i) * 2 * runSize;
+				int nA = roMinOf2(runSize, count - start);
+				int nB = roMinOf2(runSize, count - start - nA);
+				if(nB > 0)
+					merge(start, nA, start + nA, nB);
+			}
+		});
+	}
 }
 
 #endif	// __SORT_H__
@@ -0,0 +1,321 @@
+#include "pch.h"
+#include "../../roar/base/roByteQueue.h"
+#include "../../roar/base/roLog.h"
+#include "../../roar/base/roRingBuffer.h"
+#include "../../roar/base/roStopWatch.h"
+#include "../../roar/base/roTaskPool.h"
+
+using namespace ro;
+
+static const bool benchmark = false;
+
+struct ByteQueueTest {};
+
+struct Message
+{
+	roUint32 producer;
+	roUint32 sequence;
+};
+
+// Message of varying size, starting with a Message and filled with a pattern derived from it
+static roSize messageSize(roUint32 sequence)
+{
+	return sizeof(Message) + (sequence * 7) % 41;
+}
+
+static void fillMessage(roByte* p, roUint32 producer, roUint32 sequence)
+{
+	Message m = { producer, sequence };
+	roMemcpy(p, &m, sizeof(m));
+	for(roSize i=sizeof(m); i<messageSize(sequence); ++i)
+		p[i] = roByte(sequence + i);
+}
+
+static bool checkMessage(const roByte* p, roSize size, Message& m)
+{
+	if(size < sizeof(Message)) return false;
+	roMemcpy(&m, p, sizeof(m));
+	if(size != messageSize(m.sequence)) return false;
+	for(roSize i=sizeof(m); i<size; ++i)
+		if(p[i] != roByte(m.sequence + i)) return false;
+	return true;
+}
+
+TEST_FIXTURE(ByteQueueTest, spsc)
+{
+	SpscByteQueue q;
+	roSize size = 0;
+	CHECK(!q.reserveWrite(1));
+	CHECK(!q.read(size));
+
+	CHECK(q.init(100));
+	CHECK_EQUAL(128u, q.capacity());
+	CHECK(!q.init(100));
+	CHECK(q.isEmpty());
+
+	// Too big
+	CHECK(!q.reserveWrite(q.maxMessageSize() + 1));
+	roByte* p = NULL;
+	CHECK_EQUAL(roStatus::size_limit_reached, q.reserveWriteWait(q.maxMessageSize() + 1, p));
+
+	// Commit less than reserved
+	p = q.reserveWrite(10);
+	CHECK(p);
+	roMemcpy(p, "hello", 5);
+	q.commitWrite(5);
+	CHECK(!q.isEmpty());
+
+	p = q.read(size);
+	CHECK_EQUAL(5u, size);
+	CHECK(memcmp(p, "hello", 5) == 0);
+	q.commitRead();
+	CHECK(!q.read(size));
+	CHECK(q.isEmpty());
+
+	// Empty message
+	CHECK(q.write(NULL, 0));
+	CHECK(q.read(size));
+	CHECK_EQUAL(0u, size);
+	q.commitRead();
+
+	// Full
+	roSize count = 0;
+	while((p = q.reserveWrite(8)) != NULL) {
+		q.commitWrite(8);
+		++count;
+	}
+	CHECK(count > 0 && count <= 128 / 16);
+	CHECK(q.read(size));
+	q.commitRead();
+	CHECK(q.reserveWrite(8));
+	q.commitWrite(8);
+
+	// Wrap around many times with varying sizes
+	while(q.read(size))
+		q.commitRead();
+	for(roUint32 i=0; i<1000; ++i) {
+		p = q.reserveWrite(messageSize(i));
+		CHECK(p);
+		if(!p) break;
+		fillMessage(p, 0, i);
+		q.commitWrite(messageSize(i));
+
+		Message m;
+		p = q.read(size);
+		CHECK(p && checkMessage(p, size, m));
+		CHECK_EQUAL(i, m.sequence);
+		q.commitRead();
+	}
+
+	// Closing still let the committed messages out
+	CHECK(q.write("a", 1));
+	q.close();
+	CHECK(q.isClosed());
+	CHECK(!q.reserveWrite(1));
+	CHECK_EQUAL(roStatus::end_of_data, q.write("b", 1));
+	CHECK(q.readWait(p, size));
+	CHECK_EQUAL('a', char(*p));
+	q.commitRead();
+	CHECK_EQUAL(roStatus::end_of_data, q.readWait(p, size));
+}
+
+TEST_FIXTURE(ByteQueueTest, mpsc)
+{
+	MpscByteQueue q;
+	CHECK(q.init(256));
+
+	// Committed out of order, read in order
+	roByte* a = q.reserveWrite(4);
+	roByte* b = q.reserveWrite(4);
+	CHECK(a && b && a != b);
+	roMemcpy(b, "bbbb", 4);
+	q.commitWrite(b, 4);
+
+	roSize size = 0;
+	CHECK(!q.read(size));
+
+	roMemcpy(a, "aa", 2);
+	q.commitWrite(a, 2);
+
+	roByte* p = q.read(size);
+	CHECK_EQUAL(2u, size);
+	CHECK(p && memcmp(p, "aa", 2) == 0);
+	q.commitRead();
+	p = q.read(size);
+	CHECK_EQUAL(4u, size);
+	CHECK(p && memcmp(p, "bbbb", 4) == 0);
+	q.commitRead();
+	CHECK(!q.read(size));
+
+	// Wrap around many times
+	for(roUint32 i=0; i<1000; ++i) {
+		p = q.reserveWrite(messageSize(i));
+		CHECK(p);
+		if(!p) break;
+		fillMessage(p, 0, i);
+		q.commitWrite(p, messageSize(i));
+
+		Message m;
+		p = q.read(size);
+		CHECK(p && checkMessage(p, size, m));
+		CHECK_EQUAL(i, m.sequence);
+		q.commitRead();
+	}
+
+	q.close();
+	CHECK_EQUAL(roStatus::end_of_data, q.readWait(p, size));
+}
+
+// Producers on TaskPool threads, consumer on this thread, small queue to exercise the blocking waits
+// Return the number of messages received in order
+template<class Queue, class Commit>
+static roSize producersAndConsumer(roSize producerCount, roUint32 messageCount, roSize capacity, Commit commit)
+{
+	Queue q;
+	if(!q.init(capacity))
+		return 0;
+
+	TaskPool taskPool;
+	taskPool.init(producerCount);
+	for(roSize i=0; i<producerCount; ++i) {
+		taskPool.addFinalized([&q, i, messageCount, commit]() {
+			for(roUint32 s=0; s<messageCount; ++s) {
+				roByte* p = NULL;
+				if(!q.reserveWriteWait(messageSize(s), p))
+					break;
+				fillMessage(p, roUint32(i), s);
+				commit(q, p, messageSize(s));
+			}
+		});
+	}
+
+	Array<roUint32> expected;
+	expected.resize(producerCount, 0);
+	roSize received = 0;
+	while(received < producerCount * messageCount) {
+		roByte* p = NULL;
+		roSize size = 0;
+		if(!q.readWait(p, size))
+			break;
+
+		Message m;
+		if(!checkMessage(p, size, m) || m.producer >= producerCount || m.sequence != expected[m.producer])
+			break;
+		++expected[m.producer];
+		q.commitRead();
+		++received;
+	}
+
+	q.close();
+	taskPool.waitAll();
+	return received;
+}
+
+TEST_FIXTURE(ByteQueueTest, threads)
+{
+	auto spscCommit = [](SpscByteQueue& q, roByte*, roSize size) { q.commitWrite(size); };
+	auto mpscCommit = [](MpscByteQueue& q, roByte* p, roSize size) { q.commitWrite(p, size); };
+	CHECK_EQUAL(100000u, producersAndConsumer<SpscByteQueue>(1, 100000, 1024, spscCommit));
+	CHECK_EQUAL(100000u, producersAndConsumer<MpscByteQueue>(1, 100000, 1024, mpscCommit));
+	CHECK_EQUAL(200000u, producersAndConsumer<MpscByteQueue>(4, 50000, 1024, mpscCommit));
+}
+
+// Messages per second from a TaskPool thread to this thread, against a mutex-guarded RingBuffer
+TEST_FIXTURE(ByteQueueTest, benchmark)
+{
+	const roUint32 count = benchmark ? 20000000 : 100000;
+	const roSize capacity = 64 * 1024;
+
+	{	SpscByteQueue q;
+		CHECK(q.init(capacity));
+		TaskPool taskPool;
+		taskPool.init(1);
+
+		StopWatch stopWatch;
+		taskPool.addFinalized([&q, count]() {
+			for(roUint32 i=0; i<count; ++i) {
+				roByte* p = NULL;
+				if(!q.reserveWriteWait(sizeof(i), p)) break;
+				roMemcpy(p, &i, sizeof(i));
+				q.commitWrite(sizeof(i));
+			}
+		});
+
+		roUint32 sum = 0;
+		for(roUint32 i=0; i<count; ++i) {
+			roByte* p = NULL;
+			roSize size = 0;
+			if(!q.readWait(p, size)) break;
+			sum += *reinterpret_cast<roUint32*>(p);
+			q.commitRead();
+		}
+		taskPool.waitAll();
+		CHECK_EQUAL(roUint32(roUint64(count) * (count - 1) / 2), sum);
+
+		if(benchmark)
+			roLog("info", "SpscByteQueue: %.1f M messages/s\n", count / stopWatch.getDouble() / 1e6);
+	}
+
+	{	MpscByteQueue q;
+		CHECK(q.init(capacity));
+		TaskPool taskPool;
+		taskPool.init(1);
+
+		StopWatch stopWatch;
+		taskPool.addFinalized([&q, count]() {
+			for(roUint32 i=0; i<count; ++i)
+				if(!q.write(&i, sizeof(i))) break;
+		});
+
+		roUint32 sum = 0;
+		for(roUint32 i=0; i<count; ++i) {
+			roByte* p = NULL;
+			roSize size = 0;
+			if(!q.readWait(p, size)) break;
+			sum += *reinterpret_cast<roUint32*>(p);
+			q.commitRead();
+		}
+		taskPool.waitAll();
+		CHECK_EQUAL(roUint32(roUint64(count) * (count - 1) / 2), sum);
+
+		if(benchmark)
+			roLog("info", "MpscByteQueue: %.1f M messages/s\n", count / stopWatch.getDouble() / 1e6);
+	}
+
+	// What we used to do: copy in and out of a RingBuffer under a mutex
+	{	RingBuffer ringBuffer;
+		CondVar condVar;
+		TaskPool taskPool;
+		taskPool.init(1);
+
+		StopWatch stopWatch;
+		taskPool.addFinalized([&ringBuffer, &condVar, count]() {
+			for(roUint32 i=0; i<count; ++i) {
+				roScopeLock(condVar);
+				roByte* p = NULL;
+				if(!ringBuffer.write(sizeof(i), p)) break;
+				roMemcpy(p, &i, sizeof(i));
+				ringBuffer.commitWrite(sizeof(i));
+				condVar.signal();
+			}
+		});
+
+		roUint32 sum = 0;
+		for(roUint32 i=0; i<count; ++i) {
+			roScopeLock(condVar);
+			roByte* p = NULL;
+			roSize size = sizeof(i);
+			while(!ringBuffer.atomicRead(size, p))
+				condVar.waitNoLock();
+			roUint32 v;
+			roMemcpy(&v, p, sizeof(v));
+			sum += v;
+			ringBuffer.commitRead(sizeof(v));
+		}
+		taskPool.waitAll();
+		CHECK_EQUAL(roUint32(roUint64(count) * (count - 1) / 2), sum);
+
+		if(benchmark)
+			roLog("info", "RingBuffer with mutex: %.1f M messages/s\n", count / stopWatch.getDouble() / 1e6);
+	}
+}
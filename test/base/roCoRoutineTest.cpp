@@ -4,6 +4,8 @@
 
 using namespace ro;
 
+static const bool benchmark = false;
+
 struct CoroutineTest {};
 
 namespace {
@@ -244,6 +246,159 @@ TEST_FIXTURE(CoroutineTest, socket)
 		coYield();
 }
 
+// Keep a large number of loopback connections open at the same time, which is
+// beyond the FD_SETSIZE limit of the select() backend when benchmark is enabled.
+// NOTE: The open file limit should allow twice the connection count
+TEST_FIXTURE(CoroutineTest, socketLoad)
+{
+	const roSize connectionCount = benchmark ? 50000 : 500;
+	const roSize listenerCount = 4;	// Spread over ports, one port can only take ~28k connections from the same loopback address
+	const roUint16 basePort = 18080;
+
+	CoSocket listeners[listenerCount];
+	for (roSize i = 0; i < listenerCount; ++i) {
+		roVerify(listeners[i].create(BsdSocket::TCP));
+		roVerify(listeners[i].bind(SockAddr(SockAddr::ipAny(), basePort + roUint16(i))));
+		roVerify(listeners[i].listen(unsigned(connectionCount / listenerCount)));
+	}
+
+	roSize acceptingCount = 0, serverCount = 0, handledCount = 0, failCount = 0;
+
+	for (roSize i = 0; i < listenerCount; ++i) {
+		CHECK(coRun([&, i]() {
+			++acceptingCount;
+			while (true) {
+				CoSocket* s = new CoSocket;
+				if (!listeners[i].accept(*s)) {
+					delete s;
+					break;
+				}
+
+				// Reply one request, then wait for the client to close
+				coRun([&, s]() {
+					++serverCount;
+					roUtf8 buf[128];
+					roSize len = sizeof(buf);
+					if (s->receive(buf, len) && s->send("pong", 4))
+						++handledCount;
+					while (len = sizeof(buf), s->receive(buf, len) && len) {}
+					s->close();
+					delete s;
+					--serverCount;
+				}, "socketLoad server", roKB(16));
+			}
+			--acceptingCount;
+		}, "socketLoad listener", roKB(16)));
+	}
+
+	// The client sockets stay open after their coroutine finished
+	CoSocket* clients = new CoSocket[connectionCount];
+	roSize clientDone = 0;
+
+	StopWatch stopWatch;
+	for (roSize i = 0; i < connectionCount; ++i) {
+		CHECK(coRun([&, i]() {
+			CoSocket& s = clients[i];
+			SockAddr addr(SockAddr::ipLoopBack(), basePort + roUint16(i % listenerCount));
+
+			roUtf8 buf[16];
+			roSize len = sizeof(buf);
+			bool ok = s.create(BsdSocket::TCP) && s.connect(addr, 10) && s.send("ping", 4) && s.receive(buf, len);
+			failCount += ok ? 0 : 1;
+			++clientDone;
+		}, "socketLoad client", roKB(16)));
+	}
+
+	while (clientDone < connectionCount)
+		coYield();
+
+	CHECK_EQUAL(0u, failCount);
+	CHECK_EQUAL(connectionCount, handledCount);
+	CHECK_EQUAL(connectionCount, serverCount);
+
+	if (benchmark)
+		printf("socketLoad: %u concurrent connections established in %f seconds\n", unsigned(connectionCount), stopWatch.getFloat());
+
+	delete[] clients;
+	while (serverCount)
+		coYield();
+
+	// Closing the listener wake up the pending accept
+	for (roSize i = 0; i < listenerCount; ++i)
+		listeners[i].close();
+	while (acceptingCount)
+		coYield();
+}
+
+#include "../../roar/base/roRawFileSystem.h"
+
+// Vectored send with a large buffer in the middle, so that it must be resumed from
+// a partially sent buffer, follow by a sendFile() of part of a file
+TEST_FIXTURE(CoroutineTest, socketVectoredSend)
+{
+	const roUint16 port = 18090;
+	CoSocket listener;
+	roVerify(listener.create(BsdSocket::TCP));
+	roVerify(listener.bind(SockAddr(SockAddr::ipAny(), port)));
+	roVerify(listener.listen(1));
+
+	void* file = NULL;
+	roUint64 fileSize = 0;
+	CHECK(rawFileSystemOpenFile("Test.vc14.vcxproj", file));
+	CHECK(rawFileSystemSize(file, fileSize));
+	roUint64 fileOffset = fileSize / 3;
+
+	String fileContent;
+	fileContent.resize(roSize(fileSize));
+	CHECK(rawFileSystemAtomicRead(file, fileContent.c_str(), fileSize));
+
+	String big;
+	big.resize(roMB(4));
+	for (roSize i = 0; i < big.size(); ++i)
+		big[i] = char('a' + i % 26);
+
+	String expected = "Header\r\n";
+	expected += big;
+	expected += "\r\n";
+	expected += fileContent.c_str() + fileOffset;
+
+	String received;
+	bool serverDone = false;
+	CHECK(coRun([&]() {
+		CoSocket s;
+		CHECK(listener.accept(s));
+
+		char buf[roKB(16)];
+		roSize len;
+		while (len = sizeof(buf), s.receive(buf, len) && len)
+			received.append(buf, len);
+		serverDone = true;
+	}, "socketVectoredSend server", roKB(64)));
+
+	CoSocket s;
+	CHECK(s.create(BsdSocket::TCP));
+	CHECK(s.connect(SockAddr(SockAddr::ipLoopBack(), port), 1));
+
+	IoVec bufs[] = {
+		{ "Header\r\n", 8 },
+		{ NULL, 0 },
+		{ big.c_str(), big.size() },
+		{ "\r\n", 2 }
+	};
+	CHECK(s.send(bufs, roCountof(bufs)));
+	CHECK(s.sendFile(file, fileOffset, fileSize - fileOffset));
+	CHECK(s.close());
+
+	while (!serverDone)
+		coYield();
+
+	CHECK_EQUAL(expected.size(), received.size());
+	CHECK(expected == received);
+
+	rawFileSystemCloseFile(file);
+	listener.close();
+}
+
 TEST_FIXTURE(CoroutineTest, socketTimeout)
 {
 	SockAddr addr;
@@ -1,11 +1,34 @@
 #include "pch.h"
 #include "../../roar/base/roRawFileSystem.h"
+#include "../../roar/base/roHttpCacheFileSystem.h"
 #include "../../roar/base/roHttpFileSystem.h"
+#include "../../roar/base/roMmapFileSystem.h"
+#include "../../roar/base/roPackFileSystem.h"
+#include "../../roar/base/roArray.h"
+#include "../../roar/base/roAtomic.h"
+#include "../../roar/base/roCoRoutine.h"
+#include "../../roar/base/roIOStream.h"
+#include "../../roar/base/roLog.h"
+#include "../../roar/base/roStopWatch.h"
+#include "../../roar/base/roStringFormat.h"
 #include "../../roar/base/roStringUtility.h"
 #include "../../roar/base/roString.h"
+#include "../../roar/base/roTaskPool.h"
+#include "../../roar/network/roHttp.h"
+#include <stdio.h>
+
+#if roOS_WIN
+#	include <direct.h>
+#else
+#	include <fcntl.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
 
 using namespace ro;
 
+static const bool benchmark = false;
+
 struct FileSystemTest {};
 
 TEST_FIXTURE(FileSystemTest, defaultFS)
@@ -82,6 +105,681 @@ TEST_FIXTURE(FileSystemTest, rawFS_directoryListing)
 	CHECK(true);
 }
 
+static const RawFileSystemOptions::AsyncIo asyncIoModes[] = {
+	RawFileSystemOptions::AsyncIo_None,
+	RawFileSystemOptions::AsyncIo_ThreadPool,
+	RawFileSystemOptions::AsyncIo_IoUring,
+};
+
+static const char* asyncIoNames[] = { "blocking", "thread pool", "io_uring" };
+
+TEST_FIXTURE(FileSystemTest, rawFS_asyncRead)
+{
+	const char* path = "rawFSAsyncTest.tmp";
+	Array<roByte> content;
+	content.resize(300 * 1024 + 11);
+	for(roSize i=0; i<content.size(); ++i)
+		content[i] = roByte(i * 13 + i / 509);
+
+	FILE* f = fopen(path, "wb");
+	CHECK(f);
+	if(!f) return;
+	fwrite(content.typedPtr(), 1, content.size(), f);
+	fclose(f);
+
+	for(roSize m=0; m<roCountof(asyncIoModes); ++m) {
+		rawFileSystemOptions.asyncIo = asyncIoModes[m];
+
+		void* file = NULL;
+		CHECK(rawFileSystemOpenFile(path, file));
+
+		// Poll like a loader task would, the data is ready once it returns false
+		while(rawFileSystemReadWillBlock(file, 100 * 1024)) {}
+		roUint64 readable = 0;
+		roByte* buf = rawFileSystemGetBuffer(file, 100 * 1024, readable);
+		CHECK_EQUAL(100u * 1024, readable);
+		CHECK(memcmp(buf, content.typedPtr(), roSize(readable)) == 0);
+
+		// Taken buffer survive further reads
+		rawFileSystemTakeBuffer(file);
+		while(rawFileSystemReadWillBlock(file, 1)) {}
+
+		roByte small[1000];
+		roUint64 bytesRead = 0;
+		CHECK(rawFileSystemRead(file, small, sizeof(small), bytesRead));
+		CHECK_EQUAL(sizeof(small), bytesRead);
+		CHECK(memcmp(small, content.typedPtr() + 100 * 1024, sizeof(small)) == 0);
+		CHECK(memcmp(buf, content.typedPtr(), 100 * 1024) == 0);
+		rawFileSystemUntakeBuffer(file, buf);
+
+		// A read in flight must not disturb seek
+		rawFileSystemReadWillBlock(file, 64 * 1024);
+		CHECK(rawFileSystemSeek(file, -100, FileSystem::SeekOrigin_End));
+		CHECK(rawFileSystemAtomicRead(file, small, 100));
+		CHECK(memcmp(small, content.typedPtr() + content.size() - 100, 100) == 0);
+		CHECK_EQUAL(Status::file_ended, rawFileSystemRead(file, small, 1, bytesRead));
+
+		// The rest of the file as a whole
+		CHECK(rawFileSystemSeek(file, 7, FileSystem::SeekOrigin_Begin));
+		while(rawFileSystemReadWillBlock(file, roUint64(-1))) {}
+		buf = rawFileSystemGetBuffer(file, roUint64(-1), readable);
+		CHECK_EQUAL(content.size() - 7, readable);
+		CHECK(memcmp(buf, content.typedPtr() + 7, roSize(readable)) == 0);
+
+		rawFileSystemGetBuffer(file, 10, readable);
+		CHECK_EQUAL(0u, readable);
+
+		rawFileSystemCloseFile(file);
+	}
+
+	rawFileSystemOptions.asyncIo = RawFileSystemOptions::AsyncIo_Auto;
+	remove(path);
+}
+
+// Consume a file chunk by chunk with getBuffer(), every chunk should continue where the last one ended
+TEST_FIXTURE(FileSystemTest, rawFS_getBufferChunks)
+{
+	const char* path = "rawFSChunkTest.tmp";
+	const roSize chunkSize = 1024;
+	Array<roByte> content;
+	content.resize(chunkSize * 20 + 7);
+	for(roSize i=0; i<content.size(); ++i)
+		content[i] = roByte(i * 7 + i / 251);
+
+	FILE* f = fopen(path, "wb");
+	CHECK(f);
+	if(!f) return;
+	fwrite(content.typedPtr(), 1, content.size(), f);
+	fclose(f);
+
+	for(roSize m=0; m<roCountof(asyncIoModes); ++m) {
+		rawFileSystemOptions.asyncIo = asyncIoModes[m];
+
+		void* file = NULL;
+		CHECK(rawFileSystemOpenFile(path, file));
+
+		Array<roByte> loaded;
+		for(roSize i=0; ; ++i) {
+			// Ask for more than a chunk sometimes, leaving data behind in the file system's buffer
+			if(i % 3 == 0)
+				while(rawFileSystemReadWillBlock(file, chunkSize * 3 + 100)) {}
+
+			roUint64 readable = 0;
+			roByte* buf = rawFileSystemGetBuffer(file, chunkSize, readable);
+			if(readable == 0)
+				break;
+			CHECK(buf);
+			loaded.pushBack(buf, roSize(readable));
+		}
+
+		CHECK_EQUAL(content.size(), loaded.size());
+		CHECK(loaded.size() == content.size() && memcmp(loaded.typedPtr(), content.typedPtr(), content.size()) == 0);
+
+		rawFileSystemCloseFile(file);
+	}
+
+	rawFileSystemOptions.asyncIo = RawFileSystemOptions::AsyncIo_Auto;
+	remove(path);
+}
+
+// Load many small files with a number of loaders in flight, as the TaskPool would
+// with loader tasks re-scheduling themselves whenever readWillBlock() return true.
+TEST_FIXTURE(FileSystemTest, rawFS_asyncReadBenchmark)
+{
+	const char* dir = "rawFSAsyncBenchmark";
+	const roSize fileCount = benchmark ? 10000 : 200;
+	const roSize loaderCount = 64;
+
+#if roOS_WIN
+	_mkdir(dir);
+#else
+	mkdir(dir, 0755);
+#endif
+
+	String path;
+	Array<roByte> content;
+	roUint64 totalSize = 0;
+	for(roSize i=0; i<fileCount; ++i) {
+		content.resize(1024 + i * 37 % (7 * 1024));
+		for(roSize j=0; j<content.size(); ++j)
+			content[j] = roByte(i + j);
+		totalSize += content.size();
+
+		path.clear();
+		strFormat(path, "{}/{}.tmp", dir, i);
+		FILE* f = fopen(path.c_str(), "wb");
+		CHECK(f);
+		if(!f) return;
+		fwrite(content.typedPtr(), 1, content.size(), f);
+		fclose(f);
+	}
+
+#if !roOS_WIN
+	::sync();
+#endif
+
+	if(benchmark)
+		roLog("info", "io_uring available: %s\n", rawFileSystemIoUringAvailable() ? "yes" : "no");
+
+	for(roSize m=0; m<roCountof(asyncIoModes); ++m) {
+		// Cold page cache
+#if !roOS_WIN
+		for(roSize i=0; i<fileCount; ++i) {
+			path.clear();
+			strFormat(path, "{}/{}.tmp", dir, i);
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if(fd < 0) continue;
+			::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			::close(fd);
+		}
+#endif
+
+		rawFileSystemOptions.asyncIo = asyncIoModes[m];
+		StopWatch stopWatch;
+
+		void* loaders[loaderCount] = { NULL };
+		roSize loaderFile[loaderCount] = { 0 };
+		roSize nextFile = 0, loaded = 0, wrongCount = 0;
+
+		while(loaded < fileCount) {
+			for(roSize l=0; l<loaderCount; ++l) {
+				if(!loaders[l]) {
+					if(nextFile >= fileCount) continue;
+					path.clear();
+					strFormat(path, "{}/{}.tmp", dir, nextFile);
+					CHECK(rawFileSystemOpenFile(path.c_str(), loaders[l]));
+					loaderFile[l] = nextFile++;
+				}
+
+				if(rawFileSystemReadWillBlock(loaders[l], roUint64(-1)))
+					continue;
+
+				roUint64 readable = 0;
+				roByte* buf = rawFileSystemGetBuffer(loaders[l], roUint64(-1), readable);
+				roSize i = loaderFile[l];
+				if(readable != 1024 + i * 37 % (7 * 1024) || !buf || buf[readable - 1] != roByte(i + readable - 1))
+					++wrongCount;
+
+				rawFileSystemCloseFile(loaders[l]);
+				loaders[l] = NULL;
+				++loaded;
+			}
+		}
+
+		CHECK_EQUAL(0u, wrongCount);
+
+		if(benchmark) {
+			double sec = stopWatch.getDouble();
+			roLog("info", "rawFileSystem %s: %u files in %.3fs, %.0f files/s, %.1f MB/s\n",
+				asyncIoNames[m], (unsigned)fileCount, sec, fileCount / sec, totalSize / sec / (1024 * 1024));
+		}
+	}
+
+	rawFileSystemOptions.asyncIo = RawFileSystemOptions::AsyncIo_Auto;
+
+	for(roSize i=0; i<fileCount; ++i) {
+		path.clear();
+		strFormat(path, "{}/{}.tmp", dir, i);
+		remove(path.c_str());
+	}
+#if roOS_WIN
+	_rmdir(dir);
+#else
+	rmdir(dir);
+#endif
+}
+
+TEST_FIXTURE(FileSystemTest, mmapFS)
+{
+	const char* path = "mmapFSTest.tmp";
+	Array<roByte> content;
+	content.resize(100 * 1024 + 3);
+	for(roSize i=0; i<content.size(); ++i)
+		content[i] = roByte(i * 7 + i / 251);
+
+	FILE* f = fopen(path, "wb");
+	CHECK(f);
+	if(!f) return;
+	fwrite(content.typedPtr(), 1, content.size(), f);
+	fclose(f);
+
+	void* file = NULL;
+	CHECK(!mmapFileSystemOpenFile("Non-existing file", file));
+	CHECK(mmapFileSystemOpenFile(path, file));
+
+	roUint64 size = 0;
+	CHECK(mmapFileSystemSize(file, size));
+	CHECK_EQUAL(content.size(), size);
+
+	CHECK(!mmapFileSystemReadWillBlock(file, 64 * 1024));
+
+	// read() copy
+	roByte buf[1000];
+	roUint64 bytesRead = 0;
+	CHECK(mmapFileSystemRead(file, buf, sizeof(buf), bytesRead));
+	CHECK_EQUAL(sizeof(buf), bytesRead);
+	CHECK(memcmp(buf, content.typedPtr(), sizeof(buf)) == 0);
+
+	// getBuffer() point into the mapping, taken buffers outlive the file
+	roUint64 readable = 0;
+	roByte* buf1 = mmapFileSystemGetBuffer(file, 8000, readable);
+	CHECK_EQUAL(8000u, readable);
+	CHECK(memcmp(buf1, content.typedPtr() + 1000, 8000) == 0);
+	mmapFileSystemTakeBuffer(file);
+
+	CHECK(mmapFileSystemSeek(file, -10, FileSystem::SeekOrigin_End));
+	roByte* buf2 = mmapFileSystemGetBuffer(file, 8000, readable);
+	CHECK_EQUAL(10u, readable);
+	CHECK(memcmp(buf2, content.typedPtr() + content.size() - 10, 10) == 0);
+	mmapFileSystemTakeBuffer(file);
+
+	mmapFileSystemGetBuffer(file, 8000, readable);
+	CHECK_EQUAL(0u, readable);
+	CHECK_EQUAL(Status::file_ended, mmapFileSystemRead(file, buf, sizeof(buf), bytesRead));
+	CHECK_EQUAL(Status::file_ended, mmapFileSystemAtomicRead(file, buf, 1));
+
+	CHECK(mmapFileSystemSeek(file, 5, FileSystem::SeekOrigin_Begin));
+	CHECK(mmapFileSystemAtomicRead(file, buf, 20));
+	CHECK(memcmp(buf, content.typedPtr() + 5, 20) == 0);
+	CHECK(!mmapFileSystemSeek(file, -100, FileSystem::SeekOrigin_Current));
+
+	mmapFileSystemCloseFile(file);
+	CHECK(memcmp(buf1, content.typedPtr() + 1000, 8000) == 0);
+	mmapFileSystemUntakeBuffer(file, buf1);
+	CHECK(memcmp(buf2, content.typedPtr() + content.size() - 10, 10) == 0);
+	mmapFileSystemUntakeBuffer(file, buf2);
+
+	// Through the default fileSystem, the taken buffer still outlive the file
+	mmapFileSystemForLocalFiles = true;
+	CHECK(fileSystem.openFile(path, file));
+	buf1 = fileSystem.getBuffer(file, roUint64(-1), readable);
+	CHECK_EQUAL(content.size(), readable);
+	CHECK(memcmp(buf1, content.typedPtr(), content.size()) == 0);
+	fileSystem.takeBuffer(file);
+	fileSystem.closeFile(file);
+	CHECK(memcmp(buf1, content.typedPtr(), content.size()) == 0);
+	fileSystem.untakeBuffer(file, buf1);
+	mmapFileSystemForLocalFiles = false;
+
+	// Empty file
+	f = fopen(path, "wb");
+	fclose(f);
+	CHECK(mmapFileSystemOpenFile(path, file));
+	CHECK(mmapFileSystemSize(file, size));
+	CHECK_EQUAL(0u, size);
+	CHECK(!mmapFileSystemGetBuffer(file, 100, readable));
+	CHECK_EQUAL(Status::file_ended, mmapFileSystemRead(file, buf, sizeof(buf), bytesRead));
+	mmapFileSystemCloseFile(file);
+
+	remove(path);
+}
+
+static bool writeTestFile(const char* path, const void* data, roSize size)
+{
+	FILE* f = fopen(path, "wb");
+	if(!f) return false;
+	bool ok = fwrite(data, 1, size, f) == size;
+	return fclose(f) == 0 && ok;
+}
+
+static void makeTestDir(const char* path)
+{
+#if roOS_WIN
+	_mkdir(path);
+#else
+	mkdir(path, 0755);
+#endif
+}
+
+static void removeTestDir(const char* path)
+{
+#if roOS_WIN
+	_rmdir(path);
+#else
+	rmdir(path);
+#endif
+}
+
+static void dropFromPageCache(const char* path)
+{
+#if !roOS_WIN
+	int fd = ::open(path, O_RDONLY);
+	if(fd < 0) return;
+	::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	::close(fd);
+#endif
+}
+
+static void makeTextData(ByteArray& data, roSize size, roSize seed)
+{
+	static const char* words[] = { "texture ", "render ", "shader ", "audio ", "json ", "{ \"x\": 12 }\n", "node ", "http " };
+	data.clear();
+	roUint32 r = roUint32(seed) * 2654435761u + 1;
+	while(data.size() < size) {
+		r = r * 1103515245 + 12345;
+		const char* w = words[(r >> 16) % roCountof(words)];
+		data.pushBack((const roByte*)w, roMinOf2(roStrLen(w), size - data.size()));
+	}
+}
+
+static void makeRandomData(ByteArray& data, roSize size, roSize seed)
+{
+	data.resize(size);
+	roUint32 r = roUint32(seed) + 7;
+	for(roSize i=0; i<size; ++i) {
+		r = r * 1103515245 + 12345;
+		data[i] = roByte(r >> 16);
+	}
+}
+
+static bool sameBytes(const ByteArray& a, const ByteArray& b)
+{
+	return a.size() == b.size() && (a.size() == 0 || memcmp(a.typedPtr(), b.typedPtr(), a.size()) == 0);
+}
+
+static bool readWhole(FileSystem& fs, const char* uri, ByteArray& data)
+{
+	void* file = NULL;
+	if(!fs.openFile(uri, file)) return false;
+
+	roUint64 size = 0;
+	bool ok = fs.size(file, size);
+	roUint64 readable = 0;
+	roByte* p = fs.getBuffer(file, size, readable);
+	ok = ok && readable == size && (p || size == 0);
+	data.clear();
+	if(ok && size > 0)
+		data.pushBack(p, roSize(size));
+	fs.closeFile(file);
+	return ok;
+}
+
+TEST_FIXTURE(FileSystemTest, packFS)
+{
+	const char* dir = "packFSTest";
+	const char* packPath = "packFSTest.pak";
+	const char* names[] = { "a.txt", "b.bin", "big.bin", "sub/c.txt", "sub/deeper/d.txt", "zero.txt" };
+
+	makeTestDir(dir);
+	makeTestDir("packFSTest/sub");
+	makeTestDir("packFSTest/sub/deeper");
+
+	ByteArray contents[roCountof(names)];
+	makeTextData(contents[0], 10 * 1024, 1);		// Small compressed
+	makeRandomData(contents[1], 3000, 2);			// Small stored
+	makeRandomData(contents[2], 100 * 1024 + 5, 3);	// Large stored
+	makeTextData(contents[3], 500, 4);
+	makeTextData(contents[4], 200 * 1024, 5);		// Large compressed
+
+	String path;
+	for(roSize i=0; i<roCountof(names); ++i) {
+		path.clear();
+		strFormat(path, "{}/{}", dir, names[i]);
+		CHECK(writeTestFile(path.c_str(), contents[i].typedPtr(), contents[i].size()));
+	}
+
+	CHECK(packArchiveBuild(dir, packPath));
+
+	// The header and alignment of the large file
+	{	FILE* f = fopen(packPath, "rb");
+		CHECK(f);
+		PackHeader header;
+		CHECK_EQUAL(1u, fread(&header, sizeof(header), 1, f));
+		CHECK(memcmp(header.magic, "roPK", 4) == 0);
+		CHECK_EQUAL(roCountof(names), header.entryCount);
+
+		Array<PackEntry> entries(header.entryCount);
+		fseek(f, long(header.tocOffset), SEEK_SET);
+		CHECK_EQUAL(1u, fread(entries.typedPtr(), entries.sizeInByte(), 1, f));
+		fclose(f);
+
+		CHECK(entries[2].offset % 4096 == 0);
+		CHECK_EQUAL(PackEntry::Compression_GZip, entries[0].compression);
+		CHECK_EQUAL(PackEntry::Compression_None, entries[1].compression);
+		CHECK_EQUAL(PackEntry::Compression_GZip, entries[4].compression);
+		CHECK(entries[0].offset < entries[2].offset && entries[3].offset < entries[2].offset);
+	}
+
+	CHECK(packFileSystemMount(packPath, "data"));
+	CHECK(packFileSystemHasMount());
+
+	// Through the default fileSystem and directly
+	ByteArray data;
+	for(roSize i=0; i<roCountof(names); ++i) {
+		path.clear();
+		strFormat(path, "data/{}", names[i]);
+		CHECK(readWhole(fileSystem, path.c_str(), data));
+		CHECK(sameBytes(data, contents[i]));
+		CHECK(readWhole(packFileSystem, path.c_str(), data));
+		CHECK(sameBytes(data, contents[i]));
+	}
+
+	void* file = NULL;
+	CHECK_EQUAL(Status::file_not_found, packFileSystemOpenFile("data/none.txt", file));
+	CHECK_EQUAL(Status::file_not_found, packFileSystemOpenFile("a.txt", file));
+	CHECK(!fileSystem.openFile("data/none.txt", file));
+
+	// Seek and read, from the archive and from decompressed memory
+	for(roSize i=2; i<=4; i+=2) {
+		path.clear();
+		strFormat(path, "data/{}", names[i]);
+		CHECK(packFileSystemOpenFile(path.c_str(), file));
+		roByte buf[100];
+		CHECK(packFileSystemSeek(file, -100, FileSystem::SeekOrigin_End));
+		CHECK(packFileSystemAtomicRead(file, buf, sizeof(buf)));
+		CHECK(memcmp(buf, contents[i].typedPtr() + contents[i].size() - 100, 100) == 0);
+		CHECK_EQUAL(Status::file_ended, packFileSystemAtomicRead(file, buf, 1));
+
+		// Taken buffer outlive the file
+		CHECK(packFileSystemSeek(file, 1000, FileSystem::SeekOrigin_Begin));
+		roUint64 readable = 0;
+		roByte* p = packFileSystemGetBuffer(file, 5000, readable);
+		CHECK_EQUAL(5000u, readable);
+		packFileSystemTakeBuffer(file);
+		packFileSystemCloseFile(file);
+		CHECK(memcmp(p, contents[i].typedPtr() + 1000, 5000) == 0);
+		packFileSystemUntakeBuffer(file, p);
+
+		// Same through the default fileSystem
+		CHECK(fileSystem.openFile(path.c_str(), file));
+		CHECK(fileSystem.seek(file, 1000, FileSystem::SeekOrigin_Begin));
+		p = fileSystem.getBuffer(file, 5000, readable);
+		CHECK_EQUAL(5000u, readable);
+		fileSystem.takeBuffer(file);
+		fileSystem.closeFile(file);
+		CHECK(memcmp(p, contents[i].typedPtr() + 1000, 5000) == 0);
+		fileSystem.untakeBuffer(file, p);
+	}
+
+	// Readers of the same archive each have their own position, readWillBlock() let the io go on in the background
+	for(roSize m=0; m<roCountof(asyncIoModes); ++m) {
+		rawFileSystemOptions.asyncIo = asyncIoModes[m];
+		CHECK(packFileSystemMount(packPath, "async"));
+
+		const char* readerNames[] = { "async/big.bin", "async/big.bin", "async/sub/deeper/d.txt" };
+		const roSize readerEntries[] = { 2, 2, 4 };
+		const roSize readerBegin[] = { 0, 50000, 0 };
+		void* readers[3] = { NULL };
+		ByteArray loaded[3];
+		roSize endedCount = 0;
+
+		for(roSize k=0; k<3; ++k) {
+			CHECK(packFileSystemOpenFile(readerNames[k], readers[k]));
+			CHECK(packFileSystemSeek(readers[k], readerBegin[k], FileSystem::SeekOrigin_Begin));
+		}
+
+		while(endedCount < 3) {
+			for(roSize k=0; k<3; ++k) {
+				if(!readers[k] || packFileSystemReadWillBlock(readers[k], 4096))
+					continue;
+
+				roByte buf[4096];
+				roUint64 bytesRead = 0;
+				Status st = packFileSystemRead(readers[k], buf, sizeof(buf), bytesRead);
+				if(st) {
+					loaded[k].insert(loaded[k].size(), buf, roSize(bytesRead));
+					continue;
+				}
+
+				CHECK_EQUAL(Status::file_ended, st);
+				packFileSystemCloseFile(readers[k]);
+				readers[k] = NULL;
+				++endedCount;
+			}
+		}
+
+		for(roSize k=0; k<3; ++k) {
+			const ByteArray& c = contents[readerEntries[k]];
+			CHECK_EQUAL(c.size() - readerBegin[k], loaded[k].size());
+			CHECK(loaded[k].size() == c.size() - readerBegin[k] && memcmp(loaded[k].typedPtr(), c.typedPtr() + readerBegin[k], loaded[k].size()) == 0);
+		}
+
+		CHECK(packFileSystemUnmount("async"));
+	}
+	rawFileSystemOptions.asyncIo = RawFileSystemOptions::AsyncIo_Auto;
+
+	// Directory listing
+	const char* rootNames[] = { "a.txt", "b.bin", "big.bin", "sub", "zero.txt" };
+	void* d = fileSystem.openDir("data");
+	for(roSize i=0; i<roCountof(rootNames); ++i) {
+		CHECK(d);
+		if(!d) break;
+		CHECK_EQUAL(rootNames[i], fileSystem.dirName(d));
+		CHECK_EQUAL(i + 1 < roCountof(rootNames), fileSystem.nextDir(d));
+	}
+	fileSystem.closeDir(d);
+
+	d = packFileSystemOpenDir("data/sub/");
+	CHECK(d);
+	CHECK_EQUAL("c.txt", packFileSystemDirName(d));
+	CHECK(packFileSystemNextDir(d));
+	CHECK_EQUAL("deeper", packFileSystemDirName(d));
+	CHECK(!packFileSystemNextDir(d));
+	packFileSystemCloseDir(d);
+
+	// Served from memory after prefetch
+	CHECK(packFileSystemPrefetchDir("data/sub"));
+	CHECK(packFileSystemPrefetchDir("data"));
+	for(roSize i=0; i<roCountof(names); ++i) {
+		path.clear();
+		strFormat(path, "data/{}", names[i]);
+		CHECK(readWhole(packFileSystem, path.c_str(), data));
+		CHECK(sameBytes(data, contents[i]));
+	}
+
+	CHECK(packFileSystemUnmount("data/"));
+	CHECK(!packFileSystemHasMount());
+	CHECK(!packFileSystemOpenFile("data/a.txt", file));
+
+	// Not an archive
+	CHECK(writeTestFile(packPath, "not a pack file, really not a pack file, no no no", 50));
+	CHECK_EQUAL(Status::data_corrupted, packFileSystemMount(packPath, ""));
+	CHECK(!packFileSystemHasMount());
+
+	for(roSize i=0; i<roCountof(names); ++i) {
+		path.clear();
+		strFormat(path, "{}/{}", dir, names[i]);
+		remove(path.c_str());
+	}
+	removeTestDir("packFSTest/sub/deeper");
+	removeTestDir("packFSTest/sub");
+	removeTestDir(dir);
+	remove(packPath);
+}
+
+// Cold start: loading many small assets, as loose files or from a pack
+TEST_FIXTURE(FileSystemTest, packFS_benchmark)
+{
+	const char* dir = "packFSBenchmark";
+	const char* packPath = "packFSBenchmark.pak";
+	const char* storedPackPath = "packFSBenchmarkStored.pak";
+	const roSize dirCount = benchmark ? 50 : 4;
+	const roSize filePerDir = benchmark ? 100 : 10;
+
+	String path;
+	ByteArray data;
+	roUint64 totalSize = 0;
+	makeTestDir(dir);
+	for(roSize d=0; d<dirCount; ++d) {
+		path.clear();
+		strFormat(path, "{}/{}", dir, d);
+		makeTestDir(path.c_str());
+		for(roSize i=0; i<filePerDir; ++i) {
+			if(i % 4 == 0)
+				makeRandomData(data, 256 + (d * 131 + i * 977) % (16 * 1024), i);
+			else
+				makeTextData(data, 256 + (d * 131 + i * 977) % (16 * 1024), i);
+			totalSize += data.size();
+			path.clear();
+			strFormat(path, "{}/{}/{}.dat", dir, d, i);
+			CHECK(writeTestFile(path.c_str(), data.typedPtr(), data.size()));
+		}
+	}
+
+	StopWatch buildWatch;
+	CHECK(packArchiveBuild(dir, packPath));
+	if(benchmark)
+		roLog("info", "packArchiveBuild: %u files in %.3fs\n", unsigned(dirCount * filePerDir), buildWatch.getDouble());
+
+	PackBuildOptions storeOnly;
+	storeOnly.compressionLevel = 0;
+	CHECK(packArchiveBuild(dir, storedPackPath, storeOnly));
+
+#if !roOS_WIN
+	::sync();
+#endif
+
+	const char* modes[] = { "loose files", "pack", "pack with prefetch", "compressed pack", "compressed pack with prefetch" };
+	for(roSize m=0; m<roCountof(modes); ++m) {
+		for(roSize d=0; d<dirCount; ++d) for(roSize i=0; i<filePerDir; ++i) {
+			path.clear();
+			strFormat(path, "{}/{}/{}.dat", dir, d, i);
+			dropFromPageCache(path.c_str());
+		}
+		dropFromPageCache(packPath);
+		dropFromPageCache(storedPackPath);
+
+		StopWatch stopWatch;
+		if(m > 0)
+			CHECK(packFileSystemMount(m < 3 ? storedPackPath : packPath, dir));
+
+		roUint64 loadedSize = 0;
+		for(roSize d=0; d<dirCount; ++d) {
+			if(m == 2 || m == 4) {
+				path.clear();
+				strFormat(path, "{}/{}", dir, d);
+				CHECK(packFileSystemPrefetchDir(path.c_str()));
+			}
+			for(roSize i=0; i<filePerDir; ++i) {
+				path.clear();
+				strFormat(path, "{}/{}/{}.dat", dir, d, i);
+				CHECK(readWhole(fileSystem, path.c_str(), data));
+				loadedSize += data.size();
+			}
+		}
+
+		packFileSystemUnmountAll();
+		CHECK_EQUAL(totalSize, loadedSize);
+
+		if(benchmark)
+			roLog("info", "Cold start from %s: %u files in %.3fs\n", modes[m], unsigned(dirCount * filePerDir), stopWatch.getDouble());
+	}
+
+	for(roSize d=0; d<dirCount; ++d) {
+		for(roSize i=0; i<filePerDir; ++i) {
+			path.clear();
+			strFormat(path, "{}/{}/{}.dat", dir, d, i);
+			remove(path.c_str());
+		}
+		path.clear();
+		strFormat(path, "{}/{}", dir, d);
+		removeTestDir(path.c_str());
+	}
+	removeTestDir(dir);
+	remove(packPath);
+	remove(storedPackPath);
+}
+
 TEST_FIXTURE(FileSystemTest, httpFS_read)
 {
 //	return;	// Enable when needed
@@ -139,3 +837,299 @@ TEST_FIXTURE(FileSystemTest, httpFS_getBuffer)
 	httpFileSystemUntakeBuffer(file, p1);
 	httpFileSystemCloseFile(file);
 }
+
+namespace {
+
+// Local stand-in of a http server hosting one file, with an artificial latency for each request
+struct RangeServer
+{
+	RangeServer(roUint16 port, roSize fileSize, float latency) : latency(latency), supportRange(true)
+	{
+		content.resize(fileSize);
+		for(roSize i=0; i<fileSize; ++i)
+			content[i] = roByte(i * 7 + (i >> 11));
+
+		server.port = port;
+		server.backlog = 16;
+		server.threadCount = 2;
+		server.onRequest = [this](HttpServer::Connection& connection, HttpRequestHeader& request) -> roStatus {
+			++requestCount;
+			coSleep(this->latency);
+
+			String ifNoneMatch;
+			if(!etag.isEmpty() && request.getField(HttpRequestHeader::HeaderField::IfNoneMatch, ifNoneMatch) && ifNoneMatch == etag) {
+				HttpResponseHeader response;
+				response.make(HttpResponseHeader::ResponseCode::NotModified);
+				return connection.response(response);
+			}
+
+			roUint64 first = 0, last = content.size() - 1;
+			String range;
+			bool ranged = supportRange && request.getField(HttpRequestHeader::HeaderField::Range, range);
+			if(ranged) {
+				unsigned long long a = 0, b = 0;
+				if(sscanf(range.c_str(), "bytes=%llu-%llu", &a, &b) != 2 || a > b || a >= content.size()) {
+					HttpResponseHeader response;
+					response.make(HttpResponseHeader::ResponseCode::RangeNotSatisfiable);
+					return connection.response(response);
+				}
+				first = a;
+				last = roMinOf2(roUint64(b), last);
+			}
+
+			HttpResponseHeader response;
+			if(ranged) {
+				response.make(HttpResponseHeader::ResponseCode::PartialContent);
+				response.addField(HttpResponseHeader::HeaderField::ContentRange, first, last, content.size());
+			}
+			else
+				response.make(HttpResponseHeader::ResponseCode::OK);
+			if(!etag.isEmpty())
+				response.addField(HttpResponseHeader::HeaderField::ETag, etag.c_str());
+
+			OStream* os = NULL;
+			roSize size = roSize(last - first + 1);
+			roStatus st = connection.response(response, os, size);
+			if(!st) return st;
+			return os->write(content.typedPtr() + first, size);
+		};
+	}
+
+	Array<roByte> content;
+	HttpServer server;
+	float latency;
+	bool supportRange;
+	String etag;	///< Support conditional request if not empty
+	AtomicInteger requestCount;
+};	// RangeServer
+
+// Read the whole file in pieces, and compare with the server's content
+static bool readAndCompare(void* file, const Array<roByte>& content, roSize readSize, FileSystem& fs = httpFileSystem)
+{
+	Array<roByte> buf;
+	buf.resize(readSize);
+
+	roSize pos = 0;
+	while(true) {
+		roUint64 bytesRead = 0;
+		Status st = fs.read(file, buf.typedPtr(), buf.size(), bytesRead);
+		if(st == Status::file_ended || (st && bytesRead == 0))
+			break;
+		if(!st)
+			return false;
+		if(pos + bytesRead > content.size() || memcmp(buf.typedPtr(), content.typedPtr() + pos, roSize(bytesRead)) != 0)
+			return false;
+		pos += roSize(bytesRead);
+	}
+
+	return pos == content.size();
+}
+
+static bool readAt(void* file, const Array<roByte>& content, roUint64 pos, roSize size)
+{
+	Array<roByte> buf;
+	buf.resize(size);
+	roUint64 bytesRead = 0;
+	return httpFileSystemRead(file, buf.typedPtr(), size, bytesRead) && bytesRead == size &&
+		memcmp(buf.typedPtr(), content.typedPtr() + pos, size) == 0;
+}
+
+}	// namespace
+
+TEST_FIXTURE(FileSystemTest, httpFS_range)
+{
+	const HttpFileSystemOptions options = httpFileSystemOptions;
+	httpFileSystemOptions.blockSize = 64 * 1024;
+
+	RangeServer rangeServer(8093, 3 * 1024 * 1024 + 123, 0.002f);
+	const Array<roByte>& content = rangeServer.content;
+	roStatus st = rangeServer.server.startThreads();
+	if(st == roStatus::not_supported)
+		return;	// No SO_REUSEPORT
+	CHECK(st);
+
+	void* file = NULL;
+	CHECK(httpFileSystemOpenFile("http://localhost:8093/pack.bin", file));
+
+	roUint64 size = 0;
+	while((st = httpFileSystemSize(file, size)) == Status::in_progress)
+		TaskPool::yield();
+	CHECK(st);
+	CHECK_EQUAL(content.size(), size);
+	CHECK(readAndCompare(file, content, 10000));
+
+	// Seek only request the needed blocks
+	int requestCount = rangeServer.requestCount.value();
+	CHECK(httpFileSystemSeek(file, content.size() / 2 + 17, FileSystem::SeekOrigin_Begin));
+	CHECK(readAt(file, content, content.size() / 2 + 17, 1000));
+	CHECK(httpFileSystemSeek(file, -500, FileSystem::SeekOrigin_Current));
+	CHECK(readAt(file, content, content.size() / 2 + 517, 1000));
+	CHECK(rangeServer.requestCount.value() - requestCount <= int(httpFileSystemOptions.readAheadBlocks));
+
+	// Across blocks, with the buffer taken by us
+	CHECK(httpFileSystemSeek(file, 64 * 1024 - 10, FileSystem::SeekOrigin_Begin));
+	roUint64 readableSize = 0;
+	roBytePtr p = httpFileSystemGetBuffer(file, 100, readableSize);
+	CHECK_EQUAL(100u, readableSize);
+	CHECK(p && memcmp(p, content.typedPtr() + 64 * 1024 - 10, 100) == 0);
+	httpFileSystemTakeBuffer(file);
+	CHECK(readAt(file, content, 64 * 1024 + 90, 100));
+	httpFileSystemUntakeBuffer(file, p);
+
+	CHECK(httpFileSystemSeek(file, 0, FileSystem::SeekOrigin_End));
+	roUint64 bytesRead = 1;
+	char c;
+	CHECK(httpFileSystemRead(file, &c, 1, bytesRead));
+	CHECK_EQUAL(0u, bytesRead);
+	CHECK(!httpFileSystemSeek(file, 1, FileSystem::SeekOrigin_End));
+
+	httpFileSystemCloseFile(file);
+
+	// Server without range support, fall back to a single stream
+	rangeServer.supportRange = false;
+	CHECK(httpFileSystemOpenFile("http://localhost:8093/pack.bin", file));
+	CHECK(readAndCompare(file, content, 10000));
+	CHECK(httpFileSystemSeek(file, 0, FileSystem::SeekOrigin_Begin) == Status::not_supported);
+	httpFileSystemCloseFile(file);
+
+	rangeServer.server.stopThreads();
+	httpFileSystemOptions = options;
+}
+
+// Download speed with different number of connections, against a server with latency
+TEST_FIXTURE(FileSystemTest, httpFS_rangeBenchmark)
+{
+	const HttpFileSystemOptions options = httpFileSystemOptions;
+	const roSize connections[] = { 1, 2, 4, 8 };
+	const roSize connectionCount = benchmark ? roCountof(connections) : 2;
+
+	RangeServer rangeServer(8094, benchmark ? 64 * 1024 * 1024 : 1024 * 1024, 0.01f);
+	roStatus st = rangeServer.server.startThreads();
+	if(st == roStatus::not_supported)
+		return;	// No SO_REUSEPORT
+	CHECK(st);
+
+	for(roSize i=0; i<connectionCount; ++i) {
+		httpFileSystemOptions.maxConnections = connections[i];
+		httpFileSystemOptions.readAheadBlocks = connections[i] * 2;
+
+		StopWatch stopWatch;
+		void* file = NULL;
+		CHECK(httpFileSystemOpenFile("http://localhost:8094/pack.bin", file));
+		CHECK(readAndCompare(file, rangeServer.content, 64 * 1024));
+		httpFileSystemCloseFile(file);
+
+		if(benchmark) {
+			roLog("info", "httpFileSystem %u connections: %.1f MB/s\n",
+				connections[i], rangeServer.content.size() / stopWatch.getFloat() / (1024 * 1024)
+			);
+		}
+	}
+
+	rangeServer.server.stopThreads();
+	httpFileSystemOptions = options;
+}
+
+TEST_FIXTURE(FileSystemTest, httpFS_cache)
+{
+	RangeServer rangeServer(8095, 300 * 1024 + 7, 0);
+	Array<roByte>& content = rangeServer.content;
+	rangeServer.etag = "\"v1\"";
+	roStatus st = rangeServer.server.startThreads();
+	if(st == roStatus::not_supported)
+		return;	// No SO_REUSEPORT
+	CHECK(st);
+
+	const char* uri1 = "http://localhost:8095/a.bin";
+	const char* uri2 = "http://localhost:8095/b.bin";
+
+	CHECK(httpCacheInit("httpCacheTest", 10 * 1024 * 1024));
+	httpCacheClear();
+	httpCacheResetStats();
+
+	// First time from the network, stored along the way
+	void* file = NULL;
+	CHECK(httpCacheFileSystemOpenFile(uri1, file));
+	CHECK(readAndCompare(file, content, 10000, httpCacheFileSystem));
+	httpCacheFileSystemCloseFile(file);
+
+	HttpCacheStats stats = httpCacheStats();
+	CHECK_EQUAL(1u, stats.missCount);
+	CHECK_EQUAL(1u, stats.storeCount);
+	CHECK_EQUAL(1u, stats.entryCount);
+	CHECK_EQUAL(content.size(), stats.size);
+
+	// Revalidated, the default fileSystem goes through the cache as well
+	CHECK(fileSystem.openFile(uri1, file));
+	CHECK(readAndCompare(file, content, 10000, fileSystem));
+	fileSystem.closeFile(file);
+
+	stats = httpCacheStats();
+	CHECK_EQUAL(1u, stats.hitCount);
+	CHECK_EQUAL(content.size(), stats.bytesFromCache);
+
+	// Changed on the server, the old body is replaced
+	content[0] ^= 0xFF;
+	rangeServer.etag = "\"v2\"";
+	CHECK(httpCacheFileSystemOpenFile(uri1, file));
+	CHECK(readAndCompare(file, content, 10000, httpCacheFileSystem));
+	httpCacheFileSystemCloseFile(file);
+
+	stats = httpCacheStats();
+	CHECK_EQUAL(2u, stats.missCount);
+	CHECK_EQUAL(2u, stats.storeCount);
+	CHECK_EQUAL(1u, stats.entryCount);
+	CHECK_EQUAL(content.size(), stats.size);
+
+	// Not stored if not read till the end
+	CHECK(httpCacheFileSystemOpenFile(uri2, file));
+	char buf[100];
+	CHECK(httpCacheFileSystemAtomicRead(file, buf, sizeof(buf)));
+	httpCacheFileSystemCloseFile(file);
+	CHECK_EQUAL(1u, httpCacheStats().entryCount);
+
+	// Room for one body only, the least recently used get evicted
+	httpCacheClose();
+	CHECK(httpCacheInit("httpCacheTest", content.size() * 3 / 2));
+	content[1] ^= 0xFF;
+	rangeServer.etag = "\"v3\"";
+	CHECK(httpCacheFileSystemOpenFile(uri2, file));
+	CHECK(readAndCompare(file, content, 10000, httpCacheFileSystem));
+	httpCacheFileSystemCloseFile(file);
+
+	stats = httpCacheStats();
+	CHECK_EQUAL(1u, stats.evictCount);
+	CHECK_EQUAL(1u, stats.entryCount);
+	CHECK_EQUAL(content.size(), stats.size);
+
+	// Server is gone, the cached body is served as is
+	rangeServer.server.stopThreads();
+	CHECK(httpCacheFileSystemOpenFile(uri2, file));
+	CHECK(readAndCompare(file, content, 10000, httpCacheFileSystem));
+	httpCacheFileSystemCloseFile(file);
+	CHECK_EQUAL(1u, httpCacheStats().staleHitCount);
+
+	// Taken buffer outlive the file
+	CHECK(httpCacheFileSystemOpenFile(uri2, file));
+	roUint64 readable = 0;
+	roBytePtr taken = httpCacheFileSystemGetBuffer(file, 100, readable);
+	CHECK(taken && readable > 0);
+	httpCacheFileSystemTakeBuffer(file);
+	httpCacheFileSystemCloseFile(file);
+	CHECK(memcmp(taken, content.typedPtr(), roSize(readable)) == 0);
+	httpCacheFileSystemUntakeBuffer(file, taken);
+
+	CHECK(httpCacheFileSystemOpenFile(uri1, file));
+	roUint64 bytesRead = 0;
+	char c;
+	CHECK(!httpCacheFileSystemRead(file, &c, 1, bytesRead));
+	httpCacheFileSystemCloseFile(file);
+
+	// The index survive a restart
+	httpCacheClose();
+	CHECK(httpCacheInit("httpCacheTest", 10 * 1024 * 1024));
+	CHECK_EQUAL(1u, httpCacheStats().entryCount);
+	httpCacheClear();
+	CHECK_EQUAL(0u, httpCacheStats().entryCount);
+	httpCacheClose();
+}
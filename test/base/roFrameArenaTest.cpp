@@ -0,0 +1,121 @@
+#include "pch.h"
+#include "../../roar/base/roFrameArena.h"
+
+using namespace ro;
+
+class FrameArenaTest {};
+
+TEST_FIXTURE(FrameArenaTest, basic)
+{
+	FrameArena arena(1024);
+
+	void* p1 = arena.malloc(10);
+	void* p2 = arena.malloc(100);
+	CHECK((roPtrInt(p1) & 15) == 0);
+	CHECK((roPtrInt(p2) & 15) == 0);
+	CHECK(p1 != p2);
+	CHECK_EQUAL(16u + 112u, arena.bytesInUse());
+
+	// Larger than a block
+	void* p3 = arena.malloc(5000);
+	CHECK(p3 != NULL);
+	CHECK(arena.capacity() >= 5000 + 1024);
+
+	// Blocks are reused after tick
+	roSize cap = arena.capacity();
+	arena.tick();
+	CHECK_EQUAL(0u, arena.bytesInUse());
+	CHECK(p1 == (void*)arena.malloc(10));
+	arena.malloc(100);
+	arena.malloc(5000);
+	CHECK_EQUAL(cap, arena.capacity());
+
+	arena.shrink();
+	CHECK_EQUAL(0u, arena.capacity());
+}
+
+TEST_FIXTURE(FrameArenaTest, realloc)
+{
+	FrameArena arena(1024);
+
+	// The most recent allocation grow in place
+	char* p = arena.malloc(10).cast<char>();
+	roMemcpy(p, "abc", 4);
+	CHECK(p == arena.realloc(p, 10, 200).cast<char>());
+
+	// Otherwise it get copied
+	arena.malloc(10);
+	char* p2 = arena.realloc(p, 200, 300).cast<char>();
+	CHECK(p != p2);
+	CHECK_EQUAL("abc", p2);
+
+	// Free the most recent one give the memory back
+	roSize used = arena.bytesInUse();
+	arena.free(arena.malloc(100));
+	CHECK_EQUAL(used, arena.bytesInUse());
+}
+
+TEST_FIXTURE(FrameArenaTest, scope)
+{
+	FrameArena arena(256);
+	arena.malloc(10);
+	roSize used = arena.bytesInUse();
+
+	{	FrameArena::Scope scope(arena);
+		for(roSize i=0; i<100; ++i)
+			arena.malloc(100);
+		CHECK(arena.bytesInUse() > used);
+	}
+
+	CHECK_EQUAL(used, arena.bytesInUse());
+}
+
+TEST_FIXTURE(FrameArenaTest, arenaArray)
+{
+	FrameArena arena;
+
+	{	ArenaArray<int> a(arena);
+		for(int i=0; i<1000; ++i)
+			a.pushBack(i);
+		CHECK_EQUAL(1000u, a.size());
+		CHECK_EQUAL(999, a.back());
+
+		ArenaArray<String> b(arena);
+		for(int i=0; i<100; ++i)
+			b.pushBack("hello");
+		CHECK_EQUAL("hello", b[99].c_str());
+	}
+
+	arena.tick();
+	CHECK_EQUAL(0u, arena.bytesInUse());
+}
+
+TEST_FIXTURE(FrameArenaTest, arenaString)
+{
+	FrameArena arena;
+
+	{	ArenaString s(arena, "Hello");
+		CHECK(s._arena() == &arena);
+		s += " world";
+		CHECK_EQUAL("Hello world", s.c_str());
+
+		// Stay with the arena after being cleared
+		s.clear();
+		CHECK(s.isEmpty());
+		s = "abc";
+		CHECK(s._arena() == &arena);
+		CHECK_EQUAL("abc", s.c_str());
+
+		ArenaString s2(s);
+		CHECK(s2._arena() == &arena);
+		CHECK(s2 == s);
+
+		// Copy to a normal String goes to the heap
+		String heap(s);
+		CHECK(heap._arena() == NULL);
+		CHECK(heap == s);
+	}
+
+	arena.tick();
+	CHECK_EQUAL(0u, arena.bytesInUse());
+}
@@ -0,0 +1,250 @@
+#include "pch.h"
+#include "../../roar/base/roHashMap.h"
+#include "../../roar/base/roLog.h"
+#include "../../roar/base/roMap.h"
+#include "../../roar/base/roStopWatch.h"
+#include <unordered_map>
+
+using namespace ro;
+
+static const bool benchmark = false;
+
+class HashMapTest {};
+
+TEST_FIXTURE(HashMapTest, basic)
+{
+	HashMap<int, int> map;
+	CHECK(map.isEmpty());
+	CHECK(!map.find(1));
+	CHECK(!map.remove(1));
+
+	for(int i=0; i<1000; ++i)
+		CHECK(map.insert(i, i * 10));
+	CHECK_EQUAL(1000u, map.size());
+
+	bool ok = true;
+	for(int i=0; i<1000; ++i)
+		ok &= map.find(i) && *map.find(i) == i * 10;
+	CHECK(ok);
+	CHECK(!map.find(1000));
+
+	// Overwrite
+	CHECK_EQUAL(-1, *map.insert(5, -1));
+	CHECK(!map.insertUnique(5, -2));
+	CHECK_EQUAL(-1, *map.find(5));
+	CHECK_EQUAL(1000u, map.size());
+
+	map[2000] = 1;
+	map[2000]++;
+	CHECK_EQUAL(2, *map.find(2000));
+
+	// Remove every other, the rest must survive the tombstones
+	for(int i=0; i<1000; i+=2)
+		CHECK(map.remove(i));
+	CHECK_EQUAL(501u, map.size());
+	ok = true;
+	for(int i=0; i<1000; ++i)
+		ok &= (map.find(i) != NULL) == (i % 2 == 1);
+	CHECK(ok);
+
+	int sum = 0;
+	roSize count = 0;
+	for(auto& e : map) {
+		sum += e.key;
+		++count;
+	}
+	CHECK_EQUAL(map.size(), count);
+	CHECK_EQUAL(250000 + 2000, sum);
+
+	roSize capacity = map.capacity();
+	map.clear();
+	CHECK(map.isEmpty());
+	CHECK_EQUAL(capacity, map.capacity());
+	CHECK(map.begin() == map.end());
+}
+
+// Keep inserting and removing on a small table, tombstones should not make it grow forever
+TEST_FIXTURE(HashMapTest, churn)
+{
+	HashMap<int, int> map;
+	CHECK(map.reserve(10));
+	roSize capacity = map.capacity();
+
+	for(int i=0; i<10000; ++i) {
+		map.insert(i, i);
+		if(i >= 10)
+			CHECK(map.remove(i - 10));
+	}
+
+	CHECK_EQUAL(10u, map.size());
+	CHECK_EQUAL(capacity, map.capacity());
+}
+
+TEST_FIXTURE(HashMapTest, stringKey)
+{
+	HashMap<String, int> map;
+	map.insert("one", 1);
+	map.insert(String("two"), 2);
+	map.insert(ConstString("three"), 3);
+
+	// Lookup without constructing any String
+	const char* str = "one two three";
+	CHECK_EQUAL(1, *map.find(RangedString(str, str + 3)));
+	CHECK_EQUAL(2, *map.find(RangedString(str + 4, str + 7)));
+	CHECK_EQUAL(3, *map.find(RangedString(str + 8, str + 13)));
+	CHECK(!map.find(RangedString(str, str + 2)));
+	CHECK_EQUAL(2, *map.find("two"));
+	CHECK_EQUAL(3, *map.find(ConstString("three")));
+	CHECK(!map.find(ConstString("four")));
+
+	CHECK(map.remove(RangedString(str, str + 3)));
+	CHECK(!map.contains("one"));
+
+	// ConstString key re-use the cached hash
+	HashMap<ConstString, int> cmap;
+	cmap.insert(ConstString("abc"), 1);
+	CHECK_EQUAL(1, *cmap.find(ConstString("abc")));
+	CHECK_EQUAL(1, *cmap.find("abc"));
+	CHECK_EQUAL(1, *cmap.find(String("abc")));
+	CHECK(StringHasher::hash("abc") == ConstString("abc").hash());
+}
+
+namespace {
+
+struct MoveOnly
+{
+	explicit MoveOnly(int v) : p(new int(v)) {}
+	MoveOnly(MoveOnly&& rhs) : p(rhs.p) { rhs.p = NULL; }
+	~MoveOnly() { delete p; }
+	MoveOnly& operator=(MoveOnly&& rhs) { roSwap(p, rhs.p); return *this; }
+
+	MoveOnly(const MoveOnly&) = delete;
+	MoveOnly& operator=(const MoveOnly&) = delete;
+
+	int* p;
+};	// MoveOnly
+
+}	// namespace
+
+TEST_FIXTURE(HashMapTest, moveOnly)
+{
+	HashMap<int, MoveOnly> map;
+	for(int i=0; i<100; ++i)
+		map.insert(i, MoveOnly(i));
+
+	bool ok = true;
+	for(int i=0; i<100; ++i)
+		ok &= *map.find(i)->p == i;
+	CHECK(ok);
+
+	map.insert(1, MoveOnly(-1));
+	CHECK_EQUAL(-1, *map.find(1)->p);
+
+	HashMap<int, MoveOnly> map2(std::move(map));
+	CHECK(map.isEmpty());
+	CHECK_EQUAL(100u, map2.size());
+	map = std::move(map2);
+	CHECK_EQUAL(100u, map.size());
+}
+
+TEST_FIXTURE(HashMapTest, hashSet)
+{
+	HashSet<String> set;
+	bool inserted = false;
+	const String* s = set.insert("hello", &inserted);
+	CHECK(inserted);
+	CHECK_EQUAL("hello", s->c_str());
+	CHECK(s == set.insert(String("hello"), &inserted));
+	CHECK(!inserted);
+	CHECK_EQUAL(1u, set.size());
+
+	set.insert("world");
+	CHECK(set.contains(RangedString("world")));
+	CHECK(set.remove("hello"));
+	CHECK(!set.contains("hello"));
+
+	roSize count = 0;
+	for(const String& str : set) {
+		CHECK_EQUAL("world", str.c_str());
+		++count;
+	}
+	CHECK_EQUAL(1u, count);
+}
+
+// ----------------------------------------------------------------------
+
+namespace {
+
+struct FooNode : public MapNode<int, FooNode>
+{
+	typedef MapNode<int, FooNode> Super;
+	FooNode(int key, int val) : Super(key), val(val) {}
+	int val;
+};	// FooNode
+
+// Spread the keys, so that the tree and the table do not get the easy sequential pattern
+static int scramble(roSize i) { return int((i * 2654435761u) & 0x7FFFFFFF); }
+
+template<class Insert, class Find, class Erase>
+bool runBenchmark(const char* name, roSize count, Insert insert, Find find, Erase erase)
+{
+	StopWatch stopWatch;
+	for(roSize i=0; i<count; ++i)
+		insert(scramble(i));
+	double insertTime = stopWatch.getAndReset();
+
+	bool ok = true;
+	for(roSize i=0; i<count; ++i)
+		ok &= find(scramble(i));
+	for(roSize i=0; i<count; ++i)
+		ok &= !find(scramble(i + count));
+	double findTime = stopWatch.getAndReset();
+
+	for(roSize i=0; i<count; ++i)
+		erase(scramble(i));
+	double eraseTime = stopWatch.getDouble();
+
+	if(benchmark)
+		roLog("info", "%s %u keys, insert: %f, find hit/miss: %f, erase: %f\n", name, count, insertTime, findTime, eraseTime);
+
+	return ok;
+}
+
+}	// namespace
+
+TEST_FIXTURE(HashMapTest, compareWithMap)
+{
+	const roSize counts[] = { 1000, 100000, 10000000 };
+	const roSize countCount = benchmark ? roCountof(counts) : 1;
+
+	for(roSize c=0; c<countCount; ++c) {
+		const roSize count = counts[c];
+
+		{	HashMap<int, int> map;
+			CHECK(runBenchmark("HashMap", count,
+				[&](int k) { map.insert(k, k); },
+				[&](int k) { return map.find(k) != NULL; },
+				[&](int k) { map.remove(k); }
+			));
+			CHECK(map.isEmpty());
+		}
+
+		{	Map<FooNode> map;
+			CHECK(runBenchmark("Map", count,
+				[&](int k) { map.insert(*new FooNode(k, k)); },
+				[&](int k) { return map.find(k) != NULL; },
+				[&](int k) { delete map.find(k); }
+			));
+			CHECK_EQUAL(0u, map.size());
+		}
+
+		{	std::unordered_map<int, int> map;
+			CHECK(runBenchmark("std::unordered_map", count,
+				[&](int k) { map.insert(std::make_pair(k, k)); },
+				[&](int k) { return map.find(k) != map.end(); },
+				[&](int k) { map.erase(k); }
+			));
+			CHECK(map.empty());
+		}
+	}
+}
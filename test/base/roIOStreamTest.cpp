@@ -2,10 +2,14 @@
 #include "../../roar/base/roIOStream.h"
 #include "../../roar/base/roCompressedStream.h"
 #include "../../roar/math/roRandom.h"
+#include "../../roar/base/roLog.h"
+#include "../../roar/base/roStopWatch.h"
 #include "../../roar/base/roString.h"
 
 using namespace ro;
 
+static const bool benchmark = false;
+
 struct IOStreamTest {};
 
 TEST_FIXTURE(IOStreamTest, memoryIStream)
@@ -77,6 +81,77 @@ TEST_FIXTURE(IOStreamTest, memoryOStream)
 	CHECK(!os.seekWrite(0, OStream::SeekOrigin_Begin));
 }
 
+TEST_FIXTURE(IOStreamTest, memoryOStreamReserveWrite)
+{
+	roByte data[] = { 1, 2, 3, 4 };
+	MemoryOStream os;
+
+	roByte* p = NULL;
+	roSize size = 0;
+	CHECK(os.reserveWrite(3, p, size));
+	CHECK(size >= 3);
+	p[0] = 9; p[1] = 8;
+	CHECK(os.commitWrite(2));
+	CHECK_EQUAL(2u, os.size());
+	CHECK_EQUAL(2u, os.posWrite());
+
+	IoVec bufs[] = { { data, 2 }, { data, 0 }, { data + 2, 2 } };
+	CHECK(os.writev(bufs, roCountof(bufs)));
+	CHECK_EQUAL(6u, os.size());
+
+	// Nothing committed
+	CHECK(os.reserveWrite(100, p, size));
+	CHECK(os.commitWrite(0));
+
+	const roByte expected[] = { 9, 8, 1, 2, 3, 4 };
+	CHECK_EQUAL(roCountof(expected), os.size());
+	CHECK(memcmp(os.bytePtr(), expected, sizeof(expected)) == 0);
+}
+
+TEST_FIXTURE(IOStreamTest, memoryChainOStream)
+{
+	roByte data[10];
+	for(roSize i=0; i<roCountof(data); ++i)
+		data[i] = roByte(i);
+
+	MemoryChainOStream os(4);
+	CHECK(os.write(data, 10));
+	CHECK_EQUAL(10u, os.posWrite());
+	CHECK_EQUAL(3u, os.blockCount());
+
+	// Fit in the tail of the last block
+	roByte* p = NULL;
+	roSize size = 0;
+	CHECK(os.reserveWrite(2, p, size));
+	CHECK_EQUAL(2u, size);
+	p[0] = 10; p[1] = 11;
+	CHECK(os.commitWrite(2));
+	CHECK_EQUAL(3u, os.blockCount());
+
+	// Bigger than a block
+	CHECK(os.reserveWrite(6, p, size));
+	CHECK_EQUAL(6u, size);
+	for(roSize i=0; i<6; ++i)
+		p[i] = roByte(12 + i);
+	CHECK(os.commitWrite(6));
+	CHECK_EQUAL(4u, os.blockCount());
+	CHECK_EQUAL(18u, os.size());
+
+	Array<IoVec> bufs;
+	CHECK(os.getIoVecs(bufs));
+	CHECK_EQUAL(4u, bufs.size());
+
+	MemoryOStream mos;
+	CHECK(os.writeTo(mos));
+	CHECK_EQUAL(18u, mos.size());
+	for(roSize i=0; i<mos.size(); ++i)
+		CHECK_EQUAL(roByte(i), mos.bytePtr()[i]);
+
+	os.clear();
+	CHECK_EQUAL(0u, os.size());
+	CHECK_EQUAL(0u, os.blockCount());
+}
+
 TEST_FIXTURE(IOStreamTest, memorySeekableOStream)
 {
 	roByte data[] = { 1, 2, 3, 4 };
@@ -150,6 +225,296 @@ TEST_FIXTURE(IOStreamTest, gzip)
 	}
 }
 
+namespace {
+
+// Something like text, compress about 3 to 4 times
+static void makeCompressibleData(ByteArray& data, roSize size)
+{
+	static const char* words[] = { "the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ", "dog, ", "roar ", "stream. ", "\n" };
+	UniformRandom rangen;
+	data.clear();
+	while(data.size() < size) {
+		const char* w = words[rangen.nextSeed() % roCountof(words)];
+		data.insert(data.size(), (const roByte*)w, (const roByte*)w + roStrLen(w));
+	}
+	data.resize(size);
+}
+
+static bool sameBytes(const ByteArray& a, const ByteArray& b)
+{
+	return a.size() == b.size() && (a.isEmpty() || memcmp(a.typedPtr(), b.typedPtr(), a.size()) == 0);
+}
+
+// Hide the buffer of the inner stream, so GZipIStream have to read into it's own buffer
+struct NoPeekIStream : public IStream
+{
+	NoPeekIStream(roByte* buffer, roSize size) : _is(buffer, size) {}
+
+	virtual Status read(void* buffer, roUint64 bytesToRead, roUint64& bytesRead) override
+	{
+		return _is.read(buffer, roMinOf2(bytesToRead, roUint64(1000)), bytesRead);
+	}
+
+	MemoryIStream _is;
+};	// NoPeekIStream
+
+static bool gunzipStream(AutoPtr<IStream>&& inner, ByteArray& out, roSize readSize, roSize chunkSize)
+{
+	GZipIStream is;
+	if(!is.init(std::move(inner), chunkSize))
+		return false;
+
+	out.clear();
+	ByteArray buf;
+	buf.resize(readSize);
+	while(true) {
+		roUint64 read = 0;
+		Status st = is.read(buf.bytePtr(), buf.size(), read);
+		if(st == Status::end_of_data)
+			return true;
+		if(!st)
+			return false;
+		out.insert(out.size(), buf.typedPtr(), buf.typedPtr() + read);
+	}
+}
+
+}	// namespace
+
+TEST_FIXTURE(IOStreamTest, gzipOneShot)
+{
+	DefaultAllocator _allocator;
+	const roSize sizes[] = { 0, 1, 1000, 100 * 1000 };
+	const int levels[] = { 0, 1, 6, 9 };
+
+	for(roSize i=0; i<roCountof(sizes); ++i) for(roSize l=0; l<roCountof(levels); ++l) {
+		ByteArray data, zipped, unzipped;
+		makeCompressibleData(data, sizes[i]);
+
+		CHECK(gzipCompress(data.bytePtr(), data.size(), zipped, levels[l]));
+		CHECK(zipped.size() <= gzipCompressBound(data.size()));
+		if(levels[l] > 0 && data.size() >= 1000)
+			CHECK(zipped.size() < data.size() / 2);
+
+		CHECK(gzipDecompress(zipped.bytePtr(), zipped.size(), unzipped));
+		CHECK(sameBytes(unzipped, data));
+
+		// The streaming one understand it as well, with or without peeking the inner stream
+		CHECK(gunzipStream(_allocator.newObj<MemoryIStream>(zipped.typedPtr(), zipped.size()), unzipped, 4096, 0));
+		CHECK(sameBytes(unzipped, data));
+		CHECK(gunzipStream(_allocator.newObj<NoPeekIStream>(zipped.typedPtr(), zipped.size()), unzipped, 777, 0));
+		CHECK(sameBytes(unzipped, data));
+		CHECK(gunzipStream(_allocator.newObj<NoPeekIStream>(zipped.typedPtr(), zipped.size()), unzipped, 100000, 64));
+		CHECK(sameBytes(unzipped, data));
+	}
+
+	// Into a buffer of known size
+	ByteArray data, zipped, unzipped;
+	makeCompressibleData(data, 5000);
+	CHECK(gzipCompress(data.bytePtr(), data.size(), zipped, 1));
+	unzipped.resize(data.size());
+	roSize size = unzipped.size();
+	CHECK(gzipDecompress(zipped.bytePtr(), zipped.size(), unzipped.bytePtr(), size));
+	CHECK_EQUAL(data.size(), size);
+	CHECK(sameBytes(unzipped, data));
+
+	size = data.size() - 1;
+	CHECK(gzipDecompress(zipped.bytePtr(), zipped.size(), unzipped.bytePtr(), size) == Status::not_enough_buffer);
+
+	// Corrupted or truncated
+	zipped[zipped.size() / 2] ^= 0x55;
+	CHECK(!gzipDecompress(zipped.bytePtr(), zipped.size(), unzipped));
+	CHECK(!gzipDecompress(zipped.bytePtr(), zipped.size() / 2, unzipped));
+	CHECK(!gzipDecompress(NULL, 0, unzipped));
+}
+
+TEST_FIXTURE(IOStreamTest, gzipFlush)
+{
+	DefaultAllocator _allocator;
+	ByteArray data;
+	makeCompressibleData(data, 300 * 1000);
+
+	GZipOStream os;
+	auto mos = _allocator.newObj<MemoryOStream>();
+	ByteArray& zipped = mos->_buf;
+	CHECK(os.init(std::move(mos), 0, 1));
+
+	// No region is left reserved in between write(), the inner stream only hold what deflate produced so far
+	CHECK(os.write(data.bytePtr(), 1000));
+	CHECK(zipped.size() < 1000);
+
+	// Everything written so far can be read after a flush
+	CHECK(os.flush());
+	ByteArray unzipped;
+	CHECK(gunzipStream(_allocator.newObj<MemoryIStream>(zipped.typedPtr(), zipped.size()), unzipped, 4096, 0));
+	CHECK_EQUAL(1000u, unzipped.size());
+	CHECK(memcmp(unzipped.bytePtr(), data.bytePtr(), 1000) == 0);
+
+	// And it goes on
+	CHECK(os.write(data.typedPtr() + 1000, data.size() - 1000));
+	CHECK_EQUAL(data.size(), os.posWrite());
+	CHECK(os.closeWrite());
+	CHECK(!os.write(data.bytePtr(), 1));
+
+	CHECK(gzipDecompress(zipped.bytePtr(), zipped.size(), unzipped));
+	CHECK(sameBytes(unzipped, data));
+}
+
+// Throughput of a single thread, one-shot against streaming in fixed or adaptive chunk
+TEST_FIXTURE(IOStreamTest, gzipBenchmark)
+{
+	DefaultAllocator _allocator;
+	ByteArray data, zipped, unzipped;
+	makeCompressibleData(data, benchmark ? 64 * 1024 * 1024 : 256 * 1024);
+	const double mb = double(data.size()) / (1024 * 1024);
+
+	const int levels[] = { 1, 6, 9 };
+	for(roSize l=0; l<roCountof(levels); ++l) {
+		StopWatch stopWatch;
+		CHECK(gzipCompress(data.bytePtr(), data.size(), zipped, levels[l]));
+		if(benchmark)
+			roLog("info", "gzipCompress level %d: %.1f MB/s per core, ratio %.2f\n", levels[l], mb / stopWatch.getDouble(), double(data.size()) / zipped.size());
+	}
+
+	const roSize chunkSizes[] = { 4096, 0 };
+	for(roSize c=0; c<roCountof(chunkSizes); ++c) {
+		StopWatch stopWatch;
+		GZipOStream os;
+		auto mos = _allocator.newObj<MemoryOStream>();
+		ByteArray& streamZipped = mos->_buf;
+		CHECK(os.init(std::move(mos), chunkSizes[c]));
+		for(roSize i=0; i<data.size(); i+=64 * 1024)
+			CHECK(os.write(data.typedPtr() + i, roMinOf2(data.size() - i, roSize(64 * 1024))));
+		CHECK(os.closeWrite());
+		if(benchmark)
+			roLog("info", "GZipOStream chunk %s: %.1f MB/s per core\n", chunkSizes[c] ? "4KB" : "adaptive", mb / stopWatch.getDouble());
+
+		CHECK(gzipDecompress(streamZipped.bytePtr(), streamZipped.size(), unzipped));
+		CHECK(sameBytes(unzipped, data));
+	}
+
+	StopWatch stopWatch;
+	CHECK(gzipDecompress(zipped.bytePtr(), zipped.size(), unzipped));
+	if(benchmark)
+		roLog("info", "gzipDecompress: %.1f MB/s per core\n", mb / stopWatch.getAndReset());
+	CHECK(sameBytes(unzipped, data));
+
+	for(roSize c=0; c<roCountof(chunkSizes); ++c) {
+		stopWatch.reset();
+		CHECK(gunzipStream(_allocator.newObj<NoPeekIStream>(zipped.typedPtr(), zipped.size()), unzipped, 64 * 1024, chunkSizes[c]));
+		if(benchmark)
+			roLog("info", "GZipIStream chunk %s: %.1f MB/s per core\n", chunkSizes[c] ? "4KB" : "adaptive", mb / stopWatch.getDouble());
+		CHECK(sameBytes(unzipped, data));
+	}
+
+	stopWatch.reset();
+	CHECK(gunzipStream(_allocator.newObj<MemoryIStream>(zipped.typedPtr(), zipped.size()), unzipped, 64 * 1024, 0));
+	if(benchmark)
+		roLog("info", "GZipIStream on MemoryIStream: %.1f MB/s per core\n", mb / stopWatch.getDouble());
+	CHECK(sameBytes(unzipped, data));
+}
+
+// Count the bytes the inner stream has to copy (given to write()) against those produced in place
+struct CopyCountingOStream : public OStream
+{
+	CopyCountingOStream(OStream& inner, bool lend) : inner(inner), lend(lend) {}
+
+	virtual	Status write(const void* buffer, roUint64 bytesToWrite) override
+	{
+		copied += bytesToWrite;
+		++calls;
+		return inner.write(buffer, bytesToWrite);
+	}
+
+	virtual Status writev(const IoVec* bufs, roSize count) override
+	{
+		for(roSize i=0; i<count; ++i)
+			copied += bufs[i].size;
+		++calls;
+		return inner.writev(bufs, count);
+	}
+
+	virtual Status reserveWrite(roSize minBytes, roByte*& outBuf, roSize& outBytes) override
+	{
+		return lend ? inner.reserveWrite(minBytes, outBuf, outBytes) : OStream::reserveWrite(minBytes, outBuf, outBytes);
+	}
+
+	virtual Status commitWrite(roSize bytesWritten) override
+	{
+		if(!lend)
+			return OStream::commitWrite(bytesWritten);
+		inPlace += bytesWritten;
+		++calls;
+		return inner.commitWrite(bytesWritten);
+	}
+
+	virtual roUint64 posWrite() const override { return inner.posWrite(); }
+
+	OStream& inner;
+	bool lend;
+	roUint64 copied = 0;
+	roUint64 inPlace = 0;
+	roUint64 calls = 0;
+};
+
+// Copies and throughput of a 100MB stream, through write() and through the reserve/commit and writev() interface
+TEST_FIXTURE(IOStreamTest, zeroCopyOStreamBenchmark)
+{
+	DefaultAllocator _allocator;
+	ByteArray data, unzipped;
+	makeCompressibleData(data, benchmark ? 100 * 1024 * 1024 : 1024 * 1024);
+	const double mb = double(data.size()) / (1024 * 1024);
+	const roSize piece = 64 * 1024;
+
+	// GZipOStream to memory, deflating into it's own buffer then copied, or into the lent region
+	for(int lend=0; lend<2; ++lend) {
+		StopWatch stopWatch;
+		MemoryOStream zipped;
+		GZipOStream os;
+		auto counter = _allocator.newObj<CopyCountingOStream>(zipped, lend != 0);
+		CopyCountingOStream& c = *counter;
+		CHECK(os.init(std::move(counter), 0, 1));
+		for(roSize i=0; i<data.size(); i+=piece)
+			CHECK(os.write(data.typedPtr() + i, roMinOf2(data.size() - i, piece)));
+		CHECK(os.closeWrite());
+		if(benchmark)
+			roLog("info", "GZipOStream %s: %.1f MB/s, %.2f MB copied, %.2f MB in place, %llu writes\n",
+				lend ? "reserveWrite" : "write", mb / stopWatch.getDouble(), double(c.copied) / (1024 * 1024), double(c.inPlace) / (1024 * 1024), c.calls);
+		CHECK_EQUAL(lend ? 0u : zipped.size(), c.copied);
+		CHECK_EQUAL(lend ? zipped.size() : 0u, c.inPlace);
+
+		CHECK(gzipDecompress(zipped.bytePtr(), zipped.size(), unzipped));
+		CHECK(sameBytes(unzipped, data));
+	}
+
+	// Accumulate then forward, contiguous buffer (copied on every growth and on forward)
+	// against a chain of blocks forwarded with a single writev()
+	{
+		StopWatch stopWatch;
+		MemoryOStream buffered, out;
+		CopyCountingOStream c(out, false);
+		for(roSize i=0; i<data.size(); i+=piece)
+			CHECK(buffered.write(data.typedPtr() + i, roMinOf2(data.size() - i, piece)));
+		CHECK(c.write(buffered.bytePtr(), buffered.size()));
+		if(benchmark)
+			roLog("info", "MemoryOStream then write: %.1f MB/s\n", mb / stopWatch.getDouble());
+		CHECK(sameBytes(out._buf, data));
+	}
+
+	{
+		StopWatch stopWatch;
+		MemoryChainOStream buffered;
+		MemoryOStream out;
+		CopyCountingOStream c(out, false);
+		for(roSize i=0; i<data.size(); i+=piece)
+			CHECK(buffered.write(data.typedPtr() + i, roMinOf2(data.size() - i, piece)));
+		CHECK(buffered.writeTo(c));
+		if(benchmark)
+			roLog("info", "MemoryChainOStream then writev: %.1f MB/s, %llu blocks in %llu writev\n", mb / stopWatch.getDouble(), (roUint64)buffered.blockCount(), c.calls);
+		CHECK_EQUAL(1u, c.calls);
+		CHECK(sameBytes(out._buf, data));
+	}
+}
+
 struct RandomIOStreamTest
 {
 	Status loadReferenceContent()
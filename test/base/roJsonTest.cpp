@@ -1,9 +1,16 @@
 #include "pch.h"
 #include "../../roar/base/roJson.h"
 #include "../../roar/base/roIOStream.h"
+#include "../../roar/base/roLog.h"
+#include "../../roar/base/roStopWatch.h"
+#include "../../roar/base/roStringFormat.h"
+#include "../../roar/math/roMath.h"
+#include "../../roar/math/roRandom.h"
 
 using namespace ro;
 
+static const bool benchmark = false;
+
 class JsonTest {};
 
 TEST_FIXTURE(JsonTest, parse_empty)
@@ -303,10 +310,111 @@ TEST_FIXTURE(JsonTest, parse_error)
 	// Must be a comma or '}' after an object member
 	TEST_ERROR("{]");
 	TEST_ERROR("{\"a\":1]");
+	TEST_ERROR("{\"a\":1,}");
+
+	// Values must be separated
+	TEST_ERROR("[1 2]");
+	TEST_ERROR("[\"a\" \"b\"]");
+	TEST_ERROR("[1x]");
+	TEST_ERROR("[,1]");
+
+	// Unterminated
+	TEST_ERROR("[\"abc");
+	TEST_ERROR("[\"abc\\\"]");
+	TEST_ERROR("[1,");
+	TEST_ERROR("{\"a\":[1]");
 
 #undef TEST_ERROR
 }
 
+// Character by character equivalent of jsonStructuralIndex()
+static bool structuralIndexRef(const roUtf8* json, roSize size, Array<roUint32>& indices)
+{
+	indices.clear();
+	bool inString = false, inScalar = false;
+	for(roSize i=0; i<size; ++i) {
+		const roUtf8 c = json[i];
+		if(inString) {
+			if(c == '\\') ++i;
+			else if(c == '"') inString = false;
+			continue;
+		}
+
+		switch(c) {
+		case '{': case '}': case '[': case ']': case ':': case ',':
+			indices.pushBack(roUint32(i));
+			inScalar = false;
+			break;
+		case ' ': case '\t': case '\n': case '\r':
+			inScalar = false;
+			break;
+		case '"':
+			if(!inScalar) indices.pushBack(roUint32(i));
+			inString = true;
+			inScalar = false;	// For after the closing quote
+			break;
+		default:
+			if(!inScalar) indices.pushBack(roUint32(i));
+			inScalar = true;
+			// An escaped quote outside a string is just part of the scalar
+			if(c == '\\' && i + 1 < size && (json[i + 1] == '"' || json[i + 1] == '\\'))
+				++i;
+			break;
+		}
+	}
+
+	return !inString;
+}
+
+TEST_FIXTURE(JsonTest, structural_index)
+{
+	Array<roUint32> indices;
+
+	{	const roUtf8* json = "{\"a\":[1, true ,\"x,y\"], \"b\" : null}";
+		CHECK(jsonStructuralIndex(json, roStrLen(json), indices));
+		roUint32 expected[] = { 0, 1, 4, 5, 6, 7, 9, 14, 15, 20, 21, 23, 27, 29, 33 };
+		CHECK_EQUAL(roCountof(expected), indices.size());
+		CHECK(indices.size() == roCountof(expected) && memcmp(indices.typedPtr(), expected, sizeof(expected)) == 0);
+	}
+
+	{	// Escapes and string crossing the 64 bytes block boundary
+		String json = "[\"";
+		for(roSize i=0; i<61; ++i) json += "a";
+		json += "\\\\\\\"\\\\\", 1]";	// The block end with a backslash escaping another one
+		CHECK(jsonStructuralIndex(json.c_str(), json.size(), indices));
+		CHECK_EQUAL(5u, indices.size());
+		CHECK_EQUAL(roUint32(json.size() - 4), indices.size() == 5 ? indices[2] : 0);
+	}
+
+	{	// Unterminated string
+		const roUtf8* json = "[\"abc\\\"]";
+		CHECK_EQUAL(roStatus::json_parse_error, jsonStructuralIndex(json, roStrLen(json), indices));
+	}
+
+	// Against the reference on random text, with lengths crossing a few blocks
+	const roUtf8 alphabet[] = "{}[]:,\"\\ \n\t\r1a-.e";
+	Array<roUint32> expected;
+	String json;
+	for(roSize n=0; n<2000; ++n) {
+		json.clear();
+		const roSize size = roRandBeginEnd<roSize>(0, 300);
+		for(roSize i=0; i<size; ++i) {
+			roUtf8 c = alphabet[roRandBeginEnd<roSize>(0, sizeof(alphabet) - 1)];
+			json.append(&c, 1);
+		}
+
+		const bool ok = structuralIndexRef(json.c_str(), json.size(), expected);
+		CHECK_EQUAL(ok, bool(jsonStructuralIndex(json.c_str(), json.size(), indices)));
+		if(!ok) continue;
+
+		CHECK_EQUAL(expected.size(), indices.size());
+		if(expected.size() != indices.size() || (!expected.isEmpty() && memcmp(expected.typedPtr(), indices.typedPtr(), expected.sizeInByte()) != 0)) {
+			CHECK(false);
+			break;
+		}
+	}
+}
+
 TEST_FIXTURE(JsonTest, writer_empty1)
 {
 	{	JsonWriter writer;
@@ -394,6 +502,109 @@ TEST_FIXTURE(JsonTest, writer)
 	writer.endDocument();
 }
 
+TEST_FIXTURE(JsonTest, writer_pretty)
+{
+	JsonWriter writer;
+	MemoryOStream os;
+
+	writer.setStream(&os);
+	writer.setPretty(true);
+	writer.beginDocument();
+	CHECK(writer.beginObject());
+		CHECK(writer.write("name", "a\"b\\c\n\x01"));
+		CHECK(writer.beginArray("array"));
+			CHECK(writer.write(1));
+			CHECK(writer.beginObject());
+			CHECK(writer.endObject());
+			CHECK(writer.writeNull());
+		CHECK(writer.endArray());
+		CHECK(writer.beginArray("empty"));
+		CHECK(writer.endArray());
+	CHECK(writer.endObject());
+	CHECK(writer.endDocument());
+
+	CHECK_EQUAL(
+		"{\n"
+		"\t\"name\": \"a\\\"b\\\\c\\n\\u0001\",\n"
+		"\t\"array\": [\n"
+		"\t\t1,\n"
+		"\t\t{},\n"
+		"\t\tnull\n"
+		"\t],\n"
+		"\t\"empty\": []\n"
+		"}",
+		(roUtf8*)os.bytePtr()
+	);
+}
+
+// Shortest digits which read back to the very same value
+TEST_FIXTURE(JsonTest, writer_number_roundtrip)
+{
+	JsonWriter writer;
+	MemoryOStream os;
+
+	writer.setStream(&os);
+	writer.beginDocument();
+	CHECK(writer.beginArray());
+		CHECK(writer.write(roInt64(-9223372036854775807LL - 1)));
+		CHECK(writer.write(roUint64(18446744073709551615ULL)));
+		CHECK(writer.write(roInt8(-128)));
+		CHECK(writer.write(0.1f));
+		CHECK(writer.write(-1e-10f));
+		CHECK(writer.write(3.4028235e38f));
+		CHECK(writer.write(1.0 / 3));
+		CHECK(writer.write(5e-324));
+		CHECK(writer.write(0.0));
+		CHECK(writer.write(roINFINITY * roINFINITY));
+	CHECK(writer.endArray());
+	CHECK(writer.endDocument());
+
+	CHECK_EQUAL(
+		"[-9223372036854775808,18446744073709551615,-128,0.1,-1e-10,3.4028235e38,0.3333333333333333,5e-324,0.0,null]",
+		(roUtf8*)os.bytePtr()
+	);
+
+	// Random bit patterns
+	Random<UniformRandom> random(1234);
+	Array<float> floats;
+	Array<double> doubles;
+	while(floats.size() < 10000) {
+		roUint32 u = random.randUint32();
+		float f;
+		roMemcpy(&f, &u, sizeof(f));
+		if(f - f == 0)
+			floats.pushBack(f);
+
+		roUint64 u64 = (roUint64(random.randUint32()) << 32) | random.randUint32();
+		double d;
+		roMemcpy(&d, &u64, sizeof(d));
+		if(d - d == 0)
+			doubles.pushBack(d);
+	}
+
+	os.clear();
+	writer.beginDocument();
+	CHECK(writer.beginArray());
+	for(float f : floats)
+		CHECK(writer.write(f));
+	for(double d : doubles)
+		CHECK(writer.write(d));
+	CHECK(writer.endArray());
+	CHECK(writer.endDocument());
+
+	// Read back with the C library, which is correctly rounded
+	char* p = (char*)os.bytePtr() + 1;
+	for(float f : floats) {
+		CHECK_EQUAL(f, strtof(p, &p));
+		++p;
+	}
+	for(double d : doubles) {
+		CHECK_EQUAL(d, strtod(p, &p));
+		++p;
+	}
+	CHECK_EQUAL("", p);
+}
+
 #include "../../roar/base/roBlockAllocator.h"
 
 TEST_FIXTURE(JsonTest, dom_parsing)
@@ -429,6 +640,116 @@ TEST_FIXTURE(JsonTest, dom_parsing_error)
 	CHECK(!json);
 }
 
+TEST_FIXTURE(JsonTest, document)
+{
+	typedef JsonParser::Event Event;
+
+	String str =
+		"{\"menu\": {"
+		"	\"id\": \"file\","
+		"		\"value\": \"File \\\"1\\\"\","
+		"		\"popup\": {"
+		"			\"menuitem\": ["
+		"			{\"value\": \"New\", \"onclick\": \"CreateNewDoc()\"},"
+		"			{\"value\": \"Open\", \"onclick\": \"OpenDoc()\"},"
+		"			{\"value\": \"Close\", \"onclick\": \"CloseDoc()\"}"
+		"			]"
+		"	},"
+		"	\"numbers\": [-1, 2, 3.5, 18446744073709551615, 1e400, true, null]"
+		"}}";
+
+	JsonDocument doc;
+	CHECK(!doc.root().isValid());
+	CHECK(doc.parseInplace(str.c_str()));
+
+	JsonCursor root = doc.root();
+	CHECK_EQUAL(Event::BeginObject, root.type());
+	CHECK_EQUAL(1u, root.size());
+	CHECK(!root.name());
+	CHECK(!root.nextSibling().isValid());
+
+	JsonCursor menu = root.member("menu");
+	CHECK_EQUAL(Event::BeginObject, menu.type());
+	CHECK_EQUAL("menu", menu.name());
+	CHECK_EQUAL(4u, menu.size());
+	CHECK_EQUAL("file", menu.member("id").getString());
+	CHECK_EQUAL("File \"1\"", menu.member("value").getString());
+	CHECK_EQUAL(8u, menu.member("value").getStringLen());
+	CHECK(!menu.member("ID").isValid());
+	CHECK(!menu.member("id").member("id").isValid());
+
+	JsonCursor items = menu.member("popup").member("menuitem");
+	CHECK_EQUAL(Event::BeginArray, items.type());
+	CHECK_EQUAL(3u, items.size());
+	CHECK_EQUAL("Close", items.child(2).member("value").getString());
+	CHECK(!items.child(3).isValid());
+	CHECK(!items.child(0).name());
+
+	roSize count = 0;
+	for(JsonCursor c = items.firstChild(); c.isValid(); c = c.nextSibling())
+		++count;
+	CHECK_EQUAL(3u, count);
+
+	// Numbers are only converted when read, out of range is detected there
+	JsonCursor numbers = menu.member("numbers");
+	CHECK_EQUAL(7u, numbers.size());
+	int i = 0;
+	CHECK(numbers.child(0).getNumber(i));
+	CHECK_EQUAL(-1, i);
+	CHECK_EQUAL(Event::UInteger64, numbers.child(1).type());
+	double d = 0;
+	CHECK(numbers.child(2).getNumber(d));
+	CHECK_EQUAL(3.5, d);
+	roUint64 u = 0;
+	CHECK(numbers.child(3).getNumber(u));
+	CHECK_EQUAL(18446744073709551615uLL, u);
+	CHECK_EQUAL(roStatus::json_parse_error, numbers.child(4).getNumber(i));
+	CHECK_EQUAL(Event::Error, numbers.child(4).type());
+	CHECK(numbers.child(5).getBool());
+	CHECK_EQUAL(Event::Null, numbers.child(6).type());
+	CHECK(!numbers.child(6).isNumber());
+	CHECK_EQUAL(roStatus::type_mismatch, numbers.child(5).getNumber(i));
+
+	// Big object, looked up with the hash table
+	String big = "{";
+	for(roSize j=0; j<100; ++j)
+		strFormat(big, "{}\"member{}\":{}", j ? "," : "", j, j);
+	big += ",\"escaped\\u0041\":true}";
+	CHECK(doc.parse(big.c_str()));
+	root = doc.root();
+	CHECK_EQUAL(101u, root.size());
+	for(roSize j=0; j<100; ++j) {
+		String name;
+		strFormat(name, "member{}", j);
+		roSize val = 0;
+		CHECK(root.member(name.c_str()).getNumber(val));
+		CHECK_EQUAL(j, val);
+	}
+	CHECK(root.member("escapedA").getBool());
+	CHECK(!root.member("member100").isValid());
+	CHECK_EQUAL(16u, sizeof(JsonDocument::_Node));
+
+	// Error
+	CHECK_EQUAL(roStatus::json_parse_error, doc.parse("{\"a\":[1,}"));
+	CHECK(!doc.root().isValid());
+	CHECK(roStrLen(doc.getErrorMessage()) > 0);
+	CHECK_EQUAL(roStatus::json_parse_error, doc.parse(""));
+
+	// The syntax of numbers and escapes is checked by the parsing
+	const char* malformed[] = { "[1x]", "[-]", "[1.]", "[.e1]", "[1e]", "[0x1]", "[\"a\\qb\"]", "[\"\\u12G4\"]", "[\"\\uD800\"]", "[\"a\\n\tb\"]" };
+	for(roSize j=0; j<roCountof(malformed); ++j)
+		CHECK_EQUAL(roStatus::json_parse_error, doc.parse(malformed[j]));
+
+	CHECK(doc.parse("[\"\\uD834\\uDD1E\\/\", -2.5e2, +1, .5]"));
+	CHECK_EQUAL("\xF0\x9D\x84\x9E/", doc.root().child(0).getString());
+	CHECK(doc.root().child(1).getNumber(d));
+	CHECK_EQUAL(-250.0, d);
+	CHECK(doc.root().child(2).getNumber(i));
+	CHECK_EQUAL(1, i);
+	CHECK(doc.root().child(3).getNumber(d));
+	CHECK_EQUAL(0.5, d);
+}
+
 #include "../../roar/base/roRawFileSystem.h"
 
 TEST_FIXTURE(JsonTest, parse_bigFile)
@@ -451,3 +772,197 @@ TEST_FIXTURE(JsonTest, parse_bigFile)
 		++i;
 	}
 }
+
+// A document of records mixing the usual value types, compact or indented like a hand edited file
+static void makeBenchmarkJson(String& json, roSize targetSize, bool indent)
+{
+	const roUtf8* compact =
+		"{}\"id\":{},\"name\":\"item {}\",\"active\":{},\"price\":{}.{},\"position\":[{}.5,-{}.25,{}e-3],"
+		"\"tags\":[\"red\",\"with \\\"quote\\\"\",\"tab\\t\"],\"parent\":null,"
+		"\"description\":\"A longer text which is typical for any kind of user facing data {}\"{}";
+	const roUtf8* indented =
+		"\t{}\n\t\t\"id\" : {},\n\t\t\"name\" : \"item {}\",\n\t\t\"active\" : {},\n\t\t\"price\" : {}.{},\n\t\t\"position\" : [ {}.5, -{}.25, {}e-3 ],\n"
+		"\t\t\"tags\" : [ \"red\", \"with \\\"quote\\\"\", \"tab\\t\" ],\n\t\t\"parent\" : null,\n"
+		"\t\t\"description\" : \"A longer text which is typical for any kind of user facing data {}\"\n\t{}";
+
+	json = "[\n";
+	for(roSize i=0; json.size() < targetSize; ++i) {
+		if(i) json += ",\n";
+		// strFormat has no escape for the braces, pass them as arguments
+		strFormat(json, indent ? indented : compact,
+			"{", i, i, (i % 2) ? "true" : "false", i % 1000, i % 100, i, i % 77, i * 13, i, "}"
+		);
+	}
+	json += "\n]";
+}
+
+// Throughput of the stage 1 alone, of the parser including the events iteration, and of the DOM
+TEST_FIXTURE(JsonTest, parse_benchmark)
+{
+	const roSize size = benchmark ? 64 * 1024 * 1024 : 256 * 1024;
+	const roSize repeat = benchmark ? 5 : 1;
+
+	for(int indent=0; indent<2; ++indent) {
+		String json, copy;
+		makeBenchmarkJson(json, size, indent != 0);
+		const double mb = double(json.size()) * repeat / (1024 * 1024);
+		if(benchmark)
+			roLog("info", indent ? "Indented document:\n" : "Compact document:\n");
+
+		{	Array<roUint32> indices;
+			StopWatch stopWatch;
+			for(roSize i=0; i<repeat; ++i)
+				CHECK(jsonStructuralIndex(json.c_str(), json.size(), indices));
+			if(benchmark)
+				roLog("info", "Json structural index: %.0f MB/s, %u indices\n", mb / stopWatch.getDouble(), indices.size());
+		}
+
+		{	JsonParser parser;
+			double time = 0;
+			roSize eventCount = 0;
+			for(roSize i=0; i<repeat; ++i) {
+				copy = json;
+				StopWatch stopWatch;
+				parser.parseInplace(copy.c_str());
+				JsonParser::Event::Enum e;
+				while((e = parser.nextEvent()) != JsonParser::Event::End && e != JsonParser::Event::Error)
+					++eventCount;
+				time += stopWatch.getDouble();
+				CHECK_EQUAL(JsonParser::Event::End, e);
+			}
+			if(benchmark)
+				roLog("info", "JsonParser events: %.0f MB/s, %u events\n", mb / time, eventCount / repeat);
+		}
+
+		{	double time = 0;
+			for(roSize i=0; i<repeat; ++i) {
+				copy = json;
+				BlockAllocator allocator(sizeof(JsonValue) * 1024);
+				StopWatch stopWatch;
+				JsonValue* root = jsonParseInplace(copy.c_str(), allocator);
+				time += stopWatch.getDouble();
+				CHECK(root);
+			}
+			if(benchmark)
+				roLog("info", "jsonParseInplace DOM: %.0f MB/s\n", mb / time);
+		}
+
+		{	double time = 0;
+			JsonDocument doc;
+			for(roSize i=0; i<repeat; ++i) {
+				copy = json;
+				StopWatch stopWatch;
+				CHECK(doc.parseInplace(copy.c_str()));
+				time += stopWatch.getDouble();
+			}
+			if(benchmark)
+				roLog("info", "JsonDocument: %.0f MB/s, %.1f bytes of tape per value\n", mb / time, double(doc.sizeInByte()) / doc._nodes.size());
+		}
+	}
+}
+
+// Member look up by name and element access by index, JsonValue tree against JsonDocument
+TEST_FIXTURE(JsonTest, document_benchmark)
+{
+	const roSize memberCount = benchmark ? 10000 : 1000;
+	const roSize repeat = benchmark ? 100 : 1;
+
+	String json = "{";
+	for(roSize i=0; i<memberCount; ++i)
+		strFormat(json, "{}\"member{}\":[{},{},{}]", i ? "," : "", i, i, i + 1, i + 2);
+	json += "}";
+
+	Array<String> names;
+	for(roSize i=0; i<memberCount; ++i) {
+		String name;
+		strFormat(name, "member{}", roRandBeginEnd<roSize>(0, memberCount));
+		names.pushBack(name);
+	}
+
+	String copy = json;
+	BlockAllocator allocator(sizeof(JsonValue) * 1024);
+	JsonValue* root = jsonParseInplace(copy.c_str(), allocator);
+	CHECK(root);
+
+	roSize sum1 = 0;
+	StopWatch stopWatch;
+	for(roSize r=0; root && r<repeat; ++r) for(const String& name : names) {
+		for(JsonValue* v = root->firstChild; v; v = v->nextSibling) {
+			if(roStrCmp(v->name, name.c_str()) != 0) continue;
+			JsonValue* e = v->firstChild->nextSibling->nextSibling;
+			roSize val = 0;
+			e->getNumber(val);
+			sum1 += val;
+			break;
+		}
+	}
+	const double domTime = stopWatch.getDouble();
+
+	JsonDocument doc;
+	CHECK(doc.parse(json.c_str()));
+	JsonCursor docRoot = doc.root();
+
+	roSize sum2 = 0;
+	stopWatch.reset();
+	for(roSize r=0; r<repeat; ++r) for(const String& name : names) {
+		roSize val = 0;
+		docRoot.member(name.c_str()).child(2).getNumber(val);
+		sum2 += val;
+	}
+	const double docTime = stopWatch.getDouble();
+	CHECK_EQUAL(sum1, sum2);
+
+	if(benchmark) {
+		const double lookups = double(memberCount * repeat);
+		roLog("info", "JsonValue tree: %.0f ns per look up\n", domTime / lookups * 1e9);
+		roLog("info", "JsonDocument: %.0f ns per look up, %.1f bytes of tape per value\n", docTime / lookups * 1e9, double(doc.sizeInByte()) / doc._nodes.size());
+	}
+}
+
+// Output throughput of records mixing the usual value types, compact and pretty
+TEST_FIXTURE(JsonTest, writer_benchmark)
+{
+	const roSize recordCount = benchmark ? 500000 : 1000;
+	const roSize repeat = benchmark ? 5 : 1;
+
+	for(int pretty=0; pretty<2; ++pretty) {
+		JsonWriter writer;
+		writer.setPretty(pretty != 0);
+		MemoryOStream os;
+		writer.setStream(&os);
+
+		double time = 0;
+		for(roSize r=0; r<repeat; ++r) {
+			os.clear();
+			StopWatch stopWatch;
+			writer.beginDocument();
+			writer.beginArray();
+			for(roSize i=0; i<recordCount; ++i) {
+				writer.beginObject();
+				writer.write("id", roUint64(i));
+				writer.write("name", "item");
+				writer.write("active", (i % 2) != 0);
+				writer.write("price", double(i % 1000) + 0.01 * (i % 100));
+				writer.beginArray("position");
+					writer.write(float(i) + 0.5f);
+					writer.write(-float(i % 77) - 0.25f);
+					writer.write(float(i * 13) * 1e-3f);
+				writer.endArray();
+				writer.writeNull("parent");
+				writer.write("description", "A longer text with a \"quote\", which is typical for any kind of user facing data");
+				writer.endObject();
+			}
+			writer.endArray();
+			CHECK(writer.endDocument());
+			time += stopWatch.getDouble();
+		}
+
+		// What is written can be parsed back
+		JsonDocument doc;
+		CHECK(doc.parse((const roUtf8*)os.bytePtr()));
+		CHECK_EQUAL(recordCount, doc.root().size());
+
+		if(benchmark)
+			roLog("info", "JsonWriter %s: %.0f MB/s\n", pretty ? "pretty" : "compact", double(os.size()) * repeat / (1024 * 1024) / time);
+	}
+}
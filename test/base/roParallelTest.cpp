@@ -0,0 +1,174 @@
+#include "pch.h"
+#include "../../roar/base/roParallel.h"
+#include "../../roar/base/roArray.h"
+#include "../../roar/base/roLog.h"
+#include "../../roar/base/roStopWatch.h"
+#include "../../src/sort.h"
+#include <math.h>
+#include <stdlib.h>
+
+using namespace ro;
+
+static const bool benchmark = false;
+static const roSize maxThreadCount = benchmark ? 8 : 2;
+static const roSize testSize = benchmark ? 10000000 : 100000;
+
+class ParallelTest {};
+
+namespace {
+
+struct Span {
+	roSize begin, end;
+	bool valid;
+};
+
+// Not commutative, detect any out of order join
+Span joinSpan(const Span& lhs, const Span& rhs)
+{
+	if(lhs.begin == lhs.end) return rhs;
+	if(rhs.begin == rhs.end) return lhs;
+	Span ret = { lhs.begin, rhs.end, lhs.valid && rhs.valid && lhs.end == rhs.begin };
+	return ret;
+}
+
+struct IntComparator {
+	static bool isCorrectOrder(int a, int b) { return a <= b; }
+};
+
+}	// namespace
+
+TEST_FIXTURE(ParallelTest, parallelFor)
+{
+	for(roSize threadCount=0; threadCount<=maxThreadCount; ++threadCount) {
+		TaskPool taskPool;
+		taskPool.init(threadCount, NULL, threadCount % 2 ? TaskPool::SchedulerMode::WorkStealing : TaskPool::SchedulerMode::SharedQueue);
+
+		Array<int> data;
+		data.resize(testSize, 0);
+
+		parallelFor(taskPool, 0, testSize, 0, [&](roSize b, roSize e) {
+			for(roSize i=b; i<e; ++i)
+				data[i] += int(i);
+		});
+
+		bool ok = true;
+		for(roSize i=0; i<testSize; ++i)
+			ok &= data[i] == int(i);
+		CHECK(ok);
+
+		// Empty range and grain larger than the range
+		parallelFor(taskPool, 10, 10, 0, [&](roSize, roSize) { ok = false; });
+		CHECK(ok);
+		roSize callCount = 0;
+		parallelFor(taskPool, 0, 10, 100, [&](roSize b, roSize e) { ++callCount; CHECK_EQUAL(0u, b); CHECK_EQUAL(10u, e); });
+		CHECK_EQUAL(1u, callCount);
+	}
+}
+
+TEST_FIXTURE(ParallelTest, parallelReduce)
+{
+	for(roSize threadCount=0; threadCount<=maxThreadCount; ++threadCount) {
+		TaskPool taskPool;
+		taskPool.init(threadCount, NULL, threadCount % 2 ? TaskPool::SchedulerMode::WorkStealing : TaskPool::SchedulerMode::SharedQueue);
+
+		roUint64 sum = parallelReduce(taskPool, 0, testSize, 64, roUint64(0),
+			[](roSize b, roSize e) { roUint64 s = 0; for(roSize i=b; i<e; ++i) s += i; return s; },
+			[](roUint64 a, roUint64 b) { return a + b; }
+		);
+		CHECK_EQUAL(roUint64(testSize) * (testSize - 1) / 2, sum);
+
+		Span identity = { 0, 0, true };
+		Span span = parallelReduce(taskPool, 0, testSize, 16, identity,
+			[](roSize b, roSize e) { Span s = { b, e, true }; return s; },
+			joinSpan
+		);
+		CHECK(span.valid);
+		CHECK_EQUAL(0u, span.begin);
+		CHECK_EQUAL(testSize, span.end);
+	}
+}
+
+// Nested parallelFor inside a parallelFor
+TEST_FIXTURE(ParallelTest, nested)
+{
+	TaskPool taskPool;
+	taskPool.init(maxThreadCount, NULL, TaskPool::SchedulerMode::WorkStealing);
+
+	const roSize outer = 64, inner = 1000;
+	Array<int> data;
+	data.resize(outer * inner, 0);
+
+	parallelFor(taskPool, 0, outer, 1, [&](roSize b, roSize e) {
+		for(roSize i=b; i<e; ++i) {
+			parallelFor(taskPool, 0, inner, 0, [&](roSize b2, roSize e2) {
+				for(roSize j=b2; j<e2; ++j)
+					data[i * inner + j] = 1;
+			});
+		}
+	});
+
+	int count = 0;
+	for(roSize i=0; i<data.size(); ++i)
+		count += data[i];
+	CHECK_EQUAL(int(outer * inner), count);
+}
+
+TEST_FIXTURE(ParallelTest, sorter)
+{
+	for(roSize threadCount=0; threadCount<=maxThreadCount; ++threadCount) {
+		TaskPool taskPool;
+		taskPool.init(threadCount);
+
+		for(unsigned count : { 0u, 1u, 2u, 3u, 1000u, unsigned(testSize) + 7 }) {
+			Array<int> data;
+			data.resize(count);
+			srand(1);
+			for(roSize i=0; i<count; ++i)
+				data[i] = rand();
+
+			Sorter<int, IntComparator, 1024> sorter(data.typedPtr(), count, &taskPool);
+			sorter.sort();
+
+			bool sorted = true;
+			for(roSize i=1; i<count; ++i)
+				sorted &= data[i-1] <= data[i];
+			CHECK(sorted);
+		}
+	}
+}
+
+// Throughput against a serial loop of the same work
+TEST_FIXTURE(ParallelTest, throughput)
+{
+	Array<float> data;
+	data.resize(testSize, 0.5f);
+
+	StopWatch stopWatch;
+	for(roSize i=0; i<testSize; ++i)
+		data[i] = sinf(data[i]);
+	double serialTime = stopWatch.getAndReset();
+
+	if(benchmark)
+		roLog("info", "parallelFor serial: %.0f items/sec\n", testSize / serialTime);
+
+	for(roSize threadCount=1; threadCount<=maxThreadCount; ++threadCount) {
+		TaskPool taskPool;
+		taskPool.init(threadCount - 1, NULL, TaskPool::SchedulerMode::WorkStealing);
+
+		stopWatch.reset();
+		parallelFor(taskPool, 0, testSize, 0, [&](roSize b, roSize e) {
+			for(roSize i=b; i<e; ++i)
+				data[i] = sinf(data[i]);
+		});
+		double time = stopWatch.getDouble();
+
+		float sum = parallelReduce(taskPool, 0, testSize, 0, 0.0f,
+			[&](roSize b, roSize e) { float s = 0; for(roSize i=b; i<e; ++i) s += data[i]; return s; },
+			[](float a, float b) { return a + b; }
+		);
+		CHECK(sum > 0);
+
+		if(benchmark)
+			roLog("info", "parallelFor %u threads: %.0f items/sec, %.2fx of serial\n", unsigned(threadCount), testSize / time, serialTime / time);
+	}
+}
@@ -1,10 +1,14 @@
 #include "pch.h"
 #include "../../roar/base/roReflection.h"
+#include "../../roar/base/roLog.h"
+#include "../../roar/base/roStopWatch.h"
 #include "../../roar/math/roVector.h"
 
 using namespace ro;
 using namespace ro::Reflection;
 
+static const bool benchmark = false;
+
 namespace ro {
 
 }
@@ -57,6 +61,16 @@ struct Container
 	MyLinkList linkList;
 };
 
+struct Particle
+{
+	roInt32		id;
+	bool		alive;
+	roUint16	flags;
+	roInt64		birth;
+	float		mass;
+	Vec3		position;
+};
+
 struct ContainPointer
 {
 	Body* body;
@@ -98,6 +112,14 @@ struct ReflectionTest
 			.field("floatArray2D", &Container::floatArray2D)
 			.field("linkList", &Container::linkList);
 
+		reflection.Class<Particle>("Particle")
+			.field("id", &Particle::id)
+			.field("alive", &Particle::alive)
+			.field("flags", &Particle::flags)
+			.field("birth", &Particle::birth)
+			.field("mass", &Particle::mass)
+			.field("position", &Particle::position);
+
 		reflection.Class<ContainPointer>("ContainPointer")
 			.field("body", &ContainPointer::body)
 			.field("constBody", &ContainPointer::constBody);
@@ -282,4 +304,332 @@ TEST_FIXTURE(ReflectionTest, serialize)
 
 		ise.endArchive();
 	}
+
+	// Read from a JsonDocument
+	{
+		JsonDocument document;
+		CHECK(document.parse((const roUtf8*)os.bytePtr()));
+		JsonInputSerializer ise;
+		ise.document = &document;
+		CHECK(ise.beginArchive());
+
+		{	Container container;
+			Type* t = reflection.getType<Container>();
+			CHECK(t->serialize(ise, "My container", &container));
+			CHECK_EQUAL(3u, container.intArray.size());
+			CHECK_EQUAL(1u, container.bodies.size());
+			CHECK_EQUAL(2.0f, container.bodies[0].velocity.z);
+			CHECK_EQUAL(2u, container.tinyArray.size());
+			CHECK_EQUAL(2u, container.floatArray2D.size());
+			CHECK_EQUAL(22, container.floatArray2D[1][1]);
+			CHECK(!container.linkList.isEmpty());
+			CHECK_EQUAL("I am list node", container.linkList.front().name.c_str());
+			container.linkList.destroyAll();
+		}
+
+		{	BasicTypes basicTypes;
+			Type* t = reflection.getType<BasicTypes>();
+			CHECK(t->serialize(ise, "Basic types", &basicTypes));
+			CHECK_EQUAL(1u, basicTypes.vUint8);
+			CHECK_EQUAL("Hello world 3", basicTypes.vString.c_str());
+		}
+
+		{	Vec3 v;
+			Type* t = reflection.getType<Vec3>();
+			CHECK(t->serialize(ise, "Vec3 type", &v));
+			CHECK_EQUAL(3, v.z);
+		}
+
+		CHECK(ise.endArchive());
+	}
+
+	// Members are looked up by name in a JsonDocument, the order doesn't matter
+	{
+		JsonDocument document;
+		CHECK(document.parse("{ \"my circle\": { \"radius\": 3, \"area\": 20 } }"));
+		JsonInputSerializer ise;
+		ise.document = &document;
+		CHECK(ise.beginArchive());
+
+		Circle c;
+		Type* t = reflection.getType<Circle>();
+		CHECK(t->serialize(ise, "my circle", &c));
+		CHECK_EQUAL(20, c.area);
+		CHECK_EQUAL(3, c.radius);
+
+		CHECK_EQUAL(roStatus::serialization_member_mismatch, t->serialize(ise, "your circle", &c));
+		CHECK(ise.endArchive());
+	}
+}
+
+#include "../../roar/base/roBinarySerializer.h"
+TEST_FIXTURE(ReflectionTest, serialize_binary)
+{
+	ByteArray buf;
+
+	// Write
+	{	BinaryOutputSerializer ose;
+		ose.serializer.setBuf(&buf);
+		CHECK(ose.beginArchive());
+
+		{	Container container;
+			container.intArray.pushBack(1);
+			container.intArray.pushBack(2);
+			container.intArray.pushBack(3);
+
+			Body body;
+			body.position = Vec3(1.0f);
+			body.velocity = Vec3(2.0f);
+			container.bodies.pushBack(body);
+
+			container.tinyArray.pushBack(1);
+			container.tinyArray.pushBack(2);
+
+			Array<float> af;
+			af.pushBack(11);
+			af.pushBack(12);
+			container.floatArray2D.pushBack(af);
+			container.floatArray2D.pushBack(Array<float>());
+
+			container.linkList.pushBack(*new MyListNode("I am list node"));
+			container.linkList.pushBack(*new MyListNode(""));
+
+			Type* t = reflection.getType<Container>();
+			CHECK(t->serialize(ose, "My container", &container));
+			container.linkList.destroyAll();
+		}
+
+		{	BasicTypes basicTypes = {
+				1u,
+				1.23f,
+				4.56,
+				NULL,
+				"Hello world 2",
+				"Hello world 3"
+			};
+
+			Type* t = reflection.getType<BasicTypes>();
+			CHECK(t->serialize(ose, "Basic types", &basicTypes));
+		}
+
+		{	Particle p = { -7, true, 0xBEEF, -(roInt64(1) << 40), 0.5f, Vec3(1, 2, 3) };
+			Type* t = reflection.getType<Particle>();
+			CHECK(t->serialize(ose, "particle", &p));
+		}
+
+		{	Circle c;
+			c.area = 10;
+			c.radius = 2;
+
+			Type* t = reflection.getType<Circle>();
+			CHECK(t->serialize(ose, "my circle", &c));
+		}
+
+		CHECK(ose.endArchive());
+	}
+
+	// Read
+	{	BinaryInputSerializer ise;
+		ise.deserializer.setBuf(&buf);
+		CHECK(ise.beginArchive());
+
+		{	Container container;
+			Type* t = reflection.getType<Container>();
+			CHECK(t->serialize(ise, "My container", &container));
+			CHECK_EQUAL(3u, container.intArray.size());
+			CHECK_EQUAL(3u, container.intArray.back());
+			CHECK_EQUAL(1u, container.bodies.size());
+			CHECK_EQUAL(1.0f, container.bodies[0].position.y);
+			CHECK_EQUAL(2.0f, container.bodies[0].velocity.z);
+			CHECK_EQUAL(2u, container.tinyArray.size());
+			CHECK_EQUAL(2u, container.floatArray2D.size());
+			if(container.floatArray2D.size() == 2) {
+				CHECK_EQUAL(2u, container.floatArray2D[0].size());
+				CHECK_EQUAL(12, container.floatArray2D[0][1]);
+				CHECK(container.floatArray2D[1].isEmpty());
+			}
+			CHECK(!container.linkList.isEmpty());
+			CHECK_EQUAL("I am list node", container.linkList.front().name.c_str());
+			CHECK_EQUAL("", container.linkList.back().name.c_str());
+			container.linkList.destroyAll();
+		}
+
+		{	BasicTypes basicTypes;
+			Type* t = reflection.getType<BasicTypes>();
+			CHECK(t->serialize(ise, "Basic types", &basicTypes));
+			CHECK_EQUAL(1u, basicTypes.vUint8);
+			CHECK_EQUAL(1.23f, basicTypes.vFloat);
+			CHECK_EQUAL(4.56, basicTypes.vDouble);
+			CHECK(!basicTypes.vStr);
+			CHECK_EQUAL("Hello world 2", basicTypes.vCStr);
+			CHECK_EQUAL("Hello world 3", basicTypes.vString.c_str());
+		}
+
+		{	Particle p;
+			Type* t = reflection.getType<Particle>();
+			CHECK(t->serialize(ise, "particle", &p));
+			CHECK_EQUAL(-7, p.id);
+			CHECK(p.alive);
+			CHECK_EQUAL(0xBEEF, p.flags);
+			CHECK_EQUAL(-(roInt64(1) << 40), p.birth);
+			CHECK_EQUAL(0.5f, p.mass);
+			CHECK_EQUAL(3, p.position.z);
+		}
+
+		// The data is a Circle, not a Shape
+		{	Shape s;
+			Type* t = reflection.getType<Shape>();
+			CHECK_EQUAL(roStatus::serialization_schema_mismatch, t->serialize(ise, "my circle", &s));
+		}
+	}
+
+	// Truncated data
+	{	ByteArray truncated;
+		truncated.assign(buf.typedPtr(), buf.size() / 2);
+
+		BinaryInputSerializer ise;
+		ise.deserializer.setBuf(&truncated);
+		CHECK(ise.beginArchive());
+
+		Container container;
+		Type* t = reflection.getType<Container>();
+		CHECK(t->serialize(ise, "My container", &container));
+		BasicTypes basicTypes;
+		t = reflection.getType<BasicTypes>();
+		CHECK(!t->serialize(ise, "Basic types", &basicTypes));
+		container.linkList.destroyAll();
+	}
+
+	// Not a binary archive
+	{	ByteArray garbage;
+		garbage.assign((const roByte*)"{}", 2);
+
+		BinaryInputSerializer ise;
+		ise.deserializer.setBuf(&garbage);
+		CHECK(!ise.beginArchive());
+	}
+}
+
+// Reflection to JSON throughput, on a Container holding many bodies
+TEST_FIXTURE(ReflectionTest, serialize_benchmark)
+{
+	const roSize bodyCount = benchmark ? 1000000 : 1000;
+
+	Container container;
+	for(roSize i=0; i<bodyCount; ++i) {
+		Body body;
+		body.position = Vec3(float(i), 0.5f * i, -1.25f);
+		body.velocity = Vec3(0.1f * i, 2.0f, float(i) / 3);
+		container.bodies.pushBack(body);
+		container.intArray.pushBack(roUint8(i));
+	}
+
+	Type* t = reflection.getType<Container>();
+	MemoryOStream os;
+
+	StopWatch stopWatch;
+	{	JsonOutputSerializer ose;
+		ose.writer.setStream(&os);
+		CHECK(ose.beginArchive());
+		CHECK(t->serialize(ose, "container", &container));
+		CHECK(ose.endArchive());
+	}
+	const double time = stopWatch.getDouble();
+
+	// The floats read back exactly
+	JsonDocument document;
+	CHECK(document.parse((const roUtf8*)os.bytePtr()));
+	JsonInputSerializer ise;
+	ise.document = &document;
+	CHECK(ise.beginArchive());
+
+	Container read;
+	CHECK(t->serialize(ise, "container", &read));
+	CHECK_EQUAL(bodyCount, read.bodies.size());
+	CHECK_EQUAL(bodyCount, read.intArray.size());
+	if(read.bodies.size() == bodyCount) {
+		CHECK_EQUAL(container.bodies.back().velocity.x, read.bodies.back().velocity.x);
+		CHECK_EQUAL(container.bodies.back().velocity.z, read.bodies.back().velocity.z);
+	}
+	CHECK(ise.endArchive());
+
+	if(benchmark)
+		roLog("info", "Reflection to JSON: %.0f MB/s\n", double(os.size()) / (1024 * 1024) / time);
+}
+
+// Save plus load of the same Container, binary against JSON
+TEST_FIXTURE(ReflectionTest, serialize_binary_benchmark)
+{
+	const roSize bodyCount = benchmark ? 1000000 : 1000;
+
+	Container container;
+	for(roSize i=0; i<bodyCount; ++i) {
+		Body body;
+		body.position = Vec3(float(i), 0.5f * i, -1.25f);
+		body.velocity = Vec3(0.1f * i, 2.0f, float(i) / 3);
+		container.bodies.pushBack(body);
+		container.intArray.pushBack(roUint8(i));
+	}
+	for(roSize i=0; i<bodyCount / 100; ++i) {
+		container.floatArray2D.pushBack(Array<float>());
+		for(roSize j=0; j<100; ++j)
+			container.floatArray2D.back().pushBack(float(i * j));
+		container.linkList.pushBack(*new MyListNode("node"));
+	}
+
+	Type* t = reflection.getType<Container>();
+
+	StopWatch stopWatch;
+	ByteArray buf;
+	{	BinaryOutputSerializer ose;
+		ose.serializer.setBuf(&buf);
+		CHECK(ose.beginArchive());
+		CHECK(t->serialize(ose, "container", &container));
+		CHECK(ose.endArchive());
+	}
+
+	Container binaryRead;
+	{	BinaryInputSerializer ise;
+		ise.deserializer.setBuf(&buf);
+		CHECK(ise.beginArchive());
+		CHECK(t->serialize(ise, "container", &binaryRead));
+		CHECK(ise.endArchive());
+	}
+	const double binaryTime = stopWatch.getDouble();
+
+	stopWatch.reset();
+	MemoryOStream os;
+	{	JsonOutputSerializer ose;
+		ose.writer.setStream(&os);
+		CHECK(ose.beginArchive());
+		CHECK(t->serialize(ose, "container", &container));
+		CHECK(ose.endArchive());
+	}
+
+	Container jsonRead;
+	{	JsonDocument document;
+		CHECK(document.parse((const roUtf8*)os.bytePtr()));
+		JsonInputSerializer ise;
+		ise.document = &document;
+		CHECK(ise.beginArchive());
+		CHECK(t->serialize(ise, "container", &jsonRead));
+		CHECK(ise.endArchive());
+	}
+	const double jsonTime = stopWatch.getDouble();
+
+	CHECK_EQUAL(bodyCount, binaryRead.bodies.size());
+	CHECK_EQUAL(bodyCount / 100, binaryRead.floatArray2D.size());
+	if(binaryRead.bodies.size() == bodyCount) {
+		CHECK_EQUAL(container.bodies.back().velocity.x, binaryRead.bodies.back().velocity.x);
+		CHECK_EQUAL(container.floatArray2D.back().back(), binaryRead.floatArray2D.back().back());
+	}
+
+	container.linkList.destroyAll();
+	binaryRead.linkList.destroyAll();
+	jsonRead.linkList.destroyAll();
+
+	if(benchmark) {
+		roLog("info", "Reflection binary save+load: %.1f ms, %u bytes\n", binaryTime * 1000, roUint32(buf.size()));
+		roLog("info", "Reflection JSON save+load: %.1f ms, %u bytes, %.1fx slower\n", jsonTime * 1000, roUint32(os.size()), jsonTime / binaryTime);
+	}
 }
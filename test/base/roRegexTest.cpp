@@ -1,8 +1,12 @@
 #include "pch.h"
 #include "../../roar/base/roRegex.h"
+#include "../../roar/base/roLog.h"
+#include "../../roar/base/roStopWatch.h"
 
 using namespace ro;
 
+static const bool benchmark = false;
+
 struct RegexTest {};
 
 // strScan(str, "http://(:i)\.(com|org)(\::z)?((/:i)*)", domain, ending, port, path);
@@ -439,6 +443,12 @@ TEST_FIXTURE(RegexTest, test)
 		{ "(([a-z]|(ab))[.])",			"",		"ab.c",											"ab.`ab.`ab`ab" },
 		{ "((c|(a))[.])",				"",		"a.c",											"a.`a.`a`a" },
 		{ "((c|(ab))[.])+",				"",		"ab.c",											"ab.`ab.`ab`ab" },
+		{ "a\\.+b",					"",		"a..b",											"a..b" },
+		{ "(a|b)*c",					"",		"xababc",										"ababc`b" },
+		{ "(?:a|aa)*c",					"",		"aaac",											"aaac" },
+		{ "(a|aa)*c",					"",		"aaaa",											NULL },
+		{ "(a?)*b",						"",		"b",											"b`" },
+		{ "\\bis",					"",		"is",											"is" },
 	};
 
 	Regex regex;
@@ -538,3 +548,70 @@ TEST_FIXTURE(RegexTest, customMatcher)
 
 	CHECK(!regex.match("1.23", "$0$1", matchers));
 }
+
+// Patterns which take exponential time with backtracking, the DFA (no capturing group)
+// and the Pike VM (with capturing group) are linear to the input
+TEST_FIXTURE(RegexTest, pathological)
+{
+	const roSize size = benchmark ? 1000000 : 10000;
+	String a, x, ab;
+	a.append('a', size);
+	x.append('x', size);
+	for(roSize i=0; i<size / 2; ++i)
+		ab.append("ab");
+	ab.append('c');
+
+	struct Case { const roUtf8* reg; const String& str; bool matched; const roUtf8* lastGroup; };
+	const Case cases[] = {
+		{ "(?:a|aa)*c",		a,	false,	NULL },
+		{ "(a|aa)*c",		a,	false,	NULL },
+		{ "(?:x+x+)+y",		x,	false,	NULL },
+		{ "(x+x+)+y",		x,	false,	NULL },
+		{ "(?:a|b)*c",		ab,	true,	NULL },
+		{ "(a|b)*c",		ab,	true,	"b" },
+	};
+
+	Regex regex;
+	for(const Case& c : cases) {
+		Regex::Compiled compiled;
+		CHECK(regex.compile(c.reg, compiled));
+
+		StopWatch stopWatch;
+		CHECK_EQUAL(c.matched, regex.match(c.str, compiled));
+		double seconds = stopWatch.getDouble();
+
+		if(c.matched)
+			CHECK_EQUAL(c.str.size(), regex.result[0].size());
+		if(c.lastGroup)
+			CHECK_EQUAL(c.lastGroup, regex.result.back().toString().c_str());
+
+		if(benchmark)
+			roLog("info", "Regex %s: %.1f MB/s\n", c.reg, c.str.size() / seconds / 1e6);
+	}
+}
+
+// Short inputs matched with the pattern string, as the http header parsing do
+TEST_FIXTURE(RegexTest, oneShot)
+{
+	const roSize count = benchmark ? 100000 : 1000;
+	const roUtf8* header = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes 100-199/1000\r\nContent-Length: 100\r\n\r\n";
+	const roUtf8* url = "http://localhost:8080/some/path?a=1";
+
+	Regex regex;
+	StopWatch stopWatch;
+	for(roSize i=0; i<count; ++i) {
+		CHECK(regex.match(header, "^HTTP/[\\d\\.]+[ ]+(\\d\\d\\d)", "i"));
+		CHECK_EQUAL("206", regex.result[1].toString().c_str());
+
+		CHECK(regex.match(" bytes 100-199/1000", "^\\s*bytes\\s+([\\d]+)\\s*-\\s*([\\d]+)\\s*/([\\d]+)"));
+		CHECK_EQUAL("1000", regex.result[3].toString().c_str());
+
+		CHECK(regex.match(url, "^\\s*([A-Za-z]+)://([^/]+)([^\\r\\n]*)"));
+		CHECK_EQUAL("localhost:8080", regex.result[2].toString().c_str());
+
+		CHECK(!regex.match(header, "^(GET|POST)\\s+([^\\s]*)", "i"));
+	}
+
+	if(benchmark)
+		roLog("info", "Regex one shot: %.2f us per match\n", stopWatch.getDouble() * 1e6 / (count * 4));
+}
@@ -1,10 +1,13 @@
 #include "pch.h"
 #include "../../roar/base/roString.h"
+#include "../../roar/base/roParallel.h"
+#include "../../roar/base/roStringFormat.h"
 
 using namespace ro;
 
 struct StringTest {};
 struct RangedStringTest {};
+struct ConstStringTest {};
 
 TEST_FIXTURE(StringTest, compare)
 {
@@ -41,3 +44,63 @@ TEST_FIXTURE(RangedStringTest, compare)
 	CHECK(RangedString("AB") > RangedString("A"));
 	CHECK(RangedString("AC") > RangedString("AB"));
 }
+
+TEST_FIXTURE(ConstStringTest, basic)
+{
+	ConstString empty;
+	CHECK(empty.isEmpty());
+	CHECK(empty == ConstString(""));
+	CHECK(empty == ConstString((const char*)NULL));
+
+	ConstString a("abc");
+	CHECK_EQUAL(3u, a.size());
+	CHECK_EQUAL("abc", a.c_str());
+	CHECK(a.c_str() == ConstString("abc").c_str());
+	CHECK(a.c_str() == ConstString("abcdef", 3).c_str());
+	CHECK(a.c_str() == ConstString(RangedString("abc")).c_str());
+	CHECK(a.c_str() == ConstString(a.hash()).c_str());
+
+	ConstString b = a;
+	b = "xyz";
+	CHECK_EQUAL("abc", a.c_str());
+	CHECK_EQUAL("xyz", b.c_str());
+	b = b;
+	CHECK_EQUAL("xyz", b.c_str());
+}
+
+// The two strings have the same sdbm hash
+TEST_FIXTURE(ConstStringTest, hashCollision)
+{
+	ConstString a("ipigcnu");
+	ConstString b("mgbclui");
+	CHECK_EQUAL(a.hash(), b.hash());
+	CHECK(!(a == b));
+	CHECK(a < b || b < a);
+	CHECK_EQUAL("ipigcnu", a.c_str());
+	CHECK_EQUAL("mgbclui", b.c_str());
+	CHECK(a.c_str() == ConstString("ipigcnu").c_str());
+	CHECK(b.c_str() == ConstString("mgbclui").c_str());
+}
+
+TEST_FIXTURE(ConstStringTest, multiThread)
+{
+	TaskPool taskPool;
+	taskPool.init(4);
+
+	// Many threads intern, copy and release the same set of strings,
+	// which keep the reference count and the incremental growing busy.
+	ConstString keep("keep");
+	parallelFor(taskPool, 0, 64, 1, [&](roSize b, roSize e) {
+		String str;
+		for(roSize i=b; i<e; ++i) for(roSize j=0; j<2000; ++j) {
+			strFormat(str, "str{}", j);
+			ConstString s1(str.c_str());
+			ConstString s2 = s1;
+			ConstString s3(keep);
+			roVerify(s1.c_str() == s2.c_str() && s2.size() == str.size());
+		}
+	});
+
+	CHECK_EQUAL("keep", keep.c_str());
+	CHECK_EQUAL("str1999", ConstString("str1999").c_str());
+}
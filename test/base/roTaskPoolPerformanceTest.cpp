@@ -0,0 +1,92 @@
+#include "pch.h"
+#include "../../roar/base/roTaskPool.h"
+#include "../../roar/base/roLog.h"
+#include "../../roar/base/roStopWatch.h"
+#include <math.h>
+
+using namespace ro;
+
+static const bool benchmark = false;
+static const roSize maxThreadCount = benchmark ? 8 : 2;
+static const int spawnDepth = benchmark ? 16 : 8;
+static const roSize flatTaskCount = benchmark ? 200000 : 1000;
+
+class TaskPoolPerformanceTest {};
+
+namespace {
+
+// Some small amount of work, close to what a fine grained loader task does
+static float _work()
+{
+	float val = 0.1f;
+	for(roSize i=0; i<200; ++i)
+		val = sinf(val);
+	return val;
+}
+
+class FlatTask : public Task
+{
+public:
+	void run(TaskPool* taskPool) override
+	{
+		_work();
+		delete this;
+	}
+};
+
+// Each task spawn 2 children and wait for them, stress the addChild() and steal path
+class TreeTask : public Task
+{
+public:
+	explicit TreeTask(int depth) : _depth(depth) {}
+	void run(TaskPool* taskPool) override
+	{
+		_work();
+		if(_depth > 0) {
+			TaskId join = taskPool->beginAdd([]() {});
+			for(int i=0; i<2; ++i) {
+				TaskId child = taskPool->beginAdd(new TreeTask(_depth - 1));
+				taskPool->addChild(join, child);
+				taskPool->finishAdd(child);
+			}
+			taskPool->finishAdd(join);
+			taskPool->wait(join);
+		}
+		delete this;
+	}
+	int _depth;
+};
+
+}	// namespace
+
+static void _runScaling(TaskPool::SchedulerMode mode, const char* modeName)
+{
+	for(roSize threadCount=1; threadCount<=maxThreadCount; ++threadCount) {
+		// NOTE: The main thread also helps to run the tasks, so spawn one less worker
+		TaskPool taskPool;
+		taskPool.init(threadCount - 1, NULL, mode);
+
+		StopWatch stopWatch;
+		for(roSize i=0; i<flatTaskCount; ++i)
+			taskPool.addFinalized(new FlatTask);
+		taskPool.waitAll();
+		double flatTime = stopWatch.getAndReset();
+
+		TaskId root = taskPool.addFinalized(new TreeTask(spawnDepth));
+		taskPool.wait(root);
+		double treeTime = stopWatch.getDouble();
+
+		const double treeTaskCount = double((2 << spawnDepth) - 1) * 2;	// Each node got a join task
+		if(benchmark) {
+			roLog("info", "%s, %u threads: flat %.0f tasks/sec, tree %.0f tasks/sec\n",
+				modeName, unsigned(threadCount), flatTaskCount / flatTime, treeTaskCount / treeTime
+			);
+		}
+	}
+}
+
+TEST_FIXTURE(TaskPoolPerformanceTest, scaling)
+{
+	_runScaling(TaskPool::SchedulerMode::SharedQueue, "SharedQueue");
+	_runScaling(TaskPool::SchedulerMode::WorkStealing, "WorkStealing");
+}
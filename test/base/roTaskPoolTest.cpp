@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "../../src/common.h"
 #include "../../roar/base/roTaskPool.h"
+#include "../../roar/base/roAtomic.h"
 #include <math.h>
 
 using namespace ro;
@@ -136,6 +137,77 @@ TEST_FIXTURE(TaskPoolTest, singleThreadChild)
 	}
 }
 
+TEST_FIXTURE(TaskPoolTest, taskIdReuse)
+{
+	TaskPool taskPool;
+	TaskId t1 = taskPool.addFinalized(new MyTask);
+	taskPool.wait(t1);
+	CHECK(taskPool.isDone(t1));
+
+	// The slot of t1 is reused, but with a different generation
+	TaskId t2 = taskPool.beginAdd(new MyTask);
+	CHECK(t1 != t2);
+	CHECK(taskPool.isDone(t1));
+	CHECK(!taskPool.isDone(t2));
+
+	taskPool.wait(t1);	// Will not wait for t2
+	taskPool.finishAdd(t2);
+	taskPool.wait(t2);
+	CHECK(taskPool.isDone(t2));
+	CHECK_EQUAL(0u, taskPool.taskCount());
+
+	// A stale id should never alias a live task, even after the slot is reused many times.
+	// The slot is reused 2^12 times below, a 12 bits generation would wrap and t3 get the id of t1,
+	// while the 32 bits generation of TaskId only wrap after 2^32 reuses
+	for(roSize i=0; i<(1 << 12) - 3; ++i) {
+		TaskId t = taskPool.addFinalized([]() {});
+		taskPool.wait(t);
+	}
+
+	TaskId t3 = taskPool.beginAdd(new MyTask);
+	CHECK(taskPool.isDone(t1));
+	CHECK(taskPool.isDone(t2));
+	CHECK(!taskPool.isDone(t3));
+	taskPool.finishAdd(t3);
+	taskPool.wait(t3);
+}
+
+namespace {
+
+// Pretend all but the last slot are taken, instead of adding a million tasks
+class NearlyFullTaskPool : public TaskPool
+{
+public:
+	static const roSize maxSlotCount = TaskList::maxChunkCount * TaskList::chunkSize;
+	NearlyFullTaskPool() { taskList._slotCount = long(maxSlotCount - 1); }
+	roSize slotCount() const { return taskList.slotCount(); }
+};
+
+}	// namespace
+
+TEST_FIXTURE(TaskPoolTest, outOfSlots)
+{
+	NearlyFullTaskPool taskPool;
+
+	TaskId t1 = taskPool.beginAdd(new MyTask);
+	CHECK(t1 != 0);
+
+	MyTask* task = new MyTask;
+	CHECK_EQUAL(0u, taskPool.beginAdd(task));
+	delete task;
+	CHECK_EQUAL(0u, taskPool.addFinalized([]() {}));
+	CHECK_EQUAL(roSize(NearlyFullTaskPool::maxSlotCount), taskPool.slotCount());
+	CHECK_EQUAL(1u, taskPool.taskCount());
+
+	// The freed slot can be used again
+	taskPool.finishAdd(t1);
+	taskPool.wait(t1);
+	TaskId t2 = taskPool.addFinalized([]() {});
+	CHECK(t2 != 0);
+	taskPool.wait(t2);
+	CHECK_EQUAL(0u, taskPool.taskCount());
+}
+
 // This test aim to stress the task pool with dependency
 TEST_FIXTURE(TaskPoolTest, dependencyDeadLock)
 {
@@ -175,3 +247,86 @@ TEST_FIXTURE(TaskPoolTest, dependencyDeadLock)
 
 	taskPool.waitAll();
 }
+
+TEST_FIXTURE(TaskPoolTest, workStealingDependencyDeadLock)
+{
+	class DummyTask : public Task
+	{
+	public:
+		void run(TaskPool* taskPool) override {}
+		TaskId thisId;
+	};
+
+	TaskPool taskPool;
+	taskPool.init(3, NULL, TaskPool::SchedulerMode::WorkStealing);
+	DummyTask tasks[1000];
+
+	for(roSize i=0; i<COUNTOF(tasks); ++i) {
+		tasks[i].thisId = taskPool.beginAdd(&tasks[i]);
+		taskPool.dependsOn(tasks[i].thisId, (i == 0) ? 0 : tasks[rand() % i].thisId);
+	}
+
+	for(roSize i=0; i<COUNTOF(tasks); ++i)
+		taskPool.finishAdd(tasks[i].thisId);
+
+	taskPool.waitAll();
+}
+
+namespace {
+
+// Spawn a binary tree of child tasks, the children are pushed to the local queue of the worker
+class SpawnTask : public Task
+{
+public:
+	SpawnTask(int depth, AtomicInteger& counter) : _depth(depth), _counter(counter) {}
+	void run(TaskPool* taskPool) override
+	{
+		++_counter;
+		if(_depth > 0) {
+			TaskId join = taskPool->beginAdd([]() {});
+			for(int i=0; i<2; ++i) {
+				TaskId child = taskPool->beginAdd(new SpawnTask(_depth - 1, _counter));
+				taskPool->addChild(join, child);
+				taskPool->finishAdd(child);
+			}
+			taskPool->finishAdd(join);
+			taskPool->wait(join);
+		}
+		delete this;
+	}
+	int _depth;
+	AtomicInteger& _counter;
+};
+
+}	// namespace
+
+TEST_FIXTURE(TaskPoolTest, workStealingChild)
+{
+	TaskPool taskPool;
+	taskPool.init(3, NULL, TaskPool::SchedulerMode::WorkStealing);
+
+	AtomicInteger counter;
+	TaskId rootId = taskPool.addFinalized(new SpawnTask(10, counter));
+	taskPool.wait(rootId);
+
+	CHECK(taskPool.isDone(rootId));
+	CHECK_EQUAL((1 << 11) - 1, counter.value());
+}
+
+TEST_FIXTURE(TaskPoolTest, workStealingSuspend)
+{
+	TaskPool taskPool;
+	taskPool.init(2, NULL, TaskPool::SchedulerMode::WorkStealing);
+
+	AtomicInteger counter;
+	TaskId t = taskPool.beginAdd([&counter]() { ++counter; });
+	taskPool.suspend(t);
+	taskPool.finishAdd(t);
+
+	TaskPool::sleep(10);
+	CHECK_EQUAL(0, counter.value());
+
+	taskPool.resume(t);
+	taskPool.wait(t);
+	CHECK_EQUAL(1, counter.value());
+}
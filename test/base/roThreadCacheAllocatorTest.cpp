@@ -0,0 +1,175 @@
+#include "pch.h"
+#include "../../roar/base/roThreadCacheAllocator.h"
+#include "../../roar/base/roParallel.h"
+#include "../../roar/base/roLog.h"
+#include "../../roar/base/roStopWatch.h"
+#include "../../roar/base/roUtility.h"
+#include <stdlib.h>
+#include <string.h>
+
+using namespace ro;
+
+static const bool benchmark = false;
+static const roSize sampleCount = benchmark ? 100 : 1;
+
+class ThreadCacheAllocatorTest {};
+
+TEST_FIXTURE(ThreadCacheAllocatorTest, basic)
+{
+	ThreadCacheAllocator& a = threadCacheAllocator;
+
+	a.free(NULL);
+	CHECK_EQUAL(0u, ThreadCacheAllocator::usableSize(NULL));
+
+	void* ptrs[600];
+	for(roSize i=0; i<roCountof(ptrs); ++i) {
+		ptrs[i] = a.malloc(i);
+		CHECK(ptrs[i] != NULL);
+		CHECK((roPtrInt(ptrs[i]) & 15) == 0);
+		CHECK(ThreadCacheAllocator::usableSize(ptrs[i]) >= i);
+		memset(ptrs[i], int(i), i);
+	}
+
+	// No block should overlap with the others
+	bool ok = true;
+	for(roSize i=0; i<roCountof(ptrs); ++i) {
+		for(roSize j=0; j<i; ++j)
+			ok &= ((roByte*)ptrs[i])[j] == roByte(i);
+	}
+	CHECK(ok);
+
+	for(roSize i=0; i<roCountof(ptrs); ++i)
+		a.free(ptrs[i]);
+}
+
+TEST_FIXTURE(ThreadCacheAllocatorTest, realloc)
+{
+	ThreadCacheAllocator& a = threadCacheAllocator;
+
+	// Grow in place within the size class
+	char* p = a.malloc(20).cast<char>();
+	roMemcpy(p, "0123456789", 10);
+	char* p2 = a.realloc(p, 20, 32).cast<char>();
+	CHECK(p == p2);
+
+	// Move to a larger class, and then a large block
+	p = a.realloc(p2, 32, 100).cast<char>();
+	CHECK(memcmp(p, "0123456789", 10) == 0);
+	p = a.realloc(p, 100, 1000).cast<char>();
+	CHECK(memcmp(p, "0123456789", 10) == 0);
+	p = a.realloc(p, 1000, 10000).cast<char>();
+	CHECK(memcmp(p, "0123456789", 10) == 0);
+
+	// Back to small
+	p = a.realloc(p, 10000, 10).cast<char>();
+	CHECK(memcmp(p, "0123456789", 10) == 0);
+	CHECK(!a.realloc(p, 10, 0));
+}
+
+// Blocks allocated by one thread and freed by another should flow back through the depot
+TEST_FIXTURE(ThreadCacheAllocatorTest, crossThreadFree)
+{
+	TaskPool taskPool;
+	taskPool.init(2, NULL, TaskPool::SchedulerMode::WorkStealing);
+
+	const roSize count = 10000;
+	void** ptrs = roMalloc(count * sizeof(void*)).cast<void*>();
+
+	for(roSize round=0; round<4; ++round) {
+		for(roSize i=0; i<count; ++i)
+			ptrs[i] = threadCacheAllocator.malloc(i % 200);
+
+		parallelFor(taskPool, 0, count, 100, [&](roSize b, roSize e) {
+			for(roSize i=b; i<e; ++i)
+				threadCacheAllocator.free(ptrs[i]);
+		});
+	}
+
+	roFree(ptrs);
+	ThreadCacheAllocator::flushThreadCache();
+}
+
+// ----------------------------------------------------------------------
+
+namespace {
+
+struct LibcAllocator
+{
+	void* malloc(roSize size) { return ::malloc(size); }
+	void* realloc(void* p, roSize, roSize newSize) { return ::realloc(p, newSize); }
+	void free(void* p) { ::free(p); }
+};
+
+// Mimic Array::pushBack(), which double the capacity with realloc
+template<class A>
+void arrayChurn(A& a, roSize repeatCount, roSize arySize)
+{
+	for(roSize j=0; j<repeatCount; ++j) {
+		roSize* data = NULL;
+		roSize capacity = 0;
+		for(roSize k=0; k<arySize; ++k) {
+			if(k == capacity) {
+				roSize newCapacity = roMaxOf2(capacity * 2, roSize(2));
+				data = (roSize*)a.realloc(data, capacity * sizeof(roSize), newCapacity * sizeof(roSize));
+				capacity = newCapacity;
+			}
+			data[k] = k;
+		}
+		a.free(data);
+	}
+}
+
+// Mimic a bunch of short String living together, freed in a different order than allocated
+template<class A>
+void stringChurn(A& a, roSize count)
+{
+	static const roSize window = 64;
+	void* live[window] = { NULL };
+	roUint32 seed = 1;
+	for(roSize i=0; i<count; ++i) {
+		seed = seed * 1103515245 + 12345;
+		roSize slot = (seed >> 16) % window;
+		a.free(live[slot]);
+		live[slot] = a.malloc(8 + (seed >> 8) % 56);
+	}
+	for(roSize i=0; i<window; ++i)
+		a.free(live[i]);
+}
+
+template<class A>
+double runChurn(A& a, TaskPool& taskPool)
+{
+	StopWatch stopWatch;
+	for(roSize i=0; i<sampleCount; ++i) {
+		arrayChurn(a, 1000, 10);
+		arrayChurn(a, 100, 100);
+		arrayChurn(a, 10, 1000);
+		stringChurn(a, 10000);
+	}
+	double singleThread = stopWatch.getAndReset();
+
+	// Each thread churn on it's own
+	parallelFor(taskPool, 0, (taskPool.threadCount() + 1) * sampleCount, 1, [&](roSize b, roSize e) {
+		for(roSize i=b; i<e; ++i) {
+			arrayChurn(a, 1000, 10);
+			stringChurn(a, 10000);
+		}
+	});
+	double multiThread = stopWatch.getDouble();
+	return singleThread + multiThread;
+}
+
+}	// namespace
+
+TEST_FIXTURE(ThreadCacheAllocatorTest, compareWithLibc)
+{
+	TaskPool taskPool;
+	taskPool.init(benchmark ? 3 : 1, NULL, TaskPool::SchedulerMode::WorkStealing);
+
+	LibcAllocator libc;
+	double libcTime = runChurn(libc, taskPool);
+	double cacheTime = runChurn(threadCacheAllocator, taskPool);
+
+	if(benchmark)
+		roLog("info", "Array/String churn, libc: %f, ThreadCacheAllocator: %f\n", libcTime, cacheTime);
+}
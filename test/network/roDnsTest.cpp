@@ -19,3 +19,201 @@ TEST_FIXTURE(DnsTest, basic)
 		str = str;
 	}
 }
+
+// The cache is not available on Windows, which uses the system resolver
+#if !roOS_WIN
+
+#include "../../roar/base/roCoRoutine.h"
+
+namespace {
+
+// Answers queries on loopback from a fixed table, and counts them:
+// multi.test has 2 A and 2 AAAA records, missing.test does not exist,
+// all with a TTL of 1 second.
+struct DnsStandIn
+{
+	roStatus init(roUint16 port)
+	{
+		roStatus st = socket.create(BsdSocket::UDP);
+		if(!st) return st;
+		return socket.bind(SockAddr(SockAddr::ipLoopBack(), port));
+	}
+
+	void run()
+	{
+		roByte buf[512];
+		while(keepRun) {
+			SockAddr from;
+			roSize len = sizeof(buf);
+			roStatus st = socket.receiveFrom(buf, len, from, 0.1f);
+			if(st == roStatus::timed_out)
+				continue;
+			if(!st) break;
+			if(len < 12 + 5)
+				continue;
+
+			++queryCount;
+			if(delay > 0)
+				coSleep(delay);
+
+			roSize size = reply(buf, len);
+			socket.sendTo(buf, size, from);
+		}
+	}
+
+	// Turn the query in buf to it's response, return the response size
+	roSize reply(roByte* buf, roSize len)
+	{
+		// The question name, eg. 5multi4test0
+		String name;
+		roSize i = 12;
+		while(i < len && buf[i]) {
+			name.append((const char*)buf + i + 1, buf[i]);
+			i += buf[i] + 1;
+			if(buf[i]) name.append('.');
+		}
+		const roUint16 qtype = roUint16(buf[i + 1] << 8 | buf[i + 2]);
+		roSize size = i + 5;	// End of question
+
+		roToLower(name.c_str());
+		const bool exist = (name == "multi.test");
+
+		buf[2] = 0x81;						// Response, recursion desired
+		buf[3] = exist ? 0x80 : 0x83;		// Recursion available, NXDOMAIN if not exist
+		buf[6] = buf[7] = buf[8] = buf[9] = buf[10] = buf[11] = 0;
+
+		static const roByte ipv4[2][4] = { { 10, 0, 0, 1 }, { 10, 0, 0, 2 } };
+		static const roByte ipv6[2][16] = { { 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,1 }, { 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,2 } };
+
+		if(exist && qtype == 1) {
+			buf[7] = 2;
+			size = record(buf, size, 1, ipv4[0], 4);
+			size = record(buf, size, 1, ipv4[1], 4);
+		}
+		else if(exist && qtype == 28) {
+			buf[7] = 2;
+			size = record(buf, size, 28, ipv6[0], 16);
+			size = record(buf, size, 28, ipv6[1], 16);
+		}
+		else {
+			// SOA with a large TTL but MINIMUM of 1 second
+			buf[9] = 1;
+			const roByte soa[22] = { 0, 0, 0,0,0,1, 0,0,0,1, 0,0,0,1, 0,0,0,1, 0,0,0,1 };
+			size = record(buf, size, 6, soa, sizeof(soa), 100);
+		}
+
+		return size;
+	}
+
+	static roSize record(roByte* buf, roSize pos, roUint16 type, const roByte* data, roUint16 dataLen, roUint32 ttl=1)
+	{
+		const roByte fixed[] = {
+			0xC0, 12,	// Pointer to the question name
+			roByte(type >> 8), roByte(type),
+			0, 1,		// Class IN
+			roByte(ttl >> 24), roByte(ttl >> 16), roByte(ttl >> 8), roByte(ttl),
+			roByte(dataLen >> 8), roByte(dataLen)
+		};
+		roMemcpy(buf + pos, fixed, sizeof(fixed));
+		roMemcpy(buf + pos + sizeof(fixed), data, dataLen);
+		return pos + sizeof(fixed) + dataLen;
+	}
+
+	CoSocket socket;
+	roSize queryCount = 0;
+	float delay = 0;
+	bool keepRun = true;
+};	// DnsStandIn
+
+}	// namespace
+
+TEST_FIXTURE(DnsTest, cache)
+{
+	const roUint16 port = 18053;
+	DnsStandIn server;
+	CHECK(server.init(port));
+
+	bool serverDone = false;
+	CHECK(coRun([&]() {
+		server.run();
+		serverDone = true;
+	}, "DnsStandIn", roKB(16)));
+
+	dnsSetServer(SockAddr(SockAddr::ipLoopBack(), port));
+	dnsClearCache();
+
+	{	// Concurrent resolve of the same name share one query
+		server.delay = 0.1f;
+		const roSize count = 100;
+		roSize okCount = 0, doneCount = 0;
+		for(roSize i=0; i<count; ++i) {
+			CHECK(coRun([&]() {
+				roUint32 ip;
+				okCount += roGetHostByName("multi.test", ip, 1) ? 1 : 0;
+				++doneCount;
+			}, "DnsTest resolve", roKB(16)));
+		}
+
+		while(doneCount < count)
+			coYield();
+
+		CHECK_EQUAL(count, okCount);
+		CHECK_EQUAL(1u, server.queryCount);
+		server.delay = 0;
+	}
+
+	// Cached, and the addresses are handed out in round-robin
+	roUint32 ip1 = 0, ip2 = 0;
+	CHECK(roGetHostByName("multi.test", ip1));
+	CHECK(roGetHostByName("multi.test", ip2));
+	CHECK(ip1 != ip2);
+	CHECK(ip1 == 0x0A000001 || ip1 == 0x0A000002);
+	CHECK(ip2 == 0x0A000001 || ip2 == 0x0A000002);
+	CHECK_EQUAL(1u, server.queryCount);
+
+	// Negative caching
+	CHECK(roGetHostByName("missing.test", ip1, 1) == roStatus::net_resolve_host_fail);
+	CHECK(roGetHostByName("missing.test", ip1, 1) == roStatus::net_resolve_host_fail);
+	CHECK_EQUAL(2u, server.queryCount);
+
+	{	// A is cached but not AAAA, the name is case insensitive
+		Array<roUint32> ipv4;
+		Array<DnsIpv6> ipv6;
+		CHECK(dnsResolveAll("Multi.TEST", ipv4, ipv6, 1));
+		CHECK_EQUAL(2u, ipv4.size());
+		CHECK_EQUAL(2u, ipv6.size());
+		CHECK_EQUAL(3u, server.queryCount);
+
+		// Now AAAA comes from the cache, rotated by whole addresses
+		Array<DnsIpv6> cached;
+		CHECK(dnsResolveAll("multi.test", ipv4, cached, 1));
+		CHECK_EQUAL(2u, cached.size());
+		CHECK_EQUAL(3u, server.queryCount);
+
+		if(ipv6.size() == 2 && cached.size() == 2) {
+			CHECK_EQUAL(1, ipv6[0].bytes[15]);
+			CHECK_EQUAL(2, ipv6[1].bytes[15]);
+			CHECK(memcmp(&cached[0], &ipv6[1], sizeof(DnsIpv6)) == 0);
+			CHECK(memcmp(&cached[1], &ipv6[0], sizeof(DnsIpv6)) == 0);
+		}
+	}
+
+	// Both the positive and negative answers expire after 1 second
+	coSleep(1.1f);
+	CHECK(roGetHostByName("multi.test", ip1));
+	CHECK(roGetHostByName("missing.test", ip1, 1) == roStatus::net_resolve_host_fail);
+	CHECK_EQUAL(5u, server.queryCount);
+
+	// Numeric address needs no query
+	CHECK(roGetHostByName("127.0.0.1", ip1));
+	CHECK_EQUAL(SockAddr::ipLoopBack(), ip1);
+	CHECK_EQUAL(5u, server.queryCount);
+
+	server.keepRun = false;
+	while(!serverDone)
+		coYield();
+
+	dnsClearCache();
+}
+
+#endif
@@ -3,9 +3,13 @@
 #include "../../roar/base/roCoRoutine.h"
 #include "../../roar/base/roIOStream.h"
 #include "../../roar/base/roLog.h"
+#include "../../roar/base/roStringFormat.h"
+#include <algorithm>
 
 using namespace ro;
 
+static const bool benchmark = false;
+
 struct HttpTest {};
 
 TEST_FIXTURE(HttpTest, requestHeader)
@@ -178,6 +182,289 @@ TEST_FIXTURE(HttpTest, server)
 	runOne();
 }
 
+namespace {
+
+// Read one response of a keep-alive connection, the body is known to be "Hello!"
+static bool receiveHello(CoSocket& s)
+{
+	char buf[512];
+	roSize total = 0;
+	while (total < sizeof(buf)) {
+		roSize len = sizeof(buf) - total;
+		if (!s.receive(buf + total, len) || len == 0)
+			return false;
+		total += len;
+
+		const char* body = roStrnStr(buf, total, "\r\n\r\n");
+		if (body && roSize(buf + total - body) >= 4 + 6)
+			return true;
+	}
+	return false;
+}
+
+}	// namespace
+
+// Requests per second and latency of HttpServer::startThreads() over loopback,
+// the clients run on their own threads with their own schedulers too.
+TEST_FIXTURE(HttpTest, serverThreads)
+{
+	const unsigned threadCounts[] = { 1, 2, 4, 8 };
+	const roSize threadCountCount = benchmark ? roCountof(threadCounts) : 2;
+	const unsigned clientThreadCount = 4;
+	const unsigned connectionPerThread = benchmark ? 64 : 4;
+	const unsigned requestPerConnection = benchmark ? 1000 : 10;
+
+	for (roSize t = 0; t < threadCountCount; ++t) {
+		HttpServer server;
+		server.port = roUint16(8081 + t);
+		server.backlog = clientThreadCount * connectionPerThread;
+		server.threadCount = threadCounts[t];
+		server.onRequest = [](HttpServer::Connection& connection, HttpRequestHeader& request) -> roStatus {
+			HttpResponseHeader response;
+			response.make(HttpResponseHeader::ResponseCode::OK);
+			OStream* os = NULL;
+			roStatus st = connection.response(response, os, 6);
+			if (!st) return st;
+			return os->write("Hello!", 6);
+		};
+
+		roStatus st = server.startThreads();
+		if (st == roStatus::not_supported)
+			break;	// No SO_REUSEPORT
+		CHECK(st);
+		if (!st) break;
+
+		Array<float> latencies[clientThreadCount];
+		AtomicInteger failCount, doneCount;
+		TaskPool clients;
+		clients.init(clientThreadCount);
+
+		StopWatch stopWatch;
+		for (unsigned c = 0; c < clientThreadCount; ++c) {
+			clients.addFinalized([&, c]() {
+				CoroutineScheduler scheduler;
+				scheduler.init();
+				for (unsigned i = 0; i < connectionPerThread; ++i) {
+					scheduler.add([&]() {
+						const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+						CoSocket s;
+						if (!s.create(BsdSocket::TCP) || !s.connect(SockAddr(SockAddr::ipLoopBack(), server.port))) {
+							++failCount;
+							return;
+						}
+						for (unsigned r = 0; r < requestPerConnection; ++r) {
+							StopWatch latency;
+							if (!s.send(request, sizeof(request) - 1) || !receiveHello(s)) {
+								++failCount;
+								return;
+							}
+							latencies[c].pushBack(latency.getFloat());
+						}
+					}, "HttpTest client", roKB(64));
+				}
+				scheduler.runTillAllFinish();
+				scheduler.stop();
+				++doneCount;
+			});
+		}
+
+		// Don't let this thread pick up a client task, it's already running a scheduler
+		while (doneCount < int(clientThreadCount))
+			TaskPool::sleep(1);
+		const float duration = stopWatch.getFloat();
+		server.stopThreads();
+
+		Array<float> all;
+		for (unsigned c = 0; c < clientThreadCount; ++c)
+			all.insert(all.size(), latencies[c].begin(), latencies[c].end());
+		std::sort(all.begin(), all.end());
+
+		CHECK_EQUAL(0, failCount.value());
+		CHECK_EQUAL(roSize(clientThreadCount * connectionPerThread * requestPerConnection), all.size());
+
+		if (benchmark && !all.isEmpty()) {
+			roLog("info", "HttpServer %u threads: %.0f requests/s, p50 %.3f ms, p99 %.3f ms\n",
+				server.threadCount, all.size() / duration,
+				all[all.size() / 2] * 1000, all[all.size() * 99 / 100] * 1000
+			);
+		}
+	}
+}
+
+namespace {
+
+// Append the body to the String pointed by userPtr
+static roStatus appendBody(const HttpResponseHeader& response, IStream& body, void* userPtr)
+{
+	roStatus st;
+	roByte buf[64];
+	roUint64 read = 0;
+	while ((st = body.read(buf, sizeof(buf), read)))
+		reinterpret_cast<String*>(userPtr)->append((char*)buf, roSize(read));
+	return st == roStatus::end_of_data ? roStatus::ok : st;
+}
+
+}	// namespace
+
+TEST_FIXTURE(HttpTest, connectionPool)
+{
+	HttpServer server;
+	server.port = 8091;
+	server.backlog = 16;
+	server.threadCount = 1;
+
+	// Echo the resource as the body
+	AtomicInteger pipelinedCount;
+	float responseDelay = 0;
+	server.onRequest = [&](HttpServer::Connection& connection, HttpRequestHeader& request) -> roStatus {
+		if (!connection._received.isEmpty())
+			++pipelinedCount;
+		if (responseDelay > 0)
+			coSleep(responseDelay);
+
+		RangedString resource;
+		request.getField(HttpRequestHeader::HeaderField::Resource, resource);
+
+		HttpResponseHeader response;
+		response.make(HttpResponseHeader::ResponseCode::OK);
+		OStream* os = NULL;
+		roStatus st = connection.response(response, os, resource.size());
+		if (!st) return st;
+		return os->write(resource.begin, resource.size());
+	};
+
+	roStatus st = server.startThreads();
+	if (st == roStatus::not_supported)
+		return;	// No SO_REUSEPORT
+	CHECK(st);
+
+	HttpClient client;
+	client.useHttpCompression = false;
+	HttpConnections pool;
+	pool.maxConnectionsPerHost = 2;
+	const char* url = "http://localhost:8091/asset";
+
+	// Sequential requests share one connection
+	for (int i = 0; i < 10; ++i) {
+		HttpRequestHeader header;
+		String body;
+		CHECK(header.make(HttpRequestHeader::Method::Get, url));
+		CHECK(client.request(header, appendBody, &body, &pool));
+		CHECK_EQUAL(url, body.c_str());
+	}
+	CHECK_EQUAL(1u, pool.connectCount);
+	CHECK_EQUAL(9u, pool.reuseCount);
+
+	// Concurrent requests wait for a connection, when all maxConnectionsPerHost are checked out
+	responseDelay = 0.01f;
+	const int coroutineCount = 8;
+	int doneCount = 0;
+	bool ok = true;
+	for (int c = 0; c < coroutineCount; ++c) {
+		coRun([&]() {
+			for (int i = 0; i < 5; ++i) {
+				HttpRequestHeader header;
+				String body;
+				ok &= header.make(HttpRequestHeader::Method::Get, url) && client.request(header, appendBody, &body, &pool);
+				ok &= body == url;
+			}
+			++doneCount;
+		}, "HttpTest connectionPool client", roKB(64));
+	}
+	while (doneCount < coroutineCount)
+		coYield();
+
+	responseDelay = 0;
+
+	CHECK(ok);
+	CHECK_EQUAL(2u, pool.connectCount);
+	CHECK_EQUAL(0u, pool.activeCount());
+	CHECK_EQUAL(2u, pool.idleCount());
+
+	// Pipelining, the server is known to keep the connection alive
+	const roSize batchSize = 20;
+	HttpRequestHeader headers[batchSize];
+	String bodies[batchSize];
+	void* userPtrs[batchSize];
+	for (roSize i = 0; i < batchSize; ++i) {
+		String path;
+		CHECK(strFormat(path, "http://localhost:8091/asset{}", i));
+		CHECK(headers[i].make(HttpRequestHeader::Method::Get, path.c_str()));
+		userPtrs[i] = &bodies[i];
+	}
+	CHECK(client.requestPipelined(headers, batchSize, appendBody, userPtrs, pool));
+
+	for (roSize i = 0; i < batchSize; ++i) {
+		String path;
+		CHECK(strFormat(path, "http://localhost:8091/asset{}", i));
+		CHECK_EQUAL(path.c_str(), bodies[i].c_str());
+	}
+	CHECK_EQUAL(2u, pool.connectCount);
+	CHECK(pipelinedCount.value() > 0);
+
+	// Idle connections are closed after idleTimeout
+	pool.idleTimeout = 0.1f;
+	coSleep(0.2f);
+	pool.evictIdle();
+	CHECK_EQUAL(0u, pool.idleCount());
+
+	server.stopThreads();
+}
+
+// The server closes the connection without telling, the pool must not reuse it
+TEST_FIXTURE(HttpTest, connectionPoolHealthCheck)
+{
+	// Any free port, the server side closing leaves it in TIME_WAIT
+	CoSocket listener;
+	CHECK(listener.create(BsdSocket::TCP));
+	CHECK(listener.bind(SockAddr(SockAddr::ipAny(), 0)));
+	CHECK(listener.listen(1));
+
+	String url;
+	CHECK(strFormat(url, "http://localhost:{}/", listener.boundEndPoint().port()));
+
+	const int requestCount = 3;
+	bool serverDone = false;
+	coRun([&]() {
+		for (int i = 0; i < requestCount; ++i) {
+			CoSocket s;
+			if (!listener.accept(s))
+				break;
+
+			String request;
+			char buf[256];
+			roSize len;
+			while (request.find("\r\n\r\n") == String::npos && (len = sizeof(buf), s.receive(buf, len)) && len)
+				request.append(buf, len);
+
+			const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nOK";
+			s.send(response, sizeof(response) - 1);
+			s.close();
+		}
+		serverDone = true;
+	}, "HttpTest connectionPoolHealthCheck server", roKB(64));
+
+	HttpClient client;
+	HttpConnections pool;
+	for (int i = 0; i < requestCount; ++i) {
+		HttpRequestHeader header;
+		String body;
+		CHECK(header.make(HttpRequestHeader::Method::Get, url.c_str()));
+		CHECK(client.request(header, appendBody, &body, &pool));
+		CHECK_EQUAL("OK", body.c_str());
+		coSleep(0.05f);
+	}
+
+	CHECK_EQUAL(roSize(requestCount), pool.connectCount);
+	CHECK_EQUAL(0u, pool.reuseCount);
+
+	// The server's graceful close waits for us
+	pool.clear();
+	while (!serverDone)
+		coYield();
+	listener.close();
+}
+
 #include "../../roar/base/roIOStream.h"
 #include "../../roar/base/roTypeCast.h"
 
@@ -208,6 +495,95 @@ roStatus onReply(const HttpResponseHeader& response, IStream& body, void* userPt
 	return st;
 }
 
+namespace {
+
+struct GZipReply
+{
+	String body;
+	String etag;
+	String vary;
+	bool gzipped = false;
+};
+
+static roStatus appendGZipReply(const HttpResponseHeader& response, IStream& body, void* userPtr)
+{
+	GZipReply& reply = *reinterpret_cast<GZipReply*>(userPtr);
+	reply.gzipped = response.cmpFieldNoCase(HttpResponseHeader::HeaderField::ContentEncoding, "gzip");
+	response.getField(HttpResponseHeader::HeaderField::ETag, reply.etag);
+	response.getField(HttpResponseHeader::HeaderField::Vary, reply.vary);
+	return appendBody(response, body, &reply.body);
+}
+
+}	// namespace
+
+// Chunked response compressed on the fly, and bodies compressed once then cached by etag
+TEST_FIXTURE(HttpTest, gzipResponse)
+{
+	String text;
+	for (int i = 0; i < 2000; ++i)
+		strFormat(text, "line {} of some compressible text\n", i);
+
+	HttpServer server;
+	server.port = 8096;
+	server.backlog = 4;
+	server.threadCount = 1;
+	server.onRequest = [&](HttpServer::Connection& connection, HttpRequestHeader& request) -> roStatus {
+		RangedString resource;
+		request.getField(HttpRequestHeader::HeaderField::Resource, resource);
+
+		HttpResponseHeader response;
+		response.make(HttpResponseHeader::ResponseCode::OK);
+
+		if (resource.findNoCase("/stream") != RangedString::npos) {
+			OStream* os = NULL;
+			roStatus st = connection.response(response, os);
+			for (roSize i = 0; st && i < text.size(); i += 1000)
+				st = os->write(text.c_str() + i, roMinOf2(text.size() - i, roSize(1000)));
+			return st;
+		}
+
+		return connection.responseBody(response, text.c_str(), text.size(), resource.findNoCase("/cached") != RangedString::npos ? "\"v1\"" : NULL);
+	};
+
+	roStatus st = server.startThreads();
+	if (st == roStatus::not_supported)
+		return;	// No SO_REUSEPORT
+	CHECK(st);
+
+	HttpClient client;
+	client.useHttpCompression = true;
+
+	const char* urls[] = { "http://localhost:8096/stream", "http://localhost:8096/cached", "http://localhost:8096/cached", "http://localhost:8096/uncached" };
+	for (roSize i = 0; i < roCountof(urls); ++i) {
+		HttpRequestHeader header;
+		GZipReply reply;
+		CHECK(header.make(HttpRequestHeader::Method::Get, urls[i]));
+		CHECK(client.request(header, appendGZipReply, &reply));
+		CHECK(reply.gzipped);
+		CHECK(reply.body == text);
+		if (i > 0) {
+			CHECK_EQUAL("Accept-Encoding", reply.vary.c_str());
+			CHECK_EQUAL(i < 3 ? "\"v1-gz\"" : "", reply.etag.c_str());
+		}
+	}
+
+	CHECK_EQUAL(1, server.gzipCacheMissCount.value());
+	CHECK_EQUAL(1, server.gzipCacheHitCount.value());
+
+	// Not for a client without gzip
+	client.useHttpCompression = false;
+	HttpRequestHeader header;
+	GZipReply reply;
+	CHECK(header.make(HttpRequestHeader::Method::Get, urls[1]));
+	CHECK(client.request(header, appendGZipReply, &reply));
+	CHECK(!reply.gzipped);
+	CHECK(reply.body == text);
+	CHECK_EQUAL("\"v1\"", reply.etag.c_str());
+	CHECK_EQUAL("Accept-Encoding", reply.vary.c_str());
+
+	server.stopThreads();
+}
+
 TEST_FIXTURE(HttpTest, client)
 {
 	HttpClient client;
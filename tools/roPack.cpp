@@ -0,0 +1,102 @@
+// Command line tool for building and inspecting the archives read by packFileSystem.
+// Build it with build/win32/roPack.vc14.vcxproj, or together with the Roar library, for example:
+//	g++ -std=c++14 -I. tools/roPack.cpp <Roar library> -lz -lpthread -o roPack
+
+#include "../roar/base/roPackFileSystem.h"
+#include "../roar/base/roArray.h"
+#include "../roar/base/roRawFileSystem.h"
+#include "../roar/base/roStringUtility.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace ro;
+
+static const char* _usage =
+	"Usage:\n"
+	"  roPack [-l level] [-s smallFileSize] [-a alignment] <directory> <output.pak>\n"
+	"  roPack -t <file.pak>\n"
+	"\n"
+	"  -l  zlib compression level 0-9, 0 to store only (default 6)\n"
+	"  -s  files up to this size are stored contiguously (default 65536)\n"
+	"  -a  alignment of the larger files (default 4096)\n"
+	"  -t  list the content of an archive\n";
+
+static int _list(const char* packPath)
+{
+	void* f = NULL;
+	if(!rawFileSystemOpenFile(packPath, f)) { fprintf(stderr, "Cannot open %s\n", packPath); return 1; }
+
+	PackHeader header;
+	if(!rawFileSystemAtomicRead(f, &header, sizeof(header)) || memcmp(header.magic, "roPK", 4) != 0) {
+		fprintf(stderr, "%s is not a pack archive\n", packPath);
+		rawFileSystemCloseFile(f);
+		return 1;
+	}
+
+	// The table of content is at the end, which can be beyond 2GB on large archives
+	Array<PackEntry> entries;
+	Array<char> names;
+	bool ok =
+		entries.resize(header.entryCount) && names.resize(header.nameSize + 1) &&
+		rawFileSystemSeek(f, roInt64(header.tocOffset), FileSystem::SeekOrigin_Begin) &&
+		(header.entryCount == 0 || rawFileSystemAtomicRead(f, entries.typedPtr(), entries.sizeInByte())) &&
+		rawFileSystemSeek(f, roInt64(header.tocOffset + entries.sizeInByte() + header.bucketCount * sizeof(roUint32)), FileSystem::SeekOrigin_Begin) &&
+		(header.nameSize == 0 || rawFileSystemAtomicRead(f, names.typedPtr(), header.nameSize));
+	rawFileSystemCloseFile(f);
+
+	if(!ok) { fprintf(stderr, "%s is corrupted\n", packPath); return 1; }
+
+	roUint64 stored = 0, original = 0;
+	printf("%12s %12s %12s  %-5s %s\n", "offset", "stored", "size", "flags", "name");
+	for(const PackEntry& e : entries) {
+		printf("%12llu %12llu %12llu  %c%c    %.*s\n",
+			(unsigned long long)e.offset, (unsigned long long)e.storedSize, (unsigned long long)e.originalSize,
+			e.compression == PackEntry::Compression_GZip ? 'z' : '-',
+			(e.flags & PackEntry::Flag_Small) ? 's' : '-',
+			int(e.nameLength), names.typedPtr() + e.nameOffset);
+		stored += e.storedSize;
+		original += e.originalSize;
+	}
+	printf("%u files, %llu bytes stored for %llu bytes\n", header.entryCount, (unsigned long long)stored, (unsigned long long)original);
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	PackBuildOptions options;
+	const char* args[2] = { NULL, NULL };
+	int argCount = 0;
+
+	for(int i=1; i<argc; ++i) {
+		const char* a = argv[i];
+		if(roStrCmp(a, "-t") == 0 && i + 1 < argc)
+			return _list(argv[i + 1]);
+		else if(roStrCmp(a, "-l") == 0 && i + 1 < argc)
+			options.compressionLevel = atoi(argv[++i]);
+		else if(roStrCmp(a, "-s") == 0 && i + 1 < argc)
+			options.smallFileSize = strtoull(argv[++i], NULL, 10);
+		else if(roStrCmp(a, "-a") == 0 && i + 1 < argc)
+			options.pageAlignment = strtoull(argv[++i], NULL, 10);
+		else if(a[0] != '-' && argCount < 2)
+			args[argCount++] = a;
+		else {
+			fputs(_usage, stderr);
+			return 1;
+		}
+	}
+
+	if(argCount != 2 || options.compressionLevel < 0 || options.compressionLevel > 9 || options.pageAlignment == 0) {
+		fputs(_usage, stderr);
+		return 1;
+	}
+
+	Status st = packArchiveBuild(args[0], args[1], options);
+	if(!st) {
+		fprintf(stderr, "Fail to build %s from %s: %s\n", args[1], args[0], st.c_str());
+		return 1;
+	}
+
+	return _list(args[1]);
+}